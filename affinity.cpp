@@ -0,0 +1,133 @@
+#include "affinity.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const std::string NODE_PATH = "/sys/devices/system/node/node";
+
+unsigned numaNodes() {
+    unsigned nodes = 0;
+    while (!access((NODE_PATH + std::to_string(nodes)).c_str(), F_OK))
+        nodes++;
+    return nodes;
+}
+
+std::vector<unsigned> nodeCpus(unsigned node) {
+    std::vector<unsigned> cpus;
+    std::ifstream file(NODE_PATH + std::to_string(node) + "/cpulist");
+    std::string list;
+    if (std::getline(file, list))
+        parseCpuList(list, cpus);
+    return cpus;
+}
+
+bool parseCpuList(const std::string &list, std::vector<unsigned> &cpus) {
+    std::istringstream in(list);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        unsigned first, last;
+        char dash;
+        std::istringstream part(range);
+        if (!(part >> first))
+            return false;
+        if (part >> dash) {
+            if (dash != '-' || !(part >> last) || last < first)
+                return false;
+        } else
+            last = first;
+        for (unsigned c = first; c <= last; c++)
+            cpus.push_back(c);
+    }
+    return !cpus.empty();
+}
+
+bool memoryNodes(const std::vector<const void*> &addresses, std::vector<int> &nodes) {
+    nodes.assign(addresses.size(), -1);
+    if (addresses.empty())
+        return true;
+    //Without target nodes move_pages only reports where the pages are; glibc has no wrapper for it outside libnuma
+    std::vector<void*> pages(addresses.size());
+    uintptr_t mask = ~uintptr_t(sysconf(_SC_PAGESIZE) - 1);
+    for (unsigned i = 0; i != addresses.size(); i++)
+        pages[i] = reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(addresses[i]) & mask);
+    if (syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr, nodes.data(), 0))
+        return false;
+    //Pages that are not present report a negative error instead of a node
+    for (int &n : nodes)
+        if (n < 0)
+            n = -1;
+    return true;
+}
+
+bool pinThread(const std::vector<unsigned> &cpus) {
+    if (cpus.empty())
+        return true;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned c : cpus)
+        if (c < CPU_SETSIZE)
+            CPU_SET(c, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+        std::cerr << "pinThread: Failed to set affinity: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+AffinityMap AffinityMap::numa(unsigned workers) {
+    AffinityMap affinity;
+    std::vector<WorkerAffinity> cpus;
+    unsigned nodes = numaNodes();
+    for (unsigned n = 0; n != nodes; n++)
+        for (unsigned c : nodeCpus(n)) {
+            WorkerAffinity a;
+            a.cpus.push_back(c);
+            a.node = n;
+            cpus.push_back(a);
+        }
+    if (cpus.empty())
+        return affinity;
+    //More workers than CPUs wrap around onto the same CPUs in the same order
+    for (unsigned w = 0; w != workers; w++)
+        affinity.workers.push_back(cpus[w % cpus.size()]);
+    return affinity;
+}
+
+bool AffinityMap::parse(const std::string &map, AffinityMap &affinity) {
+    //Node of every CPU so each worker knows where it runs
+    std::vector<unsigned> cpuNodes;
+    unsigned nodes = numaNodes();
+    for (unsigned n = 0; n != nodes; n++)
+        for (unsigned c : nodeCpus(n)) {
+            if (c >= cpuNodes.size())
+                cpuNodes.resize(c + 1, 0);
+            cpuNodes[c] = n;
+        }
+    
+    affinity.workers.clear();
+    std::istringstream in(map);
+    std::string list;
+    while (std::getline(in, list, ';')) {
+        WorkerAffinity a;
+        if (!parseCpuList(list, a.cpus))
+            return false;
+        a.node = a.cpus.front() < cpuNodes.size() ? cpuNodes[a.cpus.front()] : 0;
+        affinity.workers.push_back(a);
+    }
+    return true;
+}
+
+WorkerAffinity AffinityMap::worker(unsigned worker) const {
+    if (worker < workers.size())
+        return workers[worker];
+    WorkerAffinity a;
+    a.node = 0;
+    return a;
+}
+
@@ -0,0 +1,40 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <string>
+#include <vector>
+
+//CPUs one worker may run on (empty leaves it to the scheduler) and the NUMA node they are on
+struct WorkerAffinity {
+    std::vector<unsigned> cpus;
+    unsigned node;
+};
+
+//Which CPUs every worker thread is pinned to
+struct AffinityMap {
+    std::vector<WorkerAffinity> workers;
+    
+    //One CPU per worker, filling every CPU of a NUMA node before moving to the next so that workers with adjacent
+    //numbers share a node; unpinned if the system does not report nodes
+    static AffinityMap numa(unsigned workers);
+    //CPU lists separated by semicolons, one per worker (e.g. "0;1;8-9"); returns false if it does not parse
+    static bool parse(const std::string &map, AffinityMap &affinity);
+    
+    //Affinity of a worker; workers past the end of the map are not pinned
+    WorkerAffinity worker(unsigned worker) const;
+};
+
+//NUMA nodes reported by sysfs (0 if there is no NUMA information)
+unsigned numaNodes();
+//CPUs of a NUMA node; empty if the node does not exist
+std::vector<unsigned> nodeCpus(unsigned node);
+//Parse a sysfs style CPU list such as "0-7,16-23"
+bool parseCpuList(const std::string &list, std::vector<unsigned> &cpus);
+//NUMA node of the page holding every address, or -1 for pages the kernel does not place; returns false if it cannot
+//say where any memory is
+bool memoryNodes(const std::vector<const void*> &addresses, std::vector<int> &nodes);
+//Restrict the calling thread (and threads it starts afterwards) to the given CPUs; returns false on failure
+bool pinThread(const std::vector<unsigned> &cpus);
+
+#endif // AFFINITY_H
+
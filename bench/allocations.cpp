@@ -0,0 +1,76 @@
+#include "bench.h"
+#include <algorithm>
+#include <chrono>
+
+//Updates run first so the pools fill up to the population the group settles at
+#define ALLOCATIONS_WARMUP 2000
+#define ALLOCATIONS_TICKS 1000
+
+using namespace std;
+using namespace chrono;
+
+void allocationBenchmark(BenchReport &report) {
+    if (!report.selected("allocations"))
+        return;
+    Group group(phi::V3(1.0, 1.0, 1.0), BENCH_SEED);
+    
+    //The largest population seen at the end of an update; an update that cannot have passed it should not allocate
+    uint64_t peakCells = 0;
+    uint64_t peakGenomes = 0;
+    uint64_t peakEdges = 0;
+    uint64_t total = 0;
+    unsigned allocating = 0;
+    unsigned steady = 0;
+    unsigned steadyAllocating = 0;
+    double seconds = 0;
+    for (unsigned t = 0; t != ALLOCATIONS_WARMUP + ALLOCATIONS_TICKS; t++) {
+        //Same immigration of random cells as the simulation; spawned cells get freshly generated programs, so
+        //spawning is growth and is left out of the count
+        group.spawn(group.rand() % 16 == 0);
+        uint64_t births = group.births;
+        uint64_t cells = group.cells.size();
+        uint64_t genomes = group.genomes.size();
+        uint64_t before = allocationCount();
+        steady_clock::time_point start = steady_clock::now();
+        group.update();
+        double elapsed = duration_cast<duration<double>>(steady_clock::now() - start).count();
+        uint64_t count = allocationCount() - before;
+        births = group.births - births;
+        //Children are born before the last deaths of an update, so at most every birth adds to what was there at
+        //the start; mutations at the end can still add genomes
+        bool grew = cells + births > peakCells || max<uint64_t>(genomes + births, group.genomes.size()) > peakGenomes ||
+                    group.edges > peakEdges;
+        peakCells = max<uint64_t>({peakCells, cells, group.cells.size()});
+        peakGenomes = max<uint64_t>({peakGenomes, genomes, group.genomes.size()});
+        peakEdges = max(peakEdges, group.edges);
+        if (t < ALLOCATIONS_WARMUP)
+            continue;
+        
+        seconds += elapsed;
+        total += count;
+        if (count)
+            allocating++;
+        if (!grew) {
+            steady++;
+            if (count)
+                steadyAllocating++;
+        }
+    }
+    
+    BenchResult r;
+    r.name = "allocations";
+    r.unit = "update";
+    r.items = ALLOCATIONS_TICKS;
+    r.repetitions = 1;
+    r.nanoseconds = seconds * 1e9 / ALLOCATIONS_TICKS;
+    r.allocations = double(total) / ALLOCATIONS_TICKS;
+    r.counters["allocating updates"] = allocating;
+    r.counters["steady updates"] = steady;
+    r.counters["steady updates that allocated"] = steadyAllocating;
+    report.results.push_back(r);
+    cout << "allocations: " << steadyAllocating << " of " << steady << " steady updates allocated (" << total
+         << " allocations in " << allocating << " of " << ALLOCATIONS_TICKS << " updates)" << endl;
+    if (steadyAllocating)
+        report.failed = true;
+}
+
@@ -0,0 +1,173 @@
+#include "bench.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+using namespace std;
+using namespace chrono;
+
+static atomic<uint64_t> allocations(0);
+
+//Every allocation in the program goes through these, including the ones made by the standard library
+void* operator new(size_t size) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+uint64_t allocationCount() {
+    return allocations.load(memory_order_relaxed);
+}
+
+void populate(Group &group, unsigned cells, mt19937 &rand) {
+    uniform_real_distribution<double> unit(-1.0, 1.0);
+    for (unsigned i = 0; i != cells; i++) {
+        group.cells.emplace_front(phi::V3(unit(rand) * group.dimensions.x, unit(rand) * group.dimensions.y,
+                                          unit(rand) * group.dimensions.z),
+                                  phi::V3(unit(rand) * PHYSICS_MAX_INITIAL_VELOCITY,
+                                          unit(rand) * PHYSICS_MAX_INITIAL_VELOCITY,
+                                          unit(rand) * PHYSICS_MAX_INITIAL_VELOCITY),
+                                  rand);
+        Cell &c = group.cells.front();
+        c.id = group.nextId++;
+        group.organisms.add(c);
+        group.genomes.add(c);
+        group.foodCreated += c.food;
+    }
+}
+
+double densityExtent(unsigned cells, double neighbors) {
+    double sphere = 4.0 / 3.0 * M_PI * PHYSICS_CONNECT_DISTANCE * PHYSICS_CONNECT_DISTANCE * PHYSICS_CONNECT_DISTANCE;
+    return cbrt(cells * sphere / neighbors) / 2;
+}
+
+BenchReport::BenchReport() : failed(false), snapshots(BENCH_SNAPSHOTS) {
+}
+
+bool BenchReport::selected(const string &name) const {
+    return filter.empty() || name == filter ||
+           (name.compare(0, filter.size(), filter) == 0 && name[filter.size()] == '/');
+}
+
+BenchResult* BenchReport::measure(const string &name, const string &unit, const function<uint64_t()> &setup,
+                                  const function<void()> &task) {
+    if (!selected(name))
+        return nullptr;
+    vector<double> times;
+    vector<double> allocated;
+    uint64_t items = 0;
+    double total = 0;
+    while (times.size() < BENCH_MAX_REPETITIONS &&
+           (times.size() < BENCH_MIN_REPETITIONS || total < BENCH_MIN_SECONDS)) {
+        items = max<uint64_t>(setup(), 1);
+        uint64_t before = allocationCount();
+        steady_clock::time_point start = steady_clock::now();
+        task();
+        double seconds = duration_cast<duration<double>>(steady_clock::now() - start).count();
+        allocated.push_back(double(allocationCount() - before) / items);
+        times.push_back(seconds * 1e9 / items);
+        total += seconds;
+    }
+    sort(times.begin(), times.end());
+    sort(allocated.begin(), allocated.end());
+    
+    BenchResult r;
+    r.name = name;
+    r.unit = unit;
+    r.items = items;
+    r.repetitions = times.size();
+    r.nanoseconds = times[times.size() / 2];
+    r.allocations = allocated[allocated.size() / 2];
+    results.push_back(r);
+    cout << left << setw(28) << name << right << setw(14) << fixed << setprecision(1) << r.nanoseconds
+         << " ns/" << unit << setw(10) << setprecision(2) << r.allocations << " allocations/" << unit << endl;
+    return &results.back();
+}
+
+bool BenchReport::write(const string &path) const {
+    ofstream out(path);
+    if (!out) {
+        cerr << "BenchReport: Failed to open " << path << endl;
+        return false;
+    }
+    out << setprecision(17);
+    out << "{\"benchmarks\": [" << endl;
+    for (unsigned i = 0; i != results.size(); i++) {
+        const BenchResult &r = results[i];
+        out << "{\"name\": \"" << r.name << "\", \"unit\": \"" << r.unit << "\", \"ns\": " << r.nanoseconds
+            << ", \"allocations\": " << r.allocations << ", \"items\": " << r.items << ", \"repetitions\": "
+            << r.repetitions << ", \"counters\": {";
+        for (auto c = r.counters.begin(); c != r.counters.end(); c++)
+            out << (c == r.counters.begin() ? "" : ", ") << "\"" << c->first << "\": " << c->second;
+        out << "}}" << (i + 1 == results.size() ? "" : ",") << endl;
+    }
+    out << "]}" << endl;
+    return bool(out);
+}
+
+//Value after "key": on a line written by BenchReport::write
+static bool field(const string &line, const string &key, string &value) {
+    size_t start = line.find("\"" + key + "\": ");
+    if (start == string::npos)
+        return false;
+    start += key.size() + 4;
+    if (line[start] == '"') {
+        size_t end = line.find('"', start + 1);
+        value = line.substr(start + 1, end - start - 1);
+    } else
+        value = line.substr(start, line.find_first_of(",}", start) - start);
+    return true;
+}
+
+bool BenchReport::compare(const string &path, double tolerance) const {
+    ifstream in(path);
+    if (!in) {
+        cerr << "BenchReport: Failed to open baseline " << path << endl;
+        return false;
+    }
+    //Time and allocations per item of every benchmark in the baseline
+    map<string, pair<double, double>> baseline;
+    string line;
+    while (getline(in, line)) {
+        string name, ns, allocated;
+        if (field(line, "name", name) && field(line, "ns", ns) && field(line, "allocations", allocated))
+            baseline[name] = make_pair(atof(ns.c_str()), atof(allocated.c_str()));
+    }
+    
+    bool passed = true;
+    cout << endl << "Compared with " << path << ":" << endl;
+    for (const BenchResult &r : results) {
+        auto b = baseline.find(r.name);
+        cout << left << setw(28) << r.name << right;
+        if (b == baseline.end() || !(b->second.first > 0)) {
+            cout << "    not in baseline" << endl;
+            continue;
+        }
+        double change = r.nanoseconds / b->second.first - 1;
+        double allocated = r.allocations - b->second.second;
+        cout << setw(9) << showpos << fixed << setprecision(1) << change * 100 << "%" << setw(10) << setprecision(2)
+             << allocated << " allocations" << noshowpos;
+        if (change > tolerance) {
+            cout << "  REGRESSION";
+            passed = false;
+        }
+        if (allocated > BENCH_ALLOCATION_SLACK) {
+            cout << "  ALLOCATES MORE";
+            passed = false;
+        }
+        cout << endl;
+    }
+    return passed;
+}
+
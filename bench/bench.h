@@ -0,0 +1,78 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "group.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+//Repetitions of a benchmark are run until this many seconds were measured, within the limits below
+#define BENCH_MIN_SECONDS 0.5
+#define BENCH_MIN_REPETITIONS 3
+#define BENCH_MAX_REPETITIONS 200
+//Slowdown over the baseline that counts as a regression
+#define BENCH_TOLERANCE 0.1
+//Allocations per item over the baseline that count as a regression; absolute, since most baselines allocate nothing
+#define BENCH_ALLOCATION_SLACK 0.01
+//Seed every benchmark population is generated from
+#define BENCH_SEED 1743
+//Default directory of the worlds the macro benchmarks start from
+#define BENCH_SNAPSHOTS "snapshots"
+
+//Outcome of one benchmark; time and allocations are per item of work (a cell, an edge, an update...)
+struct BenchResult {
+    std::string name;
+    std::string unit;
+    uint64_t items;
+    unsigned repetitions;
+    //Median over the repetitions
+    double nanoseconds;
+    double allocations;
+    //Anything else worth keeping, such as the imbalance of a full update
+    std::map<std::string, double> counters;
+};
+
+//Runs the benchmarks the filter selects and collects their results
+//A filter selects the benchmark of that name or, like "connect", the group of benchmarks named connect/...
+struct BenchReport {
+    std::string filter;
+    std::vector<BenchResult> results;
+    //Set by a benchmark that checks something and found it broken
+    bool failed;
+    //Directory the worlds the macro benchmarks start from are kept in; missing ones are generated and saved there
+    std::string snapshots;
+    
+    BenchReport();
+    
+    bool selected(const std::string &name) const;
+    //Repeatedly run setup untimed, which returns the items of work that task is about to do, and then time task
+    //Returns the result so counters can be added, or null if the benchmark was filtered out
+    BenchResult* measure(const std::string &name, const std::string &unit, const std::function<uint64_t()> &setup,
+                         const std::function<void()> &task);
+    
+    //One benchmark per line so baselines can be read back without a JSON library
+    bool write(const std::string &path) const;
+    //Print how the time and allocations of every result compare with the same benchmark in the baseline; returns
+    //false if either regressed
+    bool compare(const std::string &path, double tolerance) const;
+};
+
+//Calls to the global allocator since the program started
+uint64_t allocationCount();
+
+//Add cells with random programs spread evenly over the group, unlike the clumps spawn makes
+void populate(Group &group, unsigned cells, std::mt19937 &rand);
+//Half extent of a cube that holds cells at the given density, in expected neighbors within the connect distance
+double densityExtent(unsigned cells, double neighbors);
+
+void microBenchmarks(BenchReport &report);
+void macroBenchmarks(BenchReport &report);
+void allocationBenchmark(BenchReport &report);
+void libraryBenchmark(BenchReport &report);
+void numaBenchmark(BenchReport &report);
+
+#endif // BENCH_H
+
@@ -0,0 +1,51 @@
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+CONFIG += c++11
+
+CONFIG(release, debug|release): DEFINES += NDEBUG
+
+QMAKE_CXXFLAGS += -pthread 
+LIBS += -pthread
+
+LIBS += \
+    -lgpi \
+    -lphitron
+
+INCLUDEPATH += ..
+
+#Only the headless parts of the simulation
+SOURCES += main.cpp \
+    bench.cpp \
+    micro.cpp \
+    macro.cpp \
+    allocations.cpp \
+    library.cpp \
+    numa.cpp \
+    ../cell.cpp \
+    ../group.cpp \
+    ../halo.cpp \
+    ../simulation.cpp \
+    ../budget.cpp \
+    ../trajectory.cpp \
+    ../lineage.cpp \
+    ../organism.cpp \
+    ../metrics.cpp \
+    ../invariant.cpp \
+    ../genome.cpp \
+    ../domain.cpp \
+    ../affinity.cpp \
+    ../workers.cpp \
+    ../checkpoint.cpp \
+    ../statehash.cpp \
+    ../census.cpp \
+    ../spatial.cpp \
+    ../stream.cpp \
+    ../lod.cpp \
+    ../island.cpp \
+    ../library.cpp
+
+HEADERS += \
+    bench.h
+
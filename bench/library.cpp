@@ -0,0 +1,192 @@
+#include "bench.h"
+#include "library.h"
+#include "genome.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <unistd.h>
+
+//Cells the exported group holds, spread over this many species of different sizes, of which the heaviest are exported
+#define LIBRARY_CELLS 2000
+#define LIBRARY_SPECIES 7
+#define LIBRARY_EXPORTED 4
+//Draws tried before a genome that select should have made drawable counts as missing
+#define LIBRARY_DRAWS 10000
+
+using namespace std;
+
+//Counts round-trip checks and reports the first that failed
+struct RoundTrip {
+    unsigned checks;
+    unsigned failures;
+    
+    RoundTrip() : checks(0), failures(0) {
+    }
+    
+    void expect(bool passed, const string &what) {
+        checks++;
+        if (passed)
+            return;
+        if (!failures)
+            cerr << "library: " << what << endl;
+        failures++;
+    }
+};
+
+//Species of the genomes select makes drawable, in the order select hands them out as best grows, so the result is
+//the run of the library it selected from
+static vector<uint64_t> drawable(GenomeLibrary &library, const string &tag, mt19937 &rand) {
+    vector<uint64_t> order;
+    set<uint64_t> seen;
+    for (unsigned best = 1; library.select(tag, best) && library.selected() == best; best++) {
+        uint64_t species;
+        const char *programs;
+        size_t bytes;
+        for (unsigned d = 0; d != LIBRARY_DRAWS && seen.size() != best; d++)
+            if (library.draw(rand, species, programs, bytes) && seen.insert(species).second)
+                order.push_back(species);
+        if (seen.size() != best)
+            break;
+    }
+    return order;
+}
+
+//Export a group, merge more genomes into the file and spawn from it, checking at every step that the library reads
+//back in the order and with the replacements the format promises
+void libraryBenchmark(BenchReport &report) {
+    if (!report.selected("library"))
+        return;
+    RoundTrip check;
+    mt19937 rand(BENCH_SEED);
+    char path[] = "/tmp/evomata-library-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        cerr << "library: Failed to create a temporary file" << endl;
+        report.failed = true;
+        return;
+    }
+    close(fd);
+    unlink(path);
+    
+    Group group(phi::V3(1.0, 1.0, 1.0), BENCH_SEED);
+    populate(group, LIBRARY_CELLS, rand);
+    //Of every 127 cells, 64 are species 1000, 32 are species 1001 and so on down to one of species 1006, so the
+    //census ranks them by number
+    unsigned index = 0;
+    for (Cell &c : group.cells) {
+        unsigned slot = index++ % 127;
+        unsigned species = 0;
+        for (unsigned bound = 64; species + 1 != LIBRARY_SPECIES && slot >= bound; bound += 64 >> ++species)
+            ;
+        c.species = 1000 + species;
+    }
+    //Programs of the cell with the most food of every species, which is the one exported for it
+    map<uint64_t, string> programs;
+    map<uint64_t, uint64_t> food;
+    for (const Cell &c : group.cells) {
+        if (!food.count(c.species) || c.food > food[c.species]) {
+            food[c.species] = c.food;
+            ostringstream out;
+            writeGenome(out, c);
+            programs[c.species] = out.str();
+        }
+    }
+    
+    GenomeExporter exporter(path, "first", 1, LIBRARY_EXPORTED);
+    exporter.tick(group);
+    exporter.wait();
+    check.expect(exporter.completed == 1, "the export failed");
+    GenomeLibrary library;
+    check.expect(library.open(path) && library.size() == LIBRARY_EXPORTED, "the export holds the wrong genomes");
+    vector<uint64_t> order = drawable(library, "first", rand);
+    vector<uint64_t> expected;
+    for (unsigned s = 0; s != LIBRARY_EXPORTED; s++)
+        expected.push_back(1000 + s);
+    check.expect(order == expected, "the export is not ordered from the heaviest species down");
+    check.expect(drawable(library, "", rand) == expected, "the fitness order of the export is wrong");
+    for (unsigned s = 0; s != LIBRARY_EXPORTED && library.select("first", s + 1); s++) {
+        //The last of the best s + 1 is drawn once the others have been, so every entry is read back
+        uint64_t species;
+        const char *text;
+        size_t bytes;
+        bool found = false;
+        for (unsigned d = 0; d != LIBRARY_DRAWS && !found; d++)
+            found = library.draw(rand, species, text, bytes) && species == expected[s];
+        check.expect(found && string(text, bytes) == programs[species], "exported programs differ");
+        if (found) {
+            ProgramsBuffer buffer(text, bytes);
+            istream in(&buffer);
+            Cell c(phi::V3(0, 0, 0), phi::V3(0, 0, 0), in);
+            ostringstream out;
+            writeGenome(out, c);
+            check.expect(in && out.str() == programs[species], "exported programs do not read back");
+        }
+    }
+    
+    //A fitter genome of an exported species replaces it, a weaker one of another tag joins, and a tag that sorts
+    //first is drawn from without disturbing the others
+    vector<LibraryGenome> added(3);
+    added[0].tag = "first";
+    added[0].species = expected.back();
+    added[0].fitness = LIBRARY_CELLS;
+    added[1].tag = "second";
+    added[1].species = 8;
+    added[1].fitness = 1;
+    added[2].tag = "a";
+    added[2].species = 7;
+    added[2].fitness = 2;
+    for (LibraryGenome &g : added) {
+        g.tick = 1;
+        g.programs = programs[expected.front()];
+    }
+    string merged = string(path) + ".merged";
+    FILE *out = fopen(merged.c_str(), "wb");
+    bool written = out && library.merge(added, out);
+    if (out && fclose(out))
+        written = false;
+    check.expect(written, "merging failed");
+    GenomeLibrary next;
+    check.expect(next.open(merged) && next.size() == LIBRARY_EXPORTED + 2, "merging kept the wrong genomes");
+    vector<uint64_t> first = {expected.back()};
+    first.insert(first.end(), expected.begin(), expected.end() - 1);
+    check.expect(drawable(next, "first", rand) == first, "the replaced genome is not where its fitness puts it");
+    check.expect(drawable(next, "second", rand) == vector<uint64_t>{8}, "the new tag is missing");
+    check.expect(drawable(next, "a", rand) == vector<uint64_t>{7}, "the tag that sorts first is missing");
+    vector<uint64_t> all = first;
+    all.push_back(7);
+    all.push_back(8);
+    check.expect(drawable(next, "", rand) == all, "the merged fitness order is wrong");
+    check.expect(!next.select("missing", 0), "a missing tag was selected");
+    
+    //A damaged genome never reaches the world; the cells spawned in its place run random programs
+    vector<LibraryGenome> damaged(1);
+    damaged[0].tag = "damaged";
+    damaged[0].species = 99;
+    damaged[0].fitness = 1;
+    damaged[0].tick = 1;
+    damaged[0].programs = programs[expected.front()].substr(0, programs[expected.front()].size() / 2);
+    string broken = string(path) + ".damaged";
+    out = fopen(broken.c_str(), "wb");
+    written = out && GenomeLibrary().merge(damaged, out);
+    if (out && fclose(out))
+        written = false;
+    GenomeLibrary bad;
+    check.expect(written && bad.open(broken) && bad.select("damaged", 0), "the damaged library could not be opened");
+    Group spawned(phi::V3(1.0, 1.0, 1.0), BENCH_SEED);
+    spawned.library = &bad;
+    spawned.spawn(1);
+    check.expect(spawned.cells.size() == CELL_SPAWN_PARTNERS + 1, "spawning from a damaged genome failed");
+    for (const Cell &c : spawned.cells)
+        check.expect(c.species != 99, "a cell spawned from a damaged genome");
+    
+    remove(path);
+    remove(merged.c_str());
+    remove(broken.c_str());
+    cout << "library: " << check.failures << " of " << check.checks << " round-trip checks failed" << endl;
+    if (check.failures)
+        report.failed = true;
+}
+
@@ -0,0 +1,74 @@
+#include "bench.h"
+#include "checkpoint.h"
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+
+//Populations a full update is measured at; the world grows with them so density matches the interactive default
+#define MACRO_SIZES {1000, 10000, 100000}
+//Cells the default world of half extent 1 is benchmarked with
+#define MACRO_UNIT_CELLS 1000
+//Updates a freshly spawned world runs before it is saved, so the snapshot holds organisms rather than loose clumps
+#define MACRO_WARMUP_TICKS 10
+
+using namespace std;
+
+//Restore the world a population is benchmarked from into a group that has no cells
+//The first run spawns the clumps the simulation starts from, warms them up and saves the result, so every later run
+//and every later version of the code starts from exactly the same cells
+static bool snapshot(const string &directory, unsigned cells, Group &group) {
+    string path = directory + "/update-" + to_string(cells) + ".evc";
+    ifstream in(path, ios::binary);
+    if (in)
+        return readCheckpoint(in, group);
+    
+    cout << "Generating " << path << endl;
+    double extent = cbrt(double(cells) / MACRO_UNIT_CELLS);
+    Group generated(phi::V3(extent, extent, extent), BENCH_SEED);
+    generated.spawn(cells / (CELL_SPAWN_PARTNERS + 1));
+    for (unsigned t = 0; t != MACRO_WARMUP_TICKS; t++)
+        generated.update();
+    mkdir(directory.c_str(), 0777);
+    ofstream out(path, ios::binary);
+    if (!writeCheckpoint(out, generated) || !out.flush()) {
+        cerr << "Bench: Failed to write " << path << endl;
+        return false;
+    }
+    out.close();
+    in.open(path, ios::binary);
+    return readCheckpoint(in, group);
+}
+
+static void update(BenchReport &report, unsigned cells) {
+    string name = "update/cells=" + to_string(cells);
+    if (!report.selected(name))
+        return;
+    //Every repetition updates a fresh copy of the snapshot, so none of them depends on how many ran before
+    unique_ptr<Group> group;
+    BenchResult *r = report.measure(name, "update", [&](){
+        group.reset(new Group(phi::V3(1, 1, 1), BENCH_SEED));
+        if (!snapshot(report.snapshots, cells, *group))
+            report.failed = true;
+        return 1;
+    }, [&](){
+        group->update();
+    });
+    if (!r)
+        return;
+    r->counters["cells"] = group->cells.size();
+    r->counters["edges"] = group->edges;
+    r->counters["imbalance"] = group->imbalance;
+    r->counters["cross node edges"] = group->crossNodeShare();
+    r->counters["steals"] = group->chunks.steals;
+    for (unsigned p = 0; p != GROUP_PHASES; p++)
+        r->counters[string("phase ") + groupPhaseNames[p]] = group->phaseDurations[p];
+}
+
+void macroBenchmarks(BenchReport &report) {
+    for (unsigned cells : MACRO_SIZES)
+        update(report, cells);
+}
+
@@ -0,0 +1,50 @@
+#include "bench.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+static void usage() {
+    cerr << "Usage: bench [--json FILE] [--baseline FILE] [--tolerance FRACTION] [--snapshots DIRECTORY] [NAME]" << endl
+         << "Runs the benchmark or group of benchmarks NAME (all by default), writes the results to FILE as JSON" << endl
+         << "and fails if any is more than FRACTION slower than in the baseline or allocates more" << endl
+         << "Full updates start from the worlds saved in DIRECTORY, which are generated the first time" << endl;
+}
+
+int main(int argc, char **argv) {
+    BenchReport report;
+    string json;
+    string baseline;
+    double tolerance = BENCH_TOLERANCE;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc)
+            json = argv[++i];
+        else if (arg == "--baseline" && i + 1 < argc)
+            baseline = argv[++i];
+        else if (arg == "--tolerance" && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+        else if (arg == "--snapshots" && i + 1 < argc)
+            report.snapshots = argv[++i];
+        else if (arg[0] != '-' && report.filter.empty())
+            report.filter = arg;
+        else {
+            usage();
+            return 2;
+        }
+    }
+    
+    microBenchmarks(report);
+    macroBenchmarks(report);
+    allocationBenchmark(report);
+    libraryBenchmark(report);
+    numaBenchmark(report);
+    
+    if (!json.empty() && !report.write(json))
+        return 1;
+    if (!baseline.empty() && !report.compare(baseline, tolerance))
+        return 1;
+    return report.failed ? 1 : 0;
+}
+
@@ -0,0 +1,423 @@
+#include "bench.h"
+#include "simulation.h"
+#include "statehash.h"
+#include "census.h"
+#include "lod.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <unordered_map>
+
+//Cells in every micro-benchmark population
+#define MICRO_CELLS 2000
+//Expected neighbors within the connect distance for the benchmarks that are not about density
+#define MICRO_NEIGHBORS 4.0
+//Children made per repetition of the mating benchmark
+#define MICRO_MATES 1000
+//Screen and orb limit of the level of detail benchmark, small enough that most cells end up in aggregates
+#define MICRO_LOD_PIXELS 400
+#define MICRO_LOD_LIMIT 256
+//Random queries of each kind the spatial index answers and checks against a scan of every cell
+#define MICRO_INDEX_QUERIES 200
+
+using namespace std;
+
+//Group of evenly spread cells that are connected to everything in range
+static void connected(Group &group, unsigned cells, mt19937 &rand) {
+    populate(group, cells, rand);
+    for (Cell &c : group.cells)
+        c.decision.connect = true;
+    group.connectCells();
+    uniform_real_distribution<double> unit(-1.0, 1.0);
+    for (Cell &c : group.cells)
+        for (Neighbor &n : c.neighbors) {
+            group.measure(c, n);
+            n.decision.force = unit(rand);
+        }
+}
+
+static uint64_t edgeRecords(const Group &group) {
+    uint64_t records = 0;
+    for (const Cell &c : group.cells)
+        records += c.neighbors.size();
+    return records;
+}
+
+static void solve(BenchReport &report) {
+    if (!report.selected("solve"))
+        return;
+    mt19937 rand(BENCH_SEED);
+    double extent = densityExtent(MICRO_CELLS, MICRO_NEIGHBORS);
+    Group group(phi::V3(extent, extent, extent), BENCH_SEED);
+    connected(group, MICRO_CELLS, rand);
+    report.measure("solve", "cell", [&](){
+        return group.cells.size();
+    }, [&](){
+        for (Cell &c : group.cells)
+            c.solvePersistent();
+        for (Cell &c : group.cells)
+            c.solveSignal();
+        for (Cell &c : group.cells)
+            c.solveNeighbor();
+    });
+}
+
+static void connectSearch(BenchReport &report, double neighbors) {
+    string name = "connect/neighbors=" + to_string(int(neighbors));
+    if (!report.selected(name))
+        return;
+    mt19937 rand(BENCH_SEED);
+    double extent = densityExtent(MICRO_CELLS, neighbors);
+    Group group(phi::V3(extent, extent, extent), BENCH_SEED);
+    populate(group, MICRO_CELLS, rand);
+    list<Neighbor> cut;
+    BenchResult *r = report.measure(name, "cell", [&](){
+        for (Cell &c : group.cells) {
+            c.pluck(cut);
+            c.decision.connect = true;
+        }
+        group.edges = 0;
+        return group.cells.size();
+    }, [&](){
+        group.connectCells();
+    });
+    if (r)
+        r->counters["edges per cell"] = double(group.edges) / group.cells.size();
+}
+
+static void physics(BenchReport &report) {
+    if (!report.selected("physics"))
+        return;
+    mt19937 rand(BENCH_SEED);
+    double extent = densityExtent(MICRO_CELLS, MICRO_NEIGHBORS);
+    Group group(phi::V3(extent, extent, extent), BENCH_SEED);
+    connected(group, MICRO_CELLS, rand);
+    //Every repetition moves the cells, so edges are measured again as part of it
+    report.measure("physics", "edge", [&](){
+        return edgeRecords(group);
+    }, [&](){
+        for (Cell &c : group.cells)
+            group.applyForces(c);
+        for (Cell &c : group.cells)
+            group.advance(c);
+        group.positionVersion++;
+    });
+}
+
+static void deaths(BenchReport &report) {
+    if (!report.selected("deaths"))
+        return;
+    mt19937 rand(BENCH_SEED);
+    double extent = densityExtent(MICRO_CELLS, MICRO_NEIGHBORS);
+    Group group(phi::V3(extent, extent, extent), BENCH_SEED);
+    //Half of the cells die every repetition and are replaced before the next
+    report.measure("deaths", "cell", [&](){
+        populate(group, MICRO_CELLS - group.cells.size(), rand);
+        for (Cell &c : group.cells)
+            c.decision.connect = true;
+        group.connectCells();
+        uint64_t killed = 0;
+        for (Cell &c : group.cells)
+            if (rand() & 1) {
+                c.kill(DEATH_STARVED);
+                killed++;
+            }
+        return killed;
+    }, [&](){
+        group.updateDeaths();
+        group.organisms.rebuild();
+    });
+}
+
+static void mate(BenchReport &report) {
+    if (!report.selected("mate"))
+        return;
+    mt19937 rand(BENCH_SEED);
+    Group group(phi::V3(1.0, 1.0, 1.0), BENCH_SEED);
+    populate(group, 2, rand);
+    Cell &a = group.cells.front();
+    Cell &b = group.cells.back();
+    Cell child(a, b, a.particle.position, rand);
+    report.measure("mate", "child", [&](){
+        return MICRO_MATES;
+    }, [&](){
+        for (unsigned i = 0; i != MICRO_MATES; i++)
+            child.remate(a, b, a.particle.position, rand);
+    });
+}
+
+static void relocate(BenchReport &report) {
+    if (!report.selected("relocate"))
+        return;
+    mt19937 rand(BENCH_SEED);
+    double extent = densityExtent(MICRO_CELLS, MICRO_NEIGHBORS);
+    Group group(phi::V3(extent, extent, extent), BENCH_SEED);
+    //Fresh cells every repetition so there is a full permutation to carry out
+    report.measure("relocate", "cell", [&](){
+        for (Cell &c : group.cells)
+            c.kill(DEATH_STARVED);
+        group.updateDeaths();
+        group.organisms.rebuild();
+        connected(group, MICRO_CELLS, rand);
+        return group.cells.size();
+    }, [&](){
+        group.relocate();
+    });
+}
+
+static void pack(BenchReport &report) {
+    if (!report.selected("pack"))
+        return;
+    mt19937 rand(BENCH_SEED);
+    Group group(phi::V3(1.0, 1.0, 1.0), BENCH_SEED);
+    populate(group, MICRO_CELLS, rand);
+    Snapshot snapshot;
+    report.measure("pack", "cell", [&](){
+        return group.cells.size();
+    }, [&](){
+        snapshot.pack(group.cells);
+    });
+}
+
+//Shortest offset from a to b along an axis of half extent e, independent of the index
+static double wrapped(double a, double b, double e) {
+    double d = b - a;
+    if (abs(d) > e)
+        d -= 2 * copysign(e, d);
+    return d;
+}
+
+static double squaredDistance(const Snapshot &snapshot, const double extent[3], const double point[3], unsigned i) {
+    double d[3] = {wrapped(point[0], snapshot.x[i], extent[0]), wrapped(point[1], snapshot.y[i], extent[1]),
+                   wrapped(point[2], snapshot.z[i], extent[2])};
+    return d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+}
+
+//Where a ray first hits any image of cell i within distance, trying the images in the neighboring copies of the
+//world, which is enough for a ray that starts inside it and is shorter than its narrowest half extent
+static double imageHit(const Snapshot &snapshot, const double extent[3], unsigned i, const double o[3],
+                       const double d[3], double radius, double distance) {
+    double p[3] = {snapshot.x[i], snapshot.y[i], snapshot.z[i]};
+    double best = numeric_limits<double>::infinity();
+    for (int image = 0; image != 27; image++) {
+        int shift[3] = {image % 3 - 1, image / 3 % 3 - 1, image / 9 - 1};
+        double along = 0;
+        double squared = 0;
+        for (unsigned a = 0; a != 3; a++) {
+            double m = p[a] + 2 * extent[a] * shift[a] - o[a];
+            along += m * d[a];
+            squared += m * m;
+        }
+        double missed = squared - along * along;
+        if (missed > radius * radius)
+            continue;
+        double half = sqrt(radius * radius - missed);
+        double hit = max(along - half, 0.0);
+        if (along + half >= 0 && hit <= distance)
+            best = min(best, hit);
+    }
+    return best;
+}
+
+//Compare every kind of query on random input with a scan of every cell; returns the queries that disagree
+static unsigned checkIndex(const Snapshot &snapshot, const phi::V3 &dimensions, mt19937 &rand) {
+    const SpatialIndex &index = snapshot.index;
+    double extent[3] = {dimensions.x, dimensions.y, dimensions.z};
+    double narrowest = min(extent[0], min(extent[1], extent[2]));
+    uniform_real_distribution<double> unit(-1.0, 1.0);
+    vector<uint64_t> found;
+    vector<uint64_t> expected;
+    unsigned wrong = 0;
+    for (unsigned q = 0; q != MICRO_INDEX_QUERIES; q++) {
+        double c[3] = {unit(rand) * extent[0], unit(rand) * extent[1], unit(rand) * extent[2]};
+        phi::V3 center(c[0], c[1], c[2]);
+        
+        double h[3] = {abs(unit(rand)) * narrowest / 2, abs(unit(rand)) * narrowest / 2,
+                       abs(unit(rand)) * narrowest / 2};
+        index.box(center, phi::V3(h[0], h[1], h[2]), found);
+        expected.clear();
+        for (unsigned i = 0; i != snapshot.size(); i++)
+            if (abs(wrapped(c[0], snapshot.x[i], extent[0])) <= h[0] &&
+                abs(wrapped(c[1], snapshot.y[i], extent[1])) <= h[1] &&
+                abs(wrapped(c[2], snapshot.z[i], extent[2])) <= h[2])
+                expected.push_back(snapshot.ids[i]);
+        sort(found.begin(), found.end());
+        sort(expected.begin(), expected.end());
+        wrong += found != expected;
+        
+        double radius = abs(unit(rand)) * narrowest / 2;
+        index.sphere(center, radius, found);
+        expected.clear();
+        for (unsigned i = 0; i != snapshot.size(); i++)
+            if (squaredDistance(snapshot, extent, c, i) <= radius * radius)
+                expected.push_back(snapshot.ids[i]);
+        sort(found.begin(), found.end());
+        sort(expected.begin(), expected.end());
+        wrong += found != expected;
+        
+        //Ties may be broken either way, so the distances are compared rather than the ids
+        unsigned k = 1 + rand() % 16;
+        index.nearest(center, k, found);
+        vector<double> distances;
+        vector<double> scanned;
+        unordered_map<uint64_t, unsigned> slots;
+        for (unsigned i = 0; i != snapshot.size(); i++) {
+            slots[snapshot.ids[i]] = i;
+            scanned.push_back(squaredDistance(snapshot, extent, c, i));
+        }
+        for (uint64_t id : found)
+            distances.push_back(squaredDistance(snapshot, extent, c, slots[id]));
+        sort(scanned.begin(), scanned.end());
+        scanned.resize(min<size_t>(k, scanned.size()));
+        wrong += distances != scanned;
+        
+        double d[3] = {unit(rand), unit(rand), unit(rand)};
+        double length = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        for (double &a : d)
+            a /= length;
+        radius = abs(unit(rand)) * PHYSICS_CONNECT_DISTANCE;
+        double distance = abs(unit(rand)) * (narrowest - radius);
+        double hit = numeric_limits<double>::infinity();
+        for (unsigned i = 0; i != snapshot.size(); i++)
+            hit = min(hit, imageHit(snapshot, extent, i, c, d, radius, distance));
+        uint64_t id;
+        if (!index.pick(center, phi::V3(d[0], d[1], d[2]), radius, distance, id))
+            wrong += hit != numeric_limits<double>::infinity();
+        else
+            //The index adds up offsets where the scan shifts whole positions, so hits only agree up to rounding,
+            //and a tie may be broken either way
+            wrong += !(abs(imageHit(snapshot, extent, slots[id], c, d, radius, distance) - hit) <= 1e-9 * narrowest);
+    }
+    
+    //A ray that wraps along a closed line past the only cell never hits it and still has to end
+    Snapshot lone;
+    lone.x.assign(1, 0);
+    lone.y.assign(1, 0);
+    lone.z.assign(1, 0);
+    lone.ids.assign(1, 0);
+    SpatialIndex single;
+    single.build(dimensions, lone.x, lone.y, lone.z, lone.ids);
+    uint64_t id;
+    wrong += single.pick(phi::V3(0, narrowest / 2, 0), phi::V3(1, 0, 0), narrowest / 4,
+                         numeric_limits<double>::infinity(), id);
+    return wrong;
+}
+
+static void spatialIndex(BenchReport &report) {
+    if (!report.selected("index"))
+        return;
+    mt19937 rand(BENCH_SEED);
+    double extent = densityExtent(MICRO_CELLS, MICRO_NEIGHBORS);
+    Group group(phi::V3(extent, extent, extent), BENCH_SEED);
+    populate(group, MICRO_CELLS, rand);
+    Snapshot snapshot;
+    snapshot.pack(group.cells);
+    report.measure("index", "cell", [&](){
+        return group.cells.size();
+    }, [&](){
+        snapshot.index.build(group.dimensions, snapshot.x, snapshot.y, snapshot.z, snapshot.ids);
+    });
+    
+    uniform_real_distribution<double> unit(-1.0, 1.0);
+    vector<uint64_t> found;
+    uint64_t hits = 0;
+    report.measure("index/sphere", "query", [&](){
+        return MICRO_INDEX_QUERIES;
+    }, [&](){
+        for (unsigned q = 0; q != MICRO_INDEX_QUERIES; q++) {
+            snapshot.index.sphere(phi::V3(unit(rand) * extent, unit(rand) * extent, unit(rand) * extent),
+                                  PHYSICS_CONNECT_DISTANCE, found);
+            hits += found.size();
+        }
+    });
+    report.measure("index/pick", "query", [&](){
+        return MICRO_INDEX_QUERIES;
+    }, [&](){
+        uint64_t id;
+        for (unsigned q = 0; q != MICRO_INDEX_QUERIES; q++)
+            hits += snapshot.index.pick(phi::V3(unit(rand) * extent, unit(rand) * extent, unit(rand) * extent),
+                                        phi::V3(unit(rand), unit(rand), unit(rand)), PHYSICS_CONNECT_DISTANCE / 4,
+                                        numeric_limits<double>::infinity(), id);
+    });
+    
+    unsigned wrong = checkIndex(snapshot, group.dimensions, rand);
+    cout << "index: " << wrong << " of " << 4 * MICRO_INDEX_QUERIES + 1
+         << " queries disagree with a scan of every cell" << endl;
+    if (wrong)
+        report.failed = true;
+}
+
+static void hashState(BenchReport &report) {
+    if (!report.selected("hash"))
+        return;
+    mt19937 rand(BENCH_SEED);
+    double extent = densityExtent(MICRO_CELLS, MICRO_NEIGHBORS);
+    Group group(phi::V3(extent, extent, extent), BENCH_SEED);
+    connected(group, MICRO_CELLS, rand);
+    StateHasher hasher(false);
+    uint64_t h = 0;
+    report.measure("hash", "cell", [&](){
+        return group.cells.size();
+    }, [&](){
+        h += hasher.hash(group);
+    });
+}
+
+static void census(BenchReport &report) {
+    if (!report.selected("census"))
+        return;
+    mt19937 rand(BENCH_SEED);
+    Group group(phi::V3(1.0, 1.0, 1.0), BENCH_SEED);
+    populate(group, MICRO_CELLS, rand);
+    Census census;
+    report.measure("census", "cell", [&](){
+        return group.cells.size();
+    }, [&](){
+        census.take(group);
+    });
+}
+
+static void lod(BenchReport &report) {
+    if (!report.selected("lod"))
+        return;
+    mt19937 rand(BENCH_SEED);
+    Group group(phi::V3(1.0, 1.0, 1.0), BENCH_SEED);
+    populate(group, MICRO_CELLS, rand);
+    Snapshot snapshot;
+    snapshot.pack(group.cells);
+    OrbFrame cells;
+    cells.resize(snapshot.size());
+    for (unsigned i = 0; i != cells.size(); i++) {
+        cells.fields[0][i] = snapshot.x[i];
+        cells.fields[1][i] = snapshot.y[i];
+        cells.fields[2][i] = snapshot.z[i];
+        for (unsigned f = 3; f != 6; f++)
+            cells.fields[f][i] = (snapshot.species[i] >> (f - 3) * 8 & 0xFF) / double(0xFF);
+        cells.fields[6][i] = 0.1;
+    }
+    OrbLod lod(MICRO_LOD_PIXELS, MICRO_LOD_PIXELS, thread::hardware_concurrency());
+    OrbFrame orbs;
+    report.measure("lod", "cell", [&](){
+        return group.cells.size();
+    }, [&](){
+        lod.reduce(cells, MICRO_LOD_LIMIT, orbs);
+    });
+}
+
+void microBenchmarks(BenchReport &report) {
+    solve(report);
+    for (double neighbors : {1.0, 4.0, 16.0})
+        connectSearch(report, neighbors);
+    physics(report);
+    deaths(report);
+    mate(report);
+    relocate(report);
+    pack(report);
+    spatialIndex(report);
+    hashState(report);
+    census(report);
+    lod(report);
+}
+
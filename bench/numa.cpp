@@ -0,0 +1,135 @@
+#include "bench.h"
+#include "statehash.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
+//Cells spawned for the NUMA benchmark and updates its check runs
+#define NUMA_CELLS 5000
+#define NUMA_TICKS 20
+
+using namespace std;
+
+static Group* spawned(unsigned workers, const AffinityMap &affinity) {
+    double extent = cbrt(double(NUMA_CELLS) / 1000);
+    Group *group = new Group(phi::V3(extent, extent, extent), BENCH_SEED);
+    group->workers.resize(workers, affinity);
+    group->spawn(NUMA_CELLS / (CELL_SPAWN_PARTNERS + 1));
+    return group;
+}
+
+//Run a group whose workers claim to be on two nodes, so every relocation copies the cells into nodes the workers
+//allocate, next to one that moves cells between the nodes they have; both must go exactly the same way
+static void check(BenchReport &report, unsigned workers) {
+    AffinityMap split;
+    for (unsigned w = 0; w != workers; w++) {
+        split.workers.emplace_back();
+        split.workers.back().node = w % 2;
+    }
+    unique_ptr<Group> rehomed(spawned(workers, split));
+    unique_ptr<Group> permuted(spawned(workers, AffinityMap()));
+    unsigned differing = 0;
+    for (unsigned t = 0; t != NUMA_TICKS; t++) {
+        rehomed->relocate();
+        permuted->relocate();
+        rehomed->update();
+        permuted->update();
+        if (stateHash(*rehomed) != stateHash(*permuted))
+            differing++;
+    }
+    cout << "numa: " << differing << " of " << NUMA_TICKS << " updates differ after moving cells to their workers' nodes"
+         << endl;
+    if (differing)
+        report.failed = true;
+}
+
+//Cell reads of a group's workers, their own cells and those at the other end of their edges, and how many of them
+//are on another node than the worker
+struct NodeReads {
+    uint64_t reads;
+    uint64_t remoteReads;
+    uint64_t remoteCells;
+    unsigned spanned;
+};
+
+//Workers count as being on the node the pinned map puts them on, so a group whose workers are not pinned is measured
+//against the same nodes as one whose workers are; returns false if the kernel does not say where memory is
+static bool nodeReads(const Group &group, const AffinityMap &pinned, NodeReads &counted) {
+    vector<const void*> addresses;
+    for (const Cell &c : group.cells)
+        addresses.push_back(&c);
+    vector<int> nodes;
+    if (!memoryNodes(addresses, nodes))
+        return false;
+    unordered_map<const Cell*, int> placed;
+    for (unsigned i = 0; i != addresses.size(); i++)
+        placed[static_cast<const Cell*>(addresses[i])] = nodes[i];
+    counted.reads = 0;
+    counted.remoteReads = 0;
+    counted.remoteCells = 0;
+    counted.spanned = 0;
+    for (const Cell &c : group.cells) {
+        int node = pinned.worker(c.worker).node;
+        counted.spanned = max(counted.spanned, unsigned(node) + 1);
+        counted.reads += 1 + c.neighbors.size();
+        if (placed[&c] != node) {
+            counted.remoteCells++;
+            counted.remoteReads++;
+        }
+        for (const Neighbor &n : c.neighbors)
+            if (placed[n.neighbor] != node)
+                counted.remoteReads++;
+    }
+    return true;
+}
+
+//Update a group pinned one worker per CPU, node after node, and count how many of the cells every worker reads are
+//on another node than the worker; a group updated just as far with unpinned workers, whose cells are only permuted
+//when they are relocated, shows how many would be without pinning
+static void traffic(BenchReport &report, unsigned workers) {
+    if (!report.selected("numa/update"))
+        return;
+    AffinityMap pinned = AffinityMap::numa(workers);
+    unique_ptr<Group> group(spawned(workers, pinned));
+    BenchResult *r = report.measure("numa/update", "update", [&](){
+        return 1;
+    }, [&](){
+        group->update();
+    });
+    if (!r)
+        return;
+    //Partitions the cells if they changed since the last update
+    r->counters["cross node edges"] = group->crossNodeShare();
+    
+    unique_ptr<Group> baseline(spawned(workers, AffinityMap()));
+    while (baseline->tick != group->tick)
+        baseline->update();
+    NodeReads local, unpinned;
+    if (!nodeReads(*group, pinned, local) || !nodeReads(*baseline, pinned, unpinned)) {
+        cout << "numa: The kernel does not say which node memory is on" << endl;
+        return;
+    }
+    double remote = local.reads ? double(local.remoteReads) / local.reads : 0.0;
+    double baselineRemote = unpinned.reads ? double(unpinned.remoteReads) / unpinned.reads : 0.0;
+    r->counters["nodes"] = local.spanned;
+    r->counters["remote cells"] = group->cells.empty() ? 0.0 : double(local.remoteCells) / group->cells.size();
+    r->counters["remote reads"] = remote;
+    r->counters["baseline remote reads"] = baselineRemote;
+    //How many times fewer reads cross nodes than without pinning; a pinned run without any counts as having one so
+    //the ratio stays finite
+    r->counters["remote read reduction"] = local.reads ? baselineRemote / max(remote, 1.0 / local.reads) : 0.0;
+    cout << "numa: " << local.remoteReads << " of " << local.reads << " cell reads and " << local.remoteCells << " of "
+         << group->cells.size() << " cells are on another node than their worker (" << local.spanned << " nodes); "
+         << unpinned.remoteReads << " of " << unpinned.reads << " reads are without pinning" << endl;
+}
+
+void numaBenchmark(BenchReport &report) {
+    unsigned workers = max(2u, thread::hardware_concurrency());
+    if (report.selected("numa/check"))
+        check(report, workers);
+    traffic(report, workers);
+}
+
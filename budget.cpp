@@ -0,0 +1,44 @@
+#include "budget.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static double smooth(double current, double measured) {
+    return current == 0 ? measured : current + BUDGET_SMOOTHING * (measured - current);
+}
+
+TickBudget::TickBudget(double target, bool pressure, uint64_t turnFoodCost) : target(target), pressure(pressure),
+                       tickCost(0), cycles(1), turnFoodCost(turnFoodCost), baseFoodCost(turnFoodCost),
+                       sincePressure(0) {
+}
+
+void TickBudget::measureTick(double seconds) {
+    tickCost = smooth(tickCost, seconds);
+    cycles = std::max(1.0, std::min(double(BUDGET_MAX_CYCLES), std::floor(target / tickCost)));
+    
+    if (++sincePressure < BUDGET_PRESSURE_INTERVAL)
+        return;
+    //Even one tick per frame is too slow, so make survival harder until the population shrinks
+    if (pressure && tickCost > target && turnFoodCost < baseFoodCost * BUDGET_PRESSURE_MAX) {
+        turnFoodCost *= 2;
+        sincePressure = 0;
+    } else if (turnFoodCost > baseFoodCost && tickCost < target * BUDGET_RELAX_RATIO) {
+        turnFoodCost /= 2;
+        sincePressure = 0;
+    }
+}
+
+DrawBudget::DrawBudget(double target) : target(target), orbCost(0) {
+}
+
+void DrawBudget::measureRender(double seconds, unsigned drawn) {
+    if (drawn)
+        orbCost = smooth(orbCost, seconds / drawn);
+}
+
+unsigned DrawBudget::limit() const {
+    if (orbCost == 0)
+        return std::numeric_limits<unsigned>::max();
+    return std::max(1.0, std::min(double(std::numeric_limits<unsigned>::max()), std::floor(target / orbCost)));
+}
+
@@ -0,0 +1,54 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <cstdint>
+
+//Weight of the newest measurement in the smoothed costs
+#define BUDGET_SMOOTHING 0.1
+//Most ticks run per frame when ticks are cheap
+#define BUDGET_MAX_CYCLES 64
+//Ticks to wait between food cost changes so the population has time to react
+#define BUDGET_PRESSURE_INTERVAL 64
+//Largest multiple of CELL_TURN_FOOD_COST the budget may raise the food cost to
+#define BUDGET_PRESSURE_MAX 256
+//Food cost is relaxed once a tick costs less than this fraction of the target
+#define BUDGET_RELAX_RATIO 0.5
+
+//Adjusts how many ticks run per frame so the simulation spends a fixed amount of time per frame
+struct TickBudget {
+    //Seconds of ticking allowed per frame
+    double target;
+    //Allow raising the food cost when a single tick per frame is already over the target
+    bool pressure;
+    //Smoothed seconds per tick
+    double tickCost;
+    unsigned cycles;
+    uint64_t turnFoodCost;
+    
+    TickBudget(double target, bool pressure, uint64_t turnFoodCost);
+    
+    //Account for one Group::update taking the given seconds
+    void measureTick(double seconds);
+    
+private:
+    uint64_t baseFoodCost;
+    unsigned sincePressure;
+};
+
+//Picks how many orbs may be drawn so orb shading stays within a fixed time
+struct DrawBudget {
+    //Seconds of orb shading allowed per frame
+    double target;
+    //Smoothed seconds of shading per drawn orb
+    double orbCost;
+    
+    DrawBudget(double target);
+    
+    //Account for drawing the given orbs taking the given seconds
+    void measureRender(double seconds, unsigned drawn);
+    //Most orbs to draw per frame (no limit until a render was measured)
+    unsigned limit() const;
+};
+
+#endif // BUDGET_H
+
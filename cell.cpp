@@ -1,15 +1,36 @@
 #include "cell.h"
 #include "assert.h"
 #include <iostream>
+#include <iterator>
 
 void Changes::clear() {
     death = false;
+    cause = DEATH_NONE;
     eatenBy = 0;
     mate = nullptr;
+    mateEdge = nullptr;
 }
 
 Cell::Cell(Cell &a, Cell &b, const phi::V3 &position, std::mt19937 &rand) : neighborProgram(a.neighborProgram),
-           signalProgram(a.signalProgram), persistentProgram(a.persistentProgram), particle(1.0, position), food(0) {
+           signalProgram(a.signalProgram), persistentProgram(a.persistentProgram), particle(1.0, position), food(0),
+           ghost(false), slab(0) {
+    cross(a, b, rand);
+}
+
+void Cell::remate(Cell &a, Cell &b, const phi::V3 &position, std::mt19937 &rand) {
+    //Assignment copies into the program storage this cell already has
+    neighborProgram = a.neighborProgram;
+    signalProgram = a.signalProgram;
+    persistentProgram = a.persistentProgram;
+    particle = phi::P3(1.0, position);
+    food = 0;
+    decision = PersistentDecision();
+    //The dead cell may have been a ghost
+    ghost = false;
+    cross(a, b, rand);
+}
+
+void Cell::cross(Cell &a, Cell &b, std::mt19937 &rand) {
     //Create crossover programs
     neighborProgram.crossover(b.neighborProgram, rand);
     signalProgram.crossover(b.signalProgram, rand);
@@ -20,22 +41,19 @@ Cell::Cell(Cell &a, Cell &b, const phi::V3 &position, std::mt19937 &rand) : neig
     particle.velocity += b.particle.velocity;
     particle.velocity *= 0.5; //Get average velocity between particles
     
-    //Add this cell as a connection to a and b
-    connect(a, *this);
-    connect(b, *this);
-    
     //species = (a.species == b.species) ? a.species : ((uint64_t(rand()) << 32) | uint64_t(rand()));
     species = (a.species & 0xFFFFFFFF00000000) | (b.species & 0x00000000FFFFFFFF);
     
-    //Mutate this cell
-    if (double(rand()) / rand.max() < CELL_MATE_MUTATION_CHANCE)
-        mutate(rand);
+    //Newborns are checked for death before their first clear
+    changes.clear();
+    
+    //Connecting to the parents and mutation are left to the group so edges can be pooled and mutation logged
 }
 
 Cell::Cell(Cell &parent, const phi::V3 &position) : neighborProgram(parent.neighborProgram),
     signalProgram(parent.signalProgram), persistentProgram(parent.persistentProgram),
-    particle(1.0, position, parent.particle.velocity), food(0), species(parent.species) {
-    connect(parent, *this);
+    particle(1.0, position, parent.particle.velocity), food(0), species(parent.species), ghost(false), slab(0) {
+    changes.clear();
 }
 
 Cell::Cell(const phi::V3 &position, const phi::V3 &velocity, std::mt19937 &rand) : 
@@ -45,24 +63,43 @@ Cell::Cell(const phi::V3 &position, const phi::V3 &velocity, std::mt19937 &rand)
                            CELL_SIGNAL_CHROMOSOME_SIZE, rand),
            persistentProgram(CELL_PERSISTENT_INPUTS, CELL_PERSISTENT_OUTPUTS, CELL_PERSISTENT_CHROMOSOMES,
                              CELL_PERSISTENT_CHROMOSOME_SIZE, rand),
-           particle(1.0, position, velocity), food(CELL_INITIAL_FOOD) {
+           particle(1.0, position, velocity), food(CELL_INITIAL_FOOD), ghost(false), slab(0) {
     species = (uint64_t(rand()) << 32) | uint64_t(rand());
+    changes.clear();
+}
+
+//Programs can only be constructed randomly, so restored ones are generated from this and then overwritten
+static std::mt19937& scratchRandom() {
+    static thread_local std::mt19937 rand;
+    return rand;
 }
 
-void Cell::pluck() {
+Cell::Cell(const phi::V3 &position, const phi::V3 &velocity, std::istream &genome) :
+           neighborProgram(CELL_NEIGHBOR_INPUTS, CELL_NEIGHBOR_OUTPUTS, CELL_NEIGHBOR_CHROMOSOMES,
+                           CELL_NEIGHBOR_CHROMOSOME_SIZE, scratchRandom()),
+           signalProgram(CELL_SIGNAL_INPUTS, CELL_SIGNAL_OUTPUTS, CELL_SIGNAL_CHROMOSOMES,
+                           CELL_SIGNAL_CHROMOSOME_SIZE, scratchRandom()),
+           persistentProgram(CELL_PERSISTENT_INPUTS, CELL_PERSISTENT_OUTPUTS, CELL_PERSISTENT_CHROMOSOMES,
+                             CELL_PERSISTENT_CHROMOSOME_SIZE, scratchRandom()),
+           particle(1.0, position, velocity), food(0), species(0), ghost(false), slab(0) {
+    readGenome(genome, *this);
+    changes.clear();
+}
+
+void Cell::pluck(std::list<Neighbor> &spare) {
     //Erase this from all neighbors
     for (Neighbor &n : neighbors)
-        n.neighbor->neighbors.erase(n.neighborsDecision);
+        spare.splice(spare.begin(), n.neighbor->neighbors, n.neighborsDecision);
     //Clear this cell's neighbors
-    neighbors.clear();
+    spare.splice(spare.begin(), neighbors);
 }
 
 bool Cell::isDead() {
     return changes.death;
 }
 
-void Cell::die() {
-    pluck();
+void Cell::die(std::list<Neighbor> &spare) {
+    pluck(spare);
 }
 
 void Cell::clear() {
@@ -164,18 +201,19 @@ void Cell::enumerateConsumptions() {
 void Cell::totalConsumptions() {
     //We also die if somebody has eaten us
     if (changes.eatenBy != 0) {
-        changes.death = true;
+        kill(DEATH_EATEN);
         return;
     }
     uint64_t sentFood = 0;
     for (Neighbor &n : neighbors) {
         if (n.decision.eat)
             food += n.neighbor->food/n.neighbor->changes.eatenBy;
-        sentFood += std::abs(n.decision.send);
+        //Send is never negative and is capped well below where a double stops holding whole numbers
+        sentFood += uint64_t(n.decision.send);
     }
     
     if (sentFood >= food) {
-        changes.death = true;
+        kill(DEATH_SENT_FOOD);
         return;
     }
     food -= sentFood;
@@ -183,7 +221,7 @@ void Cell::totalConsumptions() {
 
 void Cell::accumulateSentFood() {
     for (Neighbor &n : neighbors) {
-        food += std::abs(n.neighborsDecision->decision.send);
+        food += uint64_t(n.neighborsDecision->decision.send);
     }
 }
 
@@ -193,21 +231,22 @@ void Cell::decideMate() {
         if (n.decision.mate > best) {
             best = n.decision.mate;
             changes.mate = n.neighbor;
+            changes.mateEdge = &n;
             break;
         }
 }
 
-void Cell::handleStarve() {
-    uint64_t totalCost = CELL_TURN_FOOD_COST;
+void Cell::handleStarve(uint64_t turnCost) {
+    uint64_t totalCost = turnCost;
     for (Neighbor &n : neighbors) {
         double potentialCost = std::abs(n.decision.force) * CELL_ACCELERATION_FOOD_COST_COEFFICIENT;
         if (potentialCost > CELL_MAX_FOOD_VALUE)
             totalCost += CELL_MAX_FOOD_VALUE;
         else
-            totalCost += potentialCost;
+            totalCost += uint64_t(potentialCost);
     }
     if (food <= totalCost) {
-        changes.death = true;
+        kill(DEATH_STARVED);
         return;
     }
     
@@ -223,10 +262,28 @@ void Cell::mutate(std::mt19937 &rand) {
         species = (uint64_t(rand()) << 32) | uint64_t(rand());
 }
 
-void connect(Cell &a, Cell &b) {
-    a.neighbors.emplace_front(&b);
-    b.neighbors.emplace_front(&a);
-    a.neighbors.front().neighborsDecision = b.neighbors.begin();
-    b.neighbors.front().neighborsDecision = a.neighbors.begin();
+void Cell::kill(DeathCause cause) {
+    changes.death = true;
+    changes.cause = cause;
+}
+
+//Put a neighbor record into from's neighbors, which are kept in the order of the neighbors' ids so that whatever
+//walks them, like choosing a mate or summing forces, does not depend on the order the edges were made in
+static std::list<Neighbor>::iterator link(Cell &from, Cell &to, std::list<Neighbor> &spare) {
+    std::list<Neighbor>::iterator at = from.neighbors.begin();
+    while (at != from.neighbors.end() && at->neighbor->id < to.id)
+        at++;
+    if (spare.empty())
+        return from.neighbors.emplace(at, &to);
+    spare.front() = Neighbor(&to);
+    from.neighbors.splice(at, spare, spare.begin());
+    return std::prev(at);
+}
+
+void connect(Cell &a, Cell &b, std::list<Neighbor> &spare) {
+    std::list<Neighbor>::iterator ab = link(a, b, spare);
+    std::list<Neighbor>::iterator ba = link(b, a, spare);
+    ab->neighborsDecision = ba;
+    ba->neighborsDecision = ab;
 }
 
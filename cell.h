@@ -3,8 +3,10 @@
 
 #include "gpi/gpi.h"
 #include "phitron/p3.h"
+#include "lineage.h"
+#include "genome.h"
 #include <list>
-#include <thread>
+#include <random>
 
 //Persistent program constants
 #define CELL_PERSISTENT_VALUES 4
@@ -74,7 +76,9 @@ struct NeighborDecision {
     //Persistant data
     double values[CELL_NEIGHBOR_PERSISTENT_VALUES];
     
-    NeighborDecision() : signal(0.0) {
+    //Edges made after the neighbor phase, such as those of a newborn, reach physics before any program decided
+    //anything about them, so they must start out doing nothing
+    NeighborDecision() : eat(false), mate(0.0), sever(false), send(0.0), force(0.0), signal(0.0) {
         for (int i = 0; i != CELL_NEIGHBOR_PERSISTENT_VALUES; i++)
             values[i] = 0;
     }
@@ -86,7 +90,7 @@ struct PersistentDecision {
     //Persistent data
     double values[CELL_PERSISTENT_VALUES];
     
-    PersistentDecision() {
+    PersistentDecision() : connect(false) {
         for (int i = 0; i != CELL_PERSISTENT_VALUES; i++)
             values[i] = 0;
     }
@@ -94,11 +98,15 @@ struct PersistentDecision {
 
 struct Neighbor {
     Cell* neighbor;
+    //Wrapped offset to the neighbor and its length; only valid while version matches the group's positionVersion
+    phi::V3 delta;
+    double distanceSquared;
     double distance;
+    uint64_t version;
     NeighborDecision decision;
     std::list<Neighbor>::iterator neighborsDecision;
     
-    Neighbor(Cell *neighbor) : neighbor(neighbor) {}
+    Neighbor(Cell *neighbor) : neighbor(neighbor), version(0) {}
     
     bool operator==(const Cell *other) const {
         return neighbor == other;
@@ -107,8 +115,11 @@ struct Neighbor {
 
 struct Changes {
     bool death;
+    DeathCause cause;
     uint64_t eatenBy;
     Cell *mate;
+    //Edge to the mate, whose geometry places the child
+    Neighbor *mateEdge;
     
     void clear();
 };
@@ -126,20 +137,38 @@ struct Cell {
     Changes changes;
     
     uint64_t species;
+    //Unique for the lifetime of the group; assigned by the group in birth order
+    uint64_t id;
+    //Node in the group's organism tracker
+    uint32_t organism;
+    //Entry in the group's genome table
+    Genome *genome;
+    //Food at the last invariant check; only meaningful while a tick is being checked
+    uint64_t checkedFood;
+    //Worker the group last assigned this cell to
+    uint32_t worker;
+    //Copy of a cell that another slab of the domain owns, kept for the cells of this slab it is or may become
+    //connected to; none of its programs run here and its edges only lead to cells of this slab
+    bool ghost;
+    //Slab that owns a ghost
+    uint32_t slab;
     
-    std::thread thread;
-    
-    //Mate
+    //Mate; the child is not connected to its parents yet
     Cell(Cell &a, Cell &b, const phi::V3 &position, std::mt19937 &rand);
+    //Mate into a dead cell, reusing its program storage
+    void remate(Cell &a, Cell &b, const phi::V3 &position, std::mt19937 &rand);
     
-    //Divide
+    //Divide; the child is not connected to its parent yet
     Cell(Cell &parent, const phi::V3 &position);
     
     //Generate
     Cell(const phi::V3 &position, const phi::V3 &velocity, std::mt19937 &rand);
     
-    //Remove this from all neighbors and all neighbors from this
-    void pluck();
+    //Restore programs written by writeGenome; check the stream afterwards
+    Cell(const phi::V3 &position, const phi::V3 &velocity, std::istream &genome);
+    
+    //Remove this from all neighbors and all neighbors from this; the removed records are moved to spare
+    void pluck(std::list<Neighbor> &spare);
     //Compute inputs and solve persistent program (for determining persistent inputs and global cell actions)
     void solvePersistent();
     //Compute inputs and solve signal program (for determining the signal to send to neighbors)
@@ -153,24 +182,30 @@ struct Cell {
     void totalConsumptions();
     //Accumulate the food sent from all surviving neighbors
     void accumulateSentFood();
-    //Determine if cell starved and apply food cost
-    void handleStarve();
+    //Determine if cell starved and apply food cost (turnCost is paid every turn on top of movement)
+    void handleStarve(uint64_t turnCost);
     //Determine the actual mate
     void decideMate();
     //Handle mutation
     void mutate(std::mt19937 &rand);
+    //Mark the cell as dead for the given reason
+    void kill(DeathCause cause);
     
     //Check if cell has been killed
     bool isDead();
     //Run cell cleanup before it must be removed
-    void die();
+    void die(std::list<Neighbor> &spare);
     
     //Ready cell for next cycle
     void clear();
+    
+private:
+    //Shared by both ways of mating once a's programs have been copied
+    void cross(Cell &a, Cell &b, std::mt19937 &rand);
 };
 
-//Connect cell a and b
-void connect(Cell &a, Cell &b);
+//Connect cell a and b, reusing records from spare before allocating new ones; both must have their ids already
+void connect(Cell &a, Cell &b, std::list<Neighbor> &spare);
 
 #endif // CELL_H
 
@@ -0,0 +1,219 @@
+#include "census.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define CENSUS_REGISTERS (1 << CENSUS_PRECISION)
+#define CENSUS_SLOTS (CENSUS_COUNTERS * 2)
+
+//Species bits are only random halves of their parents', so they are mixed before any of them are used
+//The top bits pick a register and the low bits a slot
+static inline uint64_t spread(uint64_t species) {
+    species ^= species >> 33;
+    species *= 0xff51afd7ed558ccdull;
+    species ^= species >> 33;
+    species *= 0xc4ceb93fe53ec249ull;
+    species ^= species >> 33;
+    return species;
+}
+
+SpeciesSketch::SpeciesSketch() {
+    clear();
+}
+
+void SpeciesSketch::clear() {
+    cells = 0;
+    food = 0;
+    used = 0;
+    memset(registers, 0, sizeof(registers));
+    for (int16_t &s : slots)
+        s = -1;
+}
+
+unsigned SpeciesSketch::find(uint64_t species) const {
+    unsigned slot = spread(species) & (CENSUS_SLOTS - 1);
+    while (slots[slot] >= 0 && counts[slots[slot]].species != species)
+        slot = (slot + 1) & (CENSUS_SLOTS - 1);
+    return slot;
+}
+
+void SpeciesSketch::exchange(unsigned a, unsigned b) {
+    unsigned slotA = find(counts[a].species);
+    unsigned slotB = find(counts[b].species);
+    std::swap(counts[a], counts[b]);
+    slots[slotA] = b;
+    slots[slotB] = a;
+}
+
+void SpeciesSketch::sink(unsigned position) {
+    while (true) {
+        unsigned lightest = position;
+        for (unsigned child = position * 2 + 1; child <= position * 2 + 2 && child < used; child++)
+            if (counts[child].cells < counts[lightest].cells)
+                lightest = child;
+        if (lightest == position)
+            return;
+        exchange(position, lightest);
+        position = lightest;
+    }
+}
+
+void SpeciesSketch::rebuild() {
+    for (int16_t &s : slots)
+        s = -1;
+    for (unsigned i = 0; i != used; i++)
+        slots[find(counts[i].species)] = i;
+    for (unsigned i = used / 2; i-- != 0;)
+        sink(i);
+}
+
+void SpeciesSketch::add(uint64_t species, uint64_t food) {
+    cells++;
+    this->food += food;
+    uint64_t hash = spread(species);
+    uint64_t rest = hash << CENSUS_PRECISION;
+    uint8_t rank = rest ? __builtin_clzll(rest) + 1 : 64 - CENSUS_PRECISION + 1;
+    uint8_t &r = registers[hash >> (64 - CENSUS_PRECISION)];
+    r = std::max(r, rank);
+    
+    unsigned slot = find(species);
+    if (slots[slot] >= 0) {
+        SpeciesCount &c = counts[slots[slot]];
+        c.cells++;
+        c.food += food;
+        sink(slots[slot]);
+        return;
+    }
+    if (used != CENSUS_COUNTERS) {
+        //Every count is at least 1, so a new one at the back only has to rise to the front over larger ones
+        unsigned position = used++;
+        counts[position] = SpeciesCount{species, 1, 0, food};
+        slots[slot] = position;
+        while (position && counts[(position - 1) / 2].cells > 1) {
+            exchange(position, (position - 1) / 2);
+            position = (position - 1) / 2;
+        }
+        return;
+    }
+    
+    //Take over the lightest counter; its slot is emptied by shifting back what probed past it
+    unsigned hole = find(counts[0].species);
+    slots[hole] = -1;
+    for (unsigned next = (hole + 1) & (CENSUS_SLOTS - 1); slots[next] >= 0; next = (next + 1) & (CENSUS_SLOTS - 1)) {
+        unsigned home = spread(counts[slots[next]].species) & (CENSUS_SLOTS - 1);
+        if (((next - home) & (CENSUS_SLOTS - 1)) >= ((next - hole) & (CENSUS_SLOTS - 1))) {
+            slots[hole] = slots[next];
+            slots[next] = -1;
+            hole = next;
+        }
+    }
+    SpeciesCount &c = counts[0];
+    c.species = species;
+    c.error = c.cells;
+    c.cells++;
+    c.food = food;
+    slots[find(species)] = 0;
+    sink(0);
+}
+
+void SpeciesSketch::merge(const SpeciesSketch &other) {
+    cells += other.cells;
+    food += other.food;
+    for (unsigned i = 0; i != CENSUS_REGISTERS; i++)
+        registers[i] = std::max(registers[i], other.registers[i]);
+    
+    //A species missing from a full sketch may have had up to its lightest count there
+    uint64_t ours = used == CENSUS_COUNTERS ? counts[0].cells : 0;
+    uint64_t theirs = other.used == CENSUS_COUNTERS ? other.counts[0].cells : 0;
+    SpeciesCount all[CENSUS_COUNTERS * 2];
+    unsigned total = 0;
+    for (unsigned i = 0; i != used; i++) {
+        SpeciesCount c = counts[i];
+        unsigned slot = other.find(c.species);
+        if (other.slots[slot] >= 0) {
+            const SpeciesCount &o = other.counts[other.slots[slot]];
+            c.cells += o.cells;
+            c.error += o.error;
+            c.food += o.food;
+        } else {
+            c.cells += theirs;
+            c.error += theirs;
+        }
+        all[total++] = c;
+    }
+    for (unsigned i = 0; i != other.used; i++)
+        if (slots[find(other.counts[i].species)] < 0) {
+            SpeciesCount c = other.counts[i];
+            c.cells += ours;
+            c.error += ours;
+            all[total++] = c;
+        }
+    
+    used = std::min(total, unsigned(CENSUS_COUNTERS));
+    std::partial_sort(all, all + used, all + total, [](const SpeciesCount &a, const SpeciesCount &b){
+        return a.cells > b.cells;
+    });
+    std::copy(all, all + used, counts);
+    rebuild();
+}
+
+double SpeciesSketch::distinct() const {
+    double m = CENSUS_REGISTERS;
+    double sum = 0;
+    unsigned zeros = 0;
+    for (uint8_t r : registers) {
+        sum += 1.0 / double(uint64_t(1) << r);
+        zeros += r == 0;
+    }
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    //Small counts are far more accurate from how many registers were never hit
+    if (estimate <= 2.5 * m && zeros)
+        estimate = m * std::log(m / zeros);
+    return estimate;
+}
+
+void SpeciesSketch::heaviest(std::vector<SpeciesCount> &out) const {
+    out.assign(counts, counts + used);
+    std::sort(out.begin(), out.end(), [](const SpeciesCount &a, const SpeciesCount &b){
+        return a.cells != b.cells ? a.cells > b.cells : a.species < b.species;
+    });
+}
+
+Census::Census() : distinct(0), cells(0), food(0) {
+}
+
+void Census::take(Group &group) {
+    population.clear();
+    for (const Cell &c : group.cells)
+        population.push_back(&c);
+    unsigned workers = group.workers.size();
+    sketches.resize(workers);
+    group.workers.run([&](unsigned worker){
+        SpeciesSketch &sketch = sketches[worker];
+        sketch.clear();
+        size_t end = population.size() * (worker + 1) / workers;
+        for (size_t i = population.size() * worker / workers; i != end; i++)
+            sketch.add(population[i]->species, population[i]->food);
+    });
+    
+    for (unsigned w = 1; w < workers; w++)
+        sketches[0].merge(sketches[w]);
+    read();
+}
+
+const SpeciesSketch& Census::sketch() const {
+    return sketches[0];
+}
+
+void Census::merge(const SpeciesSketch &other) {
+    sketches[0].merge(other);
+    read();
+}
+
+void Census::read() {
+    distinct = sketches[0].distinct();
+    cells = sketches[0].cells;
+    food = sketches[0].food;
+    sketches[0].heaviest(heaviest);
+}
+
@@ -0,0 +1,88 @@
+#ifndef CENSUS_H
+#define CENSUS_H
+
+#include "group.h"
+#include <cstdint>
+#include <vector>
+
+//Every sketch has 2^CENSUS_PRECISION distinct counting registers; the estimate is off by about 1.04 / sqrt(registers)
+#define CENSUS_PRECISION 12
+//Species every sketch keeps counts of; a species with more than cells / CENSUS_COUNTERS cells is always among them
+#define CENSUS_COUNTERS 64
+//Heaviest species reported in the metrics
+#define CENSUS_REPORTED 8
+
+//Count of one species in a sketch
+//Space-Saving hands the counter of the lightest species to any species it has not seen, so cells may be overcounted
+//by up to error and food only covers the cells counted since the species took the counter; both are exact when error
+//is 0
+struct SpeciesCount {
+    uint64_t species;
+    uint64_t cells;
+    uint64_t error;
+    uint64_t food;
+};
+
+//Census of a stream of cells in fixed memory: a HyperLogLog of the distinct species and Space-Saving counts of the
+//heaviest ones
+//Sketches of any split of the cells merge into the sketch of all of them
+struct SpeciesSketch {
+    //Cells and food added, counted exactly
+    uint64_t cells;
+    uint64_t food;
+    //Counters in use; they form a heap with the lightest species at the front
+    unsigned used;
+    SpeciesCount counts[CENSUS_COUNTERS];
+    
+    SpeciesSketch();
+    
+    void clear();
+    void add(uint64_t species, uint64_t food);
+    void merge(const SpeciesSketch &other);
+    //Estimated number of distinct species added
+    double distinct() const;
+    //Copy the counters out heaviest first
+    void heaviest(std::vector<SpeciesCount> &out) const;
+    
+private:
+    uint8_t registers[1 << CENSUS_PRECISION];
+    //Open addressed table from species to the position of its counter in the heap, -1 where empty
+    int16_t slots[CENSUS_COUNTERS * 2];
+    
+    //Slot of a species, or the empty slot it would go in
+    unsigned find(uint64_t species) const;
+    //Swap two counters in the heap along with the slots pointing at them
+    void exchange(unsigned a, unsigned b);
+    //Restore the heap below a counter whose count grew
+    void sink(unsigned position);
+    void rebuild();
+};
+
+//Species census of a group, taken with one sketch per worker that are merged at the end
+struct Census {
+    double distinct;
+    uint64_t cells;
+    uint64_t food;
+    //Heaviest species first, at most CENSUS_COUNTERS of them
+    std::vector<SpeciesCount> heaviest;
+    
+    Census();
+    
+    //Runs on the group's workers, so it may only be called between updates
+    void take(Group &group);
+    //Sketch the last census was read from
+    const SpeciesSketch& sketch() const;
+    //Add the cells of a sketch taken elsewhere, such as by the census of another slab, to the last census
+    void merge(const SpeciesSketch &other);
+    
+private:
+    std::vector<SpeciesSketch> sketches;
+    //Cells gathered for the workers; kept to avoid allocating every census
+    std::vector<const Cell*> population;
+    
+    //Set the results from the merged sketch
+    void read();
+};
+
+#endif // CENSUS_H
+
@@ -0,0 +1,963 @@
+#include "checkpoint.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+//Genomes of the living cells ordered by hash
+static std::vector<Genome*> distinctGenomes(const Group &group) {
+    std::vector<Genome*> genomes;
+    for (const Cell &c : group.cells)
+        genomes.push_back(c.genome);
+    std::sort(genomes.begin(), genomes.end(), [](const Genome *a, const Genome *b){ return a->hash < b->hash; });
+    genomes.erase(std::unique(genomes.begin(), genomes.end()), genomes.end());
+    return genomes;
+}
+
+static unsigned hotGenomes(const Group &group) {
+    unsigned hot = 0;
+    for (const Genome *g : distinctGenomes(group))
+        hot += g->hot;
+    return hot;
+}
+
+bool writeCheckpoint(std::ostream &out, const Group &group) {
+    //Doubles have to come back bit for bit for the restored group to take the same ticks
+    out.precision(std::numeric_limits<double>::max_digits10);
+    out << CHECKPOINT_HEADER << "\n";
+    out << "dimensions " << group.dimensions.x << " " << group.dimensions.y << " " << group.dimensions.z << "\n";
+    out << "tick " << group.tick << " nextId " << group.nextId << " births " << group.births << " turnFoodCost "
+        << group.turnFoodCost << " foodCreated " << group.foodCreated << " foodRemoved " << group.foodRemoved
+        << " edges " << group.edges << "\n";
+    out << "deaths";
+    for (uint64_t d : group.deaths)
+        out << " " << d;
+    out << "\n";
+    out << "evaluations " << group.genomes.evaluations << " " << group.genomes.hotEvaluations << " "
+        << group.genomes.promotions << " " << group.genomes.evictions << "\n";
+    out << "rand " << group.rand << "\n";
+    
+    //Restoring immigrates every cell to the front of the list, so they are written back to front
+    out << "cells " << group.cells.size() << "\n";
+    for (auto c = group.cells.rbegin(); c != group.cells.rend(); c++) {
+        out << c->id << " " << c->species << " " << c->food << " " << c->decision.connect;
+        for (double v : c->decision.values)
+            out << " " << v;
+        const phi::V3 &p = c->particle.position;
+        const phi::V3 &v = c->particle.velocity;
+        out << " " << p.x << " " << p.y << " " << p.z << " " << v.x << " " << v.y << " " << v.z << " "
+            << c->neighbors.size() << "\n";
+        writeGenome(out, *c);
+        out << "\n";
+        //Neighbor decisions carry the signal and persistent values into the next update
+        for (const Neighbor &n : c->neighbors) {
+            const NeighborDecision &d = n.decision;
+            out << n.neighbor->id << " " << d.eat << " " << d.mate << " " << d.sever << " " << d.send << " "
+                << d.force << " " << d.signal;
+            for (double v : d.values)
+                out << " " << v;
+            out << "\n";
+        }
+    }
+    
+    //Every distinct genome once, with how far it is from becoming hot
+    std::vector<Genome*> genomes = distinctGenomes(group);
+    out << "genomes " << genomes.size() << "\n";
+    for (const Genome *g : genomes)
+        out << g->hash << " " << g->evaluations << " " << g->hot << "\n";
+    return bool(out);
+}
+
+//Read a label followed by a value and check the label
+template <typename T>
+static bool field(std::istream &in, const char *label, T &value) {
+    std::string word;
+    return in >> word >> value && word == label;
+}
+
+//Point every neighbor record back at its mirror in the neighbor's list
+static bool relink(Group &group) {
+    for (Cell &c : group.cells)
+        for (Neighbor &n : c.neighbors) {
+            auto mirror = std::find(n.neighbor->neighbors.begin(), n.neighbor->neighbors.end(), &c);
+            if (mirror == n.neighbor->neighbors.end()) {
+                std::cerr << "Checkpoint: Edge from cell " << c.id << " is one-sided" << std::endl;
+                return false;
+            }
+            n.neighborsDecision = mirror;
+        }
+    return true;
+}
+
+bool readCheckpoint(std::istream &in, Group &group) {
+    if (!group.cells.empty()) {
+        std::cerr << "Checkpoint: Cannot restore into a group that has cells" << std::endl;
+        return false;
+    }
+    std::string header;
+    std::getline(in, header);
+    if (header != CHECKPOINT_HEADER) {
+        std::cerr << "Checkpoint: Not a checkpoint or written by another version" << std::endl;
+        return false;
+    }
+    phi::V3 dimensions;
+    std::string word;
+    if (!(in >> word >> dimensions.x >> dimensions.y >> dimensions.z) || word != "dimensions") {
+        std::cerr << "Checkpoint: Corrupt dimensions" << std::endl;
+        return false;
+    }
+    group.dimensions = dimensions;
+    uint64_t tick, nextId, births, turnFoodCost, foodCreated, foodRemoved, edges;
+    if (!field(in, "tick", tick) || !field(in, "nextId", nextId) || !field(in, "births", births) ||
+        !field(in, "turnFoodCost", turnFoodCost) || !field(in, "foodCreated", foodCreated) ||
+        !field(in, "foodRemoved", foodRemoved) || !field(in, "edges", edges)) {
+        std::cerr << "Checkpoint: Corrupt counters" << std::endl;
+        return false;
+    }
+    uint64_t deaths[DEATH_CAUSES];
+    in >> word;
+    for (uint64_t &d : deaths)
+        in >> d;
+    GenomeTable &genomes = group.genomes;
+    uint64_t evaluations, hotEvaluations, promotions, evictions;
+    if (word != "deaths" || !field(in, "evaluations", evaluations) ||
+        !(in >> hotEvaluations >> promotions >> evictions) || !(in >> word >> group.rand) || word != "rand") {
+        std::cerr << "Checkpoint: Corrupt counters" << std::endl;
+        return false;
+    }
+    
+    unsigned count;
+    if (!field(in, "cells", count)) {
+        std::cerr << "Checkpoint: Corrupt cell count" << std::endl;
+        return false;
+    }
+    //Neighbor records are linked once every cell exists
+    std::unordered_map<uint64_t, Cell*> byId;
+    std::vector<std::pair<uint64_t, NeighborDecision>> records;
+    std::vector<unsigned> degrees;
+    byId.reserve(count);
+    degrees.reserve(count);
+    for (unsigned i = 0; i != count; i++) {
+        uint64_t id, species, food;
+        bool connect;
+        double values[CELL_PERSISTENT_VALUES];
+        phi::V3 position, velocity;
+        unsigned degree;
+        in >> id >> species >> food >> connect;
+        for (double &v : values)
+            in >> v;
+        in >> position.x >> position.y >> position.z >> velocity.x >> velocity.y >> velocity.z >> degree;
+        if (!in) {
+            std::cerr << "Checkpoint: Corrupt cell " << i << std::endl;
+            return false;
+        }
+        Cell *c = group.immigrate(id, position, velocity, food, species, in);
+        if (!c) {
+            std::cerr << "Checkpoint: Corrupt genome of cell " << id << std::endl;
+            return false;
+        }
+        c->decision.connect = connect;
+        for (unsigned v = 0; v != CELL_PERSISTENT_VALUES; v++)
+            c->decision.values[v] = values[v];
+        byId[id] = c;
+        degrees.push_back(degree);
+        for (unsigned n = 0; n != degree; n++) {
+            records.emplace_back();
+            NeighborDecision &d = records.back().second;
+            in >> records.back().first >> d.eat >> d.mate >> d.sever >> d.send >> d.force >> d.signal;
+            for (double &v : d.values)
+                in >> v;
+        }
+        if (!in) {
+            std::cerr << "Checkpoint: Corrupt neighbors of cell " << id << std::endl;
+            return false;
+        }
+    }
+    
+    //Immigrating put every cell in front of the ones read before it, so back to front is the order they were read
+    auto record = records.begin();
+    auto degree = degrees.begin();
+    for (auto c = group.cells.rbegin(); c != group.cells.rend(); c++, degree++)
+        for (unsigned n = 0; n != *degree; n++, record++) {
+            auto neighbor = byId.find(record->first);
+            if (neighbor == byId.end() || neighbor->second == &*c) {
+                std::cerr << "Checkpoint: Cell " << c->id << " has an invalid neighbor" << std::endl;
+                return false;
+            }
+            c->neighbors.emplace_back(neighbor->second);
+            c->neighbors.back().decision = record->second;
+        }
+    if (!relink(group))
+        return false;
+    for (Cell &c : group.cells)
+        for (Neighbor &n : c.neighbors)
+            if (c.id < n.neighbor->id)
+                group.organisms.join(c, *n.neighbor);
+    
+    if (!field(in, "genomes", count)) {
+        std::cerr << "Checkpoint: Corrupt genome count" << std::endl;
+        return false;
+    }
+    std::unordered_map<uint64_t, Genome*> byHash;
+    for (Cell &c : group.cells)
+        byHash[c.genome->hash] = c.genome;
+    for (unsigned i = 0; i != count; i++) {
+        uint64_t hash, evaluations;
+        bool hot;
+        in >> hash >> evaluations >> hot;
+        auto g = byHash.find(hash);
+        if (!in || g == byHash.end()) {
+            std::cerr << "Checkpoint: Corrupt genome " << i << std::endl;
+            return false;
+        }
+        g->second->evaluations = evaluations;
+        g->second->hot = hot;
+    }
+    genomes.hot = hotGenomes(group);
+    
+    group.tick = tick;
+    group.nextId = nextId;
+    group.births = births;
+    group.turnFoodCost = turnFoodCost;
+    group.foodCreated = foodCreated;
+    group.foodRemoved = foodRemoved;
+    group.edges = edges;
+    for (unsigned i = 0; i != DEATH_CAUSES; i++)
+        group.deaths[i] = deaths[i];
+    genomes.evaluations = evaluations;
+    genomes.hotEvaluations = hotEvaluations;
+    genomes.promotions = promotions;
+    genomes.evictions = evictions;
+    return true;
+}
+
+//Deltas are binary in native byte order; they are read back on the machine that wrote them
+template <typename T>
+static void put(std::ostream &out, const T &value) {
+    out.write((const char*)&value, sizeof(T));
+}
+
+template <typename T>
+static bool get(std::istream &in, T &value) {
+    return bool(in.read((char*)&value, sizeof(T)));
+}
+
+static void putString(std::ostream &out, const std::string &value) {
+    put(out, uint64_t(value.size()));
+    out.write(value.data(), value.size());
+}
+
+static bool getString(std::istream &in, std::string &value) {
+    uint64_t size;
+    if (!get(in, size))
+        return false;
+    value.resize(size);
+    return bool(in.read(&value[0], size));
+}
+
+//Values of survivors are written as their bitwise difference from the previous checkpoint without its leading zero
+//bytes, which saves the sign, exponent and high mantissa bits of anything that only moved a little
+static void putXor(std::ostream &out, uint64_t now, uint64_t before) {
+    uint64_t difference = now ^ before;
+    uint8_t bytes = 0;
+    while (bytes != 8 && difference >> 8 * bytes)
+        bytes++;
+    put(out, bytes);
+    for (uint8_t i = 0; i != bytes; i++)
+        put(out, uint8_t(difference >> 8 * i));
+}
+
+static void putXor(std::ostream &out, const double *now, const double *before, unsigned count) {
+    for (unsigned i = 0; i != count; i++) {
+        uint64_t a, b;
+        memcpy(&a, &now[i], sizeof(a));
+        memcpy(&b, &before[i], sizeof(b));
+        putXor(out, a, b);
+    }
+}
+
+//Value holds what it was at the previous checkpoint
+static bool getXor(std::istream &in, uint64_t &value) {
+    uint8_t bytes;
+    if (!get(in, bytes) || bytes > 8)
+        return false;
+    for (uint8_t i = 0; i != bytes; i++) {
+        uint8_t byte;
+        get(in, byte);
+        value ^= uint64_t(byte) << 8 * i;
+    }
+    return bool(in);
+}
+
+static bool getXor(std::istream &in, double &value) {
+    uint64_t b;
+    memcpy(&b, &value, sizeof(b));
+    bool read = getXor(in, b);
+    memcpy(&value, &b, sizeof(b));
+    return read;
+}
+
+static std::string genomeText(const Cell &c) {
+    std::ostringstream out;
+    writeGenome(out, c);
+    return out.str();
+}
+
+//Programs the reader already has, from the previous checkpoint or from earlier in the same delta, are only written as
+//their hash; most births share the programs of a parent
+static void putGenome(std::ostream &out, const Cell &c, std::unordered_set<uint64_t> &known) {
+    put(out, c.genome->hash);
+    if (known.insert(c.genome->hash).second)
+        putString(out, genomeText(c));
+}
+
+//Returns null if the stream is corrupt
+static const std::string* getGenome(std::istream &in, std::unordered_map<uint64_t, std::string> &known) {
+    uint64_t hash;
+    if (!get(in, hash))
+        return nullptr;
+    auto g = known.find(hash);
+    if (g == known.end()) {
+        g = known.emplace(hash, std::string()).first;
+        if (!getString(in, g->second))
+            return nullptr;
+    }
+    return &g->second;
+}
+
+//Compared bit for bit, so a value that changed in its last bit is still written
+static bool same(const double *a, const double *b, unsigned count) {
+    return memcmp(a, b, count * sizeof(double)) == 0;
+}
+
+struct MirrorCell {
+    uint64_t id;
+    uint64_t genome;
+    uint64_t species;
+    uint64_t food;
+    double position[3];
+    double velocity[3];
+    double values[CELL_PERSISTENT_VALUES];
+    uint32_t connect;
+    uint32_t degree;
+};
+
+struct MirrorEdge {
+    uint64_t neighbor;
+    double values[CELL_NEIGHBOR_PERSISTENT_VALUES];
+};
+
+//Followed by the cells and then the edges of every cell in turn
+struct CheckpointMirror {
+    //Tick the mirror holds; 0 while it is being rewritten or when it holds nothing
+    uint64_t tick;
+    uint64_t cells;
+    uint64_t edges;
+    
+    MirrorCell* cellRecords() {
+        return (MirrorCell*)(this + 1);
+    }
+    
+    MirrorEdge* edgeRecords() {
+        return (MirrorEdge*)(cellRecords() + cells);
+    }
+};
+
+static void mirrorCell(const Cell &c, MirrorCell &m) {
+    m.id = c.id;
+    m.genome = c.genome->hash;
+    m.species = c.species;
+    m.food = c.food;
+    const phi::V3 &p = c.particle.position;
+    const phi::V3 &v = c.particle.velocity;
+    m.position[0] = p.x;
+    m.position[1] = p.y;
+    m.position[2] = p.z;
+    m.velocity[0] = v.x;
+    m.velocity[1] = v.y;
+    m.velocity[2] = v.z;
+    for (unsigned i = 0; i != CELL_PERSISTENT_VALUES; i++)
+        m.values[i] = c.decision.values[i];
+    m.connect = c.decision.connect;
+    m.degree = c.neighbors.size();
+}
+
+//Record the state of the group for the next delta; a group too large for the mirror leaves it empty
+static void updateMirror(CheckpointMirror &mirror, const Group &group, uint64_t tick) {
+    mirror.tick = 0;
+    uint64_t cells = group.cells.size();
+    if (sizeof(CheckpointMirror) + cells * sizeof(MirrorCell) + 2 * group.edges * sizeof(MirrorEdge) >
+        CHECKPOINT_MIRROR_BYTES)
+        return;
+    mirror.cells = cells;
+    MirrorCell *m = mirror.cellRecords();
+    MirrorEdge *e = mirror.edgeRecords();
+    for (const Cell &c : group.cells) {
+        mirrorCell(c, *m++);
+        for (const Neighbor &n : c.neighbors) {
+            e->neighbor = n.neighbor->id;
+            for (unsigned i = 0; i != CELL_NEIGHBOR_PERSISTENT_VALUES; i++)
+                e->values[i] = n.decision.values[i];
+            e++;
+        }
+    }
+    mirror.edges = e - mirror.edgeRecords();
+    mirror.tick = tick;
+}
+
+//What changed about a cell that survived since the previous checkpoint
+enum DeltaChange : uint8_t {
+    DELTA_FOOD = 1 << 0,
+    DELTA_POSITION = 1 << 1,
+    DELTA_VELOCITY = 1 << 2,
+    //Connect decision and persistent values
+    DELTA_DECISION = 1 << 3,
+    //Programs and species
+    DELTA_GENOME = 1 << 4,
+    //Neighbors were added, removed or reordered; all of them are written along with their values
+    DELTA_EDGES = 1 << 5,
+    //Same neighbors, but their persistent values changed
+    DELTA_EDGE_VALUES = 1 << 6
+};
+
+static void putEdges(std::ostream &out, const Cell &c) {
+    put(out, uint32_t(c.neighbors.size()));
+    for (const Neighbor &n : c.neighbors) {
+        put(out, n.neighbor->id);
+        for (double v : n.decision.values)
+            put(out, v);
+    }
+}
+
+//Cells are only ever added to the front of the list and the rest keep their order, so the list is the cells born
+//since the previous checkpoint followed by the survivors in the order the mirror has them
+//Returns false, before writing anything, if the list does not have that shape
+static bool writeDelta(std::ostream &out, const Group &group, CheckpointMirror &mirror) {
+    std::unordered_map<uint64_t, uint64_t> index;
+    index.reserve(mirror.cells);
+    MirrorCell *previous = mirror.cellRecords();
+    for (uint64_t i = 0; i != mirror.cells; i++)
+        index[previous[i].id] = i;
+    auto firstSurvivor = group.cells.begin();
+    while (firstSurvivor != group.cells.end() && !index.count(firstSurvivor->id))
+        firstSurvivor++;
+    std::vector<bool> survived(mirror.cells, false);
+    uint64_t last = 0;
+    for (auto c = firstSurvivor; c != group.cells.end(); c++) {
+        auto i = index.find(c->id);
+        if (i == index.end() || (c != firstSurvivor && i->second <= last))
+            return false;
+        last = i->second;
+        survived[last] = true;
+    }
+    std::vector<uint64_t> firstEdge(mirror.cells + 1, 0);
+    std::unordered_set<uint64_t> known;
+    for (uint64_t i = 0; i != mirror.cells; i++) {
+        firstEdge[i + 1] = firstEdge[i] + previous[i].degree;
+        known.insert(previous[i].genome);
+    }
+    
+    out << CHECKPOINT_DELTA_HEADER << "\n";
+    put(out, mirror.tick);
+    put(out, group.tick);
+    put(out, group.nextId);
+    put(out, group.births);
+    put(out, group.turnFoodCost);
+    put(out, group.foodCreated);
+    put(out, group.foodRemoved);
+    put(out, group.edges);
+    for (uint64_t d : group.deaths)
+        put(out, d);
+    put(out, group.genomes.evaluations);
+    put(out, group.genomes.hotEvaluations);
+    put(out, group.genomes.promotions);
+    put(out, group.genomes.evictions);
+    //The generator only exposes its state as text, which is twice the size of its words
+    std::stringstream rand;
+    rand << group.rand;
+    std::vector<uint32_t> words;
+    for (uint32_t word; rand >> word; )
+        words.push_back(word);
+    put(out, uint32_t(words.size()));
+    out.write((const char*)words.data(), words.size() * sizeof(uint32_t));
+    
+    put(out, uint64_t(std::count(survived.begin(), survived.end(), false)));
+    for (uint64_t i = 0; i != mirror.cells; i++)
+        if (!survived[i])
+            put(out, previous[i].id);
+    
+    put(out, uint64_t(std::distance(firstSurvivor, group.cells.end())));
+    MirrorCell now;
+    for (auto c = firstSurvivor; c != group.cells.end(); c++) {
+        uint64_t i = index[c->id];
+        const MirrorCell &m = previous[i];
+        mirrorCell(*c, now);
+        uint8_t changes = 0;
+        if (now.food != m.food)
+            changes |= DELTA_FOOD;
+        if (!same(now.position, m.position, 3))
+            changes |= DELTA_POSITION;
+        if (!same(now.velocity, m.velocity, 3))
+            changes |= DELTA_VELOCITY;
+        if (now.connect != m.connect || !same(now.values, m.values, CELL_PERSISTENT_VALUES))
+            changes |= DELTA_DECISION;
+        if (now.genome != m.genome || now.species != m.species)
+            changes |= DELTA_GENOME;
+        const MirrorEdge *edge = mirror.edgeRecords() + firstEdge[i];
+        bool edges = now.degree == m.degree;
+        bool values = true;
+        const MirrorEdge *e = edge;
+        for (const Neighbor &n : c->neighbors) {
+            if (!edges)
+                break;
+            edges = n.neighbor->id == e->neighbor;
+            values = values && same(n.decision.values, e->values, CELL_NEIGHBOR_PERSISTENT_VALUES);
+            e++;
+        }
+        if (!edges)
+            changes |= DELTA_EDGES;
+        else if (!values)
+            changes |= DELTA_EDGE_VALUES;
+        
+        put(out, changes);
+        if (changes & DELTA_FOOD)
+            putXor(out, now.food, m.food);
+        if (changes & DELTA_POSITION)
+            putXor(out, now.position, m.position, 3);
+        if (changes & DELTA_VELOCITY)
+            putXor(out, now.velocity, m.velocity, 3);
+        if (changes & DELTA_DECISION) {
+            put(out, now.connect);
+            putXor(out, now.values, m.values, CELL_PERSISTENT_VALUES);
+        }
+        if (changes & DELTA_GENOME) {
+            put(out, now.species);
+            putGenome(out, *c, known);
+        }
+        if (changes & DELTA_EDGES)
+            putEdges(out, *c);
+        else if (changes & DELTA_EDGE_VALUES)
+            for (const Neighbor &n : c->neighbors)
+                putXor(out, n.decision.values, (edge++)->values, CELL_NEIGHBOR_PERSISTENT_VALUES);
+    }
+    
+    //Back to front so that adding each to the front of the list restores their order
+    put(out, uint64_t(std::distance(group.cells.begin(), firstSurvivor)));
+    for (auto c = std::list<Cell>::const_reverse_iterator(firstSurvivor); c != group.cells.rend(); c++) {
+        mirrorCell(*c, now);
+        out.write((const char*)&now, sizeof(now));
+        putGenome(out, *c, known);
+        putEdges(out, *c);
+    }
+    
+    std::vector<Genome*> genomes = distinctGenomes(group);
+    put(out, uint64_t(genomes.size()));
+    for (const Genome *g : genomes) {
+        put(out, g->hash);
+        put(out, g->evaluations);
+        put(out, uint8_t(g->hot));
+    }
+    return true;
+}
+
+//Edges of a cell read from a delta; linked once every cell of the delta exists
+struct PendingEdge {
+    Cell *cell;
+    uint64_t neighbor;
+    double values[CELL_NEIGHBOR_PERSISTENT_VALUES];
+};
+
+static bool getEdges(std::istream &in, Cell &c, std::vector<PendingEdge> &pending) {
+    uint32_t degree;
+    if (!get(in, degree))
+        return false;
+    for (uint32_t i = 0; i != degree; i++) {
+        pending.emplace_back();
+        PendingEdge &e = pending.back();
+        e.cell = &c;
+        get(in, e.neighbor);
+        in.read((char*)e.values, sizeof(e.values));
+    }
+    return bool(in);
+}
+
+static void setDecision(Cell &c, uint32_t connect, const double *values) {
+    c.decision.connect = connect;
+    for (unsigned i = 0; i != CELL_PERSISTENT_VALUES; i++)
+        c.decision.values[i] = values[i];
+}
+
+bool readDelta(std::istream &in, Group &group) {
+    std::string header;
+    std::getline(in, header);
+    uint64_t from, tick;
+    if (header != CHECKPOINT_DELTA_HEADER || !get(in, from) || !get(in, tick)) {
+        std::cerr << "Checkpoint: Not a delta or written by another version" << std::endl;
+        return false;
+    }
+    if (from != group.tick) {
+        std::cerr << "Checkpoint: Delta follows tick " << from << " but the group is at " << group.tick << std::endl;
+        return false;
+    }
+    uint64_t nextId, births, turnFoodCost, foodCreated, foodRemoved, edges;
+    uint64_t deaths[DEATH_CAUSES];
+    uint64_t evaluations, hotEvaluations, promotions, evictions;
+    std::stringstream rand;
+    get(in, nextId);
+    get(in, births);
+    get(in, turnFoodCost);
+    get(in, foodCreated);
+    get(in, foodRemoved);
+    get(in, edges);
+    for (uint64_t &d : deaths)
+        get(in, d);
+    get(in, evaluations);
+    get(in, hotEvaluations);
+    get(in, promotions);
+    get(in, evictions);
+    uint32_t words;
+    get(in, words);
+    for (uint32_t i = 0; i != words; i++) {
+        uint32_t word;
+        get(in, word);
+        rand << word << " ";
+    }
+    if (!in) {
+        std::cerr << "Checkpoint: Corrupt counters in delta" << std::endl;
+        return false;
+    }
+    
+    //Programs of the previous tick, which the delta only refers to by hash
+    std::unordered_map<uint64_t, std::string> known;
+    for (const Cell &c : group.cells)
+        if (!known.count(c.genome->hash))
+            known[c.genome->hash] = genomeText(c);
+    const std::string *genome;
+    
+    //Cells that died or left go the same way emigrants do, taking their edges with them
+    uint64_t count;
+    get(in, count);
+    std::unordered_set<uint64_t> removed;
+    for (uint64_t i = 0; i != count; i++) {
+        uint64_t id;
+        get(in, id);
+        removed.insert(id);
+    }
+    for (auto c = group.cells.begin(); c != group.cells.end(); )
+        c = removed.count(c->id) ? group.emigrate(c) : std::next(c);
+    
+    std::vector<PendingEdge> pending;
+    //Cells whose edges are replaced, which may split or join organisms
+    std::vector<Cell*> changed;
+    if (!get(in, count) || count != group.cells.size()) {
+        std::cerr << "Checkpoint: Delta does not match the cells of tick " << from << std::endl;
+        return false;
+    }
+    for (Cell &c : group.cells) {
+        uint8_t changes;
+        if (!get(in, changes))
+            break;
+        if (changes & DELTA_FOOD)
+            getXor(in, c.food);
+        if (changes & DELTA_POSITION) {
+            getXor(in, c.particle.position.x);
+            getXor(in, c.particle.position.y);
+            getXor(in, c.particle.position.z);
+        }
+        if (changes & DELTA_VELOCITY) {
+            getXor(in, c.particle.velocity.x);
+            getXor(in, c.particle.velocity.y);
+            getXor(in, c.particle.velocity.z);
+        }
+        if (changes & DELTA_DECISION) {
+            uint32_t connect;
+            get(in, connect);
+            c.decision.connect = connect;
+            for (double &v : c.decision.values)
+                getXor(in, v);
+        }
+        if (changes & DELTA_GENOME) {
+            get(in, c.species);
+            if (!(genome = getGenome(in, known)))
+                break;
+            std::istringstream programs(*genome);
+            if (!readGenome(programs, c))
+                break;
+            group.genomes.change(c);
+        }
+        if (changes & DELTA_EDGES) {
+            //The records pointing back at this cell are relinked once all edges are in place
+            c.neighbors.clear();
+            changed.push_back(&c);
+            if (!getEdges(in, c, pending))
+                break;
+        } else if (changes & DELTA_EDGE_VALUES)
+            for (Neighbor &n : c.neighbors)
+                for (double &v : n.decision.values)
+                    getXor(in, v);
+    }
+    if (!in) {
+        std::cerr << "Checkpoint: Corrupt cells in delta" << std::endl;
+        return false;
+    }
+    
+    get(in, count);
+    for (uint64_t i = 0; i != count; i++) {
+        MirrorCell m;
+        if (!get(in, m) || !(genome = getGenome(in, known)))
+            break;
+        std::istringstream programs(*genome);
+        Cell *c = group.immigrate(m.id, phi::V3(m.position[0], m.position[1], m.position[2]),
+                                  phi::V3(m.velocity[0], m.velocity[1], m.velocity[2]), m.food, m.species,
+                                  programs);
+        if (!c) {
+            in.setstate(std::ios::failbit);
+            break;
+        }
+        setDecision(*c, m.connect, m.values);
+        changed.push_back(c);
+        if (!getEdges(in, *c, pending))
+            break;
+    }
+    if (!in) {
+        std::cerr << "Checkpoint: Corrupt born cells in delta" << std::endl;
+        return false;
+    }
+    
+    std::unordered_map<uint64_t, Cell*> byId;
+    byId.reserve(group.cells.size());
+    for (Cell &c : group.cells)
+        byId[c.id] = &c;
+    for (const PendingEdge &e : pending) {
+        auto neighbor = byId.find(e.neighbor);
+        if (neighbor == byId.end() || neighbor->second == e.cell) {
+            std::cerr << "Checkpoint: Cell " << e.cell->id << " has an invalid neighbor" << std::endl;
+            return false;
+        }
+        e.cell->neighbors.emplace_back(neighbor->second);
+        for (unsigned i = 0; i != CELL_NEIGHBOR_PERSISTENT_VALUES; i++)
+            e.cell->neighbors.back().decision.values[i] = e.values[i];
+    }
+    if (!relink(group))
+        return false;
+    //Removed edges may have split organisms and added ones join them
+    for (Cell *c : changed)
+        group.organisms.split(*c);
+    group.organisms.rebuild();
+    for (Cell *c : changed)
+        for (const Neighbor &n : c->neighbors)
+            group.organisms.join(*c, *n.neighbor);
+    
+    std::unordered_map<uint64_t, Genome*> byHash;
+    for (Cell &c : group.cells)
+        byHash[c.genome->hash] = c.genome;
+    get(in, count);
+    for (uint64_t i = 0; i != count; i++) {
+        uint64_t hash, evaluations;
+        uint8_t hot;
+        get(in, hash);
+        get(in, evaluations);
+        get(in, hot);
+        auto g = byHash.find(hash);
+        if (!in || g == byHash.end()) {
+            std::cerr << "Checkpoint: Corrupt genome " << i << " in delta" << std::endl;
+            return false;
+        }
+        g->second->evaluations = evaluations;
+        g->second->hot = hot;
+    }
+    
+    rand >> group.rand;
+    group.tick = tick;
+    group.nextId = nextId;
+    group.births = births;
+    group.turnFoodCost = turnFoodCost;
+    group.foodCreated = foodCreated;
+    group.foodRemoved = foodRemoved;
+    group.edges = edges;
+    for (unsigned i = 0; i != DEATH_CAUSES; i++)
+        group.deaths[i] = deaths[i];
+    GenomeTable &genomes = group.genomes;
+    genomes.evaluations = evaluations;
+    genomes.hotEvaluations = hotEvaluations;
+    genomes.promotions = promotions;
+    genomes.evictions = evictions;
+    genomes.hot = hotGenomes(group);
+    return bool(rand);
+}
+
+std::string checkpointPath(const std::string &directory, uint64_t tick, bool delta) {
+    return directory + "/checkpoint-" + std::to_string(tick) + (delta ? ".evd" : ".evc");
+}
+
+bool restoreCheckpoint(const std::string &path, Group &group) {
+    size_t slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : path.substr(0, slash);
+    //Walk back from the newest file to the full checkpoint the chain starts from
+    std::vector<std::string> chain(1, path);
+    while (true) {
+        std::ifstream in(chain.back(), std::ios::binary);
+        std::string header;
+        std::getline(in, header);
+        if (header == CHECKPOINT_HEADER)
+            break;
+        uint64_t from, tick;
+        if (header != CHECKPOINT_DELTA_HEADER || !get(in, from) || !get(in, tick) || from >= tick) {
+            std::cerr << "Checkpoint: " << chain.back() << " is missing or not a checkpoint" << std::endl;
+            return false;
+        }
+        //A full checkpoint of the same tick, such as one compacted from the chain, ends the chain early
+        std::string base = checkpointPath(directory, from, false);
+        chain.push_back(access(base.c_str(), R_OK) == 0 ? base : checkpointPath(directory, from, true));
+    }
+    for (auto p = chain.rbegin(); p != chain.rend(); p++) {
+        std::ifstream in(*p, std::ios::binary);
+        if (!(p == chain.rbegin() ? readCheckpoint(in, group) : readDelta(in, group))) {
+            std::cerr << "Checkpoint: Failed to restore " << *p << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+//How a checkpoint child exited
+enum CheckpointResult {
+    CHECKPOINT_FULL,
+    CHECKPOINT_FAILED,
+    CHECKPOINT_DELTA
+};
+
+Checkpointer::Checkpointer(const std::string &directory, uint64_t interval, unsigned chain, unsigned keep) :
+                           directory(directory), interval(interval), chain(chain), keep(keep), completed(0),
+                           failed(0), bytes(0), pause(0), child(0), childTick(0), previous(0), deltas(0) {
+    //Shared, so what one child leaves in it is there for the next; nothing is committed until a child writes it
+    void *memory = mmap(nullptr, CHECKPOINT_MIRROR_BYTES, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) {
+        std::cerr << "Checkpointer: Failed to map the mirror, every checkpoint will be full" << std::endl;
+        mirror = nullptr;
+    } else {
+        mirror = (CheckpointMirror*)memory;
+        mirror->tick = 0;
+    }
+}
+
+Checkpointer::~Checkpointer() {
+    wait();
+    if (mirror)
+        munmap(mirror, CHECKPOINT_MIRROR_BYTES);
+}
+
+void Checkpointer::tick(Group &group) {
+    collect(false);
+    if (child || !interval || group.tick % interval)
+        return;
+    
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    pid_t pid = group.workers.fork();
+    if (pid == 0)
+        write(group, group.tick);
+    pause = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start).count();
+    if (pid < 0) {
+        std::cerr << "Checkpointer: Failed to fork: " << strerror(errno) << std::endl;
+        failed++;
+        return;
+    }
+    child = pid;
+    childTick = group.tick;
+}
+
+void Checkpointer::wait() {
+    collect(true);
+}
+
+void Checkpointer::collect(bool block) {
+    if (!child)
+        return;
+    int status;
+    pid_t pid;
+    do
+        pid = waitpid(child, &status, block ? 0 : WNOHANG);
+    while (pid < 0 && errno == EINTR);
+    if (pid == 0)
+        return;
+    child = 0;
+    int result = pid >= 0 && WIFEXITED(status) ? WEXITSTATUS(status) : CHECKPOINT_FAILED;
+    if (result != CHECKPOINT_FULL && result != CHECKPOINT_DELTA) {
+        std::cerr << "Checkpointer: Writing the checkpoint of tick " << childTick << " failed" << std::endl;
+        failed++;
+        return;
+    }
+    
+    completed++;
+    previous = childTick;
+    latest = checkpointPath(directory, childTick, result == CHECKPOINT_DELTA);
+    struct stat info;
+    if (stat(latest.c_str(), &info) == 0)
+        bytes += info.st_size;
+    if (result == CHECKPOINT_DELTA) {
+        deltas++;
+        chains.back().push_back(latest);
+    } else {
+        deltas = 0;
+        chains.emplace_back(1, latest);
+    }
+    //A chain is only useful as a whole, so whole chains are deleted
+    while (chains.size() > keep) {
+        for (const std::string &file : chains.front())
+            unlink(file.c_str());
+        chains.pop_front();
+    }
+    if (notify)
+        notify(latest);
+}
+
+void Checkpointer::write(const Group &group, uint64_t tick) {
+    //Only this thread exists in the child; nothing here may wait on a lock another thread of the parent held
+    //The mirror has to hold the last checkpoint that completed; a child that died while rewriting it left it empty
+    bool delta = mirror && !chains.empty() && deltas + 1 < chain && mirror->tick == previous;
+    std::string final = checkpointPath(directory, tick, delta);
+    std::string partial = final + ".partial";
+    std::ofstream out(partial, std::ios::binary);
+    //Nothing was written if the list cannot be described as a delta, and the checkpoint is written in full instead
+    if (delta && !writeDelta(out, group, *mirror)) {
+        delta = false;
+        out.close();
+        unlink(partial.c_str());
+        final = checkpointPath(directory, tick, false);
+        partial = final + ".partial";
+        out.open(partial, std::ios::binary);
+    }
+    if (!delta)
+        writeCheckpoint(out, group);
+    out.close();
+    bool written = bool(out);
+    //A checkpoint only appears under its name once all of it is on disk
+    int fd = open(partial.c_str(), O_RDONLY);
+    written = written && fd >= 0 && fsync(fd) == 0;
+    if (fd >= 0)
+        close(fd);
+    written = written && rename(partial.c_str(), final.c_str()) == 0;
+    if (!written) {
+        std::cerr << "Checkpointer: Failed to write " << final << std::endl;
+        unlink(partial.c_str());
+    } else if (mirror)
+        updateMirror(*mirror, group, tick);
+    //Skip destructors of everything the parent owns, including the workers this process does not have
+    _exit(!written ? CHECKPOINT_FAILED : delta ? CHECKPOINT_DELTA : CHECKPOINT_FULL);
+}
+
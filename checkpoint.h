@@ -0,0 +1,89 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "group.h"
+#include <deque>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+//First line of every full checkpoint and of every delta; bumped whenever the format changes
+#define CHECKPOINT_HEADER "evomata-checkpoint 1"
+#define CHECKPOINT_DELTA_HEADER "evomata-delta 1"
+//Address space reserved for the state the last checkpoint was written from; pages are only committed as they are used
+//and a world that does not fit is checkpointed in full every time
+#define CHECKPOINT_MIRROR_BYTES (size_t(1) << 32)
+
+//Write everything about the group that carries over from one update to the next; only reads the group, so it is
+//safe in a forked child that has no other threads
+bool writeCheckpoint(std::ostream &out, const Group &group);
+//Restore a full checkpoint into a group that has no cells, which takes on the dimensions of the checkpoint; updating
+//it afterwards gives exactly the same ticks as updating the group it was written from
+bool readCheckpoint(std::istream &in, Group &group);
+//Bring a group restored to the tick a delta was written against forward to the tick of the delta
+bool readDelta(std::istream &in, Group &group);
+//Restore the full checkpoint or delta at path into a group that has no cells, following a delta back through the
+//checkpoints next to it to its base
+bool restoreCheckpoint(const std::string &path, Group &group);
+//File the checkpoint of a tick is written to
+std::string checkpointPath(const std::string &directory, uint64_t tick, bool delta);
+
+//State of every cell at the last checkpoint in list order, kept in memory shared by every checkpoint child so the
+//next one can write only what changed since
+struct CheckpointMirror;
+
+//Checkpoints a group every interval ticks from a forked child
+//The child writes the copy-on-write image of the group while the parent keeps simulating, so the simulation only
+//pauses for the fork itself; finished children are collected between ticks and only the newest chains are kept
+//A chain is a full checkpoint followed by deltas that hold only born and dead cells, mutated genomes, changed edges
+//and the values that changed since the checkpoint before them
+struct Checkpointer {
+    std::string directory;
+    uint64_t interval;
+    //Checkpoints per chain; every one after the first is a delta (1 writes only full checkpoints)
+    unsigned chain;
+    //Newest chains kept; older ones are deleted as soon as a new chain starts
+    unsigned keep;
+    //Checkpoints that were written and that failed since the checkpointer was created
+    uint64_t completed;
+    uint64_t failed;
+    //Bytes of every completed checkpoint
+    uint64_t bytes;
+    //Seconds the simulation thread spent forking the last checkpoint
+    double pause;
+    //Path of the newest complete checkpoint (empty until one completes)
+    std::string latest;
+    //Called on the simulation thread with the path of every checkpoint that completes
+    std::function<void(const std::string&)> notify;
+    
+    Checkpointer(const std::string &directory, uint64_t interval, unsigned chain, unsigned keep);
+    //Waits for a checkpoint that is still being written
+    ~Checkpointer();
+    
+    //Called between updates; collects a finished child and forks a new one when the interval is up and the previous
+    //checkpoint is done
+    void tick(Group &group);
+    //Block until the running checkpoint, if any, is done
+    void wait();
+    
+private:
+    pid_t child;
+    uint64_t childTick;
+    //Tick of the last completed checkpoint and deltas written since its chain started
+    uint64_t previous;
+    unsigned deltas;
+    //Files of the kept chains from oldest to newest
+    std::deque<std::vector<std::string>> chains;
+    //Shared with the children; null if it could not be mapped, in which case every checkpoint is full
+    CheckpointMirror *mirror;
+    
+    //Reap the child if it is done, or wait for it when block is set
+    void collect(bool block);
+    //Runs in the child; never returns
+    void write(const Group &group, uint64_t tick);
+};
+
+#endif // CHECKPOINT_H
+
@@ -0,0 +1,270 @@
+#include "domain.h"
+#include "simulation.h"
+#include "affinity.h"
+#include "invariant.h"
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+//Fixed part of a cell sent between worlds; the genome follows as text
+struct Migrant {
+    uint64_t id;
+    double position[3];
+    double velocity[3];
+    uint64_t food;
+    uint64_t species;
+};
+
+void packMigrant(const Cell &cell, std::string &message) {
+    Migrant m;
+    m.id = cell.id;
+    m.position[0] = cell.particle.position.x;
+    m.position[1] = cell.particle.position.y;
+    m.position[2] = cell.particle.position.z;
+    m.velocity[0] = cell.particle.velocity.x;
+    m.velocity[1] = cell.particle.velocity.y;
+    m.velocity[2] = cell.particle.velocity.z;
+    m.food = cell.food;
+    m.species = cell.species;
+    std::ostringstream genome;
+    writeGenome(genome, cell);
+    message.assign((const char*)&m, sizeof(m));
+    message += genome.str();
+}
+
+Cell* unpackMigrant(const std::string &message, Group &group, MigrationCounts &counts) {
+    Migrant m;
+    memcpy(&m, message.data(), sizeof(m));
+    std::istringstream genome(message.substr(sizeof(m)));
+    Cell *c = group.immigrate(m.id, phi::V3(m.position[0], m.position[1], m.position[2]),
+                              phi::V3(m.velocity[0], m.velocity[1], m.velocity[2]), m.food, m.species, genome);
+    if (!c) {
+        std::cerr << "Migrant: Dropped cell " << m.id << " with " << m.food << " food, its programs arrived damaged"
+                  << std::endl;
+        counts.dropped++;
+        counts.droppedFood += m.food;
+        return nullptr;
+    }
+    counts.immigrated++;
+    return c;
+}
+
+bool ShmRing::push(const std::string &message) {
+    uint64_t head = header->head.load(std::memory_order_relaxed);
+    uint64_t tail = header->tail.load(std::memory_order_acquire);
+    uint32_t size = message.size();
+    if (capacity - (head - tail) < sizeof(size) + size)
+        return false;
+    copyIn(head, &size, sizeof(size));
+    copyIn(head + sizeof(size), message.data(), size);
+    header->head.store(head + sizeof(size) + size, std::memory_order_release);
+    return true;
+}
+
+bool ShmRing::pop(std::string &message) {
+    uint64_t tail = header->tail.load(std::memory_order_relaxed);
+    uint64_t head = header->head.load(std::memory_order_acquire);
+    if (head == tail)
+        return false;
+    uint32_t size;
+    copyOut(tail, &size, sizeof(size));
+    message.resize(size);
+    copyOut(tail + sizeof(size), &message[0], size);
+    header->tail.store(tail + sizeof(size) + size, std::memory_order_release);
+    return true;
+}
+
+void ShmRing::copyIn(uint64_t position, const void *source, size_t size) {
+    size_t offset = position % capacity;
+    size_t first = std::min(size, capacity - offset);
+    memcpy(data + offset, source, first);
+    memcpy(data, (const uint8_t*)source + first, size - first);
+}
+
+void ShmRing::copyOut(uint64_t position, void *destination, size_t size) {
+    size_t offset = position % capacity;
+    size_t first = std::min(size, capacity - offset);
+    memcpy(destination, data + offset, first);
+    memcpy((uint8_t*)destination + first, data, size - first);
+}
+
+Domain::Domain(const phi::V3 &dimensions, unsigned slabs) : slabs(slabs), slab(0), dimensions(dimensions),
+               progress(slabs) {
+    if (slabs > DOMAIN_MAX_SLABS) {
+        std::cerr << "Domain: At most " << DOMAIN_MAX_SLABS << " slabs are supported" << std::endl;
+        exit(1);
+    }
+    //Anonymous shared memory is inherited by the forked slabs, so there is nothing to name or unlink
+    length = size_t(slabs) * slabs * (sizeof(RingHeader) + DOMAIN_RING_BYTES);
+    memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        std::cerr << "Domain: Failed to map " << length << " bytes of shared memory" << std::endl;
+        exit(1);
+    }
+    for (unsigned from = 0; from != slabs; from++)
+        for (unsigned to = 0; to != slabs; to++) {
+            ShmRing r = ring(from, to);
+            new (r.header) RingHeader;
+            r.header->head = 0;
+            r.header->tail = 0;
+        }
+    for (Progress &p : progress) {
+        p.sent.resize(slabs);
+        p.pushed.resize(slabs);
+        p.popped.resize(slabs);
+    }
+}
+
+Domain::~Domain() {
+    for (pid_t child : children)
+        kill(child, SIGTERM);
+    for (pid_t child : children)
+        waitpid(child, nullptr, 0);
+    munmap(memory, length);
+}
+
+ShmRing Domain::ring(unsigned from, unsigned to) {
+    ShmRing r;
+    size_t stride = sizeof(RingHeader) + DOMAIN_RING_BYTES;
+    r.header = (RingHeader*)((uint8_t*)memory + (size_t(from) * slabs + to) * stride);
+    r.data = (uint8_t*)(r.header + 1);
+    r.capacity = DOMAIN_RING_BYTES;
+    return r;
+}
+
+void Domain::start(uint32_t seed, double tickRate, uint64_t invariantInterval) {
+    unsigned nodes = numaNodes();
+    for (unsigned s = 1; s != slabs; s++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            std::cerr << "Domain: Failed to fork slab " << s << ": " << strerror(errno) << std::endl;
+            exit(1);
+        }
+        if (pid == 0) {
+            slab = s;
+            children.clear();
+            if (nodes)
+                pinThread(nodeCpus(slab % nodes));
+            runSlab(seed, tickRate, invariantInterval);
+            //Skip destructors of everything the parent owns
+            _exit(0);
+        }
+        children.push_back(pid);
+    }
+    if (nodes)
+        pinThread(nodeCpus(0));
+}
+
+void Domain::runSlab(uint32_t seed, double tickRate, uint64_t invariantInterval) {
+    pid_t parent = getppid();
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    //Blocked before the simulation starts its threads so only sigwait sees them
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != parent)
+        return;
+    
+    InvariantChecker invariants(invariantInterval);
+    Simulation sim(dimensions, seed, tickRate);
+    sim.group.checker = &invariants;
+    sim.domain = this;
+    sim.start();
+    int signal;
+    sigwait(&signals, &signal);
+    //The simulation thread may be waiting on slabs that already stopped, so it is not joined
+    _exit(0);
+}
+
+unsigned Domain::owner(const phi::V3 &position) const {
+    double offset = (position.x + dimensions.x) / (2 * dimensions.x);
+    if (!(offset > 0))
+        return 0;
+    return std::min(unsigned(offset * slabs), slabs - 1);
+}
+
+double Domain::reach(const phi::V3 &position, unsigned slab) const {
+    double width = 2 * dimensions.x / slabs;
+    double low = -dimensions.x + slab * width;
+    double high = low + width;
+    if (position.x >= low && position.x < high)
+        return 0;
+    double up = low - position.x;
+    if (up < 0)
+        up += 2 * dimensions.x;
+    double down = position.x - high;
+    if (down < 0)
+        down += 2 * dimensions.x;
+    return std::min(up, down);
+}
+
+void Domain::exchange(unsigned slab, const std::vector<std::string> &outgoing, std::vector<std::string> &incoming) {
+    Progress &p = progress[slab];
+    incoming.resize(slabs);
+    unsigned pending = 0;
+    for (unsigned t = 0; t != slabs; t++) {
+        incoming[t].clear();
+        p.sent[t] = 0;
+        p.pushed[t] = p.popped[t] = t == slab;
+        if (t != slab)
+            pending += 2;
+    }
+    
+    //Every message goes in chunks whose first byte says whether it is the last, so an empty message is one chunk
+    //Pushing and popping alternate, so two slabs filling the rings to each other never wait on each other
+    unsigned idle = 0;
+    std::chrono::steady_clock::time_point moved = std::chrono::steady_clock::now();
+    while (pending) {
+        bool progressed = false;
+        for (unsigned t = 0; t != slabs; t++) {
+            if (!p.pushed[t]) {
+                size_t size = std::min(outgoing[t].size() - p.sent[t], size_t(DOMAIN_CHUNK_BYTES));
+                bool last = p.sent[t] + size == outgoing[t].size();
+                p.chunk.assign(1, char(last));
+                p.chunk.append(outgoing[t], p.sent[t], size);
+                if (ring(slab, t).push(p.chunk)) {
+                    p.sent[t] += size;
+                    progressed = true;
+                    if (last) {
+                        p.pushed[t] = true;
+                        pending--;
+                    }
+                }
+            }
+            if (!p.popped[t] && ring(t, slab).pop(p.chunk)) {
+                incoming[t].append(p.chunk, 1, std::string::npos);
+                progressed = true;
+                if (p.chunk[0]) {
+                    p.popped[t] = true;
+                    pending--;
+                }
+            }
+        }
+        if (progressed) {
+            idle = 0;
+            moved = std::chrono::steady_clock::now();
+            continue;
+        }
+        if (++idle < DOMAIN_SPIN) {
+            std::this_thread::yield();
+            continue;
+        }
+        std::this_thread::sleep_for(DOMAIN_SLEEP);
+        if (std::chrono::steady_clock::now() - moved > std::chrono::seconds(DOMAIN_STALL_SECONDS)) {
+            std::cerr << "Domain: Slab " << slab << " heard nothing from the other slabs for "
+                      << DOMAIN_STALL_SECONDS << " seconds" << std::endl;
+            exit(1);
+        }
+    }
+}
+
@@ -0,0 +1,105 @@
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+#include "group.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+//Bytes of every one-way ring between two slabs
+#define DOMAIN_RING_BYTES (1 << 20)
+//Most bytes of a message that go through a ring at once; longer messages are split into chunks of this size
+#define DOMAIN_CHUNK_BYTES (DOMAIN_RING_BYTES / 4)
+//Slabs are kept in 64 bit masks
+#define DOMAIN_MAX_SLABS 64
+//Cells this close along x to another slab are copied to it every update; a little over PHYSICS_CONNECT_DISTANCE so
+//rounding never hides a cell that could connect across the boundary
+#define DOMAIN_HALO (PHYSICS_CONNECT_DISTANCE * 1.1)
+//Idle polls of the rings a slab yields for before it starts sleeping between them
+#define DOMAIN_SPIN 1000
+#define DOMAIN_SLEEP std::chrono::microseconds(50)
+//Seconds a slab waits for the others without anything arriving before it gives up on the domain
+#define DOMAIN_STALL_SECONDS 60
+//Ids of the cells born on an island start at the island number shifted by this so they stay unique across islands
+#define DOMAIN_ID_SHIFT 48
+
+//Position and counters of a ring that lives in shared memory; atomics are lock-free so they work across processes
+struct RingHeader {
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+};
+
+//Single producer, single consumer queue of messages in memory shared between processes or threads
+struct ShmRing {
+    RingHeader *header;
+    uint8_t *data;
+    //Bytes of data
+    size_t capacity;
+    
+    //Returns false without writing anything if there is not enough room
+    bool push(const std::string &message);
+    //Returns false if the ring is empty
+    bool pop(std::string &message);
+    
+private:
+    void copyIn(uint64_t position, const void *source, size_t size);
+    void copyOut(uint64_t position, void *destination, size_t size);
+};
+
+//Message carrying a living cell to another world with its position, velocity, food, species and programs
+void packMigrant(const Cell &cell, std::string &message);
+//Move the cell of a message made by packMigrant into group and count it in counts
+//A cell whose programs arrived damaged is dropped rather than run with whatever could be read, and counted as such
+//with its food; returns it or null if it was dropped
+Cell* unpackMigrant(const std::string &message, Group &group, MigrationCounts &counts);
+
+//Splits the torus into slabs along x, each simulated by its own process
+//The groups of the slabs update in lockstep: they exchange the cells that moved, copies of the cells near their
+//boundaries and what their cells decided about those copies through shared memory several times every update, and
+//together go exactly the way a single group holding the whole world would (see Group::domain)
+struct Domain {
+    unsigned slabs;
+    //Slab simulated by this process
+    unsigned slab;
+    phi::V3 dimensions;
+    
+    Domain(const phi::V3 &dimensions, unsigned slabs);
+    ~Domain();
+    
+    //Fork a headless process for every slab but the first; only the calling process (slab 0) returns
+    //Each process is pinned to a NUMA node chosen by its slab; every slab starts from the same seed and checks its
+    //invariants every invariantInterval ticks (0 disables them)
+    void start(uint32_t seed, double tickRate, uint64_t invariantInterval);
+    //Slab that owns a position
+    unsigned owner(const phi::V3 &position) const;
+    //Distance along x from a position to the nearest part of a slab, around the torus; 0 inside it
+    double reach(const phi::V3 &position, unsigned slab) const;
+    //Send outgoing[t] to every other slab t and receive what each sent into incoming[t]; blocks until every other
+    //slab made the same call
+    //Every slab makes the same calls in the same order; the slab is passed in so slabs that share a Domain in one
+    //process can each make theirs from their own thread
+    void exchange(unsigned slab, const std::vector<std::string> &outgoing, std::vector<std::string> &incoming);
+    
+private:
+    //What a slab has sent and received in the exchange it is making
+    struct Progress {
+        std::string chunk;
+        std::vector<size_t> sent;
+        std::vector<bool> pushed;
+        std::vector<bool> popped;
+    };
+    
+    void *memory;
+    size_t length;
+    std::vector<pid_t> children;
+    std::vector<Progress> progress;
+    
+    //Ring carrying messages from one slab to another
+    ShmRing ring(unsigned from, unsigned to);
+    void runSlab(uint32_t seed, double tickRate, uint64_t invariantInterval);
+};
+
+#endif // DOMAIN_H
+
@@ -1,6 +1,48 @@
 #include "draw.h"
 #include <iostream>
 #include <GL/glu.h>
+#include <algorithm>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ORB_F16C
+#endif
+
+//Scalar conversion used when F16C is unavailable
+static uint16_t toHalfFloat(float x) {
+    uint32_t &f = reinterpret_cast<uint32_t&>(x);
+    return ((f >> 16) & 0x8000) | ((((f & 0x7f800000) - 0x38000000) >> 13) & 0x7c00) | ((f >> 13) & 0x03ff);
+}
+
+static void toHalfFloats(uint16_t *out, const float *in, unsigned total) {
+    for (unsigned i = 0; i != total; i++)
+        out[i] = toHalfFloat(in[i]);
+}
+
+#ifdef ORB_F16C
+__attribute__((target("avx,f16c")))
+static void toHalfFloatsF16C(uint16_t *out, const float *in, unsigned total) {
+    unsigned i;
+    for (i = 0; i + 8 <= total; i += 8)
+        _mm_storeu_si128((__m128i*)(out + i), _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+    //Pad the tail so it gets the same rounding as the rest
+    if (i != total) {
+        float tailIn[8] = {};
+        uint16_t tailOut[8];
+        for (unsigned j = 0; i + j != total; j++)
+            tailIn[j] = in[i + j];
+        _mm_storeu_si128((__m128i*)tailOut, _mm256_cvtps_ph(_mm256_loadu_ps(tailIn), _MM_FROUND_TO_NEAREST_INT));
+        for (unsigned j = 0; i + j != total; j++)
+            out[i + j] = tailOut[j];
+    }
+}
+#endif
+
+//Pick the fastest conversion the CPU supports once
+static void (*const convertHalfFloats)(uint16_t*, const float*, unsigned) =
+#ifdef ORB_F16C
+        __builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx") ? toHalfFloatsF16C :
+#endif
+        toHalfFloats;
 
 ShaderProgram::ShaderProgram(const std::string &name) : name(name) {
     program = glCreateProgram();
@@ -337,7 +379,8 @@ void Renderer::bind(Window &window) {
 }
 
 GroupRenderer::GroupRenderer(unsigned width, unsigned height) : orbProgram("Orbs"), screenProgram("Screen"),
-                             orbFrame(GL_TEXTURE_2D), buffer(DRAWABLES*7*2, GL_R16F, nullptr, GL_STREAM_DRAW) {
+                             orbFrame(GL_TEXTURE_2D), current(0), capacity(0), uploaded(0),
+                             orbTime(0), orbCount(0) {
     orbProgram.addShader(GL_VERTEX_SHADER, "Vertex Main",
 R"(#version 140
 in vec2 pos;
@@ -356,6 +399,7 @@ smooth in vec2 inter;
 out vec4 finalColor;
 uniform samplerBuffer orbs;
 uniform int count;
+uniform int stride;
 
 #define RING_RATIO 0.25
 
@@ -363,17 +407,17 @@ void main() {
     vec3 color = vec3(0.0, 0.0, 0.0);
     int i;
     for (i = 0; i != count; i++) {
-        vec3 delta = vec3(texelFetch(orbs, i*7+0).r - inter.x,
-                          texelFetch(orbs, i*7+1).r - inter.y,
-                          texelFetch(orbs, i*7+2).r - 0.05);
+        vec3 delta = vec3(texelFetch(orbs, i + stride*0).r - inter.x,
+                          texelFetch(orbs, i + stride*1).r - inter.y,
+                          texelFetch(orbs, i + stride*2).r - 0.05);
         float dis2DSquared = delta.x * delta.x + delta.y * delta.y;
         float zSquared = delta.z * delta.z;
         float dis3DSquared = dis2DSquared + zSquared;
-        float radius = texelFetch(orbs, i*7+6).r;
+        float radius = texelFetch(orbs, i + stride*6).r;
         if (dis3DSquared < radius * radius) {
-            vec3 orbColor = vec3(texelFetch(orbs, i*7+3).r,
-                                 texelFetch(orbs, i*7+4).r,
-                                 texelFetch(orbs, i*7+5).r);
+            vec3 orbColor = vec3(texelFetch(orbs, i + stride*3).r,
+                                 texelFetch(orbs, i + stride*4).r,
+                                 texelFetch(orbs, i + stride*5).r);
             //Adjusted for ring
             float radius2DSquared = radius * radius - zSquared;
             float radius2DSquaredAdjusted = radius2DSquared * RING_RATIO;
@@ -448,26 +492,94 @@ void main() {
     
     orbsLocation = orbProgram.getUniformLocation("orbs");
     countLocation = orbProgram.getUniformLocation("count");
+    strideLocation = orbProgram.getUniformLocation("stride");
+    
+    //Every field of every orb has to fit in the texture buffer
+    GLint maxTexels;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    maxCapacity = unsigned(maxTexels) / ORB_FIELDS;
+    
+    reserve(ORB_INITIAL_CAPACITY);
 }
 
-void GroupRenderer::render(unsigned total, unsigned width, unsigned height) {
-    if (total > DRAWABLES) {
-        std::cerr << "GroupRenderer: Tried to draw too many things!" << std::endl;
-        exit(1);
+GroupRenderer::~GroupRenderer() {
+    for (OrbBuffer &b : buffers) {
+        b.wait();
+        b.destroy();
     }
+}
+
+void GroupRenderer::reserve(unsigned total) {
+    if (total <= capacity || capacity == maxCapacity)
+        return;
+    
+    unsigned next = capacity ? capacity : ORB_INITIAL_CAPACITY;
+    while (next < total && next < maxCapacity)
+        next *= ORB_GROWTH_FACTOR;
+    if (next > maxCapacity) {
+        std::cerr << "GroupRenderer: Orb count is limited by the texture buffer to " << maxCapacity << std::endl;
+        next = maxCapacity;
+    }
+    
+    //The GPU may still be reading the old buffers, so let it finish before they are freed
+    for (OrbBuffer &b : buffers) {
+        b.wait();
+        b.destroy();
+        b.create(next);
+    }
+    capacity = next;
+}
+
+void GroupRenderer::upload(const OrbFrame &frame) {
+    reserve(frame.size());
+    
+    current = (current + 1) % ORB_BUFFERS;
+    OrbBuffer &b = buffers[current];
+    //Only blocks if the GPU is more than ORB_BUFFERS - 1 frames behind
+    b.wait();
+    //The fence has passed, so the timing of the last draw from this buffer is ready
+    if (b.drawn) {
+        GLuint64 elapsed;
+        glGetQueryObjectui64v(b.timer, GL_QUERY_RESULT, &elapsed);
+        orbTime = elapsed * 1e-9;
+        orbCount = b.drawn;
+        b.drawn = 0;
+    }
+    
+    uploaded = std::min(frame.size(), capacity);
+    for (unsigned i = 0; i != ORB_FIELDS; i++)
+        convertHalfFloats(b.mapped + i * capacity, frame.fields[i].data(), uploaded);
+    
+    //Without persistent mapping the shadow copy has to be sent over explicitly
+    if (!GLEW_ARB_buffer_storage) {
+        glBindBuffer(GL_TEXTURE_BUFFER, b.bo);
+        for (unsigned i = 0; i != ORB_FIELDS; i++)
+            glBufferSubData(GL_TEXTURE_BUFFER, GLintptr(i) * capacity * sizeof(uint16_t),
+                            GLsizeiptr(uploaded) * sizeof(uint16_t), b.mapped + i * capacity);
+    }
+}
+
+void GroupRenderer::render(unsigned width, unsigned height) {
+    OrbBuffer &b = buffers[current];
     //Draw orbs
     orbProgram.use();
     orbFrame.colors.unbind();
     orbFrame.bind();
     glActiveTexture(GL_TEXTURE0);
-    buffer.texture.bind();
+    glBindTexture(GL_TEXTURE_BUFFER, b.texture);
     glViewport(0, 0, width, height);
     glClearColor(0.0, 0.0, 0.0, 1.0);
     glClear(GL_COLOR_BUFFER_BIT);
     orbVAO.bind();
-        orbProgram.setUniform(countLocation, (int)total);
+        orbProgram.setUniform(countLocation, (int)uploaded);
+        orbProgram.setUniform(strideLocation, (int)capacity);
+        glBeginQuery(GL_TIME_ELAPSED, b.timer);
         glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        glEndQuery(GL_TIME_ELAPSED);
     orbVAO.unbind();
+    b.drawn = uploaded;
+    //The buffer may be written again once the GPU passes this point
+    b.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
     
     //Draw screen
     
@@ -482,3 +594,52 @@ void GroupRenderer::render(unsigned total, unsigned width, unsigned height) {
         glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
     screenVAO.unbind();
 }
+
+OrbBuffer::OrbBuffer() : bo(0), texture(0), mapped(nullptr), fence(nullptr), timer(0), drawn(0) {
+}
+
+void OrbBuffer::create(unsigned capacity) {
+    GLsizeiptr size = GLsizeiptr(capacity) * ORB_FIELDS * sizeof(uint16_t);
+    glGenBuffers(1, &bo);
+    glBindBuffer(GL_TEXTURE_BUFFER, bo);
+    if (GLEW_ARB_buffer_storage) {
+        //Stay mapped for the lifetime of the buffer; fences keep writes away from frames in flight
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_TEXTURE_BUFFER, size, nullptr, flags);
+        mapped = (uint16_t*)glMapBufferRange(GL_TEXTURE_BUFFER, 0, size, flags);
+    } else {
+        //Without buffer storage the mapping has to be dropped before drawing, so write through a shadow copy
+        glBufferData(GL_TEXTURE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        mapped = nullptr;
+    }
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R16F, bo);
+    glGenQueries(1, &timer);
+    
+    if (!mapped)
+        mapped = new uint16_t[size / sizeof(uint16_t)];
+}
+
+void OrbBuffer::destroy() {
+    if (!bo)
+        return;
+    if (!GLEW_ARB_buffer_storage)
+        delete [] mapped;
+    glDeleteQueries(1, &timer);
+    glDeleteTextures(1, &texture);
+    glDeleteBuffers(1, &bo);
+    timer = 0;
+    drawn = 0;
+    bo = 0;
+    texture = 0;
+    mapped = nullptr;
+}
+
+void OrbBuffer::wait() {
+    if (!fence)
+        return;
+    while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(fence);
+    fence = nullptr;
+}
@@ -2,7 +2,33 @@
 #define DRAW_H
 
 #include "group.h"
+#include "lod.h"
 #include <drew/draw.h>
+#include <vector>
+
+//Number of upload buffers cycled through so the CPU never writes one the GPU is still reading
+#define ORB_BUFFERS 3
+//Orbs the upload buffers can hold before their first growth
+#define ORB_INITIAL_CAPACITY 1024
+//Factor the upload buffers grow by when a frame does not fit
+#define ORB_GROWTH_FACTOR 2
+//One persistently mapped texture buffer of the upload ring
+struct OrbBuffer {
+    GLuint bo;
+    GLuint texture;
+    uint16_t *mapped;
+    GLsync fence;
+    //Measures how long the orbs drawn from this buffer took to shade
+    GLuint timer;
+    unsigned drawn;
+    
+    OrbBuffer();
+    
+    void create(unsigned capacity);
+    void destroy();
+    //Block until the GPU is done reading from this buffer
+    void wait();
+};
 
 struct GroupRenderer {
     ShaderProgram orbProgram;
@@ -12,12 +38,28 @@ struct GroupRenderer {
     FBO orbFrame;
     GLint orbsLocation;
     GLint countLocation;
-    TBO buffer;
+    GLint strideLocation;
+    OrbBuffer buffers[ORB_BUFFERS];
+    unsigned current;
+    unsigned capacity;
+    unsigned maxCapacity;
+    unsigned uploaded;
+    //Most recent GPU time spent shading orbs and how many orbs that was
+    double orbTime;
+    unsigned orbCount;
     
 public:
     GroupRenderer(unsigned width, unsigned height);
+    ~GroupRenderer();
+    
+    //Convert and write the frame into the next free upload buffer
+    void upload(const OrbFrame &frame);
+    //Draw the last uploaded frame
+    void render(unsigned width, unsigned height);
     
-    void render(unsigned total, unsigned width, unsigned height);
+private:
+    //Grow every upload buffer until total orbs fit (or the texture buffer limit is hit)
+    void reserve(unsigned total);
 };
 
 #endif // DRAW_H
@@ -4,6 +4,9 @@ CONFIG -= app_bundle
 CONFIG -= qt
 CONFIG += c++11
 
+#Release builds only check invariants on sampled ticks
+CONFIG(release, debug|release): DEFINES += NDEBUG
+
 QMAKE_CXXFLAGS += -pthread 
 LIBS += -pthread
 
@@ -19,7 +22,27 @@ LIBS += \
 SOURCES += main.cpp \
     cell.cpp \
     group.cpp \
-    draw.cpp
+    halo.cpp \
+    draw.cpp \
+    simulation.cpp \
+    budget.cpp \
+    trajectory.cpp \
+    lineage.cpp \
+    organism.cpp \
+    metrics.cpp \
+    invariant.cpp \
+    genome.cpp \
+    domain.cpp \
+    affinity.cpp \
+    workers.cpp \
+    checkpoint.cpp \
+    statehash.cpp \
+    census.cpp \
+    spatial.cpp \
+    stream.cpp \
+    lod.cpp \
+    island.cpp \
+    library.cpp
 
 include(deployment.pri)
 qtcAddDeployment()
@@ -27,5 +50,25 @@ qtcAddDeployment()
 HEADERS += \
     cell.h \
     group.h \
-    draw.h
+    draw.h \
+    simulation.h \
+    triplebuffer.h \
+    budget.h \
+    trajectory.h \
+    lineage.h \
+    organism.h \
+    metrics.h \
+    invariant.h \
+    genome.h \
+    domain.h \
+    affinity.h \
+    workers.h \
+    checkpoint.h \
+    statehash.h \
+    census.h \
+    spatial.h \
+    stream.h \
+    lod.h \
+    island.h \
+    library.h
 
@@ -0,0 +1,178 @@
+#include "genome.h"
+#include "cell.h"
+#include "workers.h"
+#include <istream>
+#include <limits>
+#include <ostream>
+
+//FNV-1a over everything written to it so programs can be hashed without building a string
+struct HashBuffer : std::streambuf {
+    uint64_t hash;
+    
+    HashBuffer() : hash(14695981039346656037ull) {}
+    
+protected:
+    int overflow(int c) override {
+        if (c != traits_type::eof()) {
+            hash ^= uint8_t(c);
+            hash *= 1099511628211ull;
+        }
+        return traits_type::not_eof(c);
+    }
+    
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+        for (std::streamsize i = 0; i != n; i++) {
+            hash ^= uint8_t(s[i]);
+            hash *= 1099511628211ull;
+        }
+        return n;
+    }
+};
+
+uint64_t genomeHash(const Cell &c) {
+    HashBuffer buffer;
+    std::ostream out(&buffer);
+    writeGenome(out, c);
+    return buffer.hash;
+}
+
+void writeGenome(std::ostream &out, const Cell &c) {
+    //Programs that only differ past the default precision are still different genomes
+    out.precision(std::numeric_limits<double>::max_digits10);
+    out << c.neighborProgram << c.signalProgram << c.persistentProgram;
+}
+
+bool readGenome(std::istream &in, Cell &c) {
+    in >> c.neighborProgram >> c.signalProgram >> c.persistentProgram;
+    return bool(in);
+}
+
+GenomeTable::GenomeTable() : evaluations(0), hotEvaluations(0), promotions(0), evictions(0), hot(0),
+                             slots(16, nullptr), count(0) {
+}
+
+unsigned GenomeTable::size() const {
+    return count;
+}
+
+unsigned GenomeTable::find(uint64_t hash) const {
+    unsigned mask = slots.size() - 1;
+    unsigned i = hash & mask;
+    while (slots[i] && slots[i]->hash != hash)
+        i = (i + 1) & mask;
+    return i;
+}
+
+void GenomeTable::grow() {
+    std::vector<Genome*> old(slots.size() * 2, nullptr);
+    old.swap(slots);
+    for (Genome *g : old)
+        if (g)
+            slots[find(g->hash)] = g;
+}
+
+void GenomeTable::attach(Cell &c, uint64_t hash) {
+    unsigned i = find(hash);
+    if (!slots[i]) {
+        if (2 * (count + 1) > slots.size()) {
+            grow();
+            i = find(hash);
+        }
+        Genome *g;
+        if (spare.empty()) {
+            storage.emplace_back();
+            g = &storage.back();
+            //Every genome can end up spare, so removing one never has to allocate
+            if (spare.capacity() < storage.size())
+                spare.reserve(2 * storage.size());
+        } else {
+            g = spare.back();
+            spare.pop_back();
+        }
+        g->hash = hash;
+        g->cells = 0;
+        g->evaluations = 0;
+        g->hot = false;
+        slots[i] = g;
+        count++;
+    }
+    slots[i]->cells++;
+    c.genome = slots[i];
+}
+
+void GenomeTable::add(Cell &c) {
+    attach(c, genomeHash(c));
+}
+
+void GenomeTable::share(Cell &c, const Cell &parent) {
+    c.genome = parent.genome;
+    c.genome->cells++;
+}
+
+void GenomeTable::change(Cell &c) {
+    remove(c);
+    add(c);
+}
+
+void GenomeTable::queue(Cell &c) {
+    queued.push_back(&c);
+}
+
+void GenomeTable::flush(WorkerPool &workers) {
+    if (queued.empty())
+        return;
+    hashes.resize(queued.size());
+    unsigned stride = workers.size();
+    workers.run([this, stride](unsigned worker){
+        for (unsigned i = worker; i < queued.size(); i += stride)
+            hashes[i] = genomeHash(*queued[i]);
+    });
+    for (unsigned i = 0; i != queued.size(); i++)
+        attach(*queued[i], hashes[i]);
+    queued.clear();
+}
+
+void GenomeTable::remove(Cell &c) {
+    Genome *g = c.genome;
+    c.genome = nullptr;
+    if (--g->cells)
+        return;
+    if (g->hot) {
+        hot--;
+        evictions++;
+    }
+    
+    //Shift later entries of the probe sequence back into the hole so lookups never stop early
+    unsigned mask = slots.size() - 1;
+    unsigned hole = find(g->hash);
+    slots[hole] = nullptr;
+    for (unsigned i = (hole + 1) & mask; slots[i]; i = (i + 1) & mask) {
+        unsigned home = slots[i]->hash & mask;
+        //An entry may move into the hole unless its home lies cyclically between the hole and where it is
+        if ((i > hole && (home <= hole || home > i)) || (i < hole && home <= hole && home > i)) {
+            slots[hole] = slots[i];
+            slots[i] = nullptr;
+            hole = i;
+        }
+    }
+    spare.push_back(g);
+    count--;
+}
+
+void GenomeTable::tally(const std::list<Cell> &cells) {
+    for (const Cell &c : cells) {
+        //The persistent program runs once and the signal and neighbor programs once per neighbor
+        uint64_t count = 1 + 2 * c.neighbors.size();
+        Genome &g = *c.genome;
+        g.evaluations += count;
+        evaluations += count;
+        if (g.hot)
+            hotEvaluations += count;
+        else if (g.evaluations >= GENOME_HOT_EVALUATIONS) {
+            g.hot = true;
+            hot++;
+            promotions++;
+        }
+    }
+}
+
@@ -0,0 +1,83 @@
+#ifndef GENOME_H
+#define GENOME_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <deque>
+#include <list>
+#include <vector>
+
+//Program evaluations after which a genome counts as hot
+#define GENOME_HOT_EVALUATIONS 100000
+
+struct Cell;
+struct WorkerPool;
+
+//One distinct set of programs shared by any number of living cells
+struct Genome {
+    uint64_t hash;
+    unsigned cells;
+    //Program evaluations by all cells with this genome since it appeared
+    uint64_t evaluations;
+    bool hot;
+};
+
+//Identifies cells running identical programs, which checkpoints use to store each genome once and state hashes use
+//to tell genomes apart, and profiles how the program evaluations are spread over genomes
+//Nothing runs hot genomes differently: gpi keeps how it stores and solves programs to itself, so a compiled tier
+//cannot be built in this tree, and the hot counts only show how much of the work the long-lived genomes do
+//Genomes are hashed from their serialized programs when a cell is born or mutates and forgotten as soon as the
+//last cell running them dies
+struct GenomeTable {
+    //Program evaluations in total and by cells with hot genomes since the table was created
+    uint64_t evaluations;
+    uint64_t hotEvaluations;
+    //Genomes that became hot and hot genomes that died out
+    uint64_t promotions;
+    uint64_t evictions;
+    unsigned hot;
+    
+    GenomeTable();
+    
+    unsigned size() const;
+    
+    //Hash the programs of a new cell
+    void add(Cell &c);
+    //A new cell has the same programs as parent
+    void share(Cell &c, const Cell &parent);
+    //The programs of the cell were mutated
+    void change(Cell &c);
+    //Hash the programs of a new or mutated cell at the next flush along with the others born or mutated in the same
+    //phase; the cell has no genome until then
+    void queue(Cell &c);
+    //Hash the queued cells on the workers and attach them in the order they were queued
+    void flush(WorkerPool &workers);
+    void remove(Cell &c);
+    //Count the evaluations the cells ran this tick and promote genomes that crossed the threshold
+    void tally(const std::list<Cell> &cells);
+    
+private:
+    //Open addressing on the hash with linear probing; a power of two that is never more than half full
+    std::vector<Genome*> slots;
+    //Genomes never move so cells can point at them, and the ones that died out are reused before storage grows,
+    //which keeps births and deaths from allocating once the table has reached its largest size
+    std::deque<Genome> storage;
+    std::vector<Genome*> spare;
+    unsigned count;
+    std::vector<Cell*> queued;
+    std::vector<uint64_t> hashes;
+    
+    void attach(Cell &c, uint64_t hash);
+    //Slot holding the hash, or the empty slot where it would go
+    unsigned find(uint64_t hash) const;
+    void grow();
+};
+
+//Hash of all three programs of a cell
+uint64_t genomeHash(const Cell &c);
+//Write or read the three programs of a cell; these are the only places that depend on how gpi stores programs
+void writeGenome(std::ostream &out, const Cell &c);
+bool readGenome(std::istream &in, Cell &c);
+
+#endif // GENOME_H
+
@@ -1,6 +1,20 @@
 #include "group.h"
+#include "invariant.h"
+#include "statehash.h"
+#include "library.h"
+#include "domain.h"
 #include <algorithm>
 #include <iostream>
+#include <iterator>
+
+//What the streams cells draw from during an update are for; each purpose of each cell or pair gets its own
+enum StreamPurpose {
+    //Where a pair's child goes, how its programs are crossed over and whether it mutates
+    STREAM_MATE,
+    //Whether a cell mutates, and how if it does
+    STREAM_MUTATE,
+    STREAM_MUTATION
+};
 
 //Rand from 0 to 1
 double normRand(std::mt19937 &rand) {
@@ -12,196 +26,746 @@ double balancedRand(std::mt19937 &rand) {
     return normRand(rand) * 2 - 1;
 }
 
-Group::Group(const phi::V3 &dimensions, uint32_t seed) : dimensions(dimensions), rand(seed) {
+const char *groupPhaseNames[GROUP_PHASES] = {"persistent", "connect", "distance", "signal", "neighbor", "consume",
+                                             "food", "sever", "mate", "physics", "mutate"};
+
+MigrationCounts::MigrationCounts() : emigrated(0), immigrated(0), blocked(0), dropped(0), droppedFood(0) {
 }
 
-double Group::distanceSquared(const Cell &a, const Cell &b) {
-    phi::V3 dis = b.particle.position;
-    dis -= a.particle.position;
-    wrapVector(dis);
-    return dis.magnitudeSquared();
+MigrationCounts& MigrationCounts::operator+=(const MigrationCounts &other) {
+    emigrated += other.emigrated;
+    immigrated += other.immigrated;
+    blocked += other.blocked;
+    dropped += other.dropped;
+    droppedFood += other.droppedFood;
+    return *this;
 }
 
-void Group::update() {
-    //Clear cells
-    for (Cell &c : cells)
-        c.thread = std::thread(&Cell::clear, &c);
+Group::Group(const phi::V3 &dimensions, uint32_t seed) : dimensions(dimensions), rand(seed),
+             turnFoodCost(CELL_TURN_FOOD_COST), nextId(0), tick(0), births(0), edges(0), foodCreated(0),
+             foodRemoved(0), checker(nullptr), hasher(nullptr), library(nullptr), imbalance(1), positionVersion(1),
+             relocations(0), domain(nullptr), slab(0), foodImported(0), foodExported(0), checking(false),
+             busiestTotal(0), averageTotal(0), reorder(true), relocateSeconds(0), localCost(0), localExcess(0),
+             relocated(false), salt(0) {
+    for (uint64_t &d : deaths)
+        d = 0;
+    for (double &d : phaseDurations)
+        d = 0;
+}
+
+void Group::endPhase(GroupPhase phase) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    phaseDurations[phase] = std::chrono::duration_cast<std::chrono::duration<double>>(now - phaseStart).count();
+    if (checking)
+        checker->endPhase(*this, phase);
+    if (hasher)
+        hasher->endPhase(*this, phase);
+    //Checking and hashing are not counted towards the phase
+    phaseStart = checking || hasher ? std::chrono::steady_clock::now() : now;
+}
+
+unsigned Group::partitionBin(const Cell &c, unsigned bins) const {
+    double offset = (c.particle.position.x + dimensions.x) / (2 * dimensions.x);
+    if (!(offset > 0))
+        return 0;
+    return std::min(unsigned(offset * bins), bins - 1);
+}
+
+void Group::partition() {
+    unsigned n = workers.size();
+    unsigned bins = n * GROUP_PARTITION_BINS;
+    //Counting sort by bin keeps this linear
+    binCounts.assign(bins + 1, 0);
+    for (const Cell &c : cells)
+        binCounts[partitionBin(c, bins) + 1]++;
+    for (unsigned b = 0; b != bins; b++)
+        binCounts[b + 1] += binCounts[b];
+    order.resize(cells.size());
     for (Cell &c : cells)
-        c.thread.join();
+        order[binCounts[partitionBin(c, bins)]++] = &c;
+    //Within a bin workers walk memory in order, which follows the curve after a relocation
+    for (unsigned b = 0; b != bins; b++)
+        std::sort(order.begin() + (b ? binCounts[b - 1] : 0), order.begin() + binCounts[b]);
     
-    //Run cell persistent programs
+    //Cut wherever the prefix sum of the work crosses the next multiple of a chunk's share
+    unsigned total = n * GROUP_CHUNKS_PER_WORKER;
+    uint64_t work = 0;
+    for (Cell *c : order)
+        work += 1 + c->neighbors.size();
+    chunkBounds.assign(1, 0);
+    uint64_t done = 0;
+    for (unsigned i = 0; i != order.size(); i++) {
+        done += 1 + order[i]->neighbors.size();
+        while (chunkBounds.size() != total && done * total >= work * chunkBounds.size())
+            chunkBounds.push_back(i + 1);
+    }
+    while (chunkBounds.size() != total + 1)
+        chunkBounds.push_back(order.size());
+    
+    workerChunks.resize(n + 1);
+    for (unsigned w = 0; w <= n; w++)
+        workerChunks[w] = w * GROUP_CHUNKS_PER_WORKER;
+    for (unsigned w = 0; w != n; w++)
+        for (unsigned i = chunkBounds[workerChunks[w]]; i != chunkBounds[workerChunks[w + 1]]; i++)
+            order[i]->worker = w;
+    reorder = false;
+}
+
+void Group::forEach(const std::function<void(Cell&)> &task) {
+    if (reorder)
+        partition();
+    chunks.reset(workerChunks);
+    busy.resize(workers.size());
+    workers.run([this, &task](unsigned worker){
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        unsigned chunk;
+        while (chunks.next(worker, chunk))
+            for (unsigned i = chunkBounds[chunk]; i != chunkBounds[chunk + 1]; i++)
+                task(*order[i]);
+        busy[worker] = std::chrono::duration_cast<std::chrono::duration<double>>(
+                           std::chrono::steady_clock::now() - start).count();
+    });
+    double busiest = 0;
+    double sum = 0;
+    for (double b : busy) {
+        busiest = std::max(busiest, b);
+        sum += b;
+    }
+    busiestTotal += busiest;
+    averageTotal += sum / busy.size();
+}
+
+double Group::crossNodeShare() {
+    if (reorder)
+        partition();
+    uint64_t total = 0;
+    uint64_t cross = 0;
+    for (const Cell &c : cells)
+        for (const Neighbor &n : c.neighbors) {
+            //Ghosts are not handled by any worker
+            if (n.neighbor->ghost)
+                continue;
+            total++;
+            if (workers.node(c.worker) != workers.node(n.neighbor->worker))
+                cross++;
+        }
+    return total ? double(cross) / total : 0.0;
+}
+
+uint64_t Group::crossEdges() const {
+    uint64_t cross = 0;
+    for (const Cell &g : ghosts)
+        cross += g.neighbors.size();
+    return cross;
+}
+
+//Spread the low bits of v so that two zero bits follow each one
+static uint64_t spreadBits(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffff;
+    v = (v | v << 16) & 0x1f0000ff0000ff;
+    v = (v | v << 8) & 0x100f00f00f00f00f;
+    v = (v | v << 4) & 0x10c30c30c30c30c3;
+    v = (v | v << 2) & 0x1249249249249249;
+    return v;
+}
+
+//Position along one axis of the world scaled to the bits of the curve
+static uint64_t curveCoordinate(double position, double dimension) {
+    double offset = (position + dimension) / (2 * dimension);
+    if (!(offset > 0))
+        return 0;
+    return std::min(uint64_t(offset * (1 << GROUP_CURVE_BITS)), uint64_t(1 << GROUP_CURVE_BITS) - 1);
+}
+
+uint64_t Group::curveKey(const phi::V3 &position) const {
+    return spreadBits(curveCoordinate(position.x, dimensions.x)) |
+           spreadBits(curveCoordinate(position.y, dimensions.y)) << 1 |
+           spreadBits(curveCoordinate(position.z, dimensions.z)) << 2;
+}
+
+unsigned Group::slot(const Cell *c) const {
+    return std::lower_bound(slots.begin(), slots.end(), c) - slots.begin();
+}
+
+void Group::relocate() {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool spread = false;
+    for (unsigned w = 1; w < workers.size(); w++)
+        spread = spread || workers.node(w) != workers.node(0);
+    if (spread)
+        rehome();
+    else
+        permute();
+    //Cells changed nodes
+    if (domain) {
+        byId.clear();
+        for (auto i = cells.begin(); i != cells.end(); i++)
+            byId[i->id] = i;
+        for (auto i = ghosts.begin(); i != ghosts.end(); i++)
+            byId[i->id] = i;
+    }
+    
+    reorder = true;
+    relocated = true;
+    relocations++;
+    relocateSeconds = std::chrono::duration_cast<std::chrono::duration<double>>(
+                          std::chrono::steady_clock::now() - start).count();
+}
+
+void Group::permute() {
+    slots.clear();
+    curve.clear();
+    for (Cell &c : cells) {
+        slots.push_back(&c);
+        curve.emplace_back(curveKey(c.particle.position), &c);
+    }
+    std::sort(slots.begin(), slots.end());
+    //Ties are broken by id rather than address so the layout does not depend on where nodes were allocated
+    std::sort(curve.begin(), curve.end(), [](const std::pair<uint64_t, Cell*> &a,
+                                             const std::pair<uint64_t, Cell*> &b){
+        return a.first != b.first ? a.first < b.first : a.second->id < b.second->id;
+    });
+    //The cell that is n-th along the curve moves to the n-th lowest node
+    destinations.resize(slots.size());
+    for (unsigned i = 0; i != curve.size(); i++)
+        destinations[slot(curve[i].second)] = i;
+    //Where in the list every node has to end up for the cells to stay in the same order
+    listOrder.resize(slots.size());
+    unsigned position = 0;
     for (Cell &c : cells)
-        c.thread = std::thread(&Cell::solvePersistent, &c);
+        listOrder[destinations[slot(&c)]] = position++;
+    
+    //Point edges at the nodes their cells are about to move to; the records themselves move with their lists
+    //Ghosts stay where they are
     for (Cell &c : cells)
-        c.thread.join();
+        for (Neighbor &n : c.neighbors)
+            if (!n.neighbor->ghost)
+                n.neighbor = slots[destinations[slot(n.neighbor)]];
+    for (Cell &g : ghosts)
+        for (Neighbor &n : g.neighbors)
+            n.neighbor = slots[destinations[slot(n.neighbor)]];
     
-    //Connect cells that request it
-    for (auto i = cells.begin(); i != cells.end(); i++) {
-        Cell &c = *i;
-        //If the cell decided to connect
-        if (c.decision.connect) {
-            //Check every cell
-            for (auto j = cells.begin(); j != cells.end(); j++) {
-                //If they are not the same cell and i is not already connected to j
-                if (i != j && std::find(c.neighbors.begin(), c.neighbors.end(), &*j) == c.neighbors.end()) {
-                    //Also check radius
-                    phi::V3 dis = c.particle.position;
-                    dis -= j->particle.position;
-                    wrapVector(dis);
-                    //If radius is less than the connection distance
-                    if (dis.magnitudeSquared() < PHYSICS_CONNECT_DISTANCE * PHYSICS_CONNECT_DISTANCE)
-                        //Connect these two cells
-                        connect(c, *j);
+    //Follow each cycle of the permutation, carrying one cell along it at a time
+    placed.assign(slots.size(), false);
+    for (unsigned i = 0; i != slots.size(); i++) {
+        if (placed[i] || destinations[i] == i)
+            continue;
+        Cell carried(std::move(*slots[i]));
+        for (unsigned j = destinations[i]; !placed[j]; j = destinations[j]) {
+            std::swap(carried, *slots[j]);
+            placed[j] = true;
+        }
+    }
+    for (Cell *c : slots)
+        organisms.moved(*c);
+    //Serial phases depend on the order of the list, so it is relinked to what it was; only memory follows the curve
+    cells.sort([this](const Cell &a, const Cell &b){
+        return listOrder[slot(&a)] < listOrder[slot(&b)];
+    });
+}
+
+void Group::rehome() {
+    //Assigns every cell the worker that handles it
+    partition();
+    unsigned n = workers.size();
+    slots.clear();
+    curve.clear();
+    for (Cell &c : cells) {
+        slots.push_back(&c);
+        curve.emplace_back(curveKey(c.particle.position), &c);
+    }
+    std::sort(slots.begin(), slots.end());
+    //Each worker's cells in one run, along the curve within it
+    std::sort(curve.begin(), curve.end(), [](const std::pair<uint64_t, Cell*> &a,
+                                             const std::pair<uint64_t, Cell*> &b){
+        if (a.second->worker != b.second->worker)
+            return a.second->worker < b.second->worker;
+        return a.first != b.first ? a.first < b.first : a.second->id < b.second->id;
+    });
+    homeStarts.assign(n + 1, 0);
+    for (const std::pair<uint64_t, Cell*> &p : curve)
+        homeStarts[p.second->worker + 1]++;
+    for (unsigned w = 0; w != n; w++)
+        homeStarts[w + 1] += homeStarts[w];
+    homes.resize(n);
+    rehomed.resize(slots.size());
+    
+    //Copy the cells with their programs and edge records; the old record of every edge is only read by the worker
+    //copying it, so it can hold the new record until the other end is pointed at it
+    workers.run([this](unsigned worker){
+        std::list<Cell> &home = homes[worker];
+        for (unsigned i = homeStarts[worker]; i != homeStarts[worker + 1]; i++) {
+            Cell &old = *curve[i].second;
+            home.push_back(old);
+            std::list<Neighbor>::iterator copy = home.back().neighbors.begin();
+            for (Neighbor &n : old.neighbors)
+                n.neighborsDecision = copy++;
+            rehomed[slot(&old)] = std::prev(home.end());
+        }
+    });
+    //Ghosts stay where they are, so their records of edges to copied cells are pointed at the copies instead; every
+    //record belongs to one edge and so is only touched by one worker
+    workers.run([this](unsigned worker){
+        for (Cell &c : homes[worker])
+            for (auto n = c.neighbors.begin(); n != c.neighbors.end(); n++) {
+                if (n->neighbor->ghost) {
+                    n->neighborsDecision->neighborsDecision = n;
+                    n->neighborsDecision->neighbor = &c;
+                    continue;
                 }
+                n->neighborsDecision = n->neighborsDecision->neighborsDecision;
+                n->neighbor = &*rehomed[slot(n->neighbor)];
             }
-        }
+    });
+    
+    //Serial phases depend on the order of the list, so the new nodes are linked in the order the old ones were in
+    std::list<Cell> old;
+    old.swap(cells);
+    for (Cell &c : old) {
+        std::list<Cell>::iterator copy = rehomed[slot(&c)];
+        cells.splice(cells.end(), homes[copy->worker], copy);
+        organisms.moved(*copy);
     }
+}
+
+void Group::weighRelocation() {
+    double work = cells.size() + 2 * edges;
+    if (!(work > 0))
+        return;
+    double cost = (phaseDurations[PHASE_SIGNAL] + phaseDurations[PHASE_NEIGHBOR] + phaseDurations[PHASE_PHYSICS]) /
+                  work;
+    if (relocated) {
+        localCost = cost;
+        localExcess = 0;
+        relocated = false;
+    } else
+        localExcess = std::max(0.0, localExcess + (cost - localCost) * work);
+}
+
+void Group::update() {
+    //Also happens on the first update, before there is anything to compare with
+    if (localExcess >= relocateSeconds)
+        relocate();
+    checking = checker && checker->begin(*this);
+    //Cells moved during the last update
+    reorder = true;
+    busiestTotal = 0;
+    averageTotal = 0;
+    phaseStart = std::chrono::steady_clock::now();
+    salt = uint64_t(rand()) << 32 | rand();
+    
+    //Clear cells
+    forEach([](Cell &c){
+        c.clear();
+    });
+    
+    //Run cell persistent programs
+    forEach([](Cell &c){
+        c.solvePersistent();
+    });
+    endPhase(PHASE_PERSISTENT);
+    
+    //Cells that crossed into another slab move to it, and every slab gets copies of the cells it may connect to
+    if (domain) {
+        migrate();
+        refreshGhosts();
+    }
+    
+    //Connect cells that request it
+    connectCells();
+    endPhase(PHASE_CONNECT);
     
     //Find all cell distances
-    for (Cell &c : cells) {
-        c.thread = std::thread([&c, this](){
-            for (Neighbor &n : c.neighbors) {
-                phi::V3 dis = n.neighbor->particle.position;
-                dis -= c.particle.position;
-                wrapVector(dis);
-                n.distance = dis.magnitude();
+    //Positions do not change again until physics, so the sever, mate and physics phases reuse these
+    forEach([this](Cell &c){
+        for (Neighbor &n : c.neighbors)
+            //The lower cell of each pair measures the edge for both directions, and cells always measure the edges
+            //to ghosts; either way gives exactly the same offset
+            if (&c < n.neighbor || n.neighbor->ghost) {
+                measure(c, n);
+                Neighbor &back = *n.neighborsDecision;
+                back.delta = n.delta;
+                back.delta *= -1;
+                back.distanceSquared = n.distanceSquared;
+                back.distance = n.distance;
+                back.version = positionVersion;
             }
-        });
-    }
-    for (Cell &c : cells)
-        c.thread.join();
+    });
+    endPhase(PHASE_DISTANCE);
     
     //Run cell signal programs
-    for (Cell &c : cells)
-        c.thread = std::thread(&Cell::solveSignal, &c);
-    for (Cell &c : cells)
-        c.thread.join();
+    forEach([](Cell &c){
+        c.solveSignal();
+    });
+    if (domain)
+        shareSignals();
+    endPhase(PHASE_SIGNAL);
     
     //Run cell neighbor programs
-    for (Cell &c : cells)
-        c.thread = std::thread(&Cell::solveNeighbor, &c);
-    for (Cell &c : cells)
-        c.thread.join();
+    forEach([](Cell &c){
+        c.solveNeighbor();
+    });
+    if (domain)
+        shareDecisions();
+    endPhase(PHASE_NEIGHBOR);
     
     //Compute consumptions
-    for (Cell &c : cells)
-        c.thread = std::thread(&Cell::enumerateConsumptions, &c);
-    for (Cell &c : cells)
-        c.thread.join();
+    forEach([](Cell &c){
+        c.enumerateConsumptions();
+    });
+    if (domain)
+        shareEatenBy();
     
     //Determine results of consumptions
-    for (Cell &c : cells)
-        c.thread = std::thread(&Cell::totalConsumptions, &c);
-    for (Cell &c : cells)
-        c.thread.join();
+    forEach([](Cell &c){
+        c.totalConsumptions();
+    });
+    if (domain)
+        countEaten();
+    if (checking)
+        checker->consumed(*this);
     
     //Kill off cells that were consumed
+    if (domain)
+        shareFates();
     updateDeaths();
+    endPhase(PHASE_CONSUME);
     
     //For cells that are still alive, send and recieve food
-    for (Cell &c : cells)
-        c.thread = std::thread(&Cell::accumulateSentFood, &c);
-    for (Cell &c : cells)
-        c.thread.join();
+    forEach([](Cell &c){
+        c.accumulateSentFood();
+    });
+    if (domain)
+        countSent();
+    if (checking)
+        checker->received(*this);
     
     //Apply the food cost to exist
-    for (Cell &c : cells)
-        c.thread = std::thread(&Cell::handleStarve, &c);
-    for (Cell &c : cells)
-        c.thread.join();
+    forEach([this](Cell &c){
+        c.handleStarve(turnFoodCost);
+    });
+    if (checking)
+        checker->starved(*this);
     
     //Kill off cells that starved
+    if (domain)
+        shareFates();
     updateDeaths();
+    endPhase(PHASE_FOOD);
     
     //Disconnect all cells that ask to be disconnected or that are too far
+    //A ghost's decision about the edge is only known from its record, since its owner severs its side on its own
     for (Cell &c : cells) {
         for (auto i = c.neighbors.begin(); i != c.neighbors.end(); ) {
             Neighbor &n = *i;
-            if (n.decision.sever || distanceSquared(c, *n.neighbor) >
-                    PHYSICS_DISCONNECT_DISTANCE * PHYSICS_DISCONNECT_DISTANCE) {
-                n.neighbor->neighbors.erase(n.neighborsDecision);
-                i = c.neighbors.erase(i);
+            if (n.decision.sever || n.distanceSquared > PHYSICS_DISCONNECT_DISTANCE * PHYSICS_DISCONNECT_DISTANCE ||
+                (n.neighbor->ghost && n.neighborsDecision->decision.sever)) {
+                spareNeighbors.splice(spareNeighbors.begin(), n.neighbor->neighbors, n.neighborsDecision);
+                auto next = std::next(i);
+                spareNeighbors.splice(spareNeighbors.begin(), c.neighbors, i);
+                i = next;
+                organisms.split(c);
+                edges--;
             } else {
                 i++;
             }
         }
     }
+    endPhase(PHASE_SEVER);
     
     //Determine what the actual mate will be
-    for (Cell &c : cells)
-        c.thread = std::thread(&Cell::decideMate, &c);
-    for (Cell &c : cells)
-        c.thread.join();
+    forEach([](Cell &c){
+        c.decideMate();
+    });
+    if (domain)
+        shareMates();
     
     //Handle mating
-    for (Cell &c : cells) {
-        //If a mate was chosen and the mate chose this cell
-        if (c.changes.mate && &c == c.changes.mate->changes.mate) {
-            //Clear the mate on the other cell to avoid double-breeding
-            c.changes.mate->changes.mate = nullptr;
-            
-#ifdef CELL_DIVIDE_FOOD_THRESHOLD
-            //Dont allow cells to mate if below threshold
-            if (c.food < CELL_DIVIDE_FOOD_THRESHOLD || c.changes.mate->food < CELL_DIVIDE_FOOD_THRESHOLD)
-                continue;
-#endif
-            
-            //Find the vector point towards the other cell from this cell
-            phi::V3 dis = c.changes.mate->particle.position;
-            dis -= c.particle.position;
-            //Wrap the distance so that it is the shortest distance possible toroidially
-            wrapVector(dis);
-            //Get half of the distance
-            dis /= 2;
-            //Add it to the original position
-            dis += c.particle.position;
-            //Randomly move the cell in the area to create randomness
-            dis += phi::V3(balancedRand(rand) * PHYSICS_CONNECT_DISTANCE,
-                           balancedRand(rand) * PHYSICS_CONNECT_DISTANCE,
-                           balancedRand(rand) * PHYSICS_CONNECT_DISTANCE);
-            //Finally wrap the new vector that is between the previous vectors
-            wrapVector(dis);
-            //Make the new cell using the computed
-            cells.emplace_front(c, *c.changes.mate, dis, rand);
-            cells.front().food += c.food * CELL_FOOD_CHILDREN_RATIO + c.changes.mate->food * CELL_FOOD_CHILDREN_RATIO;
-            c.food -= c.food * CELL_FOOD_CHILDREN_RATIO;
-            c.changes.mate->food -= c.changes.mate->food * CELL_FOOD_CHILDREN_RATIO;
-        } else
-            c.changes.mate = nullptr;
-        ///At this point in the code, one cell in each pair of mated cells contains a reference.
-        ///All other cells are nulled if they did not mate.
-    }
+    mate();
+    genomes.flush(workers);
+    endPhase(PHASE_MATE);
     
     //Update physics
-    for (Cell &c : cells)
-        c.thread = std::thread([this, &c](){
-            processPhysics(c);
-        });
-    for (Cell &c : cells)
-        c.thread.join();
+    forEach([this](Cell &c){
+        applyForces(c);
+    });
+    forEach([this](Cell &c){
+        advance(c);
+    });
+    positionVersion++;
     
     //Kill off cells that did something they werent supposed to with the laws of physics
+    if (domain)
+        shareFates();
     updateDeaths();
+    endPhase(PHASE_PHYSICS);
     
+    //The first draw of each cell's stream decides whether it mutates; only the ones that do seed a generator
     for (Cell &c : cells)
-        if (normRand(rand) < CELL_MUTATION_CHANCE)
-            c.mutate(rand);
+        if (streamSeed(c.id, STREAM_MUTATE) / 4294967296.0 < CELL_MUTATION_CHANCE) {
+            std::mt19937 mutation(streamSeed(c.id, STREAM_MUTATION));
+            c.mutate(mutation);
+            lineage.mutation(tick, c.id, c.species);
+            genomes.remove(c);
+            genomes.queue(c);
+        }
+    genomes.flush(workers);
+    genomes.tally(cells);
+    
+    //Split up organisms that lost edges or cells this tick
+    organisms.rebuild();
+    endPhase(PHASE_MUTATE);
+    
+    imbalance = averageTotal > 0 ? busiestTotal / averageTotal : 1;
+    weighRelocation();
+    tick++;
+}
+
+uint32_t Group::streamSeed(uint64_t id, unsigned purpose) const {
+    //Murmur3 finalizer, so seeds of neighboring ids and purposes have nothing in common
+    uint64_t h = salt + id * 0x9e3779b97f4a7c15ull + purpose * 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb93fe53ec249ull;
+    h ^= h >> 33;
+    return uint32_t(h);
+}
+
+phi::V3 Group::birthPlace(const Cell &a, const phi::V3 &toMate, std::mt19937 &stream) {
+    //Get half of the vector toroidially pointing towards the mate
+    phi::V3 place = toMate;
+    place /= 2;
+    //Add it to the original position
+    place += a.particle.position;
+    //Randomly move the cell in the area to create randomness; drawn one after another so the order is fixed
+    double x = balancedRand(stream) * PHYSICS_CONNECT_DISTANCE;
+    double y = balancedRand(stream) * PHYSICS_CONNECT_DISTANCE;
+    double z = balancedRand(stream) * PHYSICS_CONNECT_DISTANCE;
+    place += phi::V3(x, y, z);
+    //Finally wrap the new vector that is between the previous vectors
+    wrapVector(place);
+    return place;
+}
+
+void Group::mate() {
+    //Pairs that chose each other mate once, through the cell with the lower id
+    matings.clear();
+    ghostMatings.clear();
+    for (Cell &c : cells) {
+        Cell *partner = c.changes.mate;
+        if (!partner || partner->changes.mate != &c) {
+            c.changes.mate = nullptr;
+            continue;
+        }
+#ifdef CELL_DIVIDE_FOOD_THRESHOLD
+        //Dont allow cells to mate if below threshold
+        if (c.food < CELL_DIVIDE_FOOD_THRESHOLD || partner->food < CELL_DIVIDE_FOOD_THRESHOLD)
+            continue;
+#endif
+        if (c.id < partner->id)
+            matings.push_back(&c);
+        else if (partner->ghost)
+            ghostMatings.emplace_back(&c, partner);
+    }
+    //Only the cell with the lower id of each pair keeps a reference to its mate; all other cells are nulled
+    for (Cell &c : cells)
+        if (c.changes.mate && c.changes.mate->id < c.id)
+            c.changes.mate = nullptr;
+    
+    //Children are numbered in the order of the lower ids of their parents over the whole world
+    std::sort(matings.begin(), matings.end(), [](const Cell *a, const Cell *b){
+        return a->id < b->id;
+    });
+    remoteMatings.clear();
+    if (domain)
+        shareMatings();
+    for (unsigned i = 0; i != matings.size(); i++) {
+        Cell &a = *matings[i];
+        uint64_t before = std::lower_bound(remoteMatings.begin(), remoteMatings.end(), a.id) - remoteMatings.begin();
+        bear(a, *a.changes.mate, nextId + i + before);
+    }
+    for (const std::pair<Cell*, Cell*> &m : ghostMatings) {
+        uint64_t id = m.second->id;
+        uint64_t before = std::lower_bound(remoteMatings.begin(), remoteMatings.end(), id) - remoteMatings.begin();
+        before += std::lower_bound(matings.begin(), matings.end(), id, [](const Cell *c, uint64_t id){
+            return c->id < id;
+        }) - matings.begin();
+        bearGhost(*m.first, *m.second, nextId + before);
+    }
+    nextId += matings.size() + remoteMatings.size();
+}
+
+void Group::bear(Cell &a, Cell &b, uint64_t id) {
+    std::mt19937 stream(streamSeed(a.id, STREAM_MATE));
+    phi::V3 place = birthPlace(a, a.changes.mateEdge->delta, stream);
+    //Make the new cell using the computed position, in a dead cell if there is one
+    if (spareCells.empty())
+        cells.emplace_front(a, b, place, stream);
+    else {
+        cells.splice(cells.begin(), spareCells, spareCells.begin());
+        cells.front().remate(a, b, place, stream);
+    }
+    reorder = true;
+    Cell &child = cells.front();
+    child.id = id;
+    if (domain)
+        byId[id] = cells.begin();
+    connect(a, child, spareNeighbors);
+    connect(b, child, spareNeighbors);
+    organisms.add(child);
+    organisms.join(child, a);
+    if (!b.ghost)
+        organisms.join(child, b);
+    births++;
+    edges += 2;
+    lineage.birth(LINEAGE_MATE, tick, child.id, a.id, b.id, child.species);
+    //Mutate the child
+    if (normRand(stream) < CELL_MATE_MUTATION_CHANCE) {
+        child.mutate(stream);
+        lineage.mutation(tick, child.id, child.species);
+    }
+    genomes.queue(child);
+    //Round each share once so the child gets exactly what the parents give up
+    uint64_t share = a.food * CELL_FOOD_CHILDREN_RATIO;
+    uint64_t mateShare = b.food * CELL_FOOD_CHILDREN_RATIO;
+    child.food += share + mateShare;
+    a.food -= share;
+    b.food -= mateShare;
+    if (b.ghost)
+        foodImported += mateShare;
+}
+
+void Group::bearGhost(Cell &b, Cell &a, uint64_t id) {
+    //The same stream the owner of a draws the child's place from, along the same edge seen from the other end
+    std::mt19937 stream(streamSeed(a.id, STREAM_MATE));
+    phi::V3 toMate = b.changes.mateEdge->delta;
+    toMate *= -1;
+    Cell &child = makeGhost(id);
+    child.slab = a.slab;
+    child.particle.position = birthPlace(a, toMate, stream);
+    child.particle.velocity = a.particle.velocity;
+    child.particle.velocity += b.particle.velocity;
+    child.particle.velocity *= 0.5;
+    child.species = (a.species & 0xFFFFFFFF00000000) | (b.species & 0x00000000FFFFFFFF);
+    connect(b, child, spareNeighbors);
+    edges++;
+    uint64_t share = a.food * CELL_FOOD_CHILDREN_RATIO;
+    uint64_t mateShare = b.food * CELL_FOOD_CHILDREN_RATIO;
+    child.food = share + mateShare;
+    b.food -= mateShare;
+    foodExported += mateShare;
+}
+
+void Group::connectCells() {
+    for (auto i = cells.begin(); i != cells.end(); i++) {
+        Cell &c = *i;
+        //If the cell decided to connect
+        if (c.decision.connect) {
+            //Check every cell
+            for (auto j = cells.begin(); j != cells.end(); j++) {
+                //If they are not the same cell and i is not already connected to j
+                if (i != j && std::find(c.neighbors.begin(), c.neighbors.end(), &*j) == c.neighbors.end()) {
+                    //Also check radius
+                    phi::V3 dis = c.particle.position;
+                    dis -= j->particle.position;
+                    wrapVector(dis);
+                    //If radius is less than the connection distance
+                    if (dis.magnitudeSquared() < PHYSICS_CONNECT_DISTANCE * PHYSICS_CONNECT_DISTANCE) {
+                        //Connect these two cells
+                        connect(c, *j, spareNeighbors);
+                        organisms.join(c, *j);
+                        edges++;
+                    }
+                }
+            }
+        }
+    }
+    //Ghosts connect to the cells here the way they do in their own slab; the distance is the same either way round
+    for (Cell &g : ghosts)
+        for (Cell &c : cells)
+            if ((g.decision.connect || c.decision.connect) &&
+                std::find(c.neighbors.begin(), c.neighbors.end(), &g) == c.neighbors.end()) {
+                phi::V3 dis = c.particle.position;
+                dis -= g.particle.position;
+                wrapVector(dis);
+                if (dis.magnitudeSquared() < PHYSICS_CONNECT_DISTANCE * PHYSICS_CONNECT_DISTANCE) {
+                    connect(c, g, spareNeighbors);
+                    edges++;
+                }
+            }
 }
 
 void Group::spawn(unsigned amnt) {
     for (unsigned i = 0; i != amnt; i++) {
-        cells.emplace_front(phi::V3(balancedRand(rand) * dimensions.x, balancedRand(rand) * dimensions.y,
-                                    balancedRand(rand) * dimensions.z),
-                            phi::V3(balancedRand(rand) * PHYSICS_MAX_INITIAL_VELOCITY,
-                                    balancedRand(rand) * PHYSICS_MAX_INITIAL_VELOCITY,
-                                    balancedRand(rand) * PHYSICS_MAX_INITIAL_VELOCITY),
-                            rand);
+        //Every slab of a domain draws where each cluster goes and the seed of its stream, and numbers its cells, but
+        //only the slab that owns the place makes it
+        double x = balancedRand(rand) * dimensions.x;
+        double y = balancedRand(rand) * dimensions.y;
+        double z = balancedRand(rand) * dimensions.z;
+        phi::V3 position(x, y, z);
+        std::mt19937 cluster(rand());
+        uint64_t id = nextId;
+        nextId += 1 + CELL_SPAWN_PARTNERS;
+        if (domain && domain->owner(position) != slab)
+            continue;
+        reorder = true;
+        
+        uint64_t species;
+        const char *programs;
+        size_t bytes;
+        if (library && library->draw(cluster, species, programs, bytes)) {
+            ProgramsBuffer buffer(programs, bytes);
+            std::istream genome(&buffer);
+            phi::V3 velocity(balancedRand(cluster) * PHYSICS_MAX_INITIAL_VELOCITY,
+                             balancedRand(cluster) * PHYSICS_MAX_INITIAL_VELOCITY,
+                             balancedRand(cluster) * PHYSICS_MAX_INITIAL_VELOCITY);
+            cells.emplace_front(position, velocity, genome);
+            if (genome) {
+                cells.front().food = CELL_INITIAL_FOOD;
+                cells.front().species = species;
+            } else {
+                //Whatever was read of a damaged entry is no program to run, so the cell starts like any other
+                std::cerr << "Group: A genome drawn from the library is damaged; spawning random programs instead"
+                          << std::endl;
+                cells.pop_front();
+                cells.emplace_front(position, velocity, cluster);
+            }
+        } else
+            cells.emplace_front(position,
+                                phi::V3(balancedRand(cluster) * PHYSICS_MAX_INITIAL_VELOCITY,
+                                        balancedRand(cluster) * PHYSICS_MAX_INITIAL_VELOCITY,
+                                        balancedRand(cluster) * PHYSICS_MAX_INITIAL_VELOCITY),
+                                cluster);
+        cells.front().id = id++;
+        if (domain)
+            byId[cells.front().id] = cells.begin();
+        organisms.add(cells.front());
+        genomes.add(cells.front());
+        births++;
+        foodCreated += cells.front().food;
+        lineage.birth(LINEAGE_SPAWN, tick, cells.front().id, LINEAGE_NO_PARENT, LINEAGE_NO_PARENT,
+                      cells.front().species);
         for (unsigned j = 0; j != CELL_SPAWN_PARTNERS; j++) {
             cells.emplace_front(cells.front(),
-                                phi::V3(cells.front().particle.position.x + balancedRand(rand) * PHYSICS_CONNECT_DISTANCE,
-                                        cells.front().particle.position.y + balancedRand(rand) * PHYSICS_CONNECT_DISTANCE,
-                                        cells.front().particle.position.z + balancedRand(rand) * PHYSICS_CONNECT_DISTANCE));
+                                phi::V3(cells.front().particle.position.x + balancedRand(cluster) * PHYSICS_CONNECT_DISTANCE,
+                                        cells.front().particle.position.y + balancedRand(cluster) * PHYSICS_CONNECT_DISTANCE,
+                                        cells.front().particle.position.z + balancedRand(cluster) * PHYSICS_CONNECT_DISTANCE));
+            cells.front().id = id++;
+            if (domain)
+                byId[cells.front().id] = cells.begin();
+            connect(*std::next(cells.begin()), cells.front(), spareNeighbors);
             cells.front().food = CELL_INITIAL_FOOD;
+            organisms.add(cells.front());
+            organisms.join(cells.front(), *std::next(cells.begin()));
+            genomes.share(cells.front(), *std::next(cells.begin()));
+            births++;
+            foodCreated += cells.front().food;
+            edges++;
+            //Each partner divides from the previous one, so the previous front is the parent
+            lineage.birth(LINEAGE_DIVIDE, tick, cells.front().id, std::next(cells.begin())->id, LINEAGE_NO_PARENT,
+                          cells.front().species);
             wrapVector(cells.front().particle.position);
         }
     }
@@ -212,13 +776,60 @@ void Group::updateDeaths() {
         Cell &c = *i;
         //Death condition
         if (c.isDead()) {
+            lineage.death(tick, c.id, c.changes.cause);
+            organisms.remove(c);
+            genomes.remove(c);
+            deaths[c.changes.cause]++;
+            edges -= c.neighbors.size();
+            if (checking)
+                checker->died(c);
+            if (domain)
+                byId.erase(c.id);
             //Perform death operations
-            c.die();
-            i = cells.erase(i);
+            c.die(spareNeighbors);
+            auto next = std::next(i);
+            spareCells.splice(spareCells.begin(), cells, i);
+            i = next;
+            reorder = true;
         } else
             //Otherwise go to next cell
             i++;
     }
+    //Their owners told this slab which ghosts died; the owners count the deaths
+    for (auto i = ghosts.begin(); i != ghosts.end(); )
+        i = i->isDead() ? removeGhost(i) : std::next(i);
+}
+
+Cell* Group::immigrate(uint64_t id, const phi::V3 &position, const phi::V3 &velocity, uint64_t food,
+                       uint64_t species, std::istream &genome) {
+    cells.emplace_front(position, velocity, genome);
+    if (!genome) {
+        cells.pop_front();
+        return nullptr;
+    }
+    Cell &c = cells.front();
+    c.id = id;
+    c.food = food;
+    c.species = species;
+    organisms.add(c);
+    genomes.add(c);
+    foodCreated += food;
+    reorder = true;
+    return &c;
+}
+
+std::list<Cell>::iterator Group::emigrate(std::list<Cell>::iterator cell) {
+    Cell &c = *cell;
+    organisms.remove(c);
+    genomes.remove(c);
+    edges -= c.neighbors.size();
+    foodRemoved += c.food;
+    //Edges to the cells left behind are cut just like when a cell dies
+    c.pluck(spareNeighbors);
+    reorder = true;
+    auto next = std::next(cell);
+    spareCells.splice(spareCells.begin(), cells, cell);
+    return next;
 }
 
 void Group::wrapVector(phi::V3 &delta) {
@@ -235,7 +846,16 @@ bool Group::isValid(const phi::V3 &delta) {
            std::abs(delta.x) < dimensions.x && std::abs(delta.y) < dimensions.y && std::abs(delta.z) < dimensions.z;
 }
 
-void Group::processPhysics(Cell &c) {
+void Group::measure(const Cell &c, Neighbor &n) {
+    n.delta = n.neighbor->particle.position;
+    n.delta -= c.particle.position;
+    wrapVector(n.delta);
+    n.distanceSquared = n.delta.magnitudeSquared();
+    n.distance = std::sqrt(n.distanceSquared);
+    n.version = positionVersion;
+}
+
+void Group::applyForces(Cell &c) {
     //Apply drag
     c.particle.drag(CELL_DRAG_COEFFICIENT);
     //Process neighbor springing forces
@@ -243,18 +863,21 @@ void Group::processPhysics(Cell &c) {
         double force = CELL_FORCE_COEFFICIENT * n.decision.force * n.neighborsDecision->decision.force;
         if (std::abs(force) > CELL_FORCE_LIMIT)
             force = copysign(CELL_FORCE_LIMIT, force);
-        phi::V3 adjDis = n.neighbor->particle.position;
-        adjDis -= c.particle.position;
-        wrapVector(adjDis);
+        //Only edges to children born this update have not been measured yet
+        if (n.version != positionVersion)
+            measure(c, n);
         phi::V3 adjPos = c.particle.position;
-        adjPos += adjDis;
+        adjPos += n.delta;
         
         c.particle.spring(force, PHYSICS_EQUILIBRIUM_DISTANCE, adjPos);
         c.particle.gravitate(-PHYSICS_REPULSION_COEFFICIENT, adjPos, PHYSICS_REPULSION_RADIUS);
     }
+}
+
+void Group::advance(Cell &c) {
     c.particle.advance();
     wrapVector(c.particle.position);
     if (!isValid(c.particle.position))
-        c.changes.death = true;
+        c.kill(DEATH_PHYSICS);
 }
 
@@ -2,11 +2,124 @@
 #define GROUP_H
 
 #include "cell.h"
+#include "organism.h"
+#include "workers.h"
+#include <chrono>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//Bins along x per worker that cells are sorted into before they are split between workers
+#define GROUP_PARTITION_BINS 64
+//Chunks of equal work per worker that each parallel phase is split into; the unit of stealing
+#define GROUP_CHUNKS_PER_WORKER 8
+//Bits per axis of the Morton curve that cells are laid out in memory along
+#define GROUP_CURVE_BITS 21
+//Slab of a ghost whose owner has not sent it yet in this update
+#define GROUP_NO_SLAB ~uint32_t(0)
+
+//Stages of Group::update that are timed separately
+enum GroupPhase {
+    //Clearing changes and running persistent programs
+    PHASE_PERSISTENT,
+    PHASE_CONNECT,
+    PHASE_DISTANCE,
+    PHASE_SIGNAL,
+    PHASE_NEIGHBOR,
+    //Eating and the deaths it causes
+    PHASE_CONSUME,
+    //Sending food, paying the turn cost and starving
+    PHASE_FOOD,
+    PHASE_SEVER,
+    PHASE_MATE,
+    //Moving cells and removing the ones that left the world
+    PHASE_PHYSICS,
+    //Random mutation and organism upkeep
+    PHASE_MUTATE,
+    GROUP_PHASES
+};
+
+extern const char *groupPhaseNames[GROUP_PHASES];
+
+//Cells that left and arrived, cells kept back because the way to their destination was full and cells dropped on
+//arrival because their programs were damaged, along with the food the dropped cells took out of the world
+struct MigrationCounts {
+    uint64_t emigrated;
+    uint64_t immigrated;
+    uint64_t blocked;
+    uint64_t dropped;
+    uint64_t droppedFood;
+    
+    MigrationCounts();
+    
+    MigrationCounts& operator+=(const MigrationCounts &other);
+};
+
+struct InvariantChecker;
+struct StateHasher;
+struct GenomeLibrary;
+struct Domain;
 
 struct Group {
     std::list<Cell> cells;
     phi::V3 dimensions;
     std::mt19937 rand;
+    //Food every cell pays per turn; starts at CELL_TURN_FOOD_COST but may be raised to shed load
+    uint64_t turnFoodCost;
+    //Id given to the next cell that is born
+    uint64_t nextId;
+    //Number of completed updates
+    uint64_t tick;
+    //Births, deaths and mutations go here; only written from the thread running the group
+    LineageBuffer lineage;
+    //Connected components of the neighbor graph
+    Organisms organisms;
+    //Distinct programs of living cells
+    GenomeTable genomes;
+    //Running totals since the group was created
+    uint64_t births;
+    uint64_t deaths[DEATH_CAUSES];
+    //Edges currently in the neighbor graph
+    uint64_t edges;
+    //Seconds each phase took in the last update
+    double phaseDurations[GROUP_PHASES];
+    //Food that entered the world through spawn or immigration and left it through emigration
+    uint64_t foodCreated;
+    uint64_t foodRemoved;
+    //Verifies sampled updates when set; not owned
+    InvariantChecker *checker;
+    //Hashes the state after every phase when set; not owned
+    StateHasher *hasher;
+    //Spawned cells start from the selected genomes of this instead of random programs when set; not owned
+    const GenomeLibrary *library;
+    //Threads running the parallel phases; one unpinned worker per hardware thread unless resized before the first
+    //update starts them
+    WorkerPool workers;
+    //Time the parallel phases of the last update took over the time they would have taken if every worker had been
+    //busy for the same time (1 is perfectly balanced)
+    double imbalance;
+    //Chunks of parallel work handed out and stolen
+    ChunkQueues chunks;
+    //Incremented whenever cells move; edge geometry cached under an older version is stale
+    uint64_t positionVersion;
+    //Times the cells were laid out along the curve since the group was created
+    uint64_t relocations;
+    //Splits the world into slabs along x, each updated by its own group in lockstep with the others, when set; not
+    //owned
+    //Every group of a domain starts from the same seed, draws the same from rand and counts the same ids, but only
+    //owns the cells in its slab, so together they go exactly the way one group updating the whole world would
+    Domain *domain;
+    //Slab this group updates when it is part of a domain
+    unsigned slab;
+    //Copies of the cells of other slabs that are close enough along x to connect to cells of this slab or that are
+    //connected to them; refreshed by their owners every update
+    std::list<Cell> ghosts;
+    //Food that came from and went to other slabs: with cells that moved, eaten, sent and given to children
+    uint64_t foodImported;
+    uint64_t foodExported;
+    //Cells that moved between this slab and the others
+    MigrationCounts migrations;
     
     Group(const phi::V3 &dimensions, uint32_t seed);
     
@@ -14,15 +127,151 @@ struct Group {
     void spawn(unsigned amnt);
     
     void updateDeaths();
+    //Connect every cell that decided to connect with all cells within PHYSICS_CONNECT_DISTANCE
+    void connectCells();
+    //Move the cells between their nodes so that memory follows a Morton curve through space and neighbors are close
+    //to each other; the order of the list and every pointer to a cell are kept up to date
+    //When the workers span NUMA nodes, every worker instead copies its cells into nodes it allocates itself, so first
+    //touch puts them on its node, and the old nodes are freed
+    void relocate();
+    
+    //Move a living cell in from or out to another world between updates; neither is a birth or a death
+    //Immigrating returns null and adds nothing if the genome could not be read
+    Cell* immigrate(uint64_t id, const phi::V3 &position, const phi::V3 &velocity, uint64_t food, uint64_t species,
+                    std::istream &genome);
+    std::list<Cell>::iterator emigrate(std::list<Cell>::iterator cell);
     
     //Wrap an origin-centered vector based on the dimensions; changes referenced vector
     void wrapVector(phi::V3 &delta);
     //Determine if the vector is a valid origin-centered vector based on the dimensions
     bool isValid(const phi::V3 &delta);
     
-    double distanceSquared(const Cell &a, const Cell &b);
+    //Cache the wrapped offset and distance from c to a neighbor under the current position version
+    void measure(const Cell &c, Neighbor &n);
+    
+    //Accumulate drag and neighbor forces; reads neighbors, so every cell has to finish before any moves
+    void applyForces(Cell &c);
+    //Move the cell by the accumulated forces
+    void advance(Cell &c);
+    
+    //Share of edges whose cells are handled by workers on different NUMA nodes
+    double crossNodeShare();
+    //Edges between a cell of this slab and a ghost; every slab such an edge joins counts it in edges, so the edges of
+    //the whole world are the sum of edges over the slabs less half the sum of these
+    uint64_t crossEdges() const;
+    
+private:
+    std::chrono::steady_clock::time_point phaseStart;
+    //Whether the checker is verifying the current update
+    bool checking;
+    //Cells sorted along x and cut into chunks of about the same work, which is one plus the degree of each cell
+    //Every worker starts out with the chunks of one region of space
+    std::vector<Cell*> order;
+    std::vector<unsigned> chunkBounds;
+    std::vector<unsigned> workerChunks;
+    std::vector<unsigned> binCounts;
+    //Seconds every worker spent in the current parallel phase and totals over the update
+    std::vector<double> busy;
+    double busiestTotal;
+    double averageTotal;
+    //Set whenever cells were added, removed or moved since the last partition
+    bool reorder;
+    //Cells that died or left and edges that were cut, kept so births and connections reuse them instead of
+    //allocating; only touched by the serial phases
+    std::list<Cell> spareCells;
+    std::list<Neighbor> spareNeighbors;
+    //Cells are relocated once the extra time the neighbor heavy phases took since the last relocation, per unit of
+    //work over what they took right after it, adds up to what relocating cost
+    double relocateSeconds;
+    double localCost;
+    double localExcess;
+    bool relocated;
+    //Curve key of every cell, node addresses in ascending order, the node each cell moves to and the position in
+    //the list each node ends up at
+    std::vector<std::pair<uint64_t, Cell*>> curve;
+    std::vector<Cell*> slots;
+    std::vector<unsigned> destinations;
+    std::vector<unsigned> listOrder;
+    std::vector<bool> placed;
+    //Cells every worker copied into its own nodes and where each cell of slots went
+    std::vector<std::list<Cell>> homes;
+    std::vector<unsigned> homeStarts;
+    std::vector<std::list<Cell>::iterator> rehomed;
+    //Drawn from rand at the start of every update; what cells draw at random during the update comes from streams
+    //keyed on it and their ids, so it does not depend on which slab owns them or the order they are visited in
+    uint64_t salt;
+    //Cells of this slab that mate with the cell they chose and have the lower id of the pair, and those with the
+    //higher id whose partner is a ghost along with the partner
+    std::vector<Cell*> matings;
+    std::vector<std::pair<Cell*, Cell*>> ghostMatings;
+    //Lower ids of the pairs that mate in other slabs
+    std::vector<uint64_t> remoteMatings;
+    //Cells of this slab and ghosts by id; only kept while the group is part of a domain
+    std::unordered_map<uint64_t, std::list<Cell>::iterator> byId;
+    //Messages to and from every other slab, kept to avoid allocating every exchange
+    std::vector<std::string> outgoing;
+    std::vector<std::string> incoming;
+    
+    void partition();
+    unsigned partitionBin(const Cell &c, unsigned bins) const;
+    //Run task on every cell using the workers
+    void forEach(const std::function<void(Cell&)> &task);
+    uint64_t curveKey(const phi::V3 &position) const;
+    //Index of the cell's node in slots
+    unsigned slot(const Cell *c) const;
+    //The two ways relocate lays out memory: moving cells between the nodes they have or into new ones on the node
+    //of the worker that handles them
+    void permute();
+    void rehome();
+    //Weigh the cost of the update that just finished against the last relocation
+    void weighRelocation();
+    
+    //Record the time since the previous phase ended as the duration of this phase
+    void endPhase(GroupPhase phase);
+    
+    //Seed of the stream a cell or pair draws from for one purpose in the current update
+    uint32_t streamSeed(uint64_t id, unsigned purpose) const;
+    //Mate every pair that chose each other; children are numbered in the order of the lower ids of their parents
+    void mate();
+    //Where the child of a is born given the offset from a to its mate
+    phi::V3 birthPlace(const Cell &a, const phi::V3 &toMate, std::mt19937 &stream);
+    //Make the child of a cell a of this slab and its mate b, a cell of this slab or a ghost
+    void bear(Cell &a, Cell &b, uint64_t id);
+    //Make a ghost of the child a ghost a has with the cell b of this slab in a's slab, connected to b
+    void bearGhost(Cell &b, Cell &a, uint64_t id);
     
-    void processPhysics(Cell &c);
+    //Exchanges with the other slabs of the domain (halo.cpp); every group of a domain makes the same ones in the
+    //same order, whether or not it has anything to send
+    //Send cells that left the slab to their new owners, keeping them as ghosts of the cells they leave behind, and
+    //take in the ones that arrived
+    void migrate();
+    //Ask for the ghosts that have edges here and send every slab the cells it asked for or that are near it
+    void refreshGhosts();
+    //Tell the owners of ghosts what the cells here decided about them
+    void shareSignals();
+    void shareDecisions();
+    //Tell the owners of ghosts how often the cells connected to them were eaten, whether they died, their food and
+    //the mates they chose
+    void shareEatenBy();
+    void shareFates();
+    void shareMates();
+    //Count the food eaten from and by ghosts and sent to and from them as imported and exported
+    void countEaten();
+    void countSent();
+    //Tell every slab the lower ids of the pairs mating here, and the owners of ghosts mating with cells here the
+    //programs of those cells
+    void shareMatings();
+    //Cell of this slab or ghost with an id, or null
+    Cell* known(uint64_t id);
+    //Record of the edge from a ghost to a cell of this slab, or null with an error if there is none
+    Neighbor* ghostRecord(uint64_t ghost, uint64_t cell);
+    //Empty ghost from spare cells or a new one
+    Cell& makeGhost(uint64_t id);
+    std::list<Cell>::iterator removeGhost(std::list<Cell>::iterator ghost);
+    //Cut the edge of a record of c and return the next record
+    std::list<Neighbor>::iterator cut(Cell &c, std::list<Neighbor>::iterator n);
+    //Send outgoing to every other slab and receive incoming from each
+    void exchange();
 };
 
 #endif // GROUP_H
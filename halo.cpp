@@ -0,0 +1,558 @@
+#include "group.h"
+#include "domain.h"
+#include "library.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+//Messages between slabs hold the raw bytes of the structs below; every slab runs the same program on the same machine
+
+//Fixed part of a cell that moves to another slab; its genome follows as text and then a record of every edge
+struct Mover {
+    uint64_t id;
+    double position[3];
+    double velocity[3];
+    uint64_t food;
+    uint64_t species;
+    double values[CELL_PERSISTENT_VALUES];
+    uint8_t connect;
+    uint32_t genomeBytes;
+    uint32_t degree;
+};
+
+//What a moving cell decided about the cell at the other end of one of its edges
+struct EdgeRecord {
+    uint64_t neighbor;
+    NeighborDecision decision;
+};
+
+//Everything a slab keeps of a cell another slab owns
+struct GhostState {
+    uint64_t id;
+    double position[3];
+    double velocity[3];
+    uint64_t food;
+    uint64_t species;
+    uint8_t connect;
+};
+
+//What a cell decided about a ghost, for the ghost's owner
+struct EdgeSignal {
+    uint64_t from;
+    uint64_t to;
+    double signal;
+};
+
+struct EdgeDecision {
+    uint64_t from;
+    uint64_t to;
+    NeighborDecision decision;
+};
+
+//Times a cell connected to ghosts was eaten, or the id of the mate it chose
+struct CellCount {
+    uint64_t id;
+    uint64_t count;
+};
+
+//Whether a cell connected to ghosts died in a phase and the food it has left
+struct CellFate {
+    uint64_t id;
+    uint64_t food;
+    uint8_t death;
+    uint8_t cause;
+};
+
+//Id sent for a cell that chose no mate
+#define HALO_NO_MATE ~uint64_t(0)
+
+template <typename T>
+static void put(std::string &message, const T &value) {
+    message.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+//Reads the values of a message back in the order they were put
+struct MessageReader {
+    const std::string &message;
+    size_t at;
+    
+    MessageReader(const std::string &message) : message(message), at(0) {
+    }
+    
+    template <typename T>
+    bool get(T &value) {
+        if (message.size() - at < sizeof(value))
+            return false;
+        memcpy(&value, message.data() + at, sizeof(value));
+        at += sizeof(value);
+        return true;
+    }
+    
+    //The next bytes of the message, or null if it is shorter
+    const char* take(size_t bytes) {
+        if (message.size() - at < bytes)
+            return nullptr;
+        at += bytes;
+        return message.data() + at - bytes;
+    }
+};
+
+//Slabs owning the ghosts a cell is connected to, as a mask
+static uint64_t ghostSlabs(const Cell &c) {
+    uint64_t mask = 0;
+    for (const Neighbor &n : c.neighbors)
+        if (n.neighbor->ghost)
+            mask |= uint64_t(1) << n.neighbor->slab;
+    return mask;
+}
+
+static void putGhost(std::string &message, const Cell &c) {
+    GhostState g;
+    g.id = c.id;
+    g.position[0] = c.particle.position.x;
+    g.position[1] = c.particle.position.y;
+    g.position[2] = c.particle.position.z;
+    g.velocity[0] = c.particle.velocity.x;
+    g.velocity[1] = c.particle.velocity.y;
+    g.velocity[2] = c.particle.velocity.z;
+    g.food = c.food;
+    g.species = c.species;
+    g.connect = c.decision.connect;
+    put(message, g);
+}
+
+void Group::exchange() {
+    domain->exchange(slab, outgoing, incoming);
+    for (std::string &m : outgoing)
+        m.clear();
+}
+
+Cell* Group::known(uint64_t id) {
+    auto i = byId.find(id);
+    return i == byId.end() ? nullptr : &*i->second;
+}
+
+Cell& Group::makeGhost(uint64_t id) {
+    if (spareCells.empty()) {
+        //A ghost's programs are never run and only replaced once its owner sends them for mating, so any will do;
+        //they come from a stream of their own so the group's generator is left alone
+        std::mt19937 placeholder;
+        ghosts.emplace_back(phi::V3(0, 0, 0), phi::V3(0, 0, 0), placeholder);
+    } else
+        ghosts.splice(ghosts.end(), spareCells, spareCells.begin());
+    Cell &g = ghosts.back();
+    g.ghost = true;
+    g.slab = GROUP_NO_SLAB;
+    g.id = id;
+    g.food = 0;
+    g.decision = PersistentDecision();
+    g.changes.clear();
+    byId[id] = std::prev(ghosts.end());
+    return g;
+}
+
+std::list<Cell>::iterator Group::removeGhost(std::list<Cell>::iterator ghost) {
+    edges -= ghost->neighbors.size();
+    ghost->pluck(spareNeighbors);
+    byId.erase(ghost->id);
+    auto next = std::next(ghost);
+    spareCells.splice(spareCells.begin(), ghosts, ghost);
+    return next;
+}
+
+std::list<Neighbor>::iterator Group::cut(Cell &c, std::list<Neighbor>::iterator n) {
+    spareNeighbors.splice(spareNeighbors.begin(), n->neighbor->neighbors, n->neighborsDecision);
+    auto next = std::next(n);
+    spareNeighbors.splice(spareNeighbors.begin(), c.neighbors, n);
+    edges--;
+    return next;
+}
+
+Neighbor* Group::ghostRecord(uint64_t ghost, uint64_t cell) {
+    Cell *g = known(ghost);
+    if (g && g->ghost)
+        for (Neighbor &n : g->neighbors)
+            if (n.neighbor->id == cell)
+                return &n;
+    std::cerr << "Group: Slab " << slab << " has no edge from ghost " << ghost << " to cell " << cell << std::endl;
+    return nullptr;
+}
+
+void Group::migrate() {
+    outgoing.resize(domain->slabs);
+    //Only cells are added or removed between updates, and only by the group, so this only happens when it joined
+    //a domain
+    if (byId.size() != cells.size() + ghosts.size()) {
+        byId.clear();
+        for (auto i = cells.begin(); i != cells.end(); i++)
+            byId[i->id] = i;
+        for (auto i = ghosts.begin(); i != ghosts.end(); i++)
+            byId[i->id] = i;
+    }
+    
+    //Cells that left stay behind as ghosts of the cells they are connected to; their edges to other ghosts no longer
+    //have an end here
+    for (auto i = cells.begin(); i != cells.end(); ) {
+        Cell &c = *i;
+        unsigned to = domain->owner(c.particle.position);
+        if (to == slab) {
+            i++;
+            continue;
+        }
+        std::ostringstream genome;
+        writeGenome(genome, c);
+        std::string programs = genome.str();
+        Mover m;
+        m.id = c.id;
+        m.position[0] = c.particle.position.x;
+        m.position[1] = c.particle.position.y;
+        m.position[2] = c.particle.position.z;
+        m.velocity[0] = c.particle.velocity.x;
+        m.velocity[1] = c.particle.velocity.y;
+        m.velocity[2] = c.particle.velocity.z;
+        m.food = c.food;
+        m.species = c.species;
+        for (unsigned v = 0; v != CELL_PERSISTENT_VALUES; v++)
+            m.values[v] = c.decision.values[v];
+        m.connect = c.decision.connect;
+        m.genomeBytes = programs.size();
+        m.degree = c.neighbors.size();
+        put(outgoing[to], m);
+        outgoing[to] += programs;
+        for (const Neighbor &n : c.neighbors) {
+            EdgeRecord r;
+            r.neighbor = n.neighbor->id;
+            r.decision = n.decision;
+            put(outgoing[to], r);
+        }
+        
+        for (auto n = c.neighbors.begin(); n != c.neighbors.end(); )
+            n = n->neighbor->ghost ? cut(c, n) : std::next(n);
+        organisms.remove(c);
+        genomes.remove(c);
+        foodExported += c.food;
+        migrations.emigrated++;
+        c.ghost = true;
+        c.slab = to;
+        auto next = std::next(i);
+        ghosts.splice(ghosts.end(), cells, i);
+        i = next;
+        reorder = true;
+    }
+    exchange();
+    
+    for (unsigned from = 0; from != incoming.size(); from++) {
+        MessageReader in(incoming[from]);
+        Mover m;
+        while (in.get(m)) {
+            const char *programs = in.take(m.genomeBytes);
+            Cell *arrived = known(m.id);
+            if (!arrived)
+                arrived = &makeGhost(m.id);
+            bool accepted = false;
+            if (!programs || !arrived->ghost)
+                std::cerr << "Group: Cell " << m.id << " moved to slab " << slab << ", which already has it"
+                          << std::endl;
+            else {
+                ProgramsBuffer buffer(programs, m.genomeBytes);
+                std::istream genome(&buffer);
+                accepted = readGenome(genome, *arrived);
+            }
+            if (!accepted) {
+                //Whatever is left of it here is dropped with the ghosts nobody sends
+                if (programs && arrived->ghost) {
+                    std::cerr << "Group: Dropped cell " << m.id << " with " << m.food
+                              << " food, its programs arrived damaged" << std::endl;
+                    migrations.dropped++;
+                    migrations.droppedFood += m.food;
+                }
+                in.take(m.degree * sizeof(EdgeRecord));
+                continue;
+            }
+            
+            Cell &c = *arrived;
+            c.ghost = false;
+            c.particle.position = phi::V3(m.position[0], m.position[1], m.position[2]);
+            c.particle.velocity = phi::V3(m.velocity[0], m.velocity[1], m.velocity[2]);
+            c.food = m.food;
+            c.checkedFood = m.food;
+            c.species = m.species;
+            for (unsigned v = 0; v != CELL_PERSISTENT_VALUES; v++)
+                c.decision.values[v] = m.values[v];
+            c.decision.connect = m.connect;
+            //What the other slabs told it about the cell in the last update is over
+            c.changes.clear();
+            cells.splice(cells.end(), ghosts, byId[c.id]);
+            organisms.add(c);
+            genomes.queue(c);
+            foodImported += c.food;
+            migrations.immigrated++;
+            reorder = true;
+            
+            //Both lists are in the order of the neighbors' ids; records the ghost had of edges the cell no longer
+            //has are cut, and edges to cells this slab does not know yet get ghosts that are sent below
+            auto n = c.neighbors.begin();
+            EdgeRecord r;
+            for (uint32_t e = 0; e != m.degree && in.get(r); e++) {
+                while (n != c.neighbors.end() && n->neighbor->id < r.neighbor)
+                    n = cut(c, n);
+                if (n == c.neighbors.end() || n->neighbor->id != r.neighbor) {
+                    Cell *other = known(r.neighbor);
+                    if (other == &c)
+                        continue;
+                    if (!other)
+                        other = &makeGhost(r.neighbor);
+                    //Goes right before n
+                    connect(c, *other, spareNeighbors);
+                    edges++;
+                    n = std::prev(n);
+                }
+                n->decision = r.decision;
+                if (!n->neighbor->ghost)
+                    organisms.join(c, *n->neighbor);
+                n++;
+            }
+            while (n != c.neighbors.end())
+                n = cut(c, n);
+        }
+    }
+    genomes.flush(workers);
+}
+
+void Group::refreshGhosts() {
+    //Ghosts with edges here, which includes the ones just made for the edges of cells that arrived, are asked for
+    //wherever their owners went; the others are only kept while they are close enough for their owners to send them
+    for (Cell &g : ghosts) {
+        if (!g.neighbors.empty())
+            for (unsigned s = 0; s != outgoing.size(); s++)
+                if (s != slab)
+                    put(outgoing[s], g.id);
+        g.slab = GROUP_NO_SLAB;
+    }
+    exchange();
+    
+    for (const Cell &c : cells)
+        for (unsigned s = 0; s != outgoing.size(); s++)
+            if (s != slab && domain->reach(c.particle.position, s) < DOMAIN_HALO)
+                putGhost(outgoing[s], c);
+    for (unsigned from = 0; from != incoming.size(); from++) {
+        MessageReader in(incoming[from]);
+        uint64_t id;
+        while (in.get(id)) {
+            Cell *c = known(id);
+            if (c && !c->ghost && domain->reach(c->particle.position, from) >= DOMAIN_HALO)
+                putGhost(outgoing[from], *c);
+        }
+    }
+    exchange();
+    
+    for (unsigned from = 0; from != incoming.size(); from++) {
+        MessageReader in(incoming[from]);
+        GhostState state;
+        while (in.get(state)) {
+            Cell *g = known(state.id);
+            if (!g)
+                g = &makeGhost(state.id);
+            else if (!g->ghost) {
+                std::cerr << "Group: Slab " << from << " sent cell " << state.id << ", which slab " << slab
+                          << " owns" << std::endl;
+                continue;
+            }
+            g->slab = from;
+            g->particle.position = phi::V3(state.position[0], state.position[1], state.position[2]);
+            g->particle.velocity = phi::V3(state.velocity[0], state.velocity[1], state.velocity[2]);
+            g->food = state.food;
+            g->checkedFood = state.food;
+            g->species = state.species;
+            g->decision.connect = state.connect;
+            g->changes.clear();
+        }
+    }
+    for (auto i = ghosts.begin(); i != ghosts.end(); ) {
+        if (i->slab != GROUP_NO_SLAB) {
+            i++;
+            continue;
+        }
+        if (!i->neighbors.empty())
+            std::cerr << "Group: No slab sent cell " << i->id << "; cutting its " << i->neighbors.size()
+                      << " edges to slab " << slab << std::endl;
+        i = removeGhost(i);
+    }
+}
+
+void Group::shareSignals() {
+    for (const Cell &c : cells)
+        for (const Neighbor &n : c.neighbors)
+            if (n.neighbor->ghost) {
+                EdgeSignal e;
+                e.from = c.id;
+                e.to = n.neighbor->id;
+                e.signal = n.decision.signal;
+                put(outgoing[n.neighbor->slab], e);
+            }
+    exchange();
+    for (const std::string &message : incoming) {
+        MessageReader in(message);
+        EdgeSignal e;
+        while (in.get(e))
+            if (Neighbor *n = ghostRecord(e.from, e.to))
+                n->decision.signal = e.signal;
+    }
+}
+
+void Group::shareDecisions() {
+    for (const Cell &c : cells)
+        for (const Neighbor &n : c.neighbors)
+            if (n.neighbor->ghost) {
+                EdgeDecision e;
+                e.from = c.id;
+                e.to = n.neighbor->id;
+                e.decision = n.decision;
+                put(outgoing[n.neighbor->slab], e);
+            }
+    exchange();
+    for (const std::string &message : incoming) {
+        MessageReader in(message);
+        EdgeDecision e;
+        while (in.get(e))
+            if (Neighbor *n = ghostRecord(e.from, e.to))
+                n->decision = e.decision;
+    }
+}
+
+void Group::shareEatenBy() {
+    for (const Cell &c : cells) {
+        uint64_t mask = ghostSlabs(c);
+        CellCount count;
+        count.id = c.id;
+        count.count = c.changes.eatenBy;
+        for (unsigned s = 0; mask; s++, mask >>= 1)
+            if (mask & 1)
+                put(outgoing[s], count);
+    }
+    exchange();
+    for (const std::string &message : incoming) {
+        MessageReader in(message);
+        CellCount count;
+        while (in.get(count))
+            if (Cell *g = known(count.id))
+                g->changes.eatenBy = count.count;
+    }
+}
+
+void Group::shareFates() {
+    for (const Cell &c : cells) {
+        uint64_t mask = ghostSlabs(c);
+        CellFate fate;
+        fate.id = c.id;
+        fate.food = c.food;
+        fate.death = c.changes.death;
+        fate.cause = c.changes.cause;
+        for (unsigned s = 0; mask; s++, mask >>= 1)
+            if (mask & 1)
+                put(outgoing[s], fate);
+    }
+    exchange();
+    for (const std::string &message : incoming) {
+        MessageReader in(message);
+        CellFate fate;
+        while (in.get(fate)) {
+            Cell *g = known(fate.id);
+            if (!g)
+                continue;
+            g->food = fate.food;
+            if (fate.death)
+                g->kill(DeathCause(fate.cause));
+        }
+    }
+}
+
+void Group::shareMates() {
+    for (const Cell &c : cells) {
+        uint64_t mask = ghostSlabs(c);
+        CellCount mate;
+        mate.id = c.id;
+        mate.count = c.changes.mate ? c.changes.mate->id : HALO_NO_MATE;
+        for (unsigned s = 0; mask; s++, mask >>= 1)
+            if (mask & 1)
+                put(outgoing[s], mate);
+    }
+    exchange();
+    for (const std::string &message : incoming) {
+        MessageReader in(message);
+        CellCount mate;
+        while (in.get(mate))
+            if (Cell *g = known(mate.id))
+                g->changes.mate = mate.count == HALO_NO_MATE ? nullptr : known(mate.count);
+    }
+}
+
+void Group::shareMatings() {
+    for (unsigned s = 0; s != outgoing.size(); s++) {
+        if (s == slab)
+            continue;
+        put(outgoing[s], uint32_t(matings.size()));
+        for (const Cell *a : matings)
+            put(outgoing[s], a->id);
+    }
+    for (const std::pair<Cell*, Cell*> &m : ghostMatings) {
+        std::ostringstream genome;
+        writeGenome(genome, *m.first);
+        std::string programs = genome.str();
+        std::string &message = outgoing[m.second->slab];
+        put(message, m.first->id);
+        put(message, uint32_t(programs.size()));
+        message += programs;
+    }
+    exchange();
+    
+    for (const std::string &message : incoming) {
+        MessageReader in(message);
+        uint32_t count = 0;
+        in.get(count);
+        uint64_t id;
+        for (uint32_t i = 0; i != count && in.get(id); i++)
+            remoteMatings.push_back(id);
+        uint32_t bytes;
+        while (in.get(id) && in.get(bytes)) {
+            const char *programs = in.take(bytes);
+            Cell *g = known(id);
+            bool read = false;
+            if (programs && g && g->ghost) {
+                ProgramsBuffer buffer(programs, bytes);
+                std::istream genome(&buffer);
+                read = readGenome(genome, *g);
+            }
+            if (!read)
+                std::cerr << "Group: The programs of cell " << id << " did not arrive for mating" << std::endl;
+        }
+    }
+    std::sort(remoteMatings.begin(), remoteMatings.end());
+}
+
+void Group::countEaten() {
+    for (const Cell &c : cells)
+        for (const Neighbor &n : c.neighbors) {
+            if (!n.neighbor->ghost)
+                continue;
+            const Cell &g = *n.neighbor;
+            //An eaten cell hands out shares to the eaters that were not eaten themselves
+            if (c.changes.eatenBy) {
+                if (n.neighborsDecision->decision.eat && !g.changes.eatenBy)
+                    foodExported += c.food / c.changes.eatenBy;
+            } else if (n.decision.eat && g.changes.eatenBy)
+                foodImported += g.food / g.changes.eatenBy;
+        }
+}
+
+void Group::countSent() {
+    for (const Cell &c : cells)
+        for (const Neighbor &n : c.neighbors)
+            if (n.neighbor->ghost) {
+                foodImported += uint64_t(n.neighborsDecision->decision.send);
+                foodExported += uint64_t(n.decision.send);
+            }
+}
+
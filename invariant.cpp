@@ -0,0 +1,235 @@
+#include "invariant.h"
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+void FoodLedger::clear() {
+    start = 0;
+    created = 0;
+    removed = 0;
+    eaten = 0;
+    sent = 0;
+    spent = 0;
+    destroyed = 0;
+    transit = 0;
+    imported = 0;
+    exported = 0;
+}
+
+InvariantChecker::InvariantChecker(uint64_t interval) : interval(interval), checked(0), violations(0),
+                                                         active(false), previous(false) {
+    ledger.clear();
+}
+
+bool InvariantChecker::begin(Group &group) {
+    active = interval && group.tick % interval == 0;
+    if (!active)
+        return false;
+    reported = false;
+    ledger.clear();
+    importedBefore = group.foodImported;
+    exportedBefore = group.foodExported;
+    for (Cell &c : group.cells) {
+        c.checkedFood = c.food;
+        ledger.start += c.food;
+    }
+    //Spawning and migration happen between updates, so they can only be verified when the previous tick was
+    //checked too
+    if (previous && previousTick + 1 == group.tick) {
+        ledger.created = group.foodCreated - previousCreated;
+        ledger.removed = group.foodRemoved - previousRemoved;
+        if (previousTotal + ledger.created - ledger.removed != ledger.start)
+            violation(group, PHASE_PERSISTENT, nullptr, "food after spawning and migration",
+                      previousTotal + ledger.created - ledger.removed, ledger.start);
+    }
+    return true;
+}
+
+void InvariantChecker::consumed(Group &group) {
+    for (Cell &c : group.cells) {
+        uint64_t eatenBy = 0;
+        for (Neighbor &n : c.neighbors)
+            if (n.neighborsDecision->decision.eat)
+                eatenBy++;
+        if (eatenBy != c.changes.eatenBy)
+            violation(group, PHASE_CONSUME, &c, "times eaten", eatenBy, c.changes.eatenBy);
+        
+        if (eatenBy) {
+            if (c.changes.cause != DEATH_EATEN)
+                violation(group, PHASE_CONSUME, &c, "death cause", DEATH_EATEN, c.changes.cause);
+            if (c.food != c.checkedFood)
+                violation(group, PHASE_CONSUME, &c, "food of eaten cell", c.checkedFood, c.food);
+            //Only eaters that were not eaten themselves get their share; the rest of the cell is lost
+            //Ghosts that ate it take their share to their own slabs
+            uint64_t share = c.checkedFood / eatenBy;
+            uint64_t claimed = 0;
+            for (Neighbor &n : c.neighbors)
+                if (n.neighborsDecision->decision.eat && n.neighbor->changes.eatenBy == 0)
+                    claimed += share;
+            ledger.destroyed += c.checkedFood - claimed;
+            continue;
+        }
+        
+        uint64_t gained = 0;
+        uint64_t sent = 0;
+        for (Neighbor &n : c.neighbors) {
+            if (n.decision.eat && n.neighbor->changes.eatenBy)
+                gained += n.neighbor->checkedFood / n.neighbor->changes.eatenBy;
+            sent += uint64_t(n.decision.send);
+        }
+        uint64_t food = c.checkedFood + gained;
+        ledger.eaten += gained;
+        if (sent >= food) {
+            //Everything the cell had is lost when it is removed
+            if (c.changes.cause != DEATH_SENT_FOOD)
+                violation(group, PHASE_CONSUME, &c, "death cause", DEATH_SENT_FOOD, c.changes.cause);
+            if (c.food != food)
+                violation(group, PHASE_CONSUME, &c, "food after eating", food, c.food);
+        } else {
+            if (c.changes.cause != DEATH_NONE)
+                violation(group, PHASE_CONSUME, &c, "death cause", DEATH_NONE, c.changes.cause);
+            if (c.food != food - sent)
+                violation(group, PHASE_CONSUME, &c, "food after eating and sending", food - sent, c.food);
+            ledger.sent += sent;
+            ledger.transit += sent;
+        }
+    }
+    for (Cell &c : group.cells)
+        c.checkedFood = c.food;
+}
+
+void InvariantChecker::received(Group &group) {
+    for (Cell &c : group.cells) {
+        uint64_t received = 0;
+        //Food from ghosts never was in transit here; food sent to ghosts left for their slabs
+        uint64_t local = 0;
+        for (Neighbor &n : c.neighbors) {
+            received += uint64_t(n.neighborsDecision->decision.send);
+            if (n.neighbor->ghost) {
+                uint64_t sent = uint64_t(n.decision.send);
+                if (sent > ledger.transit)
+                    violation(group, PHASE_FOOD, &c, "sent to other slabs more than was sent", ledger.transit, sent);
+                else
+                    ledger.transit -= sent;
+            } else
+                local += uint64_t(n.neighborsDecision->decision.send);
+        }
+        if (c.food != c.checkedFood + received)
+            violation(group, PHASE_FOOD, &c, "food after receiving", c.checkedFood + received, c.food);
+        if (local > ledger.transit)
+            violation(group, PHASE_FOOD, &c, "received more than was sent", ledger.transit, local);
+        else
+            ledger.transit -= local;
+        c.checkedFood = c.food;
+    }
+    //Whatever is left was sent to cells that died before they could receive it
+    ledger.destroyed += ledger.transit;
+    ledger.transit = 0;
+}
+
+void InvariantChecker::starved(Group &group) {
+    for (Cell &c : group.cells) {
+        uint64_t cost = group.turnFoodCost;
+        for (Neighbor &n : c.neighbors) {
+            double potentialCost = std::abs(n.decision.force) * CELL_ACCELERATION_FOOD_COST_COEFFICIENT;
+            if (potentialCost > CELL_MAX_FOOD_VALUE)
+                cost += CELL_MAX_FOOD_VALUE;
+            else
+                cost += uint64_t(potentialCost);
+        }
+        if (c.checkedFood <= cost) {
+            if (c.changes.cause != DEATH_STARVED)
+                violation(group, PHASE_FOOD, &c, "death cause", DEATH_STARVED, c.changes.cause);
+            if (c.food != c.checkedFood)
+                violation(group, PHASE_FOOD, &c, "food of starved cell", c.checkedFood, c.food);
+        } else {
+            if (c.changes.cause != DEATH_NONE)
+                violation(group, PHASE_FOOD, &c, "death cause", DEATH_NONE, c.changes.cause);
+            if (c.food != c.checkedFood - cost)
+                violation(group, PHASE_FOOD, &c, "food after paying costs", c.checkedFood - cost, c.food);
+            ledger.spent += cost;
+        }
+        c.checkedFood = c.food;
+    }
+}
+
+void InvariantChecker::died(const Cell &c) {
+    //Eaten cells were accounted for when their food was handed out
+    if (c.changes.cause != DEATH_EATEN)
+        ledger.destroyed += c.food;
+}
+
+void InvariantChecker::endPhase(Group &group, GroupPhase phase) {
+    checkEdges(group, phase);
+    checkBalance(group, phase);
+    if (phase == PHASE_MUTATE) {
+        active = false;
+        checked++;
+        previous = true;
+        previousTick = group.tick;
+        previousTotal = 0;
+        for (const Cell &c : group.cells)
+            previousTotal += c.food;
+        previousCreated = group.foodCreated;
+        previousRemoved = group.foodRemoved;
+    }
+}
+
+void InvariantChecker::checkEdges(Group &group, GroupPhase phase) {
+    uint64_t ends = 0;
+    for (Cell &c : group.cells)
+        for (Neighbor &n : c.neighbors) {
+            ends++;
+            if (n.neighbor == &c)
+                violation(group, phase, &c, "connected to itself");
+            else if (&*n.neighborsDecision->neighborsDecision != &n || n.neighborsDecision->neighbor != &c)
+                violation(group, phase, &c, "edge does not point back");
+            else if (n.neighbor->changes.death)
+                violation(group, phase, &c, "connected to a dead cell");
+        }
+    //Edges to ghosts only have their end of this slab here
+    ends += group.crossEdges();
+    if (ends != 2 * group.edges)
+        violation(group, phase, nullptr, "edge ends", 2 * group.edges, ends);
+}
+
+void InvariantChecker::checkBalance(Group &group, GroupPhase phase) {
+    uint64_t total = 0;
+    for (const Cell &c : group.cells)
+        total += c.food;
+    //Kept as a sum so nothing underflows: everything at the start or brought in from other slabs is still held, in
+    //transit, spent, destroyed or taken to other slabs
+    ledger.imported = group.foodImported - importedBefore;
+    ledger.exported = group.foodExported - exportedBefore;
+    uint64_t accounted = total + ledger.transit + ledger.spent + ledger.destroyed + ledger.exported;
+    if (accounted != ledger.start + ledger.imported)
+        violation(group, phase, nullptr, "accounted food", ledger.start + ledger.imported, accounted);
+}
+
+void InvariantChecker::violation(const Group &group, GroupPhase phase, const Cell *c, const char *what) {
+    violations++;
+    if (reported)
+        return;
+    reported = true;
+    std::cerr << "InvariantChecker: Tick " << group.tick << ", phase " << groupPhaseNames[phase];
+    if (c)
+        std::cerr << ", cell " << c->id;
+    std::cerr << ": " << what << std::endl;
+#ifndef NDEBUG
+    //Stop where the state can still be inspected
+    abort();
+#endif
+}
+
+void InvariantChecker::violation(const Group &group, GroupPhase phase, const Cell *c, const char *what,
+                                 uint64_t expected, uint64_t found) {
+    if (reported) {
+        violations++;
+        return;
+    }
+    std::ostringstream message;
+    message << what << " is " << found << " instead of " << expected;
+    violation(group, phase, c, message.str().c_str());
+}
+
@@ -0,0 +1,78 @@
+#ifndef INVARIANT_H
+#define INVARIANT_H
+
+#include "group.h"
+
+//Where the food of one checked tick went
+struct FoodLedger {
+    //Food held by cells when the tick started
+    uint64_t start;
+    //Food spawned or immigrated and food emigrated since the previous tick when that tick was also checked
+    uint64_t created;
+    uint64_t removed;
+    //Moved from eaten cells to the cells that ate them
+    uint64_t eaten;
+    //Moved between neighbors by sending
+    uint64_t sent;
+    //Paid as turn and movement costs
+    uint64_t spent;
+    //Lost with dead cells, as leftovers of eaten cells and when sent to a cell that died
+    uint64_t destroyed;
+    //Sent but not yet received
+    uint64_t transit;
+    //Came from and went to other slabs of a domain during the tick
+    uint64_t imported;
+    uint64_t exported;
+    
+    void clear();
+};
+
+//Checks that food is conserved and that the neighbor graph is symmetric while a group updates
+//Checked ticks recompute every food transfer from the decisions and compare it against what the cells did,
+//so a tick costs about as much again as the update; unchecked ticks only cost a branch per phase
+struct InvariantChecker {
+    //Ticks between checked ticks (0 disables checking)
+    uint64_t interval;
+    //Totals since the checker was created
+    uint64_t checked;
+    uint64_t violations;
+    //Whether the tick being run is checked
+    bool active;
+    //Ledger of the last checked tick
+    FoodLedger ledger;
+    
+    InvariantChecker(uint64_t interval);
+    
+    //Called by the group at the start of every update; returns whether this tick is checked
+    bool begin(Group &group);
+    //Called by the group before it removes cells that died in each phase
+    void consumed(Group &group);
+    void received(Group &group);
+    void starved(Group &group);
+    //Called by the group for every cell it removes
+    void died(const Cell &c);
+    //Called by the group after every phase
+    void endPhase(Group &group, GroupPhase phase);
+    
+private:
+    //State of the previous checked tick used to verify spawning between two checked ticks
+    bool previous;
+    uint64_t previousTick;
+    uint64_t previousTotal;
+    uint64_t previousCreated;
+    uint64_t previousRemoved;
+    //Only the first violation of a tick is reported
+    bool reported;
+    //Food the group counted as imported and exported when the tick started
+    uint64_t importedBefore;
+    uint64_t exportedBefore;
+    
+    void checkEdges(Group &group, GroupPhase phase);
+    void checkBalance(Group &group, GroupPhase phase);
+    void violation(const Group &group, GroupPhase phase, const Cell *c, const char *what);
+    void violation(const Group &group, GroupPhase phase, const Cell *c, const char *what, uint64_t expected,
+                   uint64_t found);
+};
+
+#endif // INVARIANT_H
+
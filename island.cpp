@@ -0,0 +1,125 @@
+#include "island.h"
+#include "simulation.h"
+#include <algorithm>
+#include <iostream>
+#include <new>
+#include <sys/mman.h>
+
+bool parseTopology(const std::string &name, IslandTopology &topology) {
+    if (name == "ring")
+        topology = ISLAND_RING;
+    else if (name == "full")
+        topology = ISLAND_FULL;
+    else if (name == "random")
+        topology = ISLAND_RANDOM;
+    else
+        return false;
+    return true;
+}
+
+Island::Island(Archipelago &archipelago, unsigned index, uint32_t seed) : index(index), archipelago(archipelago),
+               rand(seed) {
+}
+
+void Island::exchange(Group &group) {
+    unsigned count = archipelago.islands.size();
+    for (unsigned from = 0; from != count; from++) {
+        if (from == index)
+            continue;
+        ShmRing r = archipelago.ring(from, index);
+        while (r.pop(message))
+            unpackMigrant(message, group, migrations);
+    }
+    if (count < 2 || group.tick % archipelago.interval)
+        return;
+    
+    destinations.clear();
+    switch (archipelago.topology) {
+    case ISLAND_RING:
+        destinations.push_back((index + 1) % count);
+        break;
+    case ISLAND_FULL:
+        for (unsigned to = 0; to != count; to++)
+            if (to != index)
+                destinations.push_back(to);
+        break;
+    case ISLAND_RANDOM:
+        destinations.push_back((index + 1 + rand() % (count - 1)) % count);
+        break;
+    }
+    
+    //Migrants are drawn at random without repeats, so no cell is sent to two islands
+    candidates.clear();
+    for (auto i = group.cells.begin(); i != group.cells.end(); i++)
+        candidates.push_back(i);
+    unsigned picked = 0;
+    bool left = false;
+    for (unsigned to : destinations) {
+        ShmRing r = archipelago.ring(index, to);
+        for (unsigned m = 0; m != archipelago.migrants && picked != candidates.size(); m++) {
+            std::swap(candidates[picked], candidates[picked + rand() % (candidates.size() - picked)]);
+            auto cell = candidates[picked];
+            packMigrant(*cell, message);
+            //A cell that does not fit stays where it is and may still go to the next destination; this one is full
+            if (!r.push(message)) {
+                migrations.blocked++;
+                break;
+            }
+            picked++;
+            group.emigrate(cell);
+            migrations.emigrated++;
+            left = true;
+        }
+    }
+    //Organisms that lost cells are only rebuilt during updates otherwise
+    if (left)
+        group.organisms.rebuild();
+}
+
+Archipelago::Archipelago(const phi::V3 &dimensions, unsigned count, IslandTopology topology, unsigned interval,
+                         unsigned migrants) : topology(topology), interval(std::max(1u, interval)),
+                         migrants(migrants), dimensions(dimensions), count(count) {
+    //Pages of rings no migrant is ever sent through are never touched, so every pair can have one
+    length = size_t(count) * count * (sizeof(RingHeader) + ISLAND_RING_BYTES);
+    memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        std::cerr << "Archipelago: Failed to map " << length << " bytes for the migration rings" << std::endl;
+        exit(1);
+    }
+    for (unsigned from = 0; from != count; from++)
+        for (unsigned to = 0; to != count; to++) {
+            ShmRing r = ring(from, to);
+            new (r.header) RingHeader;
+            r.header->head = 0;
+            r.header->tail = 0;
+        }
+}
+
+Archipelago::~Archipelago() {
+    //The simulations push into the rings until they stop
+    simulations.clear();
+    munmap(memory, length);
+}
+
+void Archipelago::start(uint32_t seed, double tickRate, unsigned workers) {
+    for (unsigned i = 0; i != count; i++)
+        islands.emplace_back(new Island(*this, i, seed + i));
+    for (unsigned i = 1; i != count; i++) {
+        Simulation *sim = new Simulation(dimensions, seed + i, tickRate);
+        simulations.emplace_back(sim);
+        sim->group.nextId = uint64_t(i) << DOMAIN_ID_SHIFT;
+        sim->group.workers.resize(workers, AffinityMap());
+        sim->island = islands[i].get();
+        sim->start();
+    }
+}
+
+ShmRing Archipelago::ring(unsigned from, unsigned to) {
+    ShmRing r;
+    size_t stride = sizeof(RingHeader) + ISLAND_RING_BYTES;
+    r.header = (RingHeader*)((uint8_t*)memory + (size_t(from) * count + to) * stride);
+    r.data = (uint8_t*)(r.header + 1);
+    r.capacity = ISLAND_RING_BYTES;
+    return r;
+}
+
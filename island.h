@@ -0,0 +1,79 @@
+#ifndef ISLAND_H
+#define ISLAND_H
+
+#include "domain.h"
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+//Bytes of the ring carrying migrants from one island to another
+#define ISLAND_RING_BYTES (1 << 16)
+
+//Which islands the migrants of an island go to
+enum IslandTopology {
+    //The next island, wrapping around
+    ISLAND_RING,
+    //Every other island
+    ISLAND_FULL,
+    //One other island picked at random for every migration
+    ISLAND_RANDOM
+};
+
+//Parse "ring", "full" or "random"; returns false for anything else
+bool parseTopology(const std::string &name, IslandTopology &topology);
+
+struct Archipelago;
+struct Simulation;
+
+//Sends cells of one island to others every interval ticks and takes in the cells sent to it; only used from the
+//thread of that island's simulation
+struct Island {
+    unsigned index;
+    //Cells that moved between this island and the others
+    MigrationCounts migrations;
+    
+    Island(Archipelago &archipelago, unsigned index, uint32_t seed);
+    
+    //Called between updates
+    void exchange(Group &group);
+    
+private:
+    Archipelago &archipelago;
+    std::mt19937 rand;
+    std::string message;
+    std::vector<unsigned> destinations;
+    std::vector<std::list<Cell>::iterator> candidates;
+};
+
+//Evolves separate worlds on their own threads, each with its own group and workers, that trade a few cells now and
+//then so species that won one island get to compete on the others
+//Every pair of islands has its own single producer, single consumer ring, so migration needs no locks and no island
+//ever waits for another
+struct Archipelago {
+    IslandTopology topology;
+    //Ticks between migrations and cells sent to every destination
+    unsigned interval;
+    unsigned migrants;
+    std::vector<std::unique_ptr<Island>> islands;
+    
+    Archipelago(const phi::V3 &dimensions, unsigned count, IslandTopology topology, unsigned interval,
+                unsigned migrants);
+    ~Archipelago();
+    
+    //Make the islands and start a headless simulation with the given workers for every island but the first, which
+    //is left to the caller to attach to its own simulation
+    void start(uint32_t seed, double tickRate, unsigned workers);
+    //Ring carrying cells from one island to another
+    ShmRing ring(unsigned from, unsigned to);
+    
+private:
+    phi::V3 dimensions;
+    unsigned count;
+    void *memory;
+    size_t length;
+    std::vector<std::unique_ptr<Simulation>> simulations;
+};
+
+#endif // ISLAND_H
+
@@ -0,0 +1,341 @@
+#include "library.h"
+#include "genome.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char LIBRARY_MAGIC[8] = {'E', 'V', 'O', 'G', 'L', 'I', 'B', '1'};
+//Magic, genome count
+static const size_t HEADER_SIZE = 8 + 8;
+//Tag, species, fitness, tick, programs offset, programs length
+static const size_t ENTRY_SIZE = LIBRARY_TAG_BYTES + 5 * 8;
+static const size_t ENTRY_SPECIES = LIBRARY_TAG_BYTES;
+static const size_t ENTRY_FITNESS = LIBRARY_TAG_BYTES + 8;
+static const size_t ENTRY_TICK = LIBRARY_TAG_BYTES + 16;
+static const size_t ENTRY_OFFSET = LIBRARY_TAG_BYTES + 24;
+static const size_t ENTRY_LENGTH = LIBRARY_TAG_BYTES + 32;
+
+template <typename T>
+static void putRaw(std::vector<uint8_t> &out, T value) {
+    uint8_t bytes[sizeof(T)];
+    memcpy(bytes, &value, sizeof(T));
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+static T getRaw(const uint8_t *in) {
+    T value;
+    memcpy(&value, in, sizeof(T));
+    return value;
+}
+
+//Tag padded with zeros to its stored size, so tags compare with memcmp
+static std::string packTag(const std::string &tag) {
+    std::string packed = tag.substr(0, LIBRARY_TAG_BYTES);
+    packed.resize(LIBRARY_TAG_BYTES, '\0');
+    return packed;
+}
+
+GenomeLibrary::GenomeLibrary() : data(nullptr), length(0), count(0), order(nullptr), first(0), range(0) {
+}
+
+GenomeLibrary::~GenomeLibrary() {
+    close();
+}
+
+bool GenomeLibrary::open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "GenomeLibrary: Failed to open " << path << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) || size_t(info.st_size) < HEADER_SIZE) {
+        std::cerr << "GenomeLibrary: " << path << " is too small to be a genome library" << std::endl;
+        ::close(fd);
+        return false;
+    }
+    length = info.st_size;
+    void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "GenomeLibrary: Failed to map " << path << std::endl;
+        length = 0;
+        return false;
+    }
+    data = (const uint8_t*)mapped;
+    
+    uint64_t total = getRaw<uint64_t>(data + 8);
+    if (memcmp(data, LIBRARY_MAGIC, sizeof(LIBRARY_MAGIC)) || total > (length - HEADER_SIZE) / (ENTRY_SIZE + 4)) {
+        std::cerr << "GenomeLibrary: " << path << " is not a genome library" << std::endl;
+        close();
+        return false;
+    }
+    count = total;
+    select("", 0);
+    return true;
+}
+
+void GenomeLibrary::close() {
+    if (data)
+        munmap((void*)data, length);
+    data = nullptr;
+    length = 0;
+    count = 0;
+    order = nullptr;
+    first = 0;
+    range = 0;
+}
+
+unsigned GenomeLibrary::size() const {
+    return count;
+}
+
+unsigned GenomeLibrary::selected() const {
+    return range;
+}
+
+const uint8_t* GenomeLibrary::entry(unsigned index) const {
+    return data + HEADER_SIZE + size_t(index) * ENTRY_SIZE;
+}
+
+bool GenomeLibrary::select(const std::string &tag, unsigned best) {
+    if (tag.empty()) {
+        order = data ? entry(count) : nullptr;
+        first = 0;
+        range = count;
+    } else {
+        //The entries of a tag are a run, found by searching for both of its ends
+        std::string key = packTag(tag);
+        unsigned low = 0, high = count;
+        while (low != high) {
+            unsigned middle = low + (high - low) / 2;
+            if (memcmp(entry(middle), key.data(), LIBRARY_TAG_BYTES) < 0)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        unsigned end = low;
+        high = count;
+        while (end != high) {
+            unsigned middle = end + (high - end) / 2;
+            if (memcmp(entry(middle), key.data(), LIBRARY_TAG_BYTES) <= 0)
+                end = middle + 1;
+            else
+                high = middle;
+        }
+        order = nullptr;
+        first = low;
+        range = end - low;
+    }
+    //Both runs are sorted from the fittest down
+    if (best)
+        range = std::min(range, best);
+    return range != 0;
+}
+
+bool GenomeLibrary::draw(std::mt19937 &rand, uint64_t &species, const char *&programs, size_t &bytes) const {
+    if (!range)
+        return false;
+    unsigned position = first + rand() % range;
+    unsigned index = order ? getRaw<uint32_t>(order + size_t(position) * 4) : position;
+    if (index >= count)
+        return false;
+    const uint8_t *e = entry(index);
+    uint64_t offset = getRaw<uint64_t>(e + ENTRY_OFFSET);
+    uint64_t size = getRaw<uint64_t>(e + ENTRY_LENGTH);
+    if (offset > length || size > length - offset)
+        return false;
+    species = getRaw<uint64_t>(e + ENTRY_SPECIES);
+    programs = (const char*)data + offset;
+    bytes = size;
+    return true;
+}
+
+bool GenomeLibrary::merge(std::vector<LibraryGenome> &added, FILE *out) const {
+    //Sorted like the entries, keeping only the fittest genome of every species and tag
+    for (LibraryGenome &g : added)
+        g.tag = packTag(g.tag);
+    std::sort(added.begin(), added.end(), [](const LibraryGenome &a, const LibraryGenome &b){
+        if (a.tag != b.tag)
+            return a.tag < b.tag;
+        if (a.fitness != b.fitness)
+            return a.fitness > b.fitness;
+        return a.species < b.species;
+    });
+    std::set<std::pair<std::string, uint64_t>> replaced;
+    added.erase(std::remove_if(added.begin(), added.end(), [&](const LibraryGenome &g){
+        return !replaced.insert(std::make_pair(g.tag, g.species)).second;
+    }), added.end());
+    auto kept = [&](unsigned index){
+        const uint8_t *e = entry(index);
+        return !replaced.count(std::make_pair(std::string((const char*)e, LIBRARY_TAG_BYTES),
+                                              getRaw<uint64_t>(e + ENTRY_SPECIES)));
+    };
+    
+    //Entries of the new library as old entry indices, or count plus the index into added
+    std::vector<unsigned> entries;
+    std::vector<unsigned> renumbered(count + added.size());
+    unsigned a = 0;
+    for (unsigned i = 0; i <= count; i++) {
+        while (a != added.size()) {
+            int tag = i == count ? -1 : memcmp(added[a].tag.data(), entry(i), LIBRARY_TAG_BYTES);
+            if (tag > 0 || (tag == 0 && added[a].fitness < getRaw<uint64_t>(entry(i) + ENTRY_FITNESS)))
+                break;
+            renumbered[count + a] = entries.size();
+            entries.push_back(count + a++);
+        }
+        if (i != count && kept(i)) {
+            renumbered[i] = entries.size();
+            entries.push_back(i);
+        }
+    }
+    //Then the same in order of fitness alone
+    std::vector<unsigned> byFitness(added.size());
+    for (unsigned i = 0; i != added.size(); i++)
+        byFitness[i] = i;
+    std::sort(byFitness.begin(), byFitness.end(), [&](unsigned x, unsigned y){
+        return added[x].fitness > added[y].fitness;
+    });
+    const uint8_t *oldOrder = data ? entry(count) : nullptr;
+    std::vector<uint8_t> fitnessOrder;
+    fitnessOrder.reserve(size_t(entries.size()) * 4);
+    a = 0;
+    for (unsigned i = 0; i <= count; i++) {
+        unsigned index = count;
+        if (i != count) {
+            index = getRaw<uint32_t>(oldOrder + size_t(i) * 4);
+            if (index >= count)
+                return false;
+        }
+        while (a != added.size() && (index == count ||
+                                     added[byFitness[a]].fitness >= getRaw<uint64_t>(entry(index) + ENTRY_FITNESS)))
+            putRaw<uint32_t>(fitnessOrder, renumbered[count + byFitness[a++]]);
+        if (index != count && kept(index))
+            putRaw<uint32_t>(fitnessOrder, renumbered[index]);
+    }
+    
+    std::vector<uint8_t> bytes(LIBRARY_MAGIC, LIBRARY_MAGIC + sizeof(LIBRARY_MAGIC));
+    putRaw<uint64_t>(bytes, entries.size());
+    uint64_t offset = HEADER_SIZE + entries.size() * (ENTRY_SIZE + 4);
+    for (unsigned source : entries) {
+        const uint8_t *e = source < count ? entry(source) : nullptr;
+        const LibraryGenome *g = source < count ? nullptr : &added[source - count];
+        uint64_t size = g ? g->programs.size() : getRaw<uint64_t>(e + ENTRY_LENGTH);
+        if (e) {
+            bytes.insert(bytes.end(), e, e + LIBRARY_TAG_BYTES);
+            putRaw<uint64_t>(bytes, getRaw<uint64_t>(e + ENTRY_SPECIES));
+            putRaw<uint64_t>(bytes, getRaw<uint64_t>(e + ENTRY_FITNESS));
+            putRaw<uint64_t>(bytes, getRaw<uint64_t>(e + ENTRY_TICK));
+        } else {
+            bytes.insert(bytes.end(), g->tag.begin(), g->tag.end());
+            putRaw<uint64_t>(bytes, g->species);
+            putRaw<uint64_t>(bytes, g->fitness);
+            putRaw<uint64_t>(bytes, g->tick);
+        }
+        putRaw<uint64_t>(bytes, offset);
+        putRaw<uint64_t>(bytes, size);
+        offset += size;
+    }
+    if (fwrite(bytes.data(), 1, bytes.size(), out) != bytes.size() ||
+            fwrite(fitnessOrder.data(), 1, fitnessOrder.size(), out) != fitnessOrder.size())
+        return false;
+    
+    //Programs of the old entries are copied straight from the mapping
+    for (unsigned source : entries) {
+        const void *programs;
+        size_t size;
+        if (source < count) {
+            const uint8_t *e = entry(source);
+            uint64_t from = getRaw<uint64_t>(e + ENTRY_OFFSET);
+            size = getRaw<uint64_t>(e + ENTRY_LENGTH);
+            if (from > length || size > length - from)
+                return false;
+            programs = data + from;
+        } else {
+            programs = added[source - count].programs.data();
+            size = added[source - count].programs.size();
+        }
+        if (fwrite(programs, 1, size, out) != size)
+            return false;
+    }
+    return true;
+}
+
+GenomeExporter::GenomeExporter(const std::string &path, const std::string &tag, uint64_t interval, unsigned species) :
+                               path(path), tag(tag), interval(interval), species(species), completed(0), failed(0),
+                               running(false) {
+}
+
+GenomeExporter::~GenomeExporter() {
+    wait();
+}
+
+void GenomeExporter::tick(Group &group) {
+    if (running || !interval || group.tick % interval)
+        return;
+    wait();
+    
+    census.take(group);
+    unsigned n = std::min(size_t(species), census.heaviest.size());
+    //The cell with the most food stands for its species
+    std::vector<const Cell*> best(n, nullptr);
+    for (const Cell &c : group.cells)
+        for (unsigned i = 0; i != n; i++)
+            if (c.species == census.heaviest[i].species) {
+                if (!best[i] || c.food > best[i]->food)
+                    best[i] = &c;
+                break;
+            }
+    genomes.clear();
+    for (unsigned i = 0; i != n; i++) {
+        if (!best[i])
+            continue;
+        LibraryGenome g;
+        g.tag = tag;
+        g.species = census.heaviest[i].species;
+        g.fitness = census.heaviest[i].cells;
+        g.tick = group.tick;
+        std::ostringstream programs;
+        writeGenome(programs, *best[i]);
+        g.programs = programs.str();
+        genomes.push_back(std::move(g));
+    }
+    running = true;
+    thread = std::thread(&GenomeExporter::write, this);
+}
+
+void GenomeExporter::wait() {
+    if (thread.joinable())
+        thread.join();
+}
+
+void GenomeExporter::write() {
+    //A library that does not exist yet starts out empty, but one that cannot be read is never overwritten
+    GenomeLibrary library;
+    bool ok = access(path.c_str(), F_OK) || library.open(path);
+    std::string temporary = path + ".tmp";
+    FILE *file = ok ? fopen(temporary.c_str(), "wb") : nullptr;
+    ok = file && library.merge(genomes, file);
+    if (file && fclose(file))
+        ok = false;
+    if (ok && rename(temporary.c_str(), path.c_str()))
+        ok = false;
+    if (ok)
+        completed++;
+    else {
+        std::cerr << "GenomeExporter: Failed to add " << genomes.size() << " genomes to " << path << std::endl;
+        if (file)
+            remove(temporary.c_str());
+        failed++;
+    }
+    running = false;
+}
+
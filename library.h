@@ -0,0 +1,105 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include "group.h"
+#include "census.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Bytes a tag is stored in; longer tags are cut short
+#define LIBRARY_TAG_BYTES 16
+
+//One genome on its way into a library
+struct LibraryGenome {
+    std::string tag;
+    uint64_t species;
+    //Cells of the species when it was exported
+    uint64_t fitness;
+    uint64_t tick;
+    //Programs as written by writeGenome
+    std::string programs;
+};
+
+//Genomes kept in a file that is mapped rather than read, so opening it takes the same time however many it holds
+//The file is a header, fixed-size entries sorted by tag and then fitness, the entries in order of fitness alone and
+//the programs of every entry; the programs of a genome are only parsed when a cell is spawned from it
+struct GenomeLibrary {
+    GenomeLibrary();
+    ~GenomeLibrary();
+    
+    //Returns false if the file could not be opened or is not a genome library; selects every genome it holds
+    bool open(const std::string &path);
+    void close();
+    
+    //Genomes in the file and genomes draw picks from
+    unsigned size() const;
+    unsigned selected() const;
+    //Only draw the best genomes stored under tag, or the best of all tags if tag is empty (0 for all of them)
+    //Returns false if no genome matches
+    bool select(const std::string &tag, unsigned best);
+    //Pick one of the selected genomes at random; returns false if none is selected or the entry is damaged
+    bool draw(std::mt19937 &rand, uint64_t &species, const char *&programs, size_t &bytes) const;
+    
+    //Write the genomes of the library merged with added to out as a new library; a genome of added replaces the one
+    //of the same species and tag; returns false if writing failed
+    bool merge(std::vector<LibraryGenome> &added, FILE *out) const;
+    
+private:
+    const uint8_t *data;
+    size_t length;
+    unsigned count;
+    //Selected genomes are either a run of entries or a run of the fitness order
+    const uint8_t *order;
+    unsigned first;
+    unsigned range;
+    
+    const uint8_t* entry(unsigned index) const;
+};
+
+//Reads the programs of a drawn genome in place for the Cell constructor
+struct ProgramsBuffer : std::streambuf {
+    ProgramsBuffer(const char *programs, size_t bytes) {
+        char *begin = const_cast<char*>(programs);
+        setg(begin, begin, begin + bytes);
+    }
+};
+
+//Adds a genome of each of the heaviest species to a library every interval ticks
+//The programs are copied out on the simulation thread, which is the only part that touches the group; merging them
+//into the library and writing it happen on a thread of their own, and the new file replaces the old one in one
+//rename, so libraries that are open elsewhere keep working
+struct GenomeExporter {
+    std::string path;
+    std::string tag;
+    uint64_t interval;
+    unsigned species;
+    //Exports that were written and that failed since the exporter was created
+    std::atomic<uint64_t> completed;
+    std::atomic<uint64_t> failed;
+    
+    GenomeExporter(const std::string &path, const std::string &tag, uint64_t interval, unsigned species);
+    //Waits for an export that is still being written
+    ~GenomeExporter();
+    
+    //Called between updates; starts an export when the interval is up unless the previous one is still running
+    void tick(Group &group);
+    //Block until the running export, if any, is done
+    void wait();
+    
+private:
+    std::thread thread;
+    std::atomic<bool> running;
+    Census census;
+    std::vector<LibraryGenome> genomes;
+    
+    void write();
+};
+
+#endif // LIBRARY_H
+
@@ -0,0 +1,264 @@
+#include "lineage.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+static const char FILE_MAGIC[8] = {'E', 'V', 'O', 'L', 'I', 'N', 'E', '1'};
+
+//Events are stored as a type byte (cause in the high nibble), the tick relative to the previous event in the chunk
+//and the id, followed by parents relative to the id and the species where the event has them
+static void putVarint(std::vector<uint8_t> &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(uint8_t(value));
+}
+
+static bool getVarint(const std::vector<uint8_t> &in, size_t &position, uint64_t &value) {
+    value = 0;
+    for (unsigned shift = 0; position != in.size() && shift < 64; shift += 7) {
+        uint8_t byte = in[position++];
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static void putSpecies(std::vector<uint8_t> &out, uint64_t species) {
+    for (unsigned i = 0; i != 8; i++)
+        out.push_back(uint8_t(species >> (i * 8)));
+}
+
+static bool getSpecies(const std::vector<uint8_t> &in, size_t &position, uint64_t &species) {
+    if (in.size() - position < 8)
+        return false;
+    species = 0;
+    for (unsigned i = 0; i != 8; i++)
+        species |= uint64_t(in[position++]) << (i * 8);
+    return true;
+}
+
+LineageLog::LineageLog(const std::string &path) : running(true), full(nullptr), spares(nullptr) {
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "LineageLog: Failed to open " << path << std::endl;
+        exit(1);
+    }
+    fwrite(FILE_MAGIC, 1, sizeof(FILE_MAGIC), file);
+    thread = std::thread(&LineageLog::run, this);
+}
+
+LineageLog::~LineageLog() {
+    running = false;
+    thread.join();
+    drain();
+    fclose(file);
+    for (LineageChunk *c : owned)
+        delete c;
+}
+
+void LineageLog::push(std::atomic<LineageChunk*> &stack, LineageChunk *chunk) {
+    chunk->next = stack.load(std::memory_order_relaxed);
+    while (!stack.compare_exchange_weak(chunk->next, chunk, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void LineageLog::submit(LineageChunk *chunk) {
+    push(full, chunk);
+}
+
+LineageChunk* LineageLog::spare() {
+    LineageChunk *c = spares.exchange(nullptr, std::memory_order_acquire);
+    if (!c) {
+        //Only the writer frees chunks, so new ones are remembered by it through the chunk itself
+        c = new LineageChunk;
+        c->next = nullptr;
+        c->bytes.reserve(LINEAGE_CHUNK_BYTES);
+        return c;
+    }
+    //Put back everything but the first spare
+    if (c->next) {
+        LineageChunk *rest = c->next;
+        LineageChunk *tail = rest;
+        while (tail->next)
+            tail = tail->next;
+        tail->next = spares.load(std::memory_order_relaxed);
+        while (!spares.compare_exchange_weak(tail->next, rest, std::memory_order_release,
+                                             std::memory_order_relaxed));
+    }
+    c->next = nullptr;
+    return c;
+}
+
+void LineageLog::run() {
+    while (running)
+        if (!drain())
+            std::this_thread::sleep_for(std::chrono::milliseconds(LINEAGE_WRITER_SLEEP));
+}
+
+bool LineageLog::drain() {
+    LineageChunk *c = full.exchange(nullptr, std::memory_order_acquire);
+    if (!c)
+        return false;
+    
+    //The stack hands chunks back newest first
+    LineageChunk *ordered = nullptr;
+    while (c) {
+        LineageChunk *next = c->next;
+        c->next = ordered;
+        ordered = c;
+        c = next;
+    }
+    
+    for (c = ordered; c; ) {
+        LineageChunk *next = c->next;
+        uint32_t size = c->bytes.size();
+        fwrite(&size, sizeof(size), 1, file);
+        fwrite(&c->baseTick, sizeof(c->baseTick), 1, file);
+        fwrite(c->bytes.data(), 1, size, file);
+        c->bytes.clear();
+        if (std::find(owned.begin(), owned.end(), c) == owned.end())
+            owned.push_back(c);
+        push(spares, c);
+        c = next;
+    }
+    fflush(file);
+    return true;
+}
+
+LineageBuffer::LineageBuffer() : log(nullptr), chunk(nullptr) {
+}
+
+LineageBuffer::~LineageBuffer() {
+    flush();
+}
+
+void LineageBuffer::begin(LineageEventType type, DeathCause cause, uint64_t tick, uint64_t id) {
+    if (!chunk) {
+        chunk = log->spare();
+        chunk->baseTick = tick;
+        chunk->lastTick = tick;
+    }
+    chunk->bytes.push_back(uint8_t(type) | uint8_t(cause << 4));
+    putVarint(chunk->bytes, tick - chunk->lastTick);
+    putVarint(chunk->bytes, id);
+    chunk->lastTick = tick;
+}
+
+void LineageBuffer::end() {
+    if (chunk->bytes.size() >= LINEAGE_CHUNK_BYTES)
+        flush();
+}
+
+void LineageBuffer::birth(LineageEventType type, uint64_t tick, uint64_t id, uint64_t parentA, uint64_t parentB,
+                          uint64_t species) {
+    if (!log)
+        return;
+    begin(type, DEATH_NONE, tick, id);
+    //Parents are always born before their children
+    if (type == LINEAGE_MATE) {
+        putVarint(chunk->bytes, id - parentA);
+        putVarint(chunk->bytes, id - parentB);
+        putSpecies(chunk->bytes, species);
+    } else if (type == LINEAGE_DIVIDE)
+        putVarint(chunk->bytes, id - parentA);
+    else
+        putSpecies(chunk->bytes, species);
+    end();
+}
+
+void LineageBuffer::death(uint64_t tick, uint64_t id, DeathCause cause) {
+    if (!log)
+        return;
+    begin(LINEAGE_DEATH, cause, tick, id);
+    end();
+}
+
+void LineageBuffer::mutation(uint64_t tick, uint64_t id, uint64_t species) {
+    if (!log)
+        return;
+    begin(LINEAGE_MUTATION, DEATH_NONE, tick, id);
+    putSpecies(chunk->bytes, species);
+    end();
+}
+
+void LineageBuffer::flush() {
+    if (!chunk)
+        return;
+    log->submit(chunk);
+    chunk = nullptr;
+}
+
+LineageReader::LineageReader() : file(nullptr), position(0), lastTick(0) {
+}
+
+LineageReader::~LineageReader() {
+    if (file)
+        fclose(file);
+}
+
+bool LineageReader::open(const std::string &path) {
+    file = fopen(path.c_str(), "rb");
+    if (!file) {
+        std::cerr << "LineageReader: Failed to open " << path << std::endl;
+        return false;
+    }
+    char magic[sizeof(FILE_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, FILE_MAGIC, sizeof(magic))) {
+        std::cerr << "LineageReader: " << path << " is not a lineage log" << std::endl;
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool LineageReader::next(LineageEvent &event) {
+    if (!file)
+        return false;
+    //Load the next chunk once this one is used up
+    while (position == bytes.size()) {
+        uint32_t size;
+        if (fread(&size, sizeof(size), 1, file) != 1 || fread(&lastTick, sizeof(lastTick), 1, file) != 1)
+            return false;
+        bytes.resize(size);
+        if (fread(bytes.data(), 1, size, file) != size)
+            return false;
+        position = 0;
+    }
+    
+    uint8_t header = bytes[position++];
+    uint64_t delta;
+    event.type = LineageEventType(header & 0xF);
+    event.cause = DeathCause(header >> 4);
+    event.parents[0] = LINEAGE_NO_PARENT;
+    event.parents[1] = LINEAGE_NO_PARENT;
+    event.species = 0;
+    if (!getVarint(bytes, position, delta) || !getVarint(bytes, position, event.id))
+        return false;
+    lastTick += delta;
+    event.tick = lastTick;
+    
+    switch (event.type) {
+    case LINEAGE_MATE:
+        if (!getVarint(bytes, position, event.parents[0]) || !getVarint(bytes, position, event.parents[1]))
+            return false;
+        event.parents[0] = event.id - event.parents[0];
+        event.parents[1] = event.id - event.parents[1];
+        return getSpecies(bytes, position, event.species);
+    case LINEAGE_DIVIDE:
+        if (!getVarint(bytes, position, event.parents[0]))
+            return false;
+        event.parents[0] = event.id - event.parents[0];
+        return true;
+    case LINEAGE_SPAWN:
+    case LINEAGE_MUTATION:
+        return getSpecies(bytes, position, event.species);
+    case LINEAGE_DEATH:
+        return true;
+    }
+    return false;
+}
+
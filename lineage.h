@@ -0,0 +1,122 @@
+#ifndef LINEAGE_H
+#define LINEAGE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Bytes a producer collects before handing them to the writer
+#define LINEAGE_CHUNK_BYTES (1 << 16)
+//Milliseconds the writer sleeps when there is nothing to write
+#define LINEAGE_WRITER_SLEEP 10
+
+//Id used for a parent that does not exist
+#define LINEAGE_NO_PARENT uint64_t(-1)
+
+enum LineageEventType : uint8_t {
+    //Both parents are known
+    LINEAGE_MATE,
+    //One parent, same genome
+    LINEAGE_DIVIDE,
+    //Random genome from Group::spawn
+    LINEAGE_SPAWN,
+    LINEAGE_DEATH,
+    LINEAGE_MUTATION
+};
+
+enum DeathCause : uint8_t {
+    DEATH_NONE,
+    DEATH_EATEN,
+    DEATH_STARVED,
+    DEATH_SENT_FOOD,
+    DEATH_PHYSICS,
+    DEATH_CAUSES
+};
+
+struct LineageEvent {
+    LineageEventType type;
+    DeathCause cause;
+    uint64_t tick;
+    uint64_t id;
+    uint64_t parents[2];
+    //Species after a birth or mutation
+    uint64_t species;
+};
+
+//Buffer of encoded events passed between a producer and the writer
+struct LineageChunk {
+    LineageChunk *next;
+    uint64_t baseTick;
+    uint64_t lastTick;
+    std::vector<uint8_t> bytes;
+};
+
+//Appends lineage events to a file from a background thread
+//Producers fill their own chunk and only touch shared state through two lock-free stacks (full and spare chunks),
+//both drained with a single exchange so they are immune to ABA
+struct LineageLog {
+    LineageLog(const std::string &path);
+    ~LineageLog();
+    
+    //Queue a full chunk for writing
+    void submit(LineageChunk *chunk);
+    //Get an empty chunk, reusing one the writer is done with if possible
+    LineageChunk* spare();
+    
+private:
+    FILE *file;
+    std::atomic<bool> running;
+    std::atomic<LineageChunk*> full;
+    std::atomic<LineageChunk*> spares;
+    std::vector<LineageChunk*> owned;
+    std::thread thread;
+    
+    void run();
+    //Write everything that was submitted; returns false if there was nothing
+    bool drain();
+    static void push(std::atomic<LineageChunk*> &stack, LineageChunk *chunk);
+};
+
+//Producer end of a lineage log owned by one thread; does nothing when no log is attached
+struct LineageBuffer {
+    LineageLog *log;
+    
+    LineageBuffer();
+    ~LineageBuffer();
+    
+    void birth(LineageEventType type, uint64_t tick, uint64_t id, uint64_t parentA, uint64_t parentB,
+               uint64_t species);
+    void death(uint64_t tick, uint64_t id, DeathCause cause);
+    void mutation(uint64_t tick, uint64_t id, uint64_t species);
+    //Hand whatever has been collected to the writer
+    void flush();
+    
+private:
+    LineageChunk *chunk;
+    
+    void begin(LineageEventType type, DeathCause cause, uint64_t tick, uint64_t id);
+    void end();
+};
+
+//Reads a lineage log back one event at a time
+struct LineageReader {
+    LineageReader();
+    ~LineageReader();
+    
+    //Returns false if the file could not be opened or is not a lineage log
+    bool open(const std::string &path);
+    //Returns false at the end of the log
+    bool next(LineageEvent &event);
+    
+private:
+    FILE *file;
+    std::vector<uint8_t> bytes;
+    size_t position;
+    uint64_t lastTick;
+};
+
+#endif // LINEAGE_H
+
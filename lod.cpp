@@ -0,0 +1,123 @@
+#include "lod.h"
+#include <algorithm>
+#include <cmath>
+
+//Count of cells followed by the sum of every field
+#define LOD_SUMS (1 + ORB_FIELDS)
+
+void OrbFrame::resize(unsigned total) {
+    for (std::vector<float> &f : fields)
+        f.resize(total);
+}
+
+unsigned OrbFrame::size() const {
+    return fields[0].size();
+}
+
+OrbLod::OrbLod(unsigned width, unsigned height, unsigned workers) : binPixels(0), aggregates(0), width(width),
+                                                                     height(height), columns(1), rows(1) {
+    this->workers.resize(std::max(1u, workers), AffinityMap());
+    sums.resize(this->workers.size());
+    firsts.resize(this->workers.size() + 1);
+}
+
+unsigned OrbLod::bin(float x, float y) const {
+    //Same mapping as the vertex shader, which stretches x by the aspect ratio
+    double px = (x * height / width + 1) / 2 * width / binPixels;
+    double py = (y + 1) / 2 * height / binPixels;
+    unsigned column = px < 0 ? 0 : std::min(unsigned(px), columns - 1);
+    unsigned row = py < 0 ? 0 : std::min(unsigned(py), rows - 1);
+    return row * columns + column;
+}
+
+void OrbLod::reduce(const OrbFrame &cells, unsigned limit, OrbFrame &out) {
+    unsigned total = cells.size();
+    limit = std::max(limit, unsigned(LOD_INDIVIDUAL));
+    if (total <= limit) {
+        for (unsigned f = 0; f != ORB_FIELDS; f++)
+            out.fields[f] = cells.fields[f];
+        binPixels = 0;
+        aggregates = 0;
+        return;
+    }
+    
+    //Smallest bins whose every orb kept individually still fits in the limit
+    binPixels = std::max(1.0, std::ceil(std::sqrt(double(width) * height * LOD_INDIVIDUAL / limit)));
+    while (true) {
+        columns = (width + binPixels - 1) / binPixels;
+        rows = (height + binPixels - 1) / binPixels;
+        if (columns * rows * LOD_INDIVIDUAL <= limit || (columns == 1 && rows == 1))
+            break;
+        binPixels++;
+    }
+    unsigned binCount = columns * rows;
+    unsigned n = workers.size();
+    bins.resize(total);
+    
+    //Every worker sums its share of the cells into its own bins
+    workers.run([&](unsigned worker){
+        std::vector<float> &s = sums[worker];
+        s.assign(size_t(binCount) * LOD_SUMS, 0);
+        unsigned end = uint64_t(total) * (worker + 1) / n;
+        for (unsigned i = uint64_t(total) * worker / n; i != end; i++) {
+            unsigned b = bin(cells.fields[0][i], cells.fields[1][i]);
+            bins[i] = b;
+            float *sum = &s[size_t(b) * LOD_SUMS];
+            sum[0]++;
+            for (unsigned f = 0; f != ORB_FIELDS; f++)
+                sum[1 + f] += cells.fields[f][i];
+        }
+    });
+    //Then merges a share of the bins of all workers into the first
+    workers.run([&](unsigned worker){
+        size_t end = size_t(binCount) * (worker + 1) / n * LOD_SUMS;
+        for (size_t i = size_t(binCount) * worker / n * LOD_SUMS; i != end; i++)
+            for (unsigned other = 1; other != n; other++)
+                sums[0][i] += sums[other][i];
+    });
+    //Then counts the cells of its share that stay individual
+    const std::vector<float> &merged = sums[0];
+    workers.run([&](unsigned worker){
+        unsigned kept = 0;
+        unsigned end = uint64_t(total) * (worker + 1) / n;
+        for (unsigned i = uint64_t(total) * worker / n; i != end; i++)
+            kept += merged[size_t(bins[i]) * LOD_SUMS] <= LOD_INDIVIDUAL;
+        firsts[worker + 1] = kept;
+    });
+    firsts[0] = 0;
+    for (unsigned worker = 0; worker != n; worker++)
+        firsts[worker + 1] += firsts[worker];
+    
+    aggregates = 0;
+    for (unsigned b = 0; b != binCount; b++)
+        aggregates += merged[size_t(b) * LOD_SUMS] > LOD_INDIVIDUAL;
+    out.resize(firsts[n] + aggregates);
+    
+    //Individual cells go first in the order they came, each worker writing from where the earlier ones stop
+    workers.run([&](unsigned worker){
+        unsigned slot = firsts[worker];
+        unsigned end = uint64_t(total) * (worker + 1) / n;
+        for (unsigned i = uint64_t(total) * worker / n; i != end; i++) {
+            if (merged[size_t(bins[i]) * LOD_SUMS] > LOD_INDIVIDUAL)
+                continue;
+            for (unsigned f = 0; f != ORB_FIELDS; f++)
+                out.fields[f][slot] = cells.fields[f][i];
+            slot++;
+        }
+    });
+    //There are no more aggregates than bins on screen, so they are cheap to write on this thread
+    unsigned slot = firsts[n];
+    for (unsigned b = 0; b != binCount; b++) {
+        const float *sum = &merged[size_t(b) * LOD_SUMS];
+        if (sum[0] <= LOD_INDIVIDUAL)
+            continue;
+        //Mean position and radius, summed color
+        for (unsigned f = 0; f != 3; f++)
+            out.fields[f][slot] = sum[1 + f] / sum[0];
+        for (unsigned f = 3; f != 6; f++)
+            out.fields[f][slot] = sum[1 + f];
+        out.fields[6][slot] = sum[1 + 6] / sum[0];
+        slot++;
+    }
+}
+
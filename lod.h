@@ -0,0 +1,50 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include "workers.h"
+#include <vector>
+
+//Half floats stored for every orb (position, color, radius)
+#define ORB_FIELDS 7
+//Cells a screen bin may hold and still have each of them drawn; fuller bins are drawn as one orb
+#define LOD_INDIVIDUAL 2
+
+//Structure of arrays with everything needed to draw the orbs of one frame
+struct OrbFrame {
+    std::vector<float> fields[ORB_FIELDS];
+    
+    void resize(unsigned total);
+    unsigned size() const;
+};
+
+//Reduces the orbs of every cell to as many as the renderer can shade in time
+//The screen is cut into square bins small enough that no more than limit orbs come out; sparse bins keep an orb per
+//cell for close-ups, and every fuller bin becomes one orb at the mean position of its cells
+//Shading is additive, so an aggregate carries the summed color of its cells and looks as bright as they would
+struct OrbLod {
+    //Side in pixels of the bins of the last reduce (0 if every cell was kept)
+    unsigned binPixels;
+    //Orbs of the last reduce that stand for more than one cell
+    unsigned aggregates;
+    
+    OrbLod(unsigned width, unsigned height, unsigned workers);
+    
+    //Fill out with at most limit orbs standing for all of cells
+    void reduce(const OrbFrame &cells, unsigned limit, OrbFrame &out);
+    
+private:
+    unsigned width, height;
+    WorkerPool workers;
+    unsigned columns, rows;
+    //Bin of every cell
+    std::vector<unsigned> bins;
+    //Per worker, the count and field sums of every bin
+    std::vector<std::vector<float>> sums;
+    //Per worker, where its cells kept individually go in out
+    std::vector<unsigned> firsts;
+    
+    unsigned bin(float x, float y) const;
+};
+
+#endif // LOD_H
+
@@ -2,8 +2,12 @@
 #include "gpi/gpi.h"
 #include "phitron/phitron.h"
 #include "draw.h"
-#include "group.h"
+#include "simulation.h"
+#include "domain.h"
+#include "island.h"
 #include <chrono>
+#include <memory>
+#include <string>
 #include <thread>
 
 #define WINDOW_WIDTH 400
@@ -11,17 +15,102 @@
 #define CLOSENESS 20.0
 
 #define FPS 30
-#define CYCLES 2
+//Frames between printing stats (0 disables printing)
+#define STATS_EVERY FPS
+//Ticks per second the simulation aims for (0 runs as fast as possible); ignored when TICK_BUDGET is set
+#define TICK_RATE 0
+//Seconds per frame the simulation may spend ticking (0 disables the budget)
+#define TICK_BUDGET (0.5 / FPS)
+//Let the tick budget raise the food cost when a single tick per frame is over budget
+#define TICK_BUDGET_PRESSURE false
+//Seconds per frame the GPU may spend shading orbs before crowded cells are drawn as aggregates
+#define DRAW_BUDGET (0.5 / FPS)
+//Threads that reduce the cells to the orbs drawn (0 for one per hardware thread)
+#define DRAW_WORKERS 2
+//File the trajectory of every tick is streamed to (empty disables recording)
+#define RECORD_FILE ""
+//Directory checkpoints are forked off to every CHECKPOINT_INTERVAL ticks (empty disables checkpoints)
+#define CHECKPOINT_DIRECTORY ""
+#define CHECKPOINT_INTERVAL 10000
+//Checkpoints from one full checkpoint to the next; the ones in between only hold what changed
+#define CHECKPOINT_CHAIN 16
+//Newest chains of a full checkpoint and its deltas kept; older ones are deleted as new ones start
+#define CHECKPOINT_KEEP 2
+//Full checkpoint or delta the simulation starts from (empty starts a new world)
+#define RESTORE_FILE ""
+//Genome library spawned cells start from (empty spawns random programs)
+#define LIBRARY_FILE ""
+//Only spawn from genomes with this tag (empty allows every tag), and only the fittest LIBRARY_BEST (0 allows all)
+#define LIBRARY_TAG ""
+#define LIBRARY_BEST 0
+//Genome library the heaviest species are added to every EXPORT_INTERVAL ticks (empty disables exporting)
+#define EXPORT_FILE ""
+#define EXPORT_INTERVAL 100000
+//Species added by every export and the tag they are stored under
+#define EXPORT_SPECIES 8
+#define EXPORT_TAG "evomata"
+//Unix socket path or TCP host:port every tick is streamed to viewers on (empty disables streaming)
+#define STREAM_ADDRESS ""
+//File births, deaths and mutations are logged to (empty disables the log)
+#define LINEAGE_FILE ""
+//Unix socket metrics are served on (empty disables the server)
+#define METRICS_SOCKET ""
+//Worker threads per simulation (0 shares the hardware threads evenly between the islands)
+#define WORKERS 0
+//CPUs each worker is pinned to: "" leaves them to the scheduler, "numa" fills one NUMA node after another and
+//anything else is a list of CPU lists per worker, e.g. "0;1;2-3"
+#define WORKER_AFFINITY ""
+//Processes the world is split into along x; each runs its own slab and all but this one are headless
+#define DOMAIN_SLABS 1
+//Separate worlds evolved side by side on their own threads; all but the one shown here are headless
+#define ISLANDS 1
+//Where migrants go: "ring", "full" or "random"
+#define ISLAND_TOPOLOGY "ring"
+//Ticks between migrations and cells an island sends to every destination
+#define ISLAND_INTERVAL 1024
+#define ISLAND_MIGRANTS 4
+//Ticks between invariant checks (0 disables them); debug builds check every tick
+#ifdef NDEBUG
+#define INVARIANT_INTERVAL 1024
+#else
+#define INVARIANT_INTERVAL 1
+#endif
 
 using namespace std;
 using namespace chrono;
 
-uint16_t toHalfFloat(float x) {
-    uint32_t &f = reinterpret_cast<uint32_t&>(x);
-    return ((f >> 16) & 0x8000) | ((((f & 0x7f800000) - 0x38000000) >> 13) & 0x7c00) | ((f >> 13) & 0x03ff);
-}
-
 int main() {
+    //Slabs are forked before anything else starts a thread
+    unique_ptr<Domain> domain;
+    if (DOMAIN_SLABS > 1) {
+        //These only see the cells of the first slab
+        if (*RECORD_FILE || *STREAM_ADDRESS || *CHECKPOINT_DIRECTORY || *RESTORE_FILE || *EXPORT_FILE ||
+            *LINEAGE_FILE || *LIBRARY_FILE) {
+            cerr << "DOMAIN_SLABS cannot be used with recording, streaming, checkpoints, lineage logs or genome "
+                 << "libraries" << endl;
+            return 1;
+        }
+        domain.reset(new Domain(phi::V3(1.0, 1.0, 1.0), DOMAIN_SLABS));
+        domain->start(1743, TICK_RATE, INVARIANT_INTERVAL);
+    }
+    
+    unsigned workers = WORKERS ? WORKERS : max(1u, thread::hardware_concurrency() / ISLANDS);
+    unique_ptr<Archipelago> archipelago;
+    if (ISLANDS > 1) {
+        IslandTopology topology;
+        if (!parseTopology(ISLAND_TOPOLOGY, topology)) {
+            cerr << "Invalid ISLAND_TOPOLOGY: " << ISLAND_TOPOLOGY << endl;
+            return 1;
+        }
+        if (DOMAIN_SLABS > 1) {
+            cerr << "ISLANDS and DOMAIN_SLABS cannot both be used" << endl;
+            return 1;
+        }
+        archipelago.reset(new Archipelago(phi::V3(1.0, 1.0, 1.0), ISLANDS, topology, ISLAND_INTERVAL,
+                                          ISLAND_MIGRANTS));
+        archipelago->start(1743, TICK_RATE, workers);
+    }
+    
     Window window("testing", WINDOW_WIDTH, WINDOW_HEIGHT);
     Renderer renderer(window);
     
@@ -29,11 +118,84 @@ int main() {
     
     steady_clock::time_point lastTime = steady_clock::now();
     
-    Group group(phi::V3(1.0, 1.0, 1.0), 1743);
+    //Declared before the simulation so it outlives the simulation thread
+    unique_ptr<TrajectoryRecorder> recorder;
+    unique_ptr<FrameStreamer> streamer;
+    unique_ptr<LineageLog> lineage;
+    Metrics metrics;
+    unique_ptr<MetricsServer> server;
+    unique_ptr<Checkpointer> checkpointer;
+    GenomeLibrary library;
+    unique_ptr<GenomeExporter> exporter;
+    InvariantChecker invariants(INVARIANT_INTERVAL);
     
-    uint16_t *posbuffer = (uint16_t*)gr.buffer.buffer.map(GL_MAP_WRITE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+    Simulation sim(phi::V3(1.0, 1.0, 1.0), 1743, TICK_RATE);
+    sim.group.checker = &invariants;
+    sim.domain = domain.get();
+    if (archipelago)
+        sim.island = archipelago->islands[0].get();
+    {
+        AffinityMap affinity;
+        if (string(WORKER_AFFINITY) == "numa")
+            affinity = AffinityMap::numa(workers);
+        else if (*WORKER_AFFINITY && !AffinityMap::parse(WORKER_AFFINITY, affinity)) {
+            cerr << "Invalid WORKER_AFFINITY: " << WORKER_AFFINITY << endl;
+            return 1;
+        }
+        sim.group.workers.resize(workers, affinity);
+    }
+    if (*RECORD_FILE) {
+        recorder.reset(new TrajectoryRecorder(RECORD_FILE, sim.group.dimensions));
+        sim.recorder = recorder.get();
+    }
+    if (*RESTORE_FILE) {
+        if (!restoreCheckpoint(RESTORE_FILE, sim.group)) {
+            cerr << "Failed to restore " << RESTORE_FILE << endl;
+            return 1;
+        }
+    }
+    //After restoring, which may change the dimensions positions are quantized over
+    if (*STREAM_ADDRESS) {
+        streamer.reset(new FrameStreamer(STREAM_ADDRESS, sim.group.dimensions));
+        sim.streamer = streamer.get();
+    }
+    if (*CHECKPOINT_DIRECTORY) {
+        checkpointer.reset(new Checkpointer(CHECKPOINT_DIRECTORY, CHECKPOINT_INTERVAL, CHECKPOINT_CHAIN,
+                                            CHECKPOINT_KEEP));
+        sim.checkpointer = checkpointer.get();
+    }
+    if (*LIBRARY_FILE) {
+        if (!library.open(LIBRARY_FILE))
+            return 1;
+        if (!library.select(LIBRARY_TAG, LIBRARY_BEST)) {
+            cerr << "No genomes tagged \"" << LIBRARY_TAG << "\" in " << LIBRARY_FILE << endl;
+            return 1;
+        }
+        sim.group.library = &library;
+    }
+    if (*EXPORT_FILE) {
+        exporter.reset(new GenomeExporter(EXPORT_FILE, EXPORT_TAG, EXPORT_INTERVAL, EXPORT_SPECIES));
+        sim.exporter = exporter.get();
+    }
+    if (*LINEAGE_FILE) {
+        lineage.reset(new LineageLog(LINEAGE_FILE));
+        sim.group.lineage.log = lineage.get();
+    }
+    if (*METRICS_SOCKET) {
+        server.reset(new MetricsServer(METRICS_SOCKET, metrics));
+        sim.metrics = &metrics;
+    }
+    if (TICK_BUDGET > 0) {
+        sim.frameRate = FPS;
+        sim.budget = TickBudget(TICK_BUDGET, TICK_BUDGET_PRESSURE, CELL_TURN_FOOD_COST);
+    }
+    sim.start();
     
-    uint64_t cycle = 0;
+    OrbFrame cells;
+    OrbFrame orbs;
+    OrbLod lod(WINDOW_WIDTH, WINDOW_HEIGHT, DRAW_WORKERS ? DRAW_WORKERS : thread::hardware_concurrency());
+    DrawBudget drawBudget(DRAW_BUDGET);
+    uint64_t frame = 0;
     
     while (true) {
         SDL_Event event;
@@ -44,55 +206,62 @@ int main() {
             }
         }
         
-        for (unsigned i = 0; i != CYCLES; i++) {
-            group.spawn(group.rand() % 16 == 0);
-            //group.spawn(4);
-            group.update();
-        }
+        //Keep drawing the previous snapshot if the simulation has not finished another tick yet
+        sim.snapshots.update();
+        const Snapshot &snapshot = sim.snapshots.read();
         
         steady_clock::time_point betweenTime = steady_clock::now();
         
-        if (group.cells.size() > DRAWABLES) {
-            std::cerr << "Error: Exceeded max drawables!" << std::endl;
-            return 1;
-        }
-        
+        drawBudget.measureRender(gr.orbTime, gr.orbCount);
         {
-            unsigned index;
-            auto i = group.cells.begin();
-            for (index = 0; i != group.cells.end(); i++, index++) {
-                Cell &c = *i;
-                posbuffer[index * 7 + 0] = toHalfFloat(c.particle.position.x);
-                posbuffer[index * 7 + 1] = toHalfFloat(c.particle.position.y);
-                posbuffer[index * 7 + 2] = toHalfFloat(c.particle.position.z / CLOSENESS);
+            cells.resize(snapshot.size());
+            for (unsigned cell = 0; cell != cells.size(); cell++) {
+                cells.fields[0][cell] = snapshot.x[cell];
+                cells.fields[1][cell] = snapshot.y[cell];
+                cells.fields[2][cell] = snapshot.z[cell] / CLOSENESS;
                 
-                posbuffer[index * 7 + 3] = toHalfFloat(((c.species & 0xFF << 0) >> 0) / double(0xFF));
-                posbuffer[index * 7 + 4] = toHalfFloat(((c.species & 0xFF << 8) >> 8) / double(0xFF));
-                posbuffer[index * 7 + 5] = toHalfFloat(((c.species & 0xFF << 16) >> 16) / double(0xFF));
+                uint64_t species = snapshot.species[cell];
+                cells.fields[3][cell] = ((species & 0xFF << 0) >> 0) / double(0xFF);
+                cells.fields[4][cell] = ((species & 0xFF << 8) >> 8) / double(0xFF);
+                cells.fields[5][cell] = ((species & 0xFF << 16) >> 16) / double(0xFF);
                 
-                posbuffer[index * 7 + 6] = toHalfFloat(0.1);
+                cells.fields[6][cell] = 0.1;
             }
         }
         
-        gr.buffer.buffer.sync();
+        //Crowded parts of the screen are merged when shading every cell would blow the budget
+        lod.reduce(cells, drawBudget.limit(), orbs);
+        gr.upload(orbs);
         
-        gr.render(group.cells.size(), WINDOW_WIDTH, WINDOW_HEIGHT);
+        gr.render(WINDOW_WIDTH, WINDOW_HEIGHT);
         
         this_thread::sleep_until(lastTime + duration<double>(1.0/FPS));
         steady_clock::time_point thisTime = steady_clock::now();
         window.flip();
         
-        cout << "\nCycle: " << cycle << endl;
-        cout << "Count: " << group.cells.size() << endl;
-        double timeDelta = duration_cast<duration<double>>(thisTime - lastTime).count();
-        cout << "FPS: " << (1.0/timeDelta) << endl;
-        double updateDelta = duration_cast<duration<double>>(betweenTime - lastTime).count();
-        cout << "Update duration: " << updateDelta << endl;
-        double renderDelta = duration_cast<duration<double>>(thisTime - betweenTime).count();
-        cout << "Render duration: " << renderDelta << endl;
+        if (STATS_EVERY && frame % STATS_EVERY == 0) {
+            cout << "\nCycle: " << snapshot.cycle << endl;
+            cout << "Count: " << snapshot.size() << endl;
+            cout << "Organisms: " << snapshot.organisms << " (largest " << snapshot.largestOrganism << ")" << endl;
+            cout << "Workers: " << snapshot.workers << " on " << snapshot.nodes << " node(s), "
+                 << snapshot.crossNodeEdges * 100 << "% of edges cross nodes" << endl;
+            cout << "Imbalance: " << snapshot.imbalance << " (" << snapshot.steals << " chunks stolen)" << endl;
+            if (domain || archipelago) {
+                const MigrationCounts &m = snapshot.migrations;
+                cout << "Migrants: " << m.emigrated << " left, " << m.immigrated << " arrived, " << m.blocked
+                     << " kept back, " << m.dropped << " dropped with " << m.droppedFood << " food" << endl;
+            }
+            double timeDelta = duration_cast<duration<double>>(thisTime - lastTime).count();
+            cout << "FPS: " << (1.0/timeDelta) << endl;
+            cout << "Tick duration: " << snapshot.tickDuration << endl;
+            double renderDelta = duration_cast<duration<double>>(thisTime - betweenTime).count();
+            cout << "Render duration: " << renderDelta << endl;
+            cout << "Budget: " << snapshot.cycles << " cycles/frame, drawing " << orbs.size() << " orbs ("
+                 << lod.aggregates << " aggregates), turn food cost " << snapshot.turnFoodCost << endl;
+        }
         
         lastTime = thisTime;
-        cycle++;
+        frame++;
     }
     return 0;
 }
@@ -0,0 +1,271 @@
+#include "metrics.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const char *deathNames[DEATH_CAUSES] = {"none", "eaten", "starved", "sent_food", "physics"};
+
+static uint64_t toBits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double fromBits(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+Metrics::Metrics() : sequence(0) {
+    for (std::atomic<uint64_t> &v : values)
+        v = 0;
+    for (unsigned p = 0; p != GROUP_PHASES; p++) {
+        for (std::atomic<uint64_t> &b : buckets[p])
+            b = 0;
+        counts[p] = 0;
+        sums[p] = 0;
+    }
+}
+
+void Metrics::begin() {
+    sequence.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void Metrics::set(MetricValue metric, uint64_t value) {
+    values[metric].store(value, std::memory_order_relaxed);
+}
+
+void Metrics::set(MetricValue metric, double value) {
+    values[metric].store(toBits(value), std::memory_order_relaxed);
+}
+
+void Metrics::end() {
+    sequence.fetch_add(1, std::memory_order_release);
+}
+
+void Metrics::observe(GroupPhase phase, double seconds) {
+    unsigned bucket = 0;
+    for (double bound = METRICS_FIRST_BUCKET; bucket != METRICS_BUCKETS - 1 && seconds > bound; bound *= 2)
+        bucket++;
+    //Only the simulation thread writes, so there is no need for read-modify-write atomics
+    buckets[phase][bucket].store(buckets[phase][bucket].load(std::memory_order_relaxed) + 1,
+                                 std::memory_order_relaxed);
+    counts[phase].store(counts[phase].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    sums[phase].store(sums[phase].load(std::memory_order_relaxed) + uint64_t(seconds * 1e9),
+                      std::memory_order_relaxed);
+}
+
+std::string Metrics::format() const {
+    uint64_t copy[METRIC_VALUES];
+    //Retry until a copy was taken without the writer in the middle of an update
+    while (true) {
+        uint64_t before = sequence.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+        for (unsigned i = 0; i != METRIC_VALUES; i++)
+            copy[i] = values[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence.load(std::memory_order_relaxed) == before)
+            break;
+    }
+    
+    std::ostringstream out;
+    out << "# TYPE evomata_tick counter\nevomata_tick " << copy[METRIC_TICK] << "\n";
+    out << "# TYPE evomata_population gauge\nevomata_population " << copy[METRIC_POPULATION] << "\n";
+    out << "# TYPE evomata_births_total counter\nevomata_births_total " << copy[METRIC_BIRTHS] << "\n";
+    out << "# TYPE evomata_deaths_total counter\n";
+    for (unsigned i = DEATH_EATEN; i != DEATH_CAUSES; i++)
+        out << "evomata_deaths_total{cause=\"" << deathNames[i] << "\"} " << copy[METRIC_DEATHS + i] << "\n";
+    out << "# TYPE evomata_edges gauge\nevomata_edges " << copy[METRIC_EDGES] << "\n";
+    out << "# TYPE evomata_species gauge\nevomata_species " << copy[METRIC_SPECIES] << "\n";
+    out << "# TYPE evomata_food gauge\nevomata_food " << copy[METRIC_FOOD] << "\n";
+    out << "# TYPE evomata_organisms gauge\nevomata_organisms " << copy[METRIC_ORGANISMS] << "\n";
+    out << "# TYPE evomata_tick_rate gauge\nevomata_tick_rate " << fromBits(copy[METRIC_TICK_RATE]) << "\n";
+    out << "# TYPE evomata_invariant_violations_total counter\nevomata_invariant_violations_total "
+        << copy[METRIC_INVARIANT_VIOLATIONS] << "\n";
+    out << "# TYPE evomata_genomes gauge\nevomata_genomes " << copy[METRIC_GENOMES] << "\n";
+    out << "# TYPE evomata_hot_genomes gauge\nevomata_hot_genomes " << copy[METRIC_HOT_GENOMES] << "\n";
+    //Evaluations by all cells and by the cells running genomes that have been evaluated the most
+    out << "# TYPE evomata_genome_evaluations_total counter\nevomata_genome_evaluations_total "
+        << copy[METRIC_GENOME_EVALUATIONS] << "\n";
+    out << "# TYPE evomata_hot_genome_evaluations_total counter\nevomata_hot_genome_evaluations_total "
+        << copy[METRIC_HOT_EVALUATIONS] << "\n";
+    out << "# TYPE evomata_genome_promotions_total counter\nevomata_genome_promotions_total "
+        << copy[METRIC_GENOME_PROMOTIONS] << "\n";
+    out << "# TYPE evomata_genome_evictions_total counter\nevomata_genome_evictions_total "
+        << copy[METRIC_GENOME_EVICTIONS] << "\n";
+    out << "# TYPE evomata_worker_imbalance gauge\nevomata_worker_imbalance " << fromBits(copy[METRIC_IMBALANCE])
+        << "\n";
+    out << "# TYPE evomata_chunks_stolen_total counter\nevomata_chunks_stolen_total " << copy[METRIC_STEALS] << "\n";
+    out << "# TYPE evomata_relocations_total counter\nevomata_relocations_total " << copy[METRIC_RELOCATIONS] << "\n";
+    out << "# TYPE evomata_checkpoints_total counter\n";
+    out << "evomata_checkpoints_total{result=\"completed\"} " << copy[METRIC_CHECKPOINTS] << "\n";
+    out << "evomata_checkpoints_total{result=\"failed\"} " << copy[METRIC_CHECKPOINT_FAILURES] << "\n";
+    out << "# TYPE evomata_checkpoint_bytes_total counter\nevomata_checkpoint_bytes_total "
+        << copy[METRIC_CHECKPOINT_BYTES] << "\n";
+    out << "# TYPE evomata_checkpoint_pause_seconds gauge\nevomata_checkpoint_pause_seconds "
+        << fromBits(copy[METRIC_CHECKPOINT_PAUSE]) << "\n";
+    out << "# TYPE evomata_migrants_total counter\n";
+    out << "evomata_migrants_total{result=\"emigrated\"} " << copy[METRIC_EMIGRATED] << "\n";
+    out << "evomata_migrants_total{result=\"immigrated\"} " << copy[METRIC_IMMIGRATED] << "\n";
+    out << "evomata_migrants_total{result=\"blocked\"} " << copy[METRIC_MIGRANTS_BLOCKED] << "\n";
+    out << "evomata_migrants_total{result=\"dropped\"} " << copy[METRIC_MIGRANTS_DROPPED] << "\n";
+    out << "# TYPE evomata_migrant_food_dropped_total counter\nevomata_migrant_food_dropped_total "
+        << copy[METRIC_MIGRANT_FOOD_DROPPED] << "\n";
+    //Species are labelled by rank alone so the number of series stays fixed while the species come and go; which
+    //species holds a rank is a value of its own, split into the halves mating recombines since a double cannot
+    //hold all 64 bits
+    out << "# TYPE evomata_species_cells gauge\n";
+    for (unsigned i = 0; i != CENSUS_REPORTED && copy[METRIC_HEAVY_CELLS + i]; i++)
+        out << "evomata_species_cells{rank=\"" << i << "\"} " << copy[METRIC_HEAVY_CELLS + i] << "\n";
+    out << "# TYPE evomata_species_food gauge\n";
+    for (unsigned i = 0; i != CENSUS_REPORTED && copy[METRIC_HEAVY_CELLS + i]; i++)
+        out << "evomata_species_food{rank=\"" << i << "\"} " << copy[METRIC_HEAVY_FOOD + i] << "\n";
+    out << "# TYPE evomata_species_id gauge\n";
+    for (unsigned i = 0; i != CENSUS_REPORTED && copy[METRIC_HEAVY_CELLS + i]; i++)
+        out << "evomata_species_id{rank=\"" << i << "\",half=\"high\"} " << (copy[METRIC_HEAVY_SPECIES + i] >> 32)
+            << "\nevomata_species_id{rank=\"" << i << "\",half=\"low\"} "
+            << (copy[METRIC_HEAVY_SPECIES + i] & 0xFFFFFFFF) << "\n";
+    
+    out << "# TYPE evomata_phase_seconds histogram\n";
+    for (unsigned p = 0; p != GROUP_PHASES; p++) {
+        uint64_t cumulative = 0;
+        double bound = METRICS_FIRST_BUCKET;
+        for (unsigned b = 0; b != METRICS_BUCKETS; b++, bound *= 2) {
+            cumulative += buckets[p][b].load(std::memory_order_relaxed);
+            out << "evomata_phase_seconds_bucket{phase=\"" << groupPhaseNames[p] << "\",le=\"";
+            if (b == METRICS_BUCKETS - 1)
+                out << "+Inf";
+            else
+                out << bound;
+            out << "\"} " << cumulative << "\n";
+        }
+        out << "evomata_phase_seconds_sum{phase=\"" << groupPhaseNames[p] << "\"} "
+            << sums[p].load(std::memory_order_relaxed) * 1e-9 << "\n";
+        out << "evomata_phase_seconds_count{phase=\"" << groupPhaseNames[p] << "\"} "
+            << counts[p].load(std::memory_order_relaxed) << "\n";
+    }
+    return out.str();
+}
+
+MetricsServer::MetricsServer(const std::string &path, const Metrics &metrics) : path(path), metrics(metrics) {
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (listener < 0 || path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "MetricsServer: Failed to create socket " << path << std::endl;
+        exit(1);
+    }
+    strcpy(address.sun_path, path.c_str());
+    //A socket left behind by a previous run would make bind fail
+    unlink(path.c_str());
+    if (bind(listener, (sockaddr*)&address, sizeof(address)) || listen(listener, METRICS_MAX_CLIENTS) ||
+            pipe(wake)) {
+        std::cerr << "MetricsServer: Failed to listen on " << path << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    fcntl(listener, F_SETFL, O_NONBLOCK);
+    thread = std::thread(&MetricsServer::run, this);
+}
+
+MetricsServer::~MetricsServer() {
+    char byte = 0;
+    if (write(wake[1], &byte, 1) != 1)
+        std::cerr << "MetricsServer: Failed to wake server thread" << std::endl;
+    thread.join();
+    close(wake[0]);
+    close(wake[1]);
+    close(listener);
+    unlink(path.c_str());
+}
+
+void MetricsServer::run() {
+    //Clients get a short moment to send a request so HTTP can be told apart from plain reads
+    struct Client {
+        int fd;
+        int polls;
+    };
+    std::vector<Client> clients;
+    std::vector<pollfd> fds;
+    
+    while (true) {
+        fds.clear();
+        fds.push_back({wake[0], POLLIN, 0});
+        fds.push_back({listener, POLLIN, 0});
+        for (Client &c : clients)
+            fds.push_back({c.fd, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), clients.empty() ? -1 : 10) < 0 && errno != EINTR)
+            return;
+        if (fds[0].revents)
+            break;
+        
+        if (fds[1].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(listener, nullptr, nullptr)) >= 0) {
+                if (clients.size() == METRICS_MAX_CLIENTS) {
+                    close(fd);
+                    continue;
+                }
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                clients.push_back({fd, 0});
+            }
+        }
+        
+        //Clients accepted above have no poll result yet
+        unsigned polled = fds.size() - 2;
+        unsigned kept = 0;
+        for (unsigned i = 0; i != clients.size(); i++) {
+            Client c = clients[i];
+            short events = i < polled ? fds[i + 2].revents : 0;
+            char request[512];
+            ssize_t received = 0;
+            if (events & POLLIN)
+                received = read(c.fd, request, sizeof(request) - 1);
+            //A client that hung up or failed gets nothing; writing to it would raise SIGPIPE
+            if (events & (POLLHUP | POLLERR)) {
+                close(c.fd);
+                continue;
+            }
+            //Answer once something arrived or the client just waits to be told
+            if (received > 0 || ++c.polls > 5) {
+                std::string body = metrics.format();
+                std::string response;
+                if (received >= 3 && !strncmp(request, "GET", 3)) {
+                    std::ostringstream header;
+                    header << "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                           << body.size() << "\r\n\r\n";
+                    response = header.str();
+                }
+                response += body;
+                //Blocking writes here would stall other clients, so a client that is too slow loses the rest
+                size_t sent = 0;
+                for (int tries = 0; sent != response.size() && tries != 100; tries++) {
+                    ssize_t n = send(c.fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+                    if (n > 0)
+                        sent += n;
+                    else if (n < 0 && errno != EAGAIN)
+                        break;
+                    else
+                        poll(nullptr, 0, 1);
+                }
+                close(c.fd);
+            } else
+                clients[kept++] = c;
+        }
+        clients.resize(kept);
+    }
+    
+    for (Client &c : clients)
+        close(c.fd);
+}
+
@@ -0,0 +1,98 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "group.h"
+#include "census.h"
+#include <atomic>
+#include <string>
+
+//Histogram buckets double from this many seconds
+#define METRICS_FIRST_BUCKET 0.000001
+#define METRICS_BUCKETS 24
+//Most connections the server keeps waiting for a request at once
+#define METRICS_MAX_CLIENTS 16
+
+enum MetricValue {
+    METRIC_TICK,
+    METRIC_POPULATION,
+    METRIC_BIRTHS,
+    //One per death cause
+    METRIC_DEATHS,
+    METRIC_EDGES = METRIC_DEATHS + DEATH_CAUSES,
+    METRIC_SPECIES,
+    METRIC_FOOD,
+    METRIC_ORGANISMS,
+    METRIC_TICK_RATE,
+    METRIC_INVARIANT_VIOLATIONS,
+    METRIC_GENOMES,
+    METRIC_HOT_GENOMES,
+    METRIC_GENOME_EVALUATIONS,
+    METRIC_HOT_EVALUATIONS,
+    METRIC_GENOME_PROMOTIONS,
+    METRIC_GENOME_EVICTIONS,
+    METRIC_IMBALANCE,
+    METRIC_STEALS,
+    METRIC_RELOCATIONS,
+    METRIC_CHECKPOINTS,
+    METRIC_CHECKPOINT_FAILURES,
+    METRIC_CHECKPOINT_BYTES,
+    //Seconds the last checkpoint paused the simulation for
+    METRIC_CHECKPOINT_PAUSE,
+    //Cells that moved to and from other slabs or islands, were kept back or dropped, and the food dropped with them
+    METRIC_EMIGRATED,
+    METRIC_IMMIGRATED,
+    METRIC_MIGRANTS_BLOCKED,
+    METRIC_MIGRANTS_DROPPED,
+    METRIC_MIGRANT_FOOD_DROPPED,
+    //Species, cells and food of the heaviest species, heaviest first; cells are 0 past the last species there is
+    METRIC_HEAVY_SPECIES,
+    METRIC_HEAVY_CELLS = METRIC_HEAVY_SPECIES + CENSUS_REPORTED,
+    METRIC_HEAVY_FOOD = METRIC_HEAVY_CELLS + CENSUS_REPORTED,
+    METRIC_VALUES = METRIC_HEAVY_FOOD + CENSUS_REPORTED
+};
+
+//Counters and gauges written by the simulation thread and read from anywhere
+//Values are published under a seqlock so a reader always sees one consistent tick and the writer never waits;
+//phase histograms only ever grow so they are plain relaxed atomics
+struct Metrics {
+    Metrics();
+    
+    //Writer side; set values between begin and end
+    void begin();
+    void set(MetricValue metric, uint64_t value);
+    void set(MetricValue metric, double value);
+    void end();
+    //Count the duration of a phase of one update
+    void observe(GroupPhase phase, double seconds);
+    
+    //Prometheus text exposition of everything
+    std::string format() const;
+    
+private:
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> values[METRIC_VALUES];
+    std::atomic<uint64_t> buckets[GROUP_PHASES][METRICS_BUCKETS];
+    std::atomic<uint64_t> counts[GROUP_PHASES];
+    //Total seconds stored in nanoseconds
+    std::atomic<uint64_t> sums[GROUP_PHASES];
+};
+
+//Serves Metrics::format on a Unix domain socket from its own thread
+//Plain clients get the text on connect; anything that sends an HTTP GET gets an HTTP response
+struct MetricsServer {
+    MetricsServer(const std::string &path, const Metrics &metrics);
+    ~MetricsServer();
+    
+private:
+    std::string path;
+    const Metrics &metrics;
+    int listener;
+    //Used to wake the server thread when shutting down
+    int wake[2];
+    std::thread thread;
+    
+    void run();
+};
+
+#endif // METRICS_H
+
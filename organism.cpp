@@ -0,0 +1,152 @@
+#include "organism.h"
+#include "cell.h"
+
+Organisms::Organisms() : count(0), largest(0) {
+}
+
+void Organisms::reset(uint32_t node) {
+    parent[node] = node;
+    next[node] = node;
+    dirty[node] = false;
+    organisms[node].size = 1;
+}
+
+void Organisms::add(Cell &c) {
+    uint32_t node;
+    if (freeNodes.empty()) {
+        node = parent.size();
+        parent.push_back(node);
+        next.push_back(node);
+        cells.push_back(nullptr);
+        organisms.emplace_back();
+        dirty.push_back(false);
+        //Lists filled during an update never hold more than every node, so they only grow along with the nodes
+        dirtyNodes.reserve(parent.capacity());
+        freeNodes.reserve(parent.capacity());
+        members.reserve(parent.capacity());
+    } else {
+        node = freeNodes.back();
+        freeNodes.pop_back();
+    }
+    reset(node);
+    cells[node] = &c;
+    c.organism = node;
+}
+
+void Organisms::remove(Cell &c) {
+    cells[c.organism] = nullptr;
+    split(c);
+}
+
+uint32_t Organisms::find(uint32_t node) {
+    //Path halving
+    while (parent[node] != node) {
+        parent[node] = parent[parent[node]];
+        node = parent[node];
+    }
+    return node;
+}
+
+uint32_t Organisms::merge(uint32_t a, uint32_t b) {
+    a = find(a);
+    b = find(b);
+    if (a == b)
+        return a;
+    //Union by size
+    if (organisms[a].size < organisms[b].size)
+        std::swap(a, b);
+    parent[b] = a;
+    organisms[a].size += organisms[b].size;
+    //Splice the member lists together
+    std::swap(next[a], next[b]);
+    if (dirty[b])
+        dirty[a] = true;
+    return a;
+}
+
+void Organisms::join(const Cell &a, const Cell &b) {
+    merge(a.organism, b.organism);
+}
+
+void Organisms::split(const Cell &c) {
+    uint32_t r = find(c.organism);
+    if (!dirty[r]) {
+        dirty[r] = true;
+        dirtyNodes.push_back(r);
+    }
+}
+
+void Organisms::moved(Cell &c) {
+    cells[c.organism] = &c;
+}
+
+void Organisms::rebuild() {
+    for (uint32_t node : dirtyNodes) {
+        uint32_t r = find(node);
+        //Already rebuilt through another node or merged into one that was
+        if (!dirty[r])
+            continue;
+        
+        members.clear();
+        uint32_t m = r;
+        do {
+            members.push_back(m);
+            m = next[m];
+        } while (m != r);
+        
+        //Break the organism into single cells and release the dead ones
+        for (uint32_t m : members) {
+            reset(m);
+            if (!cells[m])
+                freeNodes.push_back(m);
+        }
+        //Join back everything that is still connected; ghosts of other slabs belong to no organism here
+        for (uint32_t m : members)
+            if (cells[m])
+                for (const Neighbor &n : cells[m]->neighbors)
+                    if (!n.neighbor->ghost)
+                        merge(m, n.neighbor->organism);
+    }
+    dirtyNodes.clear();
+}
+
+void Organisms::refresh() {
+    count = 0;
+    largest = 0;
+    for (uint32_t r = 0; r != parent.size(); r++) {
+        if (parent[r] != r || !cells[r])
+            continue;
+        Organism &o = organisms[r];
+        o.food = 0;
+        o.dominantSpecies = 0;
+        o.dominantCount = 0;
+        species.clear();
+        uint32_t m = r;
+        do {
+            if (cells[m]) {
+                o.food += cells[m]->food;
+                unsigned &n = species[cells[m]->species];
+                n++;
+                if (n > o.dominantCount) {
+                    o.dominantCount = n;
+                    o.dominantSpecies = cells[m]->species;
+                }
+            }
+            m = next[m];
+        } while (m != r);
+        o.speciesCount = species.size();
+        
+        count++;
+        if (o.size > largest)
+            largest = o.size;
+    }
+}
+
+const Organism& Organisms::organism(const Cell &c) {
+    return organisms[find(c.organism)];
+}
+
+uint32_t Organisms::root(const Cell &c) {
+    return find(c.organism);
+}
+
@@ -0,0 +1,68 @@
+#ifndef ORGANISM_H
+#define ORGANISM_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+struct Cell;
+
+//Summary of one connected group of cells
+struct Organism {
+    unsigned size;
+    //Only valid after Organisms::refresh
+    uint64_t food;
+    uint64_t dominantSpecies;
+    unsigned dominantCount;
+    unsigned speciesCount;
+};
+
+//Tracks which cells form connected organisms as the neighbor graph changes
+//Connections are merged immediately with union-find; since union-find cannot split, severs and deaths only mark
+//their organism dirty and every dirty organism is rebuilt from its own members once per tick
+struct Organisms {
+    //Number of organisms and size of the largest; only valid after refresh
+    unsigned count;
+    unsigned largest;
+    
+    Organisms();
+    
+    //Start tracking a new cell as an organism of its own
+    void add(Cell &c);
+    //The cell died; its node is released at the next rebuild
+    void remove(Cell &c);
+    //Cells a and b were connected
+    void join(const Cell &a, const Cell &b);
+    //An edge of the cell was removed, so its organism may have split
+    void split(const Cell &c);
+    //The cell was moved to another address
+    void moved(Cell &c);
+    //Recompute the organisms that were split or lost cells
+    void rebuild();
+    //Recompute food and species of every organism (linear in cells)
+    void refresh();
+    
+    const Organism& organism(const Cell &c);
+    //Cells in the same organism share a root
+    uint32_t root(const Cell &c);
+    
+private:
+    std::vector<uint32_t> parent;
+    //Circular list through the members of each organism
+    std::vector<uint32_t> next;
+    //Null for free or dead nodes
+    std::vector<Cell*> cells;
+    std::vector<Organism> organisms;
+    std::vector<bool> dirty;
+    std::vector<uint32_t> dirtyNodes;
+    std::vector<uint32_t> freeNodes;
+    std::vector<uint32_t> members;
+    std::unordered_map<uint64_t, unsigned> species;
+    
+    uint32_t find(uint32_t node);
+    uint32_t merge(uint32_t a, uint32_t b);
+    void reset(uint32_t node);
+};
+
+#endif // ORGANISM_H
+
@@ -0,0 +1,351 @@
+#include "simulation.h"
+#include "domain.h"
+#include "island.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+using namespace std::chrono;
+
+//What the first slab of a domain tells the others after each update
+struct SlabOrders {
+    //Food cost the budget of the first slab chose for the next update
+    uint64_t turnFoodCost;
+    //Send your cells with your next report
+    uint8_t frame;
+};
+
+//Follows the report of a slab when the first slab asked for its cells: the census sketch of the slab, then this, then
+//the cells
+struct SlabFrame {
+    uint64_t organisms;
+    uint64_t largestOrganism;
+    uint64_t cells;
+};
+
+struct FramedCell {
+    float x, y, z;
+    uint64_t species;
+    uint64_t id;
+};
+
+Snapshot::Snapshot() : cycle(0), ticks(0), tickDuration(0), cycles(0), turnFoodCost(0),
+                       organisms(0), largestOrganism(0), workers(0), nodes(0), crossNodeEdges(0),
+                       imbalance(1), steals(0) {
+}
+
+unsigned Snapshot::size() const {
+    return x.size();
+}
+
+void Snapshot::pack(const std::list<Cell> &cells) {
+    unsigned total = cells.size();
+    x.resize(total);
+    y.resize(total);
+    z.resize(total);
+    species.resize(total);
+    ids.resize(total);
+    
+    unsigned index = 0;
+    for (const Cell &c : cells) {
+        x[index] = c.particle.position.x;
+        y[index] = c.particle.position.y;
+        z[index] = c.particle.position.z;
+        species[index] = c.species;
+        ids[index] = c.id;
+        index++;
+    }
+}
+
+Simulation::Simulation(const phi::V3 &dimensions, uint32_t seed, double tickRate) : group(dimensions, seed),
+                       tickRate(tickRate), frameRate(0), budget(0, false, CELL_TURN_FOOD_COST), recorder(nullptr),
+                       streamer(nullptr), metrics(nullptr), checkpointer(nullptr), exporter(nullptr), domain(nullptr),
+                       island(nullptr), running(false), frameRequested(false), framePending(false) {
+}
+
+Simulation::~Simulation() {
+    stop();
+}
+
+void Simulation::start() {
+    if (running)
+        return;
+    if (domain) {
+        group.domain = domain;
+        group.slab = domain->slab;
+    }
+    running = true;
+    thread = std::thread(&Simulation::run, this);
+}
+
+void Simulation::stop() {
+    running = false;
+    if (thread.joinable())
+        thread.join();
+    //Whatever the simulation thread collected would otherwise wait for the group to be destroyed
+    group.lineage.flush();
+}
+
+void Simulation::run() {
+    steady_clock::time_point lastTick = steady_clock::now();
+    steady_clock::time_point lastPublish = lastTick;
+    uint64_t ticks = 0;
+    
+    while (running) {
+        group.spawn(group.rand() % 16 == 0);
+        steady_clock::time_point tickStart = steady_clock::now();
+        group.update();
+        if (frameRate > 0) {
+            budget.measureTick(duration_cast<duration<double>>(steady_clock::now() - tickStart).count());
+            group.turnFoodCost = budget.turnFoodCost;
+        }
+        ticks++;
+        //Slabs of a domain report to the first one, which publishes once the cells of all of them arrived
+        bool frame = domain ? report() : snapshots.consumed();
+        if (island)
+            island->exchange(group);
+        if (recorder)
+            recorder->capture(group.tick, group);
+        if (streamer)
+            streamer->capture(group.tick, group);
+        if (checkpointer)
+            checkpointer->tick(group);
+        if (exporter)
+            exporter->tick(group);
+        if (metrics)
+            updateMetrics();
+        
+        //Only copy the group out once the viewer has taken the previous snapshot
+        if (frame) {
+            steady_clock::time_point now = steady_clock::now();
+            publish(ticks, duration_cast<duration<double>>(now - lastPublish).count() / ticks);
+            lastPublish = now;
+            ticks = 0;
+        }
+        
+        double rate = frameRate > 0 ? budget.cycles * frameRate : tickRate;
+        if (rate > 0) {
+            lastTick += duration_cast<steady_clock::duration>(duration<double>(1.0 / rate));
+            //Do not try to catch up on ticks that were missed by a slow update
+            steady_clock::time_point now = steady_clock::now();
+            if (lastTick < now)
+                lastTick = now;
+            else
+                std::this_thread::sleep_until(lastTick);
+        }
+    }
+}
+
+SlabReport Simulation::ownReport() const {
+    SlabReport r;
+    r.cells = group.cells.size();
+    r.births = group.births;
+    for (unsigned i = 0; i != DEATH_CAUSES; i++)
+        r.deaths[i] = group.deaths[i];
+    r.edges = group.edges;
+    r.crossEdges = group.crossEdges();
+    r.genomes = group.genomes.size();
+    r.violations = group.checker ? group.checker->violations : 0;
+    r.imbalance = group.imbalance;
+    r.migrations = group.migrations;
+    return r;
+}
+
+SlabReport Simulation::totals() const {
+    if (!domain || reports.empty())
+        return ownReport();
+    SlabReport all = reports[0];
+    for (unsigned t = 1; t != reports.size(); t++) {
+        const SlabReport &r = reports[t];
+        all.cells += r.cells;
+        all.births += r.births;
+        for (unsigned i = 0; i != DEATH_CAUSES; i++)
+            all.deaths[i] += r.deaths[i];
+        all.edges += r.edges;
+        all.crossEdges += r.crossEdges;
+        //A genome held by several slabs is counted by each
+        all.genomes += r.genomes;
+        all.violations += r.violations;
+        all.imbalance = std::max(all.imbalance, r.imbalance);
+        all.migrations += r.migrations;
+    }
+    //Edges between slabs are counted by both
+    all.edges -= all.crossEdges / 2;
+    all.crossEdges = 0;
+    return all;
+}
+
+bool Simulation::report() {
+    unsigned slabs = domain->slabs;
+    outgoing.resize(slabs);
+    reports.resize(slabs);
+    reports[group.slab] = ownReport();
+    bool arriving = framePending;
+    if (group.slab == 0) {
+        SlabOrders orders;
+        orders.turnFoodCost = group.turnFoodCost;
+        //Cells are only asked for once the viewer took the last snapshot and the previous ones arrived
+        orders.frame = !framePending && snapshots.consumed();
+        framePending = orders.frame;
+        for (unsigned t = 1; t != slabs; t++)
+            outgoing[t].assign(reinterpret_cast<const char*>(&orders), sizeof(orders));
+    } else {
+        std::string &out = outgoing[0];
+        out.assign(reinterpret_cast<const char*>(&reports[group.slab]), sizeof(SlabReport));
+        if (frameRequested) {
+            census.take(group);
+            out.append(reinterpret_cast<const char*>(&census.sketch()), sizeof(SpeciesSketch));
+            group.organisms.refresh();
+            SlabFrame frame;
+            frame.organisms = group.organisms.count;
+            frame.largestOrganism = group.organisms.largest;
+            frame.cells = group.cells.size();
+            out.append(reinterpret_cast<const char*>(&frame), sizeof(frame));
+            for (const Cell &c : group.cells) {
+                FramedCell f;
+                f.x = c.particle.position.x;
+                f.y = c.particle.position.y;
+                f.z = c.particle.position.z;
+                f.species = c.species;
+                f.id = c.id;
+                out.append(reinterpret_cast<const char*>(&f), sizeof(f));
+            }
+        }
+    }
+    domain->exchange(group.slab, outgoing, incoming);
+    for (std::string &m : outgoing)
+        m.clear();
+    
+    if (group.slab != 0) {
+        SlabOrders orders;
+        if (incoming[0].size() < sizeof(orders))
+            return false;
+        memcpy(&orders, incoming[0].data(), sizeof(orders));
+        group.turnFoodCost = orders.turnFoodCost;
+        frameRequested = orders.frame;
+        return false;
+    }
+    for (unsigned t = 1; t != slabs; t++)
+        if (incoming[t].size() >= sizeof(SlabReport))
+            memcpy(&reports[t], incoming[t].data(), sizeof(SlabReport));
+    if (!arriving)
+        return false;
+    frames.swap(incoming);
+    return true;
+}
+
+MigrationCounts Simulation::migrations() const {
+    MigrationCounts counts = totals().migrations;
+    if (island)
+        counts += island->migrations;
+    return counts;
+}
+
+void Simulation::updateMetrics() {
+    for (unsigned p = 0; p != GROUP_PHASES; p++)
+        metrics->observe(GroupPhase(p), group.phaseDurations[p]);
+    SlabReport all = totals();
+    metrics->begin();
+    metrics->set(METRIC_TICK, group.tick);
+    metrics->set(METRIC_POPULATION, all.cells);
+    metrics->set(METRIC_BIRTHS, all.births);
+    for (unsigned i = 0; i != DEATH_CAUSES; i++)
+        metrics->set(MetricValue(METRIC_DEATHS + i), all.deaths[i]);
+    metrics->set(METRIC_EDGES, all.edges);
+    metrics->set(METRIC_GENOMES, all.genomes);
+    metrics->set(METRIC_HOT_GENOMES, uint64_t(group.genomes.hot));
+    metrics->set(METRIC_GENOME_EVALUATIONS, group.genomes.evaluations);
+    metrics->set(METRIC_HOT_EVALUATIONS, group.genomes.hotEvaluations);
+    metrics->set(METRIC_GENOME_PROMOTIONS, group.genomes.promotions);
+    metrics->set(METRIC_GENOME_EVICTIONS, group.genomes.evictions);
+    metrics->set(METRIC_IMBALANCE, all.imbalance);
+    metrics->set(METRIC_STEALS, uint64_t(group.chunks.steals));
+    metrics->set(METRIC_RELOCATIONS, group.relocations);
+    if (checkpointer) {
+        metrics->set(METRIC_CHECKPOINTS, checkpointer->completed);
+        metrics->set(METRIC_CHECKPOINT_FAILURES, checkpointer->failed);
+        metrics->set(METRIC_CHECKPOINT_BYTES, checkpointer->bytes);
+        metrics->set(METRIC_CHECKPOINT_PAUSE, checkpointer->pause);
+    }
+    if (group.checker)
+        metrics->set(METRIC_INVARIANT_VIOLATIONS, all.violations);
+    MigrationCounts moved = migrations();
+    metrics->set(METRIC_EMIGRATED, moved.emigrated);
+    metrics->set(METRIC_IMMIGRATED, moved.immigrated);
+    metrics->set(METRIC_MIGRANTS_BLOCKED, moved.blocked);
+    metrics->set(METRIC_MIGRANTS_DROPPED, moved.dropped);
+    metrics->set(METRIC_MIGRANT_FOOD_DROPPED, moved.droppedFood);
+    metrics->end();
+}
+
+void Simulation::publish(uint64_t ticks, double tickDuration) {
+    Snapshot &s = snapshots.write();
+    s.cycle = group.tick;
+    s.ticks = ticks;
+    s.tickDuration = tickDuration;
+    s.cycles = frameRate > 0 ? budget.cycles : 0;
+    s.turnFoodCost = group.turnFoodCost;
+    group.organisms.refresh();
+    s.organisms = group.organisms.count;
+    s.largestOrganism = group.organisms.largest;
+    s.workers = group.workers.size();
+    s.nodes = 0;
+    for (unsigned w = 0; w != s.workers; w++)
+        s.nodes = std::max(s.nodes, group.workers.node(w) + 1);
+    s.crossNodeEdges = group.crossNodeShare();
+    s.imbalance = totals().imbalance;
+    s.steals = group.chunks.steals;
+    s.migrations = migrations();
+    s.pack(group.cells);
+    if (metrics)
+        census.take(group);
+    
+    //The other slabs of a domain sent their cells, organisms and census with their last reports
+    for (unsigned t = 1; t < frames.size(); t++) {
+        const std::string &f = frames[t];
+        size_t at = sizeof(SlabReport) + sizeof(SpeciesSketch);
+        SlabFrame frame;
+        if (f.size() < at + sizeof(frame))
+            continue;
+        memcpy(&frame, f.data() + at, sizeof(frame));
+        at += sizeof(frame);
+        if (f.size() < at + frame.cells * sizeof(FramedCell))
+            continue;
+        if (metrics) {
+            SpeciesSketch sketch;
+            memcpy(&sketch, f.data() + sizeof(SlabReport), sizeof(sketch));
+            census.merge(sketch);
+        }
+        s.organisms += frame.organisms;
+        s.largestOrganism = std::max(s.largestOrganism, unsigned(frame.largestOrganism));
+        for (uint64_t i = 0; i != frame.cells; i++) {
+            FramedCell c;
+            memcpy(&c, f.data() + at + i * sizeof(c), sizeof(c));
+            s.x.push_back(c.x);
+            s.y.push_back(c.y);
+            s.z.push_back(c.z);
+            s.species.push_back(c.species);
+            s.ids.push_back(c.id);
+        }
+    }
+    
+    //Whole population statistics are only worth gathering as often as someone looks at them
+    if (metrics) {
+        metrics->begin();
+        metrics->set(METRIC_FOOD, census.food);
+        metrics->set(METRIC_SPECIES, uint64_t(census.distinct + 0.5));
+        for (unsigned i = 0; i != CENSUS_REPORTED; i++) {
+            const SpeciesCount *c = i < census.heaviest.size() ? &census.heaviest[i] : nullptr;
+            metrics->set(MetricValue(METRIC_HEAVY_SPECIES + i), c ? c->species : 0);
+            metrics->set(MetricValue(METRIC_HEAVY_CELLS + i), c ? c->cells : 0);
+            metrics->set(MetricValue(METRIC_HEAVY_FOOD + i), c ? c->food : 0);
+        }
+        metrics->set(METRIC_ORGANISMS, uint64_t(s.organisms));
+        metrics->set(METRIC_TICK_RATE, tickDuration > 0 ? 1.0 / tickDuration : 0.0);
+        metrics->end();
+    }
+    
+    s.index.build(group.dimensions, s.x, s.y, s.z, s.ids);
+    snapshots.publish();
+}
+
@@ -0,0 +1,130 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "group.h"
+#include "triplebuffer.h"
+#include "budget.h"
+#include "trajectory.h"
+#include "metrics.h"
+#include "invariant.h"
+#include "checkpoint.h"
+#include "census.h"
+#include "spatial.h"
+#include "stream.h"
+#include "library.h"
+#include "domain.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+struct Island;
+
+//Immutable copy of what the viewer needs from one tick
+struct Snapshot {
+    uint64_t cycle;
+    //Ticks run since the previous published snapshot and the average time they took
+    uint64_t ticks;
+    double tickDuration;
+    //Ticks per frame and food cost chosen by the budget
+    unsigned cycles;
+    uint64_t turnFoodCost;
+    unsigned organisms;
+    unsigned largestOrganism;
+    //Workers, the NUMA nodes they run on and the share of edges between cells on different nodes
+    unsigned workers;
+    unsigned nodes;
+    double crossNodeEdges;
+    //Parallel work imbalance of the last tick and chunks stolen so far
+    double imbalance;
+    uint64_t steals;
+    //Cells moved to and from other slabs or islands so far
+    MigrationCounts migrations;
+    std::vector<float> x, y, z;
+    std::vector<uint64_t> species;
+    std::vector<uint64_t> ids;
+    //Index of the positions above; safe to query from whichever thread holds the snapshot
+    SpatialIndex index;
+    
+    Snapshot();
+    
+    unsigned size() const;
+    //Copy the positions, species and ids of the cells into the arrays
+    void pack(const std::list<Cell> &cells);
+};
+
+//Counters every slab of a domain sends the first one after each update
+struct SlabReport {
+    uint64_t cells;
+    uint64_t births;
+    uint64_t deaths[DEATH_CAUSES];
+    uint64_t edges;
+    uint64_t crossEdges;
+    uint64_t genomes;
+    uint64_t violations;
+    double imbalance;
+    MigrationCounts migrations;
+};
+
+//Runs a Group on its own thread and publishes snapshots for whoever is displaying it
+struct Simulation {
+    Group group;
+    TripleBuffer<Snapshot> snapshots;
+    //Target ticks per second (0 runs as fast as possible)
+    double tickRate;
+    //Frames per second the budget paces ticks to; when set this overrides tickRate
+    double frameRate;
+    TickBudget budget;
+    //Receives every tick when set; not owned
+    TrajectoryRecorder *recorder;
+    //Receives every tick when set; not owned
+    FrameStreamer *streamer;
+    //Updated every tick when set; not owned
+    Metrics *metrics;
+    //Forks a checkpoint of the group between ticks when set; not owned
+    Checkpointer *checkpointer;
+    //Adds the heaviest species to a genome library between ticks when set; not owned
+    GenomeExporter *exporter;
+    //Updates the group as one slab of a domain in lockstep with the others when set; not owned
+    //The first slab gathers the counters and cells of all of them for its metrics and snapshots, and the others
+    //follow its food cost
+    Domain *domain;
+    //Trades cells with the other islands of an archipelago after every tick when set; not owned
+    Island *island;
+    
+    Simulation(const phi::V3 &dimensions, uint32_t seed, double tickRate);
+    ~Simulation();
+    
+    void start();
+    void stop();
+    
+private:
+    std::atomic<bool> running;
+    std::thread thread;
+    Census census;
+    //Latest report of every slab of the domain, this one's included
+    std::vector<SlabReport> reports;
+    //The first slab asked the others for their cells (on the others), or is about to receive them (on the first)
+    bool frameRequested;
+    bool framePending;
+    //Reports to and from the other slabs and the last ones that came with cells; kept to avoid allocating every tick
+    std::vector<std::string> outgoing;
+    std::vector<std::string> incoming;
+    std::vector<std::string> frames;
+    
+    void run();
+    //Counters of this group
+    SlabReport ownReport() const;
+    //Counters of the whole domain, or of this group without one
+    SlabReport totals() const;
+    //Trade reports with the other slabs; returns whether the first slab received the cells of all of them
+    bool report();
+    //Migration counters of the domain and the island, whichever are set
+    MigrationCounts migrations() const;
+    //Counters that are cheap enough to update every tick
+    void updateMetrics();
+    //Copy the group into the producer slot of the snapshot buffer and hand it over
+    void publish(uint64_t ticks, double tickDuration);
+};
+
+#endif // SIMULATION_H
+
@@ -0,0 +1,234 @@
+#include "spatial.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+//Wrap a bin coordinate that may lie outside the grid back into it
+static inline unsigned wrapBin(long long coordinate, unsigned resolution) {
+    long long wrapped = coordinate % (long long)resolution;
+    return wrapped < 0 ? wrapped + resolution : wrapped;
+}
+
+SpatialIndex::SpatialIndex() : extent{1, 1, 1}, resolution{1, 1, 1}, binSize{2, 2, 2}, starts(2, 0) {
+}
+
+void SpatialIndex::build(const phi::V3 &dimensions, const std::vector<float> &x, const std::vector<float> &y,
+                         const std::vector<float> &z, const std::vector<uint64_t> &ids) {
+    const std::vector<float> *source[3] = {&x, &y, &z};
+    unsigned cells = ids.size();
+    extent[0] = dimensions.x;
+    extent[1] = dimensions.y;
+    extent[2] = dimensions.z;
+    //Bins as close to cubes as the world allows, enough of them for about SPATIAL_CELLS_PER_BIN cells each
+    double side = std::cbrt(8 * extent[0] * extent[1] * extent[2] / std::max(cells / SPATIAL_CELLS_PER_BIN, 1.0));
+    unsigned total = 1;
+    for (unsigned a = 0; a != 3; a++) {
+        resolution[a] = std::max(1u, std::min(unsigned(SPATIAL_MAX_RESOLUTION), unsigned(2 * extent[a] / side)));
+        binSize[a] = 2 * extent[a] / resolution[a];
+        total *= resolution[a];
+    }
+    
+    //Counting sort by bin
+    bins.resize(cells);
+    starts.assign(total + 1, 0);
+    for (unsigned i = 0; i != cells; i++) {
+        unsigned b = 0;
+        for (unsigned a = 0; a != 3; a++)
+            b = b * resolution[a] + bin((*source[a])[i], a);
+        bins[i] = b;
+        starts[b + 1]++;
+    }
+    for (unsigned b = 0; b != total; b++)
+        starts[b + 1] += starts[b];
+    for (unsigned a = 0; a != 3; a++)
+        positions[a].resize(cells);
+    this->ids.resize(cells);
+    for (unsigned i = 0; i != cells; i++) {
+        unsigned slot = starts[bins[i]]++;
+        for (unsigned a = 0; a != 3; a++)
+            positions[a][slot] = (*source[a])[i];
+        this->ids[slot] = ids[i];
+    }
+    //Placing moved every start to the end of its bin, which is the start of the next
+    for (unsigned b = total; b != 0; b--)
+        starts[b] = starts[b - 1];
+    starts[0] = 0;
+}
+
+void SpatialIndex::build(const Group &group) {
+    for (unsigned a = 0; a != 3; a++)
+        loose[a].clear();
+    looseIds.clear();
+    for (const Cell &c : group.cells) {
+        loose[0].push_back(c.particle.position.x);
+        loose[1].push_back(c.particle.position.y);
+        loose[2].push_back(c.particle.position.z);
+        looseIds.push_back(c.id);
+    }
+    build(group.dimensions, loose[0], loose[1], loose[2], looseIds);
+}
+
+unsigned SpatialIndex::size() const {
+    return ids.size();
+}
+
+unsigned SpatialIndex::bin(double position, unsigned axis) const {
+    double b = std::floor((position + extent[axis]) / binSize[axis]);
+    return b < 0 ? 0 : std::min(unsigned(b), resolution[axis] - 1);
+}
+
+double SpatialIndex::offset(double a, double b, unsigned axis) const {
+    double d = b - a;
+    if (std::abs(d) > extent[axis])
+        d -= 2 * std::copysign(extent[axis], d);
+    return d;
+}
+
+template <typename Visit>
+void SpatialIndex::visitBins(const double center[3], const double reach[3], Visit visit) const {
+    long long first[3];
+    unsigned count[3];
+    for (unsigned a = 0; a != 3; a++) {
+        first[a] = std::floor((center[a] - reach[a] + extent[a]) / binSize[a]);
+        long long last = std::floor((center[a] + reach[a] + extent[a]) / binSize[a]);
+        count[a] = std::min((unsigned long long)(last - first[a] + 1), (unsigned long long)resolution[a]);
+    }
+    for (unsigned i = 0; i != count[0]; i++) {
+        unsigned bx = wrapBin(first[0] + i, resolution[0]);
+        for (unsigned j = 0; j != count[1]; j++) {
+            unsigned by = wrapBin(first[1] + j, resolution[1]);
+            for (unsigned k = 0; k != count[2]; k++) {
+                unsigned b = (bx * resolution[1] + by) * resolution[2] + wrapBin(first[2] + k, resolution[2]);
+                for (unsigned cell = starts[b]; cell != starts[b + 1]; cell++)
+                    visit(cell);
+            }
+        }
+    }
+}
+
+void SpatialIndex::box(const phi::V3 &center, const phi::V3 &halfExtent, std::vector<uint64_t> &out) const {
+    out.clear();
+    double c[3] = {center.x, center.y, center.z};
+    double h[3] = {halfExtent.x, halfExtent.y, halfExtent.z};
+    visitBins(c, h, [&](unsigned cell){
+        for (unsigned a = 0; a != 3; a++)
+            if (std::abs(offset(c[a], positions[a][cell], a)) > h[a])
+                return;
+        out.push_back(ids[cell]);
+    });
+}
+
+void SpatialIndex::sphere(const phi::V3 &center, double radius, std::vector<uint64_t> &out) const {
+    out.clear();
+    double c[3] = {center.x, center.y, center.z};
+    double r[3] = {radius, radius, radius};
+    visitBins(c, r, [&](unsigned cell){
+        double distanceSquared = 0;
+        for (unsigned a = 0; a != 3; a++) {
+            double d = offset(c[a], positions[a][cell], a);
+            distanceSquared += d * d;
+        }
+        if (distanceSquared <= radius * radius)
+            out.push_back(ids[cell]);
+    });
+}
+
+void SpatialIndex::nearest(const phi::V3 &point, unsigned k, std::vector<uint64_t> &out) const {
+    out.clear();
+    k = std::min(k, size());
+    if (!k)
+        return;
+    double c[3] = {point.x, point.y, point.z};
+    //Search ever larger spheres until one holds k cells or covers the whole world
+    double farthest = std::sqrt(extent[0] * extent[0] + extent[1] * extent[1] + extent[2] * extent[2]);
+    double radius = std::max(binSize[0], std::max(binSize[1], binSize[2]));
+    std::vector<std::pair<double, unsigned>> found;
+    while (true) {
+        found.clear();
+        double r[3] = {radius, radius, radius};
+        visitBins(c, r, [&](unsigned cell){
+            double distanceSquared = 0;
+            for (unsigned a = 0; a != 3; a++) {
+                double d = offset(c[a], positions[a][cell], a);
+                distanceSquared += d * d;
+            }
+            if (distanceSquared <= radius * radius)
+                found.emplace_back(distanceSquared, cell);
+        });
+        if (found.size() >= k || radius >= farthest)
+            break;
+        radius *= 2;
+    }
+    std::partial_sort(found.begin(), found.begin() + k, found.end());
+    for (unsigned i = 0; i != k; i++)
+        out.push_back(ids[found[i].second]);
+}
+
+bool SpatialIndex::pick(const phi::V3 &origin, const phi::V3 &direction, double radius, double distance,
+                        uint64_t &id) const {
+    double length = std::sqrt(direction.magnitudeSquared());
+    if (!size() || !(length > 0))
+        return false;
+    double o[3] = {origin.x, origin.y, origin.z};
+    double d[3] = {direction.x / length, direction.y / length, direction.z / length};
+    double diagonal = 2 * std::sqrt(extent[0] * extent[0] + extent[1] * extent[1] + extent[2] * extent[2]);
+    distance = std::min(distance, SPATIAL_PICK_DIAGONALS * diagonal);
+    
+    //Walk the bins the ray passes through without wrapping, testing the cells within reach of each, until the next
+    //bin starts further along than the nearest hit
+    double infinity = std::numeric_limits<double>::infinity();
+    long long current[3];
+    int step[3];
+    double next[3];
+    double across[3];
+    double reach[3];
+    for (unsigned a = 0; a != 3; a++) {
+        current[a] = std::floor((o[a] + extent[a]) / binSize[a]);
+        step[a] = d[a] < 0 ? -1 : 1;
+        across[a] = d[a] ? binSize[a] / std::abs(d[a]) : infinity;
+        next[a] = d[a] ? ((current[a] + (step[a] > 0)) * binSize[a] - extent[a] - o[a]) / d[a] : infinity;
+        reach[a] = binSize[a] / 2 + radius;
+    }
+    double best = infinity;
+    double bestSquared = infinity;
+    double entered = 0;
+    while (entered <= distance && entered <= best) {
+        double center[3];
+        double wrapped[3];
+        for (unsigned a = 0; a != 3; a++) {
+            center[a] = (current[a] + 0.5) * binSize[a] - extent[a];
+            wrapped[a] = (wrapBin(current[a], resolution[a]) + 0.5) * binSize[a] - extent[a];
+        }
+        visitBins(wrapped, reach, [&](unsigned cell){
+            //The image of the cell next to this stretch of the ray
+            double m[3];
+            double along = 0;
+            double squared = 0;
+            for (unsigned a = 0; a != 3; a++) {
+                m[a] = center[a] + offset(wrapped[a], positions[a][cell], a) - o[a];
+                along += m[a] * d[a];
+                squared += m[a] * m[a];
+            }
+            double missed = squared - along * along;
+            if (missed > radius * radius)
+                return;
+            double half = std::sqrt(radius * radius - missed);
+            //Behind the origin
+            if (along + half < 0)
+                return;
+            double hit = std::max(along - half, 0.0);
+            //Spheres the origin is inside all hit at 0, and the one whose center is nearest wins
+            if (hit <= distance && (hit < best || (hit == best && squared < bestSquared))) {
+                best = hit;
+                bestSquared = squared;
+                id = ids[cell];
+            }
+        });
+        unsigned a = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+        entered = next[a];
+        current[a] += step[a];
+        next[a] += across[a];
+    }
+    return best != infinity;
+}
+
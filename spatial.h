@@ -0,0 +1,59 @@
+#ifndef SPATIAL_H
+#define SPATIAL_H
+
+#include "group.h"
+#include <cstdint>
+#include <vector>
+
+//Cells the grid of a spatial index aims for per grid cell
+#define SPATIAL_CELLS_PER_BIN 2.0
+//Most bins along one axis
+#define SPATIAL_MAX_RESOLUTION 1024
+//World diagonals a picking ray is followed for at most; one that wraps along a closed line may never hit anything
+#define SPATIAL_PICK_DIAGONALS 4
+
+//Read-only index of cell positions in a uniform grid over the wrapped world
+//Queries only read the index, so any number of threads may query one that is no longer being built; every query
+//takes the shortest way around the edges of the world and returns cell ids, which never change while a cell lives
+struct SpatialIndex {
+    SpatialIndex();
+    
+    //Bin cells by position; positions have to lie within the half extents in dimensions
+    void build(const phi::V3 &dimensions, const std::vector<float> &x, const std::vector<float> &y,
+               const std::vector<float> &z, const std::vector<uint64_t> &ids);
+    void build(const Group &group);
+    
+    unsigned size() const;
+    //Cells within halfExtent of center along every axis
+    void box(const phi::V3 &center, const phi::V3 &halfExtent, std::vector<uint64_t> &out) const;
+    //Cells within radius of center
+    void sphere(const phi::V3 &center, double radius, std::vector<uint64_t> &out) const;
+    //The k cells nearest to point, nearest first (all of them if there are fewer)
+    void nearest(const phi::V3 &point, unsigned k, std::vector<uint64_t> &out) const;
+    //First cell, treated as a sphere of radius, that the ray from origin along direction hits within distance, which
+    //may be infinite but is cut to SPATIAL_PICK_DIAGONALS world diagonals; returns false if it hits nothing
+    bool pick(const phi::V3 &origin, const phi::V3 &direction, double radius, double distance, uint64_t &id) const;
+    
+private:
+    double extent[3];
+    unsigned resolution[3];
+    double binSize[3];
+    //Cells sorted by bin and the start of every bin in them, with the end of the last one at the back
+    std::vector<unsigned> starts;
+    std::vector<float> positions[3];
+    std::vector<uint64_t> ids;
+    //Bin of every cell and, when building from a group, its position and id before they are sorted
+    std::vector<unsigned> bins;
+    std::vector<float> loose[3];
+    std::vector<uint64_t> looseIds;
+    
+    unsigned bin(double position, unsigned axis) const;
+    //Shortest offset from a to b along an axis
+    double offset(double a, double b, unsigned axis) const;
+    //Call visit(cell) for the cells in every bin overlapping center plus or minus reach, each bin once
+    template <typename Visit>
+    void visitBins(const double center[3], const double reach[3], Visit visit) const;
+};
+
+#endif // SPATIAL_H
+
@@ -0,0 +1,157 @@
+#include "statehash.h"
+#include <cstring>
+
+//Every word goes through a multiply and a rotate so that neighboring words land far apart; nothing depends on
+//anything but the previous word, which leaves the compiler free to keep it all in registers
+static inline uint64_t mix(uint64_t h, uint64_t word) {
+    h ^= word * 0x9e3779b97f4a7c15ull;
+    h = (h << 31 | h >> 33) * 0xbf58476d1ce4e5b9ull;
+    return h;
+}
+
+static inline uint64_t mix(uint64_t h, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return mix(h, bits);
+}
+
+//Murmur3 finalizer; cells are summed, so each one's hash has to be well spread on its own
+static inline uint64_t finish(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb93fe53ec249ull;
+    h ^= h >> 33;
+    return h;
+}
+
+//Pending changes and what each edge decided to do are scratch that every update writes before reading, so they only
+//count within an update; between updates a cell is what a checkpoint keeps of it
+static uint64_t cellHash(const Cell &c, bool scratch) {
+    uint64_t h = mix(0, c.id);
+    h = mix(h, c.food);
+    h = mix(h, c.species);
+    h = mix(h, c.genome->hash);
+    h = mix(h, c.particle.position.x);
+    h = mix(h, c.particle.position.y);
+    h = mix(h, c.particle.position.z);
+    h = mix(h, c.particle.velocity.x);
+    h = mix(h, c.particle.velocity.y);
+    h = mix(h, c.particle.velocity.z);
+    h = mix(h, uint64_t(c.decision.connect));
+    for (double v : c.decision.values)
+        h = mix(h, v);
+    if (scratch) {
+        h = mix(h, uint64_t(c.changes.death) | uint64_t(c.changes.cause) << 8);
+        h = mix(h, c.changes.eatenBy);
+        h = mix(h, c.changes.mate ? c.changes.mate->id : ~uint64_t(0));
+    }
+    for (const Neighbor &n : c.neighbors) {
+        const NeighborDecision &d = n.decision;
+        h = mix(h, n.neighbor->id);
+        if (scratch) {
+            h = mix(h, uint64_t(d.eat) | uint64_t(d.sever) << 8);
+            h = mix(h, d.mate);
+            h = mix(h, d.send);
+            h = mix(h, d.force);
+            h = mix(h, d.signal);
+        }
+        for (double v : d.values)
+            h = mix(h, v);
+    }
+    return finish(h);
+}
+
+StateHasher::StateHasher(bool everyPhase) : everyPhase(everyPhase), tick(0) {
+    for (uint64_t &p : phases)
+        p = 0;
+    for (StateShare &s : shares)
+        s = StateShare();
+}
+
+StateShare StateHasher::share(Group &group, bool scratch) {
+    cells.clear();
+    for (const Cell &c : group.cells)
+        cells.push_back(&c);
+    unsigned workers = group.workers.size();
+    sums.assign(workers, 0);
+    group.workers.run([&](unsigned worker){
+        size_t end = cells.size() * (worker + 1) / workers;
+        uint64_t sum = 0;
+        for (size_t i = cells.size() * worker / workers; i != end; i++)
+            sum += cellHash(*cells[i], scratch);
+        sums[worker] = sum;
+    });
+    
+    StateShare s;
+    s.cells = 0;
+    for (uint64_t sum : sums)
+        s.cells += sum;
+    s.population = group.cells.size();
+    s.births = group.births;
+    for (unsigned d = 0; d != DEATH_CAUSES; d++)
+        s.deaths[d] = group.deaths[d];
+    s.edges = group.edges;
+    s.crossEdges = group.crossEdges();
+    s.foodCreated = group.foodCreated;
+    s.foodRemoved = group.foodRemoved;
+    s.tick = group.tick;
+    s.nextId = group.nextId;
+    s.turnFoodCost = group.turnFoodCost;
+    //The generator is only hashed through what it would draw next, which is enough to catch a stray draw
+    std::mt19937 rand = group.rand;
+    s.draw = rand();
+    return s;
+}
+
+uint64_t StateHasher::hash(Group &group) {
+    StateShare s = share(group, false);
+    return combineShares(&s, 1);
+}
+
+void StateHasher::endPhase(Group &group, GroupPhase phase) {
+    tick = group.tick;
+    if (everyPhase || phase == GROUP_PHASES - 1) {
+        shares[phase] = share(group, phase != GROUP_PHASES - 1);
+        phases[phase] = combineShares(&shares[phase], 1);
+    }
+}
+
+uint64_t StateHasher::last() const {
+    return phases[GROUP_PHASES - 1];
+}
+
+uint64_t combineShares(const StateShare *shares, unsigned count) {
+    //Every edge between two slabs is counted by both
+    StateShare all = shares[0];
+    for (unsigned i = 1; i != count; i++) {
+        const StateShare &s = shares[i];
+        all.cells += s.cells;
+        all.population += s.population;
+        all.births += s.births;
+        for (unsigned d = 0; d != DEATH_CAUSES; d++)
+            all.deaths[d] += s.deaths[d];
+        all.edges += s.edges;
+        all.crossEdges += s.crossEdges;
+        all.foodCreated += s.foodCreated;
+        all.foodRemoved += s.foodRemoved;
+    }
+    uint64_t h = mix(0, all.tick);
+    h = mix(h, all.nextId);
+    h = mix(h, all.births);
+    for (uint64_t d : all.deaths)
+        h = mix(h, d);
+    h = mix(h, all.edges - all.crossEdges / 2);
+    h = mix(h, all.turnFoodCost);
+    h = mix(h, all.foodCreated);
+    h = mix(h, all.foodRemoved);
+    h = mix(h, all.draw);
+    h = mix(h, all.population);
+    return finish(h) + all.cells;
+}
+
+uint64_t stateHash(Group &group) {
+    StateHasher hasher(false);
+    return hasher.hash(group);
+}
+
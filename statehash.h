@@ -0,0 +1,65 @@
+#ifndef STATEHASH_H
+#define STATEHASH_H
+
+#include "group.h"
+
+//Hash of everything that decides how a group goes on from one update to the next: counters, generator, positions,
+//velocities, food, persistent decisions, genomes and edges; a group restored from a checkpoint hashes the same
+//Cells are hashed on their own and summed, so the hash does not depend on the order of the list or where cells live
+//in memory, while a cell's edges are hashed in the order of its neighbor list since that order changes results
+//Runs on the group's workers, so it may only be called between parallel phases
+uint64_t stateHash(Group &group);
+
+//What one group adds to the hash of the world it is part of; a world split into slabs hashes the same as when one
+//group holds it once the shares of all its slabs are combined
+struct StateShare {
+    //Sum of the hashes of the cells
+    uint64_t cells;
+    uint64_t population;
+    uint64_t births;
+    uint64_t deaths[DEATH_CAUSES];
+    uint64_t edges;
+    uint64_t crossEdges;
+    uint64_t foodCreated;
+    uint64_t foodRemoved;
+    //The same in every slab of a domain
+    uint64_t tick;
+    uint64_t nextId;
+    uint64_t turnFoodCost;
+    //What the generator would draw next
+    uint64_t draw;
+};
+
+//Hash of the world that the groups of the shares together hold
+uint64_t combineShares(const StateShare *shares, unsigned count);
+
+//Hashes a group after every phase of every update when set as its hasher
+struct StateHasher {
+    //Hash every phase rather than only the state at the end of an update
+    bool everyPhase;
+    //Group::tick during the update the hashes below belong to, which is one less than after it
+    uint64_t tick;
+    //State after each phase of that update and the shares it was combined from; only the last is set unless
+    //everyPhase is, and only the phases before the last include pending changes and what edges decided
+    uint64_t phases[GROUP_PHASES];
+    StateShare shares[GROUP_PHASES];
+    
+    StateHasher(bool everyPhase);
+    
+    //Called by the group after every phase
+    void endPhase(Group &group, GroupPhase phase);
+    //Hash of the state at the end of the last update
+    uint64_t last() const;
+    //Hash the group now; the same as stateHash
+    uint64_t hash(Group &group);
+    //Share of the group in the hash of its world now, with or without the scratch an update leaves behind
+    StateShare share(Group &group, bool scratch);
+    
+private:
+    //Cells gathered for the workers and what each worker summed; kept to avoid allocating every phase
+    std::vector<const Cell*> cells;
+    std::vector<uint64_t> sums;
+};
+
+#endif // STATEHASH_H
+
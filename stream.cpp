@@ -0,0 +1,617 @@
+#include "stream.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//Sent once to every viewer: magic, dimensions and position bits
+static const char STREAM_MAGIC[8] = {'E', 'V', 'O', 'S', 'T', 'R', 'M', '1'};
+static const size_t HELLO_SIZE = 8 + 3 * sizeof(double) + 4;
+
+static void putVarint(std::vector<uint8_t> &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(uint8_t(value));
+}
+
+static uint64_t zigzag(int64_t value) {
+    return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+template<class T>
+static void putRaw(std::vector<uint8_t> &out, T value) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+//Bounds checked reading of a message; once anything was out of bounds every read returns 0
+struct StreamReader {
+    const uint8_t *in;
+    const uint8_t *end;
+    bool ok;
+    
+    StreamReader(const uint8_t *in, size_t length) : in(in), end(in + length), ok(true) {}
+    
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (in == end)
+                break;
+            uint8_t byte = *in++;
+            value |= uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        ok = false;
+        return 0;
+    }
+    
+    template<class T>
+    T raw() {
+        T value = 0;
+        if (size_t(end - in) < sizeof(T))
+            ok = false;
+        else {
+            memcpy(&value, in, sizeof(T));
+            in += sizeof(T);
+        }
+        return value;
+    }
+};
+
+static uint16_t quantize(double value, double extent) {
+    double top = (1 << STREAM_POSITION_BITS) - 1;
+    double q = (value + extent) / (2 * extent) * top + 0.5;
+    if (!(q > 0))
+        return 0;
+    if (q > top)
+        return top;
+    return uint16_t(q);
+}
+
+double streamPosition(uint16_t quantized, double extent) {
+    return quantized / double((1 << STREAM_POSITION_BITS) - 1) * 2 * extent - extent;
+}
+
+//Edges are sorted, so firsts only grow and seconds only grow while the first stays the same
+static void putEdges(std::vector<uint8_t> &out, const std::vector<StreamEdge> &edges) {
+    putVarint(out, edges.size());
+    StreamEdge last(0, 0);
+    for (const StreamEdge &e : edges) {
+        putVarint(out, e.first - last.first);
+        putVarint(out, e.first == last.first ? e.second - last.second : e.second - e.first);
+        last = e;
+    }
+}
+
+static void getEdges(StreamReader &in, std::vector<StreamEdge> &edges) {
+    uint64_t count = in.varint();
+    edges.clear();
+    StreamEdge last(0, 0);
+    for (uint64_t i = 0; i != count && in.ok; i++) {
+        StreamEdge e;
+        e.first = last.first + in.varint();
+        e.second = (e.first == last.first ? last.second : e.first) + in.varint();
+        edges.push_back(e);
+        last = e;
+    }
+}
+
+//Open a listening (server) or connected socket; anything with a colon is a TCP host:port and the rest are Unix socket
+//paths; returns -1 and says why on failure
+static int openSocket(const std::string &address, bool server) {
+    size_t colon = address.rfind(':');
+    int fd = -1;
+    if (colon == std::string::npos) {
+        sockaddr_un local;
+        memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(local.sun_path)) {
+            std::cerr << "Stream: Socket path too long: " << address << std::endl;
+            return -1;
+        }
+        strcpy(local.sun_path, address.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        //A socket left behind by a previous run would make bind fail
+        if (server)
+            unlink(address.c_str());
+        if (fd >= 0 && (server ? bind(fd, (sockaddr*)&local, sizeof(local)) || listen(fd, STREAM_MAX_CLIENTS) :
+                                 ::connect(fd, (sockaddr*)&local, sizeof(local)))) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        std::string host = address.substr(0, colon);
+        std::string port = address.substr(colon + 1);
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = server ? AI_PASSIVE : 0;
+        addrinfo *found;
+        if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found)) {
+            std::cerr << "Stream: Failed to resolve " << address << std::endl;
+            return -1;
+        }
+        for (addrinfo *a = found; a && fd < 0; a = a->ai_next) {
+            fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            int yes = 1;
+            if (fd >= 0 && server)
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+            if (fd >= 0 && (server ? bind(fd, a->ai_addr, a->ai_addrlen) || listen(fd, STREAM_MAX_CLIENTS) :
+                                     ::connect(fd, a->ai_addr, a->ai_addrlen))) {
+                close(fd);
+                fd = -1;
+            }
+            //Messages are written whole, so there is nothing to gain from waiting to fill packets
+            if (fd >= 0 && !server)
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        }
+        freeaddrinfo(found);
+    }
+    if (fd < 0)
+        std::cerr << "Stream: Failed to " << (server ? "listen on " : "connect to ") << address << ": "
+                  << strerror(errno) << std::endl;
+    return fd;
+}
+
+StreamFrame::StreamFrame() : tick(0) {
+}
+
+void StreamFrame::clear() {
+    tick = 0;
+    ids.clear();
+    x.clear();
+    y.clear();
+    z.clear();
+    colors.clear();
+    edges.clear();
+}
+
+unsigned StreamFrame::size() const {
+    return ids.size();
+}
+
+void encodeFrame(const StreamFrame &previous, const StreamFrame &current, std::vector<uint8_t> &out) {
+    //Cells are matched up by walking both frames in id order; cells in both are numbered in that order and changes
+    //to them are stored against the number of the last changed one
+    std::vector<uint8_t> removed, added, moved, recolored;
+    uint64_t removedCount = 0, addedCount = 0, movedCount = 0, recoloredCount = 0;
+    uint64_t lastRemoved = 0, lastAdded = 0, lastMoved = 0, lastRecolored = 0;
+    uint64_t common = 0;
+    unsigned i = 0;
+    unsigned j = 0;
+    while (i != previous.size() || j != current.size()) {
+        if (j == current.size() || (i != previous.size() && previous.ids[i] < current.ids[j])) {
+            putVarint(removed, previous.ids[i] - lastRemoved);
+            lastRemoved = previous.ids[i++];
+            removedCount++;
+        } else if (i == previous.size() || current.ids[j] < previous.ids[i]) {
+            putVarint(added, current.ids[j] - lastAdded);
+            putVarint(added, current.x[j]);
+            putVarint(added, current.y[j]);
+            putVarint(added, current.z[j]);
+            putVarint(added, current.colors[j]);
+            lastAdded = current.ids[j++];
+            addedCount++;
+        } else {
+            if (previous.x[i] != current.x[j] || previous.y[i] != current.y[j] || previous.z[i] != current.z[j]) {
+                putVarint(moved, common - lastMoved);
+                putVarint(moved, zigzag(int64_t(current.x[j]) - previous.x[i]));
+                putVarint(moved, zigzag(int64_t(current.y[j]) - previous.y[i]));
+                putVarint(moved, zigzag(int64_t(current.z[j]) - previous.z[i]));
+                lastMoved = common;
+                movedCount++;
+            }
+            if (previous.colors[i] != current.colors[j]) {
+                putVarint(recolored, common - lastRecolored);
+                putVarint(recolored, current.colors[j]);
+                lastRecolored = common;
+                recoloredCount++;
+            }
+            common++;
+            i++;
+            j++;
+        }
+    }
+    
+    std::vector<StreamEdge> cut;
+    std::vector<StreamEdge> linked;
+    std::set_difference(previous.edges.begin(), previous.edges.end(), current.edges.begin(), current.edges.end(),
+                        std::back_inserter(cut));
+    std::set_difference(current.edges.begin(), current.edges.end(), previous.edges.begin(), previous.edges.end(),
+                        std::back_inserter(linked));
+    
+    putRaw(out, current.tick);
+    putVarint(out, removedCount);
+    out.insert(out.end(), removed.begin(), removed.end());
+    putVarint(out, addedCount);
+    out.insert(out.end(), added.begin(), added.end());
+    putVarint(out, movedCount);
+    out.insert(out.end(), moved.begin(), moved.end());
+    putVarint(out, recoloredCount);
+    out.insert(out.end(), recolored.begin(), recolored.end());
+    putEdges(out, cut);
+    putEdges(out, linked);
+}
+
+bool decodeFrame(const uint8_t *data, size_t length, StreamFrame &frame) {
+    StreamReader in(data, length);
+    uint64_t tick = in.raw<uint64_t>();
+    struct Born {
+        uint64_t id;
+        uint16_t x, y, z;
+        uint32_t color;
+    };
+    //Changes to cells that are in both frames, by their number among those cells
+    struct Moved {
+        uint64_t common;
+        int64_t x, y, z;
+    };
+    std::vector<uint64_t> removed;
+    std::vector<Born> added;
+    std::vector<Moved> moved;
+    std::vector<std::pair<uint64_t, uint32_t>> recolored;
+    uint64_t last = 0;
+    for (uint64_t i = 0, count = in.varint(); i != count && in.ok; i++)
+        removed.push_back(last += in.varint());
+    last = 0;
+    for (uint64_t i = 0, count = in.varint(); i != count && in.ok; i++) {
+        Born b;
+        b.id = last += in.varint();
+        b.x = in.varint();
+        b.y = in.varint();
+        b.z = in.varint();
+        b.color = in.varint();
+        added.push_back(b);
+    }
+    last = 0;
+    for (uint64_t i = 0, count = in.varint(); i != count && in.ok; i++) {
+        Moved m;
+        m.common = last += in.varint();
+        m.x = unzigzag(in.varint());
+        m.y = unzigzag(in.varint());
+        m.z = unzigzag(in.varint());
+        moved.push_back(m);
+    }
+    last = 0;
+    for (uint64_t i = 0, count = in.varint(); i != count && in.ok; i++) {
+        last += in.varint();
+        recolored.emplace_back(last, in.varint());
+    }
+    std::vector<StreamEdge> cut;
+    std::vector<StreamEdge> linked;
+    getEdges(in, cut);
+    getEdges(in, linked);
+    if (!in.ok || in.in != in.end)
+        return false;
+    
+    StreamFrame next;
+    next.tick = tick;
+    size_t r = 0, a = 0, m = 0, c = 0;
+    uint64_t common = 0;
+    unsigned i = 0;
+    while (i != frame.size() || a != added.size()) {
+        if (a != added.size() && (i == frame.size() || added[a].id < frame.ids[i])) {
+            next.ids.push_back(added[a].id);
+            next.x.push_back(added[a].x);
+            next.y.push_back(added[a].y);
+            next.z.push_back(added[a].z);
+            next.colors.push_back(added[a].color);
+            a++;
+        } else if (a != added.size() && added[a].id == frame.ids[i]) {
+            return false;
+        } else if (r != removed.size() && removed[r] == frame.ids[i]) {
+            r++;
+            i++;
+        } else {
+            next.ids.push_back(frame.ids[i]);
+            next.x.push_back(frame.x[i]);
+            next.y.push_back(frame.y[i]);
+            next.z.push_back(frame.z[i]);
+            next.colors.push_back(frame.colors[i]);
+            if (m != moved.size() && moved[m].common == common) {
+                next.x.back() += moved[m].x;
+                next.y.back() += moved[m].y;
+                next.z.back() += moved[m].z;
+                m++;
+            }
+            if (c != recolored.size() && recolored[c].first == common) {
+                next.colors.back() = recolored[c].second;
+                c++;
+            }
+            common++;
+            i++;
+        }
+    }
+    if (r != removed.size() || m != moved.size() || c != recolored.size())
+        return false;
+    
+    std::vector<StreamEdge> kept;
+    std::set_difference(frame.edges.begin(), frame.edges.end(), cut.begin(), cut.end(), std::back_inserter(kept));
+    if (kept.size() + cut.size() != frame.edges.size())
+        return false;
+    std::merge(kept.begin(), kept.end(), linked.begin(), linked.end(), std::back_inserter(next.edges));
+    std::swap(frame, next);
+    return true;
+}
+
+FrameStreamer::FrameStreamer(const std::string &address, const phi::V3 &dimensions) : dropped(0), sent(0), bytes(0),
+                             address(address), dimensions(dimensions), stopping(false), clients(0) {
+    listener = openSocket(address, true);
+    if (listener < 0 || pipe(wake)) {
+        std::cerr << "FrameStreamer: Failed to start" << std::endl;
+        exit(1);
+    }
+    fcntl(listener, F_SETFL, O_NONBLOCK);
+    //Capturing must never block on a streaming thread that has not drained its wakeups yet
+    fcntl(wake[1], F_SETFL, O_NONBLOCK);
+    thread = std::thread(&FrameStreamer::run, this);
+}
+
+FrameStreamer::~FrameStreamer() {
+    stopping = true;
+    char byte = 0;
+    if (write(wake[1], &byte, 1) != 1)
+        std::cerr << "FrameStreamer: Failed to wake streaming thread" << std::endl;
+    thread.join();
+    close(wake[0]);
+    close(wake[1]);
+    close(listener);
+    if (address.find(':') == std::string::npos)
+        unlink(address.c_str());
+}
+
+void FrameStreamer::capture(uint64_t tick, const Group &group) {
+    if (!clients.load(std::memory_order_relaxed))
+        return;
+    StreamFrame &f = frames.write();
+    f.clear();
+    f.tick = tick;
+    for (const Cell &c : group.cells) {
+        f.ids.push_back(c.id);
+        f.x.push_back(quantize(c.particle.position.x, dimensions.x));
+        f.y.push_back(quantize(c.particle.position.y, dimensions.y));
+        f.z.push_back(quantize(c.particle.position.z, dimensions.z));
+        f.colors.push_back(c.species & 0xFFFFFF);
+        for (const Neighbor &n : c.neighbors)
+            if (c.id < n.neighbor->id)
+                f.edges.emplace_back(c.id, n.neighbor->id);
+    }
+    frames.publish();
+    char byte = 0;
+    //A full pipe already has a wakeup waiting
+    if (write(wake[1], &byte, 1) < 0 && errno != EAGAIN)
+        std::cerr << "FrameStreamer: Failed to wake streaming thread" << std::endl;
+}
+
+void FrameStreamer::sort(const StreamFrame &captured) {
+    order.resize(captured.size());
+    for (unsigned i = 0; i != order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b){
+        return captured.ids[a] < captured.ids[b];
+    });
+    latest.clear();
+    latest.tick = captured.tick;
+    for (unsigned i : order) {
+        latest.ids.push_back(captured.ids[i]);
+        latest.x.push_back(captured.x[i]);
+        latest.y.push_back(captured.y[i]);
+        latest.z.push_back(captured.z[i]);
+        latest.colors.push_back(captured.colors[i]);
+    }
+    latest.edges = captured.edges;
+    std::sort(latest.edges.begin(), latest.edges.end());
+}
+
+bool FrameStreamer::flush(Client &client) {
+    while (client.written != client.pending.size()) {
+        ssize_t n = send(client.fd, client.pending.data() + client.written, client.pending.size() - client.written,
+                         MSG_NOSIGNAL);
+        if (n > 0)
+            client.written += n;
+        else
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+    }
+    client.pending.clear();
+    client.written = 0;
+    return true;
+}
+
+void FrameStreamer::run() {
+    std::vector<Client> viewers;
+    std::vector<pollfd> fds;
+    std::vector<uint8_t> message;
+    
+    while (!stopping) {
+        fds.clear();
+        fds.push_back({wake[0], POLLIN, 0});
+        fds.push_back({listener, POLLIN, 0});
+        for (Client &c : viewers)
+            fds.push_back({c.fd, short(c.pending.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+        if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR)
+            return;
+        if (fds[0].revents & POLLIN) {
+            char drain[64];
+            if (read(wake[0], drain, sizeof(drain)) < 0)
+                std::cerr << "FrameStreamer: Failed to read wakeups" << std::endl;
+        }
+        
+        //Viewers only ever hang up, so anything readable from them is the end
+        std::vector<bool> gone(viewers.size(), false);
+        for (unsigned i = 0; i != viewers.size(); i++)
+            if (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) {
+                char byte;
+                gone[i] = recv(viewers[i].fd, &byte, 1, MSG_DONTWAIT) <= 0 || (fds[i + 2].revents & POLLERR);
+            }
+        
+        if (fds[1].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(listener, nullptr, nullptr)) >= 0) {
+                if (viewers.size() == STREAM_MAX_CLIENTS) {
+                    close(fd);
+                    continue;
+                }
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                int yes = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+                viewers.emplace_back();
+                Client &c = viewers.back();
+                c.fd = fd;
+                c.written = 0;
+                c.pending.insert(c.pending.end(), STREAM_MAGIC, STREAM_MAGIC + sizeof(STREAM_MAGIC));
+                putRaw(c.pending, dimensions.x);
+                putRaw(c.pending, dimensions.y);
+                putRaw(c.pending, dimensions.z);
+                putRaw(c.pending, uint32_t(STREAM_POSITION_BITS));
+                gone.push_back(false);
+            }
+            clients = viewers.size();
+        }
+        
+        if (frames.update()) {
+            sort(frames.read());
+            for (unsigned i = 0; i != viewers.size(); i++) {
+                Client &c = viewers[i];
+                if (gone[i])
+                    continue;
+                if (!c.pending.empty()) {
+                    dropped++;
+                    continue;
+                }
+                message.clear();
+                putRaw(message, uint32_t(0));
+                encodeFrame(c.frame, latest, message);
+                uint32_t length = message.size() - 4;
+                memcpy(message.data(), &length, 4);
+                c.pending.swap(message);
+                c.frame = latest;
+                sent++;
+                bytes += c.pending.size();
+            }
+        }
+        
+        unsigned kept = 0;
+        for (unsigned i = 0; i != viewers.size(); i++) {
+            if (gone[i] || !flush(viewers[i])) {
+                close(viewers[i].fd);
+                continue;
+            }
+            if (kept != i)
+                viewers[kept] = std::move(viewers[i]);
+            kept++;
+        }
+        viewers.resize(kept);
+        clients = kept;
+    }
+    
+    for (Client &c : viewers)
+        close(c.fd);
+}
+
+FrameReceiver::FrameReceiver() : bytes(0), fd(-1), used(0) {
+}
+
+FrameReceiver::~FrameReceiver() {
+    if (fd >= 0)
+        close(fd);
+}
+
+bool FrameReceiver::connect(const std::string &address) {
+    if (fd >= 0)
+        close(fd);
+    used = 0;
+    fd = openSocket(address, false);
+    if (fd < 0)
+        return false;
+    uint8_t hello[HELLO_SIZE];
+    size_t got = 0;
+    while (got != HELLO_SIZE) {
+        ssize_t n = read(fd, hello + got, HELLO_SIZE - got);
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    StreamReader in(hello + sizeof(STREAM_MAGIC), HELLO_SIZE - sizeof(STREAM_MAGIC));
+    dimensions.x = in.raw<double>();
+    dimensions.y = in.raw<double>();
+    dimensions.z = in.raw<double>();
+    if (got != HELLO_SIZE || memcmp(hello, STREAM_MAGIC, sizeof(STREAM_MAGIC)) ||
+            in.raw<uint32_t>() != STREAM_POSITION_BITS) {
+        std::cerr << "FrameReceiver: " << address << " is not a compatible frame stream" << std::endl;
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return true;
+}
+
+bool FrameReceiver::receive(StreamFrame &frame, double timeout) {
+    bool waited = false;
+    while (fd >= 0) {
+        while (true) {
+            if (buffer.size() - used < 65536)
+                buffer.resize(used + 65536);
+            ssize_t n = read(fd, buffer.data() + used, buffer.size() - used);
+            if (n > 0)
+                used += n;
+            else {
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    close(fd);
+                    fd = -1;
+                }
+                break;
+            }
+        }
+        
+        //Every message has to be applied in turn, since each is a delta against the one before
+        size_t offset = 0;
+        bool received = false;
+        while (used - offset >= 4) {
+            uint32_t length;
+            memcpy(&length, buffer.data() + offset, 4);
+            if (used - offset - 4 < length)
+                break;
+            if (!decodeFrame(buffer.data() + offset + 4, length, frame)) {
+                std::cerr << "FrameReceiver: Malformed frame" << std::endl;
+                if (fd >= 0)
+                    close(fd);
+                fd = -1;
+                return false;
+            }
+            bytes += length + 4;
+            offset += length + 4;
+            received = true;
+        }
+        memmove(buffer.data(), buffer.data() + offset, used - offset);
+        used -= offset;
+        if (received || waited || fd < 0)
+            return received;
+        
+        pollfd readable = {fd, POLLIN, 0};
+        poll(&readable, 1, int(timeout * 1000));
+        waited = true;
+    }
+    return false;
+}
+
+bool FrameReceiver::closed() const {
+    return fd < 0;
+}
+
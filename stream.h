@@ -0,0 +1,110 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "group.h"
+#include "triplebuffer.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+//Bits positions are quantized to along each axis; coarser positions leave more cells unchanged between frames
+#define STREAM_POSITION_BITS 12
+//Viewers connected at once; more are turned away
+#define STREAM_MAX_CLIENTS 8
+
+typedef std::pair<uint64_t, uint64_t> StreamEdge;
+
+//What a viewer draws of one tick, sorted by id; colors are the low 24 bits of the species
+struct StreamFrame {
+    uint64_t tick;
+    std::vector<uint64_t> ids;
+    std::vector<uint16_t> x, y, z;
+    std::vector<uint32_t> colors;
+    //Every edge once with the lower id first, sorted
+    std::vector<StreamEdge> edges;
+    
+    StreamFrame();
+    
+    void clear();
+    unsigned size() const;
+};
+
+//Append the message that turns previous into current: cells that died, cells that were born, then only the cells
+//whose quantized position or color changed and the edges that were added or cut
+//Against an empty previous frame this is a key frame, so bytes scale with motion rather than population
+void encodeFrame(const StreamFrame &previous, const StreamFrame &current, std::vector<uint8_t> &out);
+//Apply a message made by encodeFrame from frame to frame; returns false if it is malformed
+bool decodeFrame(const uint8_t *in, size_t length, StreamFrame &frame);
+//Convert a quantized coordinate back into a position within extent
+double streamPosition(uint16_t quantized, double extent);
+
+//Streams the ticks of a group to viewers on a Unix socket path or a TCP host:port from its own thread
+//Each viewer gets deltas against the last frame it was sent; one that has not taken its last message yet skips
+//frames until it has, so a slow viewer never holds up the simulation or the other viewers
+struct FrameStreamer {
+    //Frames not sent to a viewer because it was still busy with an earlier one, and messages sent
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> sent;
+    std::atomic<uint64_t> bytes;
+    
+    FrameStreamer(const std::string &address, const phi::V3 &dimensions);
+    ~FrameStreamer();
+    
+    //Quantize the group for the streaming thread; called from the simulation thread after a tick and does nothing
+    //while no viewer is connected
+    void capture(uint64_t tick, const Group &group);
+    
+private:
+    struct Client {
+        int fd;
+        //Unsent bytes of the last message and the frame the viewer will have once it has them all
+        std::vector<uint8_t> pending;
+        size_t written;
+        StreamFrame frame;
+    };
+    
+    std::string address;
+    phi::V3 dimensions;
+    int listener;
+    int wake[2];
+    std::atomic<bool> stopping;
+    std::atomic<unsigned> clients;
+    //Captured frames in capture order; sorted by id on the streaming thread
+    TripleBuffer<StreamFrame> frames;
+    StreamFrame latest;
+    std::vector<unsigned> order;
+    std::thread thread;
+    
+    void run();
+    //Sort the newest captured frame into latest
+    void sort(const StreamFrame &captured);
+    //Write as much of the pending message as the socket takes; returns false if the viewer is gone
+    bool flush(Client &client);
+};
+
+//Receives the frames of a FrameStreamer
+struct FrameReceiver {
+    phi::V3 dimensions;
+    //Bytes of every message received
+    uint64_t bytes;
+    
+    FrameReceiver();
+    ~FrameReceiver();
+    
+    //Returns false if nothing is listening at address or it is not a frame streamer
+    bool connect(const std::string &address);
+    //Bring frame up to the newest message that has arrived, waiting up to timeout seconds for one
+    //Returns false if no message arrived in time or the connection is gone, which closed tells apart
+    bool receive(StreamFrame &frame, double timeout);
+    bool closed() const;
+    
+private:
+    int fd;
+    std::vector<uint8_t> buffer;
+    size_t used;
+};
+
+#endif // STREAM_H
+
@@ -0,0 +1,51 @@
+#include "checkpoint.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+static void usage() {
+    cerr << "Usage: compact CHECKPOINT [OUTPUT]" << endl
+         << "Restores the chain of deltas ending at CHECKPOINT and writes it as one full checkpoint to OUTPUT, by" << endl
+         << "default the full checkpoint of the same tick next to CHECKPOINT, which later deltas then start from" << endl;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2 && argc != 3) {
+        usage();
+        return 2;
+    }
+    string path = argv[1];
+    //Dimensions come from the checkpoint
+    Group group(phi::V3(1.0, 1.0, 1.0), 0);
+    if (!restoreCheckpoint(path, group))
+        return 1;
+    
+    string output;
+    if (argc == 3)
+        output = argv[2];
+    else {
+        size_t slash = path.find_last_of('/');
+        output = checkpointPath(slash == string::npos ? "." : path.substr(0, slash), group.tick, false);
+    }
+    //Written aside first so a chain that ends in a full checkpoint of the same tick is never left half replaced
+    string partial = output + ".partial";
+    {
+        ofstream out(partial);
+        if (!out || !writeCheckpoint(out, group) || !out.flush()) {
+            cerr << "compact: Failed to write " << partial << endl;
+            remove(partial.c_str());
+            return 1;
+        }
+    }
+    if (rename(partial.c_str(), output.c_str()) != 0) {
+        cerr << "compact: Failed to replace " << output << endl;
+        return 1;
+    }
+    cout << "Tick " << group.tick << ": " << group.cells.size() << " cells, " << group.edges << " edges written to "
+         << output << endl;
+    return 0;
+}
+
@@ -0,0 +1,168 @@
+#include "statehash.h"
+#include "domain.h"
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static void usage() {
+    cerr << "Usage: diverge [--ticks N] [--seed S] [--workers A B] [--slabs N] [--record FILE | --against FILE]"
+         << endl
+         << "Runs the world twice from the same seed, with A and B workers (1 and one per hardware thread by" << endl
+         << "default), and reports the first tick and phase after which their states differ" << endl
+         << "--slabs splits the second run into a domain of N slabs, each with B workers on its own thread" << endl
+         << "--record writes the hashes of a single run to FILE and --against compares a run with such a file," << endl
+         << "for instance one recorded before a change" << endl;
+}
+
+//Ticks the same way the simulation thread does
+static void step(Group &group) {
+    group.spawn(group.rand() % 16 == 0);
+    group.update();
+}
+
+//Ticks the slabs of a domain together; each needs its own thread since every exchange waits for all of them
+static void step(vector<unique_ptr<Group>> &slabs) {
+    vector<thread> threads;
+    for (unique_ptr<Group> &g : slabs)
+        threads.emplace_back([&g](){
+            step(*g);
+        });
+    for (thread &t : threads)
+        t.join();
+}
+
+static void report(uint64_t tick, unsigned phase, uint64_t a, uint64_t b) {
+    cout << "Diverged in tick " << tick << " after phase " << groupPhaseNames[phase] << ": " << hex << setw(16)
+         << setfill('0') << a << " != " << setw(16) << b << dec << endl;
+}
+
+int main(int argc, char **argv) {
+    uint64_t ticks = 1000;
+    uint32_t seed = 1743;
+    unsigned workers[2] = {1, thread::hardware_concurrency()};
+    unsigned slabs = 0;
+    string record;
+    string against;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--ticks" && i + 1 < argc)
+            ticks = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--seed" && i + 1 < argc)
+            seed = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--workers" && i + 2 < argc) {
+            workers[0] = atoi(argv[++i]);
+            workers[1] = atoi(argv[++i]);
+        } else if (arg == "--slabs" && i + 1 < argc)
+            slabs = atoi(argv[++i]);
+        else if (arg == "--record" && i + 1 < argc)
+            record = argv[++i];
+        else if (arg == "--against" && i + 1 < argc)
+            against = argv[++i];
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if ((!record.empty() && !against.empty()) || slabs > DOMAIN_MAX_SLABS) {
+        usage();
+        return 2;
+    }
+    
+    bool single = !record.empty() || !against.empty();
+    Group a(phi::V3(1.0, 1.0, 1.0), seed);
+    Group b(phi::V3(1.0, 1.0, 1.0), seed);
+    StateHasher hashA(true);
+    StateHasher hashB(true);
+    a.hasher = &hashA;
+    b.hasher = &hashB;
+    a.workers.resize(workers[0], AffinityMap());
+    b.workers.resize(workers[1], AffinityMap());
+    //Every slab starts from the same seed and only makes the cells it owns
+    unique_ptr<Domain> domain;
+    vector<unique_ptr<Group>> parts;
+    vector<unique_ptr<StateHasher>> partHashes;
+    vector<StateShare> shares(slabs);
+    if (slabs) {
+        domain.reset(new Domain(phi::V3(1.0, 1.0, 1.0), slabs));
+        for (unsigned s = 0; s != slabs; s++) {
+            parts.emplace_back(new Group(phi::V3(1.0, 1.0, 1.0), seed));
+            partHashes.emplace_back(new StateHasher(true));
+            parts[s]->hasher = partHashes[s].get();
+            parts[s]->workers.resize(workers[1], AffinityMap());
+            parts[s]->domain = domain.get();
+            parts[s]->slab = s;
+        }
+    }
+    
+    //One line per tick: the tick followed by the hash after every phase
+    ofstream out;
+    ifstream in;
+    if (!record.empty())
+        out.open(record);
+    if (!against.empty())
+        in.open(against);
+    if ((!record.empty() && !out) || (!against.empty() && !in)) {
+        cerr << "diverge: Failed to open " << (record.empty() ? against : record) << endl;
+        return 1;
+    }
+    out << hex;
+    
+    for (uint64_t t = 0; t != ticks; t++) {
+        step(a);
+        uint64_t expected[GROUP_PHASES];
+        if (!single && slabs) {
+            step(parts);
+            for (unsigned p = 0; p != GROUP_PHASES; p++) {
+                for (unsigned s = 0; s != slabs; s++)
+                    shares[s] = partHashes[s]->shares[p];
+                expected[p] = combineShares(shares.data(), slabs);
+            }
+        } else if (!single) {
+            step(b);
+            for (unsigned p = 0; p != GROUP_PHASES; p++)
+                expected[p] = hashB.phases[p];
+        } else if (!against.empty()) {
+            string line;
+            uint64_t tick;
+            istringstream fields(getline(in, line) ? line : string());
+            fields >> hex >> tick;
+            for (unsigned p = 0; p != GROUP_PHASES; p++)
+                fields >> expected[p];
+            if (!fields || tick != hashA.tick) {
+                cout << "Recording ends before tick " << hashA.tick << endl;
+                return 1;
+            }
+        } else {
+            out << hashA.tick;
+            for (uint64_t h : hashA.phases)
+                out << " " << h;
+            out << "\n";
+            continue;
+        }
+        for (unsigned p = 0; p != GROUP_PHASES; p++)
+            if (hashA.phases[p] != expected[p]) {
+                report(hashA.tick, p, hashA.phases[p], expected[p]);
+                return 1;
+            }
+    }
+    
+    if (!record.empty()) {
+        out.close();
+        if (!out) {
+            cerr << "diverge: Failed to write " << record << endl;
+            return 1;
+        }
+    }
+    cout << "No divergence in " << ticks << " ticks; " << a.cells.size() << " cells, final hash " << hex
+         << setw(16) << setfill('0') << hashA.last() << dec << endl;
+    return 0;
+}
+
@@ -0,0 +1,40 @@
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+CONFIG += c++11
+
+QMAKE_CXXFLAGS += -pthread 
+LIBS += -pthread
+
+LIBS += \
+    -lgpi \
+    -lphitron
+
+INCLUDEPATH += ..
+
+#Groups may be slabs of a domain, which runs its slabs as simulations
+SOURCES += diverge.cpp \
+    ../cell.cpp \
+    ../group.cpp \
+    ../halo.cpp \
+    ../simulation.cpp \
+    ../budget.cpp \
+    ../trajectory.cpp \
+    ../lineage.cpp \
+    ../organism.cpp \
+    ../metrics.cpp \
+    ../invariant.cpp \
+    ../genome.cpp \
+    ../domain.cpp \
+    ../affinity.cpp \
+    ../workers.cpp \
+    ../checkpoint.cpp \
+    ../statehash.cpp \
+    ../census.cpp \
+    ../spatial.cpp \
+    ../stream.cpp \
+    ../lod.cpp \
+    ../island.cpp \
+    ../library.cpp
+
@@ -0,0 +1,121 @@
+#include <iostream>
+#include "gpi/gpi.h"
+#include "phitron/phitron.h"
+#include "draw.h"
+#include "budget.h"
+#include "stream.h"
+#include <chrono>
+#include <string>
+#include <thread>
+
+#define WINDOW_WIDTH 400
+#define WINDOW_HEIGHT 400
+#define CLOSENESS 20.0
+
+#define FPS 30
+//Frames between printing stats (0 disables printing)
+#define STATS_EVERY FPS
+//Seconds per frame the GPU may spend shading orbs before crowded cells are drawn as aggregates
+#define DRAW_BUDGET (0.5 / FPS)
+//Threads that reduce the cells to the orbs drawn (0 for one per hardware thread)
+#define DRAW_WORKERS 2
+
+using namespace std;
+using namespace chrono;
+
+static void usage() {
+    cerr << "Usage: viewer ADDRESS" << endl
+         << "Shows the simulation streaming to ADDRESS, a Unix socket path or a TCP host:port" << endl;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        usage();
+        return 2;
+    }
+    FrameReceiver receiver;
+    if (!receiver.connect(argv[1]))
+        return 1;
+    
+    Window window("viewer", WINDOW_WIDTH, WINDOW_HEIGHT);
+    Renderer renderer(window);
+    
+    GroupRenderer gr(WINDOW_WIDTH, WINDOW_HEIGHT);
+    
+    steady_clock::time_point lastTime = steady_clock::now();
+    
+    StreamFrame stream;
+    OrbFrame cells;
+    OrbFrame orbs;
+    OrbLod lod(WINDOW_WIDTH, WINDOW_HEIGHT, DRAW_WORKERS ? DRAW_WORKERS : thread::hardware_concurrency());
+    DrawBudget drawBudget(DRAW_BUDGET);
+    uint64_t frame = 0;
+    uint64_t lastBytes = 0;
+    uint64_t lastTick = 0;
+    
+    while (true) {
+        SDL_Event event;
+        while (window.pollEvent(event)) {
+            switch (event.type) {
+            case SDL_QUIT:
+                return 0;
+            }
+        }
+        
+        //Keep drawing the previous frame if no new one arrived
+        receiver.receive(stream, 0);
+        if (receiver.closed()) {
+            cerr << "viewer: The stream ended" << endl;
+            return 1;
+        }
+        
+        steady_clock::time_point betweenTime = steady_clock::now();
+        
+        drawBudget.measureRender(gr.orbTime, gr.orbCount);
+        {
+            cells.resize(stream.size());
+            for (unsigned cell = 0; cell != cells.size(); cell++) {
+                cells.fields[0][cell] = streamPosition(stream.x[cell], receiver.dimensions.x);
+                cells.fields[1][cell] = streamPosition(stream.y[cell], receiver.dimensions.y);
+                cells.fields[2][cell] = streamPosition(stream.z[cell], receiver.dimensions.z) / CLOSENESS;
+                
+                uint32_t color = stream.colors[cell];
+                cells.fields[3][cell] = ((color & 0xFF << 0) >> 0) / double(0xFF);
+                cells.fields[4][cell] = ((color & 0xFF << 8) >> 8) / double(0xFF);
+                cells.fields[5][cell] = ((color & 0xFF << 16) >> 16) / double(0xFF);
+                
+                cells.fields[6][cell] = 0.1;
+            }
+        }
+        
+        //Crowded parts of the screen are merged when shading every cell would blow the budget
+        lod.reduce(cells, drawBudget.limit(), orbs);
+        gr.upload(orbs);
+        
+        gr.render(WINDOW_WIDTH, WINDOW_HEIGHT);
+        
+        this_thread::sleep_until(lastTime + duration<double>(1.0/FPS));
+        steady_clock::time_point thisTime = steady_clock::now();
+        window.flip();
+        
+        if (STATS_EVERY && frame % STATS_EVERY == 0) {
+            cout << "\nCycle: " << stream.tick << endl;
+            cout << "Count: " << stream.size() << " (" << stream.edges.size() << " edges)" << endl;
+            double timeDelta = duration_cast<duration<double>>(thisTime - lastTime).count();
+            cout << "FPS: " << (1.0/timeDelta) << endl;
+            double renderDelta = duration_cast<duration<double>>(thisTime - betweenTime).count();
+            cout << "Render duration: " << renderDelta << endl;
+            //Ticks the stream skipped reach the viewer as one larger delta
+            uint64_t ticks = stream.tick - lastTick;
+            cout << "Stream: " << (receiver.bytes - lastBytes) / 1024.0 << " KiB over " << ticks << " ticks, drawing "
+                 << orbs.size() << " orbs (" << lod.aggregates << " aggregates)" << endl;
+            lastBytes = receiver.bytes;
+            lastTick = stream.tick;
+        }
+        
+        lastTime = thisTime;
+        frame++;
+    }
+    return 0;
+}
+
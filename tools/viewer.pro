@@ -0,0 +1,28 @@
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+CONFIG += c++11
+
+QMAKE_CXXFLAGS += -pthread 
+LIBS += -pthread
+
+LIBS += \
+    -ldrew \
+    -lgpi \
+    -lphitron \
+    -lSDL2 \
+    -lGL \
+    -lGLU \
+    -lGLEW
+
+INCLUDEPATH += ..
+
+SOURCES += viewer.cpp \
+    ../draw.cpp \
+    ../budget.cpp \
+    ../stream.cpp \
+    ../lod.cpp \
+    ../workers.cpp \
+    ../affinity.cpp
+
@@ -0,0 +1,515 @@
+#include "trajectory.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char FILE_MAGIC[8] = {'E', 'V', 'O', 'T', 'R', 'A', 'J', '1'};
+static const char INDEX_MAGIC[8] = {'E', 'V', 'O', 'T', 'I', 'D', 'X', '1'};
+static const uint32_t CHUNK_MAGIC = 0x4b4e4843;
+//Magic, dimensions
+static const size_t FILE_HEADER_SIZE = 8 + 3 * sizeof(double);
+//Magic, first tick, tick count, column sizes
+static const size_t CHUNK_HEADER_SIZE = 4 + 8 + 4 + 4 * TRAJECTORY_COLUMNS;
+//Index offset, chunk count, magic
+static const size_t FOOTER_SIZE = 8 + 8 + 8;
+
+enum Column {
+    COLUMN_COUNTS,
+    COLUMN_IDS,
+    COLUMN_X,
+    COLUMN_Y,
+    COLUMN_Z,
+    COLUMN_FOOD,
+    COLUMN_SPECIES,
+    COLUMN_ADDED,
+    COLUMN_REMOVED
+};
+
+static void putVarint(std::vector<uint8_t> &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(uint8_t(value));
+}
+
+static uint64_t getVarint(const uint8_t *&in) {
+    uint64_t value = 0;
+    for (unsigned shift = 0; ; shift += 7) {
+        uint8_t byte = *in++;
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+}
+
+static uint64_t zigzag(int64_t value) {
+    return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+template<class T>
+static void putRaw(std::vector<uint8_t> &out, T value) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template<class T>
+static T getRaw(const uint8_t *in) {
+    T value;
+    memcpy(&value, in, sizeof(T));
+    return value;
+}
+
+static uint16_t quantize(double value, double extent) {
+    double q = (value + extent) / (2 * extent) * 65535.0 + 0.5;
+    if (!(q > 0))
+        return 0;
+    if (q > 65535)
+        return 65535;
+    return uint16_t(q);
+}
+
+//Edges sorted and delta coded on the lower id, the higher id stored relative to the lower one
+static void putEdges(std::vector<uint8_t> &out, const std::vector<Edge> &edges) {
+    uint64_t last = 0;
+    for (const Edge &e : edges) {
+        putVarint(out, e.first - last);
+        putVarint(out, e.second - e.first);
+        last = e.first;
+    }
+}
+
+static void getEdges(const uint8_t *&in, uint64_t count, std::vector<Edge> &edges) {
+    uint64_t last = 0;
+    edges.resize(count);
+    for (Edge &e : edges) {
+        e.first = last + getVarint(in);
+        e.second = e.first + getVarint(in);
+        last = e.first;
+    }
+}
+
+void TrajectoryFrame::clear() {
+    ids.clear();
+    x.clear();
+    y.clear();
+    z.clear();
+    food.clear();
+    species.clear();
+    edges.clear();
+}
+
+unsigned TrajectoryFrame::size() const {
+    return ids.size();
+}
+
+TrajectoryRecorder::TrajectoryRecorder(const std::string &path, const phi::V3 &dimensions) : dropped(0),
+                                       dimensions(dimensions), closing(false), chunkFirstTick(0), chunkTicks(0) {
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "TrajectoryRecorder: Failed to open " << path << std::endl;
+        exit(1);
+    }
+    fwrite(FILE_MAGIC, 1, sizeof(FILE_MAGIC), file);
+    fwrite(&dimensions.x, sizeof(double), 1, file);
+    fwrite(&dimensions.y, sizeof(double), 1, file);
+    fwrite(&dimensions.z, sizeof(double), 1, file);
+    
+    for (Capture &c : captures)
+        idle.push_back(&c);
+    thread = std::thread(&TrajectoryRecorder::run, this);
+}
+
+TrajectoryRecorder::~TrajectoryRecorder() {
+    close();
+}
+
+void TrajectoryRecorder::capture(uint64_t tick, const Group &group) {
+    Capture *c;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idle.empty()) {
+            dropped++;
+            return;
+        }
+        c = idle.back();
+        idle.pop_back();
+    }
+    
+    c->tick = tick;
+    c->ids.clear();
+    c->positions.clear();
+    c->food.clear();
+    c->species.clear();
+    c->edges.clear();
+    for (const Cell &cell : group.cells) {
+        c->ids.push_back(cell.id);
+        c->positions.push_back(cell.particle.position);
+        c->food.push_back(cell.food);
+        c->species.push_back(cell.species);
+        //Every edge is seen from both ends, so only keep it from the lower id
+        for (const Neighbor &n : cell.neighbors)
+            if (cell.id < n.neighbor->id)
+                c->edges.emplace_back(cell.id, n.neighbor->id);
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(c);
+    }
+    ready.notify_one();
+}
+
+void TrajectoryRecorder::close() {
+    if (!file)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    ready.notify_one();
+    thread.join();
+    
+    flushChunk();
+    uint64_t indexOffset = ftell(file);
+    for (const IndexEntry &e : index) {
+        fwrite(&e.firstTick, sizeof(uint64_t), 1, file);
+        fwrite(&e.lastTick, sizeof(uint64_t), 1, file);
+        fwrite(&e.offset, sizeof(uint64_t), 1, file);
+    }
+    uint64_t total = index.size();
+    fwrite(&indexOffset, sizeof(uint64_t), 1, file);
+    fwrite(&total, sizeof(uint64_t), 1, file);
+    fwrite(INDEX_MAGIC, 1, sizeof(INDEX_MAGIC), file);
+    fclose(file);
+    file = nullptr;
+    
+    if (dropped)
+        std::cerr << "TrajectoryRecorder: Dropped " << dropped << " ticks the writer could not keep up with" << std::endl;
+}
+
+void TrajectoryRecorder::run() {
+    while (true) {
+        Capture *c;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [this](){ return closing || !pending.empty(); });
+            if (pending.empty())
+                return;
+            c = pending.front();
+            pending.erase(pending.begin());
+        }
+        
+        encode(*c);
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            idle.push_back(c);
+        }
+    }
+}
+
+void TrajectoryRecorder::encode(const Capture &capture) {
+    if (chunkTicks == 0) {
+        //Start every chunk from nothing so it does not depend on earlier chunks
+        previous.clear();
+        previous.tick = capture.tick;
+        chunkFirstTick = capture.tick;
+    }
+    
+    //Sort cells by id so ids delta code well and cells can be matched to the previous tick by merging
+    unsigned total = capture.ids.size();
+    order.resize(total);
+    for (unsigned i = 0; i != total; i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&capture](unsigned a, unsigned b){
+        return capture.ids[a] < capture.ids[b];
+    });
+    
+    current.clear();
+    current.tick = capture.tick;
+    for (unsigned i : order) {
+        current.ids.push_back(capture.ids[i]);
+        current.x.push_back(quantize(capture.positions[i].x, dimensions.x));
+        current.y.push_back(quantize(capture.positions[i].y, dimensions.y));
+        current.z.push_back(quantize(capture.positions[i].z, dimensions.z));
+        current.food.push_back(capture.food[i]);
+        current.species.push_back(capture.species[i]);
+    }
+    current.edges = capture.edges;
+    std::sort(current.edges.begin(), current.edges.end());
+    
+    std::vector<Edge> added, removed;
+    std::set_difference(current.edges.begin(), current.edges.end(), previous.edges.begin(), previous.edges.end(),
+                        std::back_inserter(added));
+    std::set_difference(previous.edges.begin(), previous.edges.end(), current.edges.begin(), current.edges.end(),
+                        std::back_inserter(removed));
+    
+    putVarint(columns[COLUMN_COUNTS], current.tick - previous.tick);
+    putVarint(columns[COLUMN_COUNTS], total);
+    putVarint(columns[COLUMN_COUNTS], added.size());
+    putVarint(columns[COLUMN_COUNTS], removed.size());
+    
+    uint64_t lastId = 0;
+    unsigned p = 0;
+    for (unsigned i = 0; i != total; i++) {
+        uint64_t id = current.ids[i];
+        putVarint(columns[COLUMN_IDS], id - lastId);
+        lastId = id;
+        
+        //Cells that were present last tick are stored relative to where they were
+        while (p != previous.size() && previous.ids[p] < id)
+            p++;
+        bool known = p != previous.size() && previous.ids[p] == id;
+        uint16_t px = known ? previous.x[p] : 0;
+        uint16_t py = known ? previous.y[p] : 0;
+        uint16_t pz = known ? previous.z[p] : 0;
+        uint64_t pfood = known ? previous.food[p] : 0;
+        uint64_t pspecies = known ? previous.species[p] : 0;
+        
+        //Wrapping 16 bit differences keep moves across the torus boundary small
+        putVarint(columns[COLUMN_X], zigzag(int16_t(current.x[i] - px)));
+        putVarint(columns[COLUMN_Y], zigzag(int16_t(current.y[i] - py)));
+        putVarint(columns[COLUMN_Z], zigzag(int16_t(current.z[i] - pz)));
+        putVarint(columns[COLUMN_FOOD], zigzag(int64_t(current.food[i] - pfood)));
+        putVarint(columns[COLUMN_SPECIES], current.species[i] ^ pspecies);
+    }
+    putEdges(columns[COLUMN_ADDED], added);
+    putEdges(columns[COLUMN_REMOVED], removed);
+    
+    std::swap(previous, current);
+    if (++chunkTicks == TRAJECTORY_CHUNK_TICKS)
+        flushChunk();
+}
+
+void TrajectoryRecorder::flushChunk() {
+    if (chunkTicks == 0)
+        return;
+    
+    IndexEntry entry;
+    entry.firstTick = chunkFirstTick;
+    entry.lastTick = previous.tick;
+    entry.offset = ftell(file);
+    index.push_back(entry);
+    
+    std::vector<uint8_t> header;
+    putRaw<uint32_t>(header, CHUNK_MAGIC);
+    putRaw<uint64_t>(header, chunkFirstTick);
+    putRaw<uint32_t>(header, chunkTicks);
+    for (const std::vector<uint8_t> &column : columns)
+        putRaw<uint32_t>(header, column.size());
+    fwrite(header.data(), 1, header.size(), file);
+    for (std::vector<uint8_t> &column : columns) {
+        fwrite(column.data(), 1, column.size(), file);
+        column.clear();
+    }
+    fflush(file);
+    chunkTicks = 0;
+}
+
+TrajectoryReader::TrajectoryReader() : data(nullptr), length(0) {
+}
+
+TrajectoryReader::~TrajectoryReader() {
+    close();
+}
+
+//Bytes of the chunk whose header is at header, header included
+static size_t chunkSize(const uint8_t *header) {
+    size_t size = CHUNK_HEADER_SIZE;
+    for (unsigned i = 0; i != TRAJECTORY_COLUMNS; i++)
+        size += getRaw<uint32_t>(header + 16 + 4 * i);
+    return size;
+}
+
+bool TrajectoryReader::open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "TrajectoryReader: Failed to open " << path << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) || size_t(info.st_size) < FILE_HEADER_SIZE) {
+        std::cerr << "TrajectoryReader: " << path << " is too small to be a trajectory" << std::endl;
+        ::close(fd);
+        return false;
+    }
+    length = info.st_size;
+    void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "TrajectoryReader: Failed to map " << path << std::endl;
+        length = 0;
+        return false;
+    }
+    data = (const uint8_t*)mapped;
+    
+    if (memcmp(data, FILE_MAGIC, sizeof(FILE_MAGIC))) {
+        std::cerr << "TrajectoryReader: " << path << " is not a trajectory" << std::endl;
+        close();
+        return false;
+    }
+    dimensions.x = getRaw<double>(data + 8);
+    dimensions.y = getRaw<double>(data + 16);
+    dimensions.z = getRaw<double>(data + 24);
+    
+    //Use the index if the recorder got to write it and everything it points at lies within the file
+    bool indexed = false;
+    if (length >= FILE_HEADER_SIZE + FOOTER_SIZE &&
+            !memcmp(data + length - sizeof(INDEX_MAGIC), INDEX_MAGIC, sizeof(INDEX_MAGIC))) {
+        uint64_t indexOffset = getRaw<uint64_t>(data + length - FOOTER_SIZE);
+        uint64_t total = getRaw<uint64_t>(data + length - FOOTER_SIZE + 8);
+        indexed = indexOffset >= FILE_HEADER_SIZE && indexOffset <= length - FOOTER_SIZE &&
+                  total <= (length - FOOTER_SIZE - indexOffset) / 24;
+        for (uint64_t i = 0; indexed && i != total; i++) {
+            const uint8_t *entry = data + indexOffset + i * 24;
+            Chunk c;
+            c.firstTick = getRaw<uint64_t>(entry);
+            c.lastTick = getRaw<uint64_t>(entry + 8);
+            c.offset = getRaw<uint64_t>(entry + 16);
+            indexed = c.offset >= FILE_HEADER_SIZE && c.offset < indexOffset &&
+                      indexOffset - c.offset >= CHUNK_HEADER_SIZE &&
+                      indexOffset - c.offset >= chunkSize(data + c.offset);
+            chunks.push_back(c);
+        }
+        if (!indexed) {
+            std::cerr << "TrajectoryReader: Index of " << path << " is damaged, scanning chunks instead" << std::endl;
+            chunks.clear();
+        }
+    }
+    if (!indexed)
+        scan();
+    return true;
+}
+
+void TrajectoryReader::close() {
+    if (data)
+        munmap((void*)data, length);
+    data = nullptr;
+    length = 0;
+    chunks.clear();
+}
+
+void TrajectoryReader::scan() {
+    size_t offset = FILE_HEADER_SIZE;
+    while (offset + CHUNK_HEADER_SIZE <= length && getRaw<uint32_t>(data + offset) == CHUNK_MAGIC) {
+        const uint8_t *header = data + offset;
+        size_t size = chunkSize(header);
+        //A chunk cut off by a crash is dropped
+        if (offset + size > length)
+            break;
+        
+        //The last tick is only known after walking the tick deltas
+        const uint8_t *counts = header + CHUNK_HEADER_SIZE;
+        uint32_t ticks = getRaw<uint32_t>(header + 12);
+        Chunk c;
+        c.firstTick = getRaw<uint64_t>(header + 4);
+        c.lastTick = c.firstTick;
+        c.offset = offset;
+        for (uint32_t t = 0; t != ticks; t++) {
+            c.lastTick += getVarint(counts);
+            for (unsigned i = 0; i != 3; i++)
+                getVarint(counts);
+        }
+        chunks.push_back(c);
+        offset += size;
+    }
+}
+
+bool TrajectoryReader::empty() const {
+    return chunks.empty();
+}
+
+uint64_t TrajectoryReader::firstTick() const {
+    return chunks.empty() ? 0 : chunks.front().firstTick;
+}
+
+uint64_t TrajectoryReader::lastTick() const {
+    return chunks.empty() ? 0 : chunks.back().lastTick;
+}
+
+double TrajectoryReader::position(uint16_t quantized, unsigned axis) const {
+    double extent = axis == 0 ? dimensions.x : axis == 1 ? dimensions.y : dimensions.z;
+    return quantized / 65535.0 * 2 * extent - extent;
+}
+
+bool TrajectoryReader::seek(uint64_t tick, TrajectoryFrame &frame) {
+    //Find the last chunk starting at or before tick
+    auto chunk = std::upper_bound(chunks.begin(), chunks.end(), tick, [](uint64_t t, const Chunk &c){
+        return t < c.firstTick;
+    });
+    if (chunk == chunks.begin())
+        return false;
+    chunk--;
+    
+    const uint8_t *header = data + chunk->offset;
+    uint32_t ticks = getRaw<uint32_t>(header + 12);
+    const uint8_t *columns[TRAJECTORY_COLUMNS];
+    const uint8_t *next = header + CHUNK_HEADER_SIZE;
+    for (unsigned i = 0; i != TRAJECTORY_COLUMNS; i++) {
+        columns[i] = next;
+        next += getRaw<uint32_t>(header + 16 + 4 * i);
+    }
+    
+    TrajectoryFrame previous, current;
+    previous.tick = chunk->firstTick;
+    for (uint32_t t = 0; t != ticks; t++) {
+        uint64_t delta = getVarint(columns[COLUMN_COUNTS]);
+        //Stop once the following tick would be past the one asked for
+        if (t != 0 && previous.tick + delta > tick)
+            break;
+        
+        current.clear();
+        current.tick = previous.tick + delta;
+        uint64_t total = getVarint(columns[COLUMN_COUNTS]);
+        uint64_t added = getVarint(columns[COLUMN_COUNTS]);
+        uint64_t removed = getVarint(columns[COLUMN_COUNTS]);
+        
+        uint64_t lastId = 0;
+        unsigned p = 0;
+        for (uint64_t i = 0; i != total; i++) {
+            uint64_t id = lastId + getVarint(columns[COLUMN_IDS]);
+            lastId = id;
+            
+            while (p != previous.size() && previous.ids[p] < id)
+                p++;
+            bool known = p != previous.size() && previous.ids[p] == id;
+            uint16_t px = known ? previous.x[p] : 0;
+            uint16_t py = known ? previous.y[p] : 0;
+            uint16_t pz = known ? previous.z[p] : 0;
+            uint64_t pfood = known ? previous.food[p] : 0;
+            uint64_t pspecies = known ? previous.species[p] : 0;
+            
+            current.ids.push_back(id);
+            current.x.push_back(uint16_t(px + unzigzag(getVarint(columns[COLUMN_X]))));
+            current.y.push_back(uint16_t(py + unzigzag(getVarint(columns[COLUMN_Y]))));
+            current.z.push_back(uint16_t(pz + unzigzag(getVarint(columns[COLUMN_Z]))));
+            current.food.push_back(pfood + unzigzag(getVarint(columns[COLUMN_FOOD])));
+            current.species.push_back(pspecies ^ getVarint(columns[COLUMN_SPECIES]));
+        }
+        
+        std::vector<Edge> addedEdges, removedEdges;
+        getEdges(columns[COLUMN_ADDED], added, addedEdges);
+        getEdges(columns[COLUMN_REMOVED], removed, removedEdges);
+        std::vector<Edge> kept;
+        std::set_difference(previous.edges.begin(), previous.edges.end(), removedEdges.begin(), removedEdges.end(),
+                            std::back_inserter(kept));
+        std::merge(kept.begin(), kept.end(), addedEdges.begin(), addedEdges.end(), std::back_inserter(current.edges));
+        
+        std::swap(previous, current);
+    }
+    
+    frame = std::move(previous);
+    return true;
+}
+
@@ -0,0 +1,126 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include "group.h"
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+//Ticks stored in one independently decodable chunk
+#define TRAJECTORY_CHUNK_TICKS 64
+//Captured ticks that may wait for the writer before new ticks are dropped
+#define TRAJECTORY_QUEUE 8
+//Columns in a chunk: tick counts, ids, x, y, z, food, species, added edges, removed edges
+#define TRAJECTORY_COLUMNS 9
+
+typedef std::pair<uint64_t, uint64_t> Edge;
+
+//One recorded tick; positions are quantized to 16 bits over the dimensions of the group
+struct TrajectoryFrame {
+    uint64_t tick;
+    std::vector<uint64_t> ids;
+    std::vector<uint16_t> x, y, z;
+    std::vector<uint64_t> food;
+    std::vector<uint64_t> species;
+    //Every edge once with the lower id first, sorted
+    std::vector<Edge> edges;
+    
+    void clear();
+    unsigned size() const;
+};
+
+//Streams ticks of a group to disk from a background thread
+//Each chunk starts from an empty previous frame so it can be decoded on its own; within a chunk positions, food
+//and species are stored as differences from the previous tick of the same cell and edges as additions/removals
+struct TrajectoryRecorder {
+    //Ticks that could not be recorded because the writer fell behind
+    uint64_t dropped;
+    
+    TrajectoryRecorder(const std::string &path, const phi::V3 &dimensions);
+    ~TrajectoryRecorder();
+    
+    //Copy the state of the group to be written; called from the simulation thread after a tick
+    void capture(uint64_t tick, const Group &group);
+    //Write out everything captured so far along with the index and stop the writer
+    void close();
+    
+private:
+    //Raw state copied out of the group
+    struct Capture {
+        uint64_t tick;
+        std::vector<uint64_t> ids;
+        std::vector<phi::V3> positions;
+        std::vector<uint64_t> food;
+        std::vector<uint64_t> species;
+        std::vector<Edge> edges;
+    };
+    
+    struct IndexEntry {
+        uint64_t firstTick;
+        uint64_t lastTick;
+        uint64_t offset;
+    };
+    
+    FILE *file;
+    phi::V3 dimensions;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable ready;
+    bool closing;
+    Capture captures[TRAJECTORY_QUEUE];
+    std::vector<Capture*> idle;
+    std::vector<Capture*> pending;
+    
+    //Writer state
+    TrajectoryFrame previous;
+    TrajectoryFrame current;
+    std::vector<unsigned> order;
+    std::vector<uint8_t> columns[TRAJECTORY_COLUMNS];
+    uint64_t chunkFirstTick;
+    unsigned chunkTicks;
+    std::vector<IndexEntry> index;
+    
+    void run();
+    void encode(const Capture &capture);
+    void flushChunk();
+};
+
+//Replays a trajectory file through a read-only memory map
+struct TrajectoryReader {
+    phi::V3 dimensions;
+    
+    TrajectoryReader();
+    ~TrajectoryReader();
+    
+    //Returns false if the file could not be opened or is not a trajectory
+    bool open(const std::string &path);
+    void close();
+    
+    bool empty() const;
+    uint64_t firstTick() const;
+    uint64_t lastTick() const;
+    //Decode the last recorded tick at or before tick into frame; returns false if there is none
+    bool seek(uint64_t tick, TrajectoryFrame &frame);
+    //Convert a quantized coordinate back into the group's space along axis (0, 1 or 2)
+    double position(uint16_t quantized, unsigned axis) const;
+    
+private:
+    struct Chunk {
+        uint64_t firstTick;
+        uint64_t lastTick;
+        uint64_t offset;
+    };
+    
+    const uint8_t *data;
+    size_t length;
+    std::vector<Chunk> chunks;
+    
+    //Rebuild the index by walking the chunks when the file was not closed cleanly
+    void scan();
+};
+
+#endif // TRAJECTORY_H
+
@@ -0,0 +1,54 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+//Lock-free single producer, single consumer handoff of the most recent value
+//The producer writes into its own slot and swaps it with the middle slot; the consumer swaps the middle slot
+//with its own slot only when it is fresh, so neither side ever waits on the other
+template<class T>
+struct TripleBuffer {
+    T slots[3];
+    
+    TripleBuffer() : back(0), middle(1), front(2) {}
+    
+    //Slot owned by the producer
+    T& write() {
+        return slots[back];
+    }
+    
+    //Hand the written slot to the consumer
+    void publish() {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+    
+    //Determine if the consumer has taken the last published value
+    bool consumed() const {
+        return !(middle.load(std::memory_order_acquire) & FRESH);
+    }
+    
+    //Take the newest published value if there is one; returns false if the front slot is unchanged
+    bool update() {
+        if (consumed())
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    
+    //Slot owned by the consumer
+    const T& read() const {
+        return slots[front];
+    }
+    
+private:
+    static const uint8_t INDEX = 0x3;
+    static const uint8_t FRESH = 0x4;
+    
+    uint8_t back;
+    std::atomic<uint8_t> middle;
+    uint8_t front;
+};
+
+#endif // TRIPLEBUFFER_H
+
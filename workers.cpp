@@ -0,0 +1,124 @@
+#include "workers.h"
+#include <unistd.h>
+
+WorkerPool::WorkerPool() : task(nullptr), generation(0), remaining(0), stopping(false) {
+    resize(std::thread::hardware_concurrency(), AffinityMap());
+}
+
+WorkerPool::~WorkerPool() {
+    stop();
+}
+
+void WorkerPool::resize(unsigned workers, const AffinityMap &affinity) {
+    stop();
+    affinities.clear();
+    nodes.clear();
+    //There has to be someone to run tasks
+    if (workers == 0)
+        workers = 1;
+    for (unsigned w = 0; w != workers; w++) {
+        affinities.push_back(affinity.worker(w));
+        nodes.push_back(affinities.back().node);
+    }
+}
+
+void WorkerPool::launch() {
+    stopping = false;
+    generation = 0;
+    for (unsigned w = 0; w != affinities.size(); w++)
+        threads.emplace_back(&WorkerPool::work, this, w, affinities[w]);
+}
+
+void WorkerPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : threads)
+        t.join();
+    threads.clear();
+}
+
+unsigned WorkerPool::size() const {
+    return affinities.size();
+}
+
+unsigned WorkerPool::node(unsigned worker) const {
+    return nodes[worker];
+}
+
+void WorkerPool::run(const std::function<void(unsigned)> &task) {
+    if (threads.empty())
+        launch();
+    std::unique_lock<std::mutex> lock(mutex);
+    this->task = &task;
+    remaining = threads.size();
+    generation++;
+    wake.notify_all();
+    done.wait(lock, [this](){ return remaining == 0; });
+    this->task = nullptr;
+}
+
+pid_t WorkerPool::fork() {
+    //Between runs every worker is waiting on wake, which releases the lock, so this never waits for long
+    std::lock_guard<std::mutex> lock(mutex);
+    return ::fork();
+}
+
+static uint64_t packRun(uint64_t front, uint64_t end) {
+    return front | end << 32;
+}
+
+ChunkQueues::ChunkQueues() : steals(0), count(0) {
+}
+
+void ChunkQueues::reset(const std::vector<unsigned> &starts) {
+    unsigned workers = starts.size() - 1;
+    if (workers != count) {
+        runs.reset(new Run[workers]);
+        count = workers;
+    }
+    for (unsigned w = 0; w != count; w++)
+        runs[w].bounds.store(packRun(starts[w], starts[w + 1]), std::memory_order_relaxed);
+}
+
+bool ChunkQueues::next(unsigned worker, unsigned &chunk) {
+    std::atomic<uint64_t> &own = runs[worker].bounds;
+    uint64_t bounds = own.load(std::memory_order_relaxed);
+    while (uint32_t(bounds) != bounds >> 32)
+        if (own.compare_exchange_weak(bounds, bounds + 1, std::memory_order_relaxed)) {
+            chunk = uint32_t(bounds);
+            return true;
+        }
+    
+    for (unsigned i = 1; i < count; i++) {
+        std::atomic<uint64_t> &victim = runs[(worker + i) % count].bounds;
+        bounds = victim.load(std::memory_order_relaxed);
+        while (uint32_t(bounds) != bounds >> 32)
+            if (victim.compare_exchange_weak(bounds, bounds - (uint64_t(1) << 32), std::memory_order_relaxed)) {
+                chunk = (bounds >> 32) - 1;
+                steals.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+    }
+    return false;
+}
+
+void WorkerPool::work(unsigned worker, WorkerAffinity affinity) {
+    pinThread(affinity.cpus);
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this, seen](){ return stopping || generation != seen; });
+        if (stopping)
+            return;
+        seen = generation;
+        lock.unlock();
+        (*task)(worker);
+        lock.lock();
+        if (--remaining == 0)
+            done.notify_one();
+    }
+}
+
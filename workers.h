@@ -0,0 +1,80 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include "affinity.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+//Fixed set of threads that run the parallel phases of an update
+//Each worker keeps its pinning for its whole life, so the cells it is handed every tick stay in its caches and on
+//its NUMA node
+//The threads are started by the first run, so resizing a pool before it is used never starts any others
+struct WorkerPool {
+    //One unpinned worker per hardware thread
+    WorkerPool();
+    ~WorkerPool();
+    
+    //Replace the workers with new ones pinned according to affinity, which start with the next run
+    void resize(unsigned workers, const AffinityMap &affinity);
+    unsigned size() const;
+    //NUMA node a worker is pinned to (0 if it is not pinned)
+    unsigned node(unsigned worker) const;
+    //Run task(worker) on every worker and return once all of them finished
+    void run(const std::function<void(unsigned)> &task);
+    //Fork the process while holding the pool's lock, so no worker is halfway through using it; the child has none of
+    //the workers, so it must not touch the pool and has to leave with _exit
+    pid_t fork();
+    
+private:
+    std::vector<std::thread> threads;
+    std::vector<WorkerAffinity> affinities;
+    std::vector<unsigned> nodes;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(unsigned)> *task;
+    //Incremented for every run so workers can tell a new task from a spurious wakeup
+    uint64_t generation;
+    unsigned remaining;
+    bool stopping;
+    
+    void work(unsigned worker, WorkerAffinity affinity);
+    void launch();
+    void stop();
+};
+
+//Chunks of one parallel phase handed out to workers
+//Every worker starts with its own run of chunks and takes them from the front; once it runs out it steals single
+//chunks from the back of the other workers' runs, which is the work furthest from where their owners are
+struct ChunkQueues {
+    //Chunks taken from another worker since the queues were created
+    std::atomic<uint64_t> steals;
+    
+    ChunkQueues();
+    
+    //Give each worker the run of chunks from starts[worker] to starts[worker + 1]
+    void reset(const std::vector<unsigned> &starts);
+    //Returns false once there are no chunks left anywhere
+    bool next(unsigned worker, unsigned &chunk);
+    
+private:
+    //Front of the run in the low half and end in the high half so both ends move with one compare and swap
+    struct Run {
+        std::atomic<uint64_t> bounds;
+        //Keep runs on separate cache lines
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+    
+    std::unique_ptr<Run[]> runs;
+    unsigned count;
+};
+
+#endif // WORKERS_H
+